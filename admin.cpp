@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include "net/packet.h"
+#include "paxos/proto.h"
+
+/**
+ * 成员变更工具：把新的Acceptor成员发给集群里任意一个节点，不是leader的节点会转发给leader，
+ * leader把变更写进复制日志，所有节点在同一个实例上应用。新旧配置的quorum必须相交，
+ * 替换一个节点要分两步：先加新节点，生效以后再删旧节点。
+ *
+ * 用法: paxos_admin -m 节点IP -n 节点基础端口 -M 节点编号列表 [-P prepare quorum] [-A accept quorum]
+ * 	[-g 分组数] [-c 事件循环数] [-t tcp/udp]
+ */
+
+static bool sendPacket(int fd, const struct sockaddr_in& addr, const std::string& packet){
+	if(connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) != 0){
+		fprintf(stderr, "connect %s:%u failed (%s)\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), strerror(errno));
+		return false;
+	}
+	size_t offset = 0;
+	while(offset < packet.size()){
+		ssize_t n = send(fd, packet.data() + offset, packet.size() - offset, 0);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			fprintf(stderr, "send to %s:%u failed (%s)\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), strerror(errno));
+			return false;
+		}
+		offset += n;
+	}
+	return true;
+}
+
+int main(int argc, char** argv){
+	std::string ip = "127.0.0.1";
+	int port = 10000;
+	int groupCount = 1;
+	int loopCount = 1;
+	int socketType = SOCK_STREAM;
+	int prepareQuorum = 0;
+	int acceptQuorum = 0;
+	std::string acceptors;
+
+	int c = 0;
+	while((c = getopt(argc, argv, "m:n:M:P:A:g:c:t:")) != -1){
+		switch(c){
+			case 'm': ip = optarg; break;
+			case 'n': port = atoi(optarg); break;
+			case 'M': acceptors = optarg; break;
+			case 'P': prepareQuorum = atoi(optarg); break;
+			case 'A': acceptQuorum = atoi(optarg); break;
+			case 'g': groupCount = atoi(optarg); break;
+			case 'c': loopCount = atoi(optarg); break;
+			case 't': socketType = strcmp(optarg, "udp") == 0 ? SOCK_DGRAM : SOCK_STREAM; break;
+			default:
+				fprintf(stderr, "usage: %s -m ip -n port -M acceptorNodeIDs [-P prepareQuorum] [-A acceptQuorum] "
+					"[-g groupCount] [-c loopCount] [-t tcp/udp]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	MembershipChangeMessage change;
+	change.m_from = INVALID_NODE_ID;
+	std::stringstream stream(acceptors);
+	std::string acceptorID;
+	while(std::getline(stream, acceptorID, ',')){
+		int nodeID = atoi(acceptorID.c_str());
+		if(nodeID <= INVALID_NODE_ID || nodeID > 0xffff){
+			fprintf(stderr, "acceptor node id:%s out of range\n", acceptorID.c_str());
+			return 1;
+		}
+		change.m_membership.m_acceptors.insert(nodeID);
+	}
+	change.m_membership.m_prepareQuorum = prepareQuorum > 0 ? prepareQuorum : 0;
+	change.m_membership.m_acceptQuorum = acceptQuorum > 0 ? acceptQuorum : 0;
+	if(change.m_membership.isOpen() || !change.m_membership.isValid()){
+		fprintf(stderr, "membership %s invalid\n", change.m_membership.toString().c_str());
+		return 1;
+	}
+	if(groupCount <= 0 || groupCount > 0xffff || loopCount <= 0 || loopCount > groupCount){
+		fprintf(stderr, "group count:%d loop count:%d invalid\n", groupCount, loopCount);
+		return 1;
+	}
+
+	//分组g在第g % loopCount个事件循环上，监听基础端口加事件循环编号
+	for(int g = 0; g < groupCount; ++g){
+		change.m_groupID = g;
+		deps::Encoder encoder;
+		encoder.serialize(MembershipChangeMessage::cmd, change);
+		std::string packet(encoder.data(), encoder.size());
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = inet_addr(ip.c_str());
+		addr.sin_port = htons(port + g % loopCount);
+		int fd = socket(AF_INET, socketType, 0);
+		if(fd < 0){
+			fprintf(stderr, "create socket failed (%s)\n", strerror(errno));
+			return 1;
+		}
+		bool ok = sendPacket(fd, addr, packet);
+		close(fd);
+		if(!ok){
+			return 1;
+		}
+		printf("group:%d membership change to %s sent\n", g, change.m_membership.toString().c_str());
+	}
+	return 0;
+}
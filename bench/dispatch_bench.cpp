@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "sys/util.h"
+#include "net/packet.h"
+#include "paxos/proto.h"
+#include "dispatcher.h"
+
+/**
+ * 收包分发路径的压测，统计每个包的堆分配次数和耗时。
+ * 对比老的make_shared加dynamic_pointer_cast的做法和MessageDispatcher。
+ * 
+ * 用法: dispatch_bench [packetCount] [valueSize]
+ */
+
+static uint64_t g_allocCount = 0;
+
+void* operator new(size_t size)
+{
+	++g_allocCount;
+	void* p = malloc(size == 0 ? 1 : size);
+	if (p == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+struct BenchHandler
+{
+	BenchHandler():m_handled(0), m_bytes(0){}
+
+	bool HandleAccept(const deps::PacketHeader& header, AcceptMessage& msg, deps::SocketBase* s)
+	{
+		++m_handled;
+		m_bytes += msg.m_proposalValue.size();
+		return true;
+	}
+
+	bool HandleAcceptAck(const deps::PacketHeader& header, AcceptAckMessage& msg, deps::SocketBase* s)
+	{
+		++m_handled;
+		return true;
+	}
+
+	bool HandleHeartbeat(const deps::PacketHeader& header, HeartbeatMessage& msg, deps::SocketBase* s)
+	{
+		++m_handled;
+		return true;
+	}
+
+	uint64_t m_handled;
+	uint64_t m_bytes;
+};
+
+//老的分发方式，每个包make_shared一次，再dynamic_pointer_cast到具体类型
+static bool dispatchShared(BenchHandler& handler, uint16_t cmd, const char* data, size_t size)
+{
+	std::shared_ptr<deps::Marshallable> pMsg;
+	switch (cmd)
+	{
+		case AcceptMessage::cmd:
+			pMsg = std::make_shared<AcceptMessage>();
+			break;
+		case AcceptAckMessage::cmd:
+			pMsg = std::make_shared<AcceptAckMessage>();
+			break;
+		case HeartbeatMessage::cmd:
+			pMsg = std::make_shared<HeartbeatMessage>();
+			break;
+		default:
+			return false;
+	}
+	deps::PacketHeader header;
+	deps::Decoder decoder(data, size);
+	decoder.deserialize(header, *pMsg);
+	switch (cmd)
+	{
+		case AcceptMessage::cmd:
+			return handler.HandleAccept(header, *std::dynamic_pointer_cast<AcceptMessage>(pMsg), nullptr);
+		case AcceptAckMessage::cmd:
+			return handler.HandleAcceptAck(header, *std::dynamic_pointer_cast<AcceptAckMessage>(pMsg), nullptr);
+		case HeartbeatMessage::cmd:
+			return handler.HandleHeartbeat(header, *std::dynamic_pointer_cast<HeartbeatMessage>(pMsg), nullptr);
+		default:
+			return false;
+	}
+}
+
+static void report(const char* name, uint64_t packets, uint64_t allocs, uint64_t costUs)
+{
+	if (costUs == 0)
+	{
+		costUs = 1;
+	}
+	printf("%-12s packets:%-10llu allocs/packet:%-8.3f ns/packet:%llu\n", name, 
+		(unsigned long long)packets, (double)allocs / packets, 
+		(unsigned long long)(costUs * 1000 / packets));
+}
+
+int main(int argc, char** argv)
+{
+	size_t packetCount = argc > 1 ? atoi(argv[1]) : 1000000;
+	size_t valueSize = argc > 2 ? atoi(argv[2]) : 128;
+
+	printf("packets:%zd value size:%zd\n", packetCount, valueSize);
+
+	//三种消息轮流，接近稳态下leader和acceptor的收包分布
+	std::vector<std::string> packets;
+	std::vector<uint16_t> cmds;
+	{
+		AcceptMessage accept;
+		accept.m_from = 1;
+		accept.m_groupID = 0;
+		accept.m_proposalID = ProposalID(1, 1);
+		accept.m_instanceID = 100;
+		accept.m_proposalValue.assign(valueSize, 'v');
+		accept.m_valueStreamID = 0;
+		AcceptAckMessage ack;
+		ack.m_from = 2;
+		ack.m_groupID = 0;
+		ack.m_proposalID = ProposalID(1, 1);
+		ack.m_instanceID = 100;
+		ack.m_truncatedInstanceID = 0;
+		HeartbeatMessage heartbeat;
+		heartbeat.m_from = 1;
+		heartbeat.m_groupID = 0;
+		heartbeat.m_leaderProposalID = ProposalID(1, 1);
+		heartbeat.m_timestamp = deps::GetMonoTimeUs();
+
+		deps::Encoder e1, e2, e3;
+		e1.serialize(AcceptMessage::cmd, accept);
+		e2.serialize(AcceptAckMessage::cmd, ack);
+		e3.serialize(HeartbeatMessage::cmd, heartbeat);
+		packets.push_back(std::string(e1.data(), e1.size()));
+		packets.push_back(std::string(e2.data(), e2.size()));
+		packets.push_back(std::string(e3.data(), e3.size()));
+		cmds.push_back(AcceptMessage::cmd);
+		cmds.push_back(AcceptAckMessage::cmd);
+		cmds.push_back(HeartbeatMessage::cmd);
+	}
+
+	BenchHandler handler;
+	uint64_t allocs = g_allocCount;
+	uint64_t start = deps::GetMonoTimeUs();
+	for (size_t i = 0; i < packetCount; ++i)
+	{
+		const std::string& packet = packets[i % packets.size()];
+		dispatchShared(handler, cmds[i % cmds.size()], packet.data(), packet.size());
+	}
+	report("shared_ptr", packetCount, g_allocCount - allocs, deps::GetMonoTimeUs() - start);
+
+	MessageDispatcher<BenchHandler> dispatcher;
+	dispatcher.registerMessage<AcceptMessage, &BenchHandler::HandleAccept>();
+	dispatcher.registerMessage<AcceptAckMessage, &BenchHandler::HandleAcceptAck>();
+	dispatcher.registerMessage<HeartbeatMessage, &BenchHandler::HandleHeartbeat>();
+
+	//第一轮让常驻消息对象里的字符串长到稳态容量
+	for (size_t i = 0; i < packets.size(); ++i)
+	{
+		dispatcher.dispatch(handler, cmds[i], packets[i].data(), packets[i].size(), nullptr);
+	}
+
+	allocs = g_allocCount;
+	start = deps::GetMonoTimeUs();
+	for (size_t i = 0; i < packetCount; ++i)
+	{
+		const std::string& packet = packets[i % packets.size()];
+		dispatcher.dispatch(handler, cmds[i % cmds.size()], packet.data(), packet.size(), nullptr);
+	}
+	uint64_t dispatchAllocs = g_allocCount - allocs;
+	report("dispatcher", packetCount, dispatchAllocs, deps::GetMonoTimeUs() - start);
+	printf("handled:%llu bytes:%llu\n", (unsigned long long)handler.m_handled, (unsigned long long)handler.m_bytes);
+	return dispatchAllocs == 0 ? 0 : 1;
+}
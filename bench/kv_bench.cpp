@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "sys/util.h"
+#include "kv/kv_state_machine.h"
+
+/**
+ * 状态机执行吞吐的压测，不经过共识，只测量命令解码和KV执行的开销。
+ * 共识吞吐看节点日志里dumpStatus的commits/s。
+ * 
+ * 用法: kv_bench [commandCount] [keyCount] [valueSize]
+ */
+
+static void report(const char* name, uint64_t ops, uint64_t costUs)
+{
+	if (costUs == 0)
+	{
+		costUs = 1;
+	}
+	printf("%-16s ops:%-10llu cost:%-8llums ops/s:%-12llu ns/op:%llu\n", name, 
+		(unsigned long long)ops, (unsigned long long)costUs / 1000, 
+		(unsigned long long)(ops * 1000000 / costUs), (unsigned long long)(costUs * 1000 / ops));
+}
+
+int main(int argc, char** argv)
+{
+	size_t commandCount = argc > 1 ? atoi(argv[1]) : 1000000;
+	size_t keyCount = argc > 2 ? atoi(argv[2]) : 100000;
+	size_t valueSize = argc > 3 ? atoi(argv[3]) : 64;
+
+	printf("commands:%zd keys:%zd value size:%zd\n", commandCount, keyCount, valueSize);
+
+	std::vector<std::string> keys(keyCount);
+	for (size_t i = 0; i < keyCount; ++i)
+	{
+		keys[i] = "key_" + std::to_string(i);
+	}
+	std::string value(valueSize, 'v');
+
+	//命令提前编码好，计时只包含执行
+	std::vector<std::string> puts(commandCount);
+	std::vector<std::string> mixed(commandCount);
+	for (size_t i = 0; i < commandCount; ++i)
+	{
+		const std::string& key = keys[random() % keyCount];
+		KvStateMachine::encodePut(key, value, puts[i]);
+		switch (i % 4)
+		{
+			case 0:
+				KvStateMachine::encodePut(key, value, mixed[i]);
+				break;
+			case 1:
+				KvStateMachine::encodeGet(key, mixed[i]);
+				break;
+			case 2:
+				KvStateMachine::encodeCas(key, value, value, mixed[i]);
+				break;
+			default:
+				KvStateMachine::encodeDelete(key, mixed[i]);
+				break;
+		}
+	}
+
+	KvStateMachine sm;
+	std::string result;
+	uint64_t start = deps::GetMonoTimeUs();
+	for (size_t i = 0; i < commandCount; ++i)
+	{
+		sm.apply(i, puts[i], result);
+	}
+	report("apply put", commandCount, deps::GetMonoTimeUs() - start);
+
+	start = deps::GetMonoTimeUs();
+	for (size_t i = 0; i < commandCount; ++i)
+	{
+		sm.apply(commandCount + i, mixed[i], result);
+	}
+	report("apply mixed", commandCount, deps::GetMonoTimeUs() - start);
+
+	//不经过命令编解码的哈希表开销
+	KvTable table(16);
+	start = deps::GetMonoTimeUs();
+	for (size_t i = 0; i < commandCount; ++i)
+	{
+		table.put(keys[i % keyCount], value);
+	}
+	report("table put", commandCount, deps::GetMonoTimeUs() - start);
+
+	start = deps::GetMonoTimeUs();
+	size_t hits = 0;
+	for (size_t i = 0; i < commandCount; ++i)
+	{
+		hits += table.get(keys[i % keyCount], result) ? 1 : 0;
+	}
+	report("table get", commandCount, deps::GetMonoTimeUs() - start);
+	printf("table size:%zd capacity:%zd hits:%zd\n", table.size(), table.capacity(), hits);
+	return 0;
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "sys/util.h"
+#include "net/packet.h"
+#include "paxos/proto.h"
+
+/**
+ * 节点编号改成16位整数以后的对比压测：
+ * 1. Accept/Permit消息除去议题值以后的字节数
+ * 2. 议题编号比较的耗时
+ * Legacy开头的结构是改动之前的消息格式，只在这里用来对比。
+ * 
+ * 用法: nodeid_bench [compareCount] [uidLength]
+ */
+
+struct LegacyProposalID : public deps::Marshallable{
+	LegacyProposalID():m_number(0){}
+	LegacyProposalID(uint32_t number, const std::string& uid):m_number(number), m_uid(uid){}
+
+	int compare(const LegacyProposalID& id) const{
+		if(m_number > id.m_number || (m_number == id.m_number && m_uid > id.m_uid)){
+			return 1;
+		}
+		else if(m_number == id.m_number && m_uid == id.m_uid){
+			return 0;
+		}
+		return -1;
+	}
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_number << m_uid;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_number >> m_uid;
+	}
+
+	uint32_t m_number;
+	std::string m_uid;
+};
+
+struct LegacyPeerInfo : public deps::Marshallable{
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_id << m_addr;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_id >> m_addr;
+	}
+
+	std::string m_id;
+	PeerAddr m_addr;
+};
+
+struct LegacyAcceptMessage : public deps::Marshallable{
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_myInfo << m_proposalID << m_instanceID << m_proposalValue;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_myInfo >> m_proposalID >> m_instanceID >> m_proposalValue;
+	}
+
+	LegacyPeerInfo m_myInfo;
+	LegacyProposalID m_proposalID;
+	uint64_t m_instanceID;
+	std::string m_proposalValue;
+};
+
+static size_t encodedSize(uint16_t cmd, const deps::Marshallable& msg)
+{
+	deps::Encoder encoder;
+	encoder.serialize(cmd, msg);
+	return encoder.size();
+}
+
+static void report(const char* name, uint64_t ops, uint64_t costUs)
+{
+	if (costUs == 0)
+	{
+		costUs = 1;
+	}
+	printf("%-16s ops:%-10llu ns/op:%llu\n", name, (unsigned long long)ops, 
+		(unsigned long long)(costUs * 1000 / ops));
+}
+
+int main(int argc, char** argv)
+{
+	size_t compareCount = argc > 1 ? atoi(argv[1]) : 10000000;
+	size_t uidLength = argc > 2 ? atoi(argv[2]) : 5;
+
+	//议题值为空，统计的就是消息头部的字节数
+	std::string uid1(uidLength, 'a');
+	std::string uid2(uidLength, 'b');
+	LegacyAcceptMessage legacy;
+	legacy.m_myInfo.m_id = uid1;
+	legacy.m_proposalID = LegacyProposalID(1, uid1);
+	legacy.m_instanceID = 100;
+	AcceptMessage accept;
+	accept.m_from = 1;
+	accept.m_groupID = 0;
+	accept.m_proposalID = ProposalID(1, 1);
+	accept.m_instanceID = 100;
+	accept.m_valueStreamID = 0;
+	accept.m_commitInstanceID = 0;
+	size_t legacySize = encodedSize(AcceptMessage::cmd, legacy);
+	size_t compactSize = encodedSize(AcceptMessage::cmd, accept);
+	printf("accept header bytes uid length:%zd legacy:%zd compact:%zd ratio:%.2f\n", uidLength, 
+		legacySize, compactSize, (double)legacySize / compactSize);
+
+	//编号相同只有节点不同是最慢的比较路径
+	std::vector<LegacyProposalID> legacyIDs;
+	legacyIDs.push_back(LegacyProposalID(7, uid1));
+	legacyIDs.push_back(LegacyProposalID(7, uid2));
+	std::vector<ProposalID> compactIDs;
+	compactIDs.push_back(ProposalID(7, 1));
+	compactIDs.push_back(ProposalID(7, 2));
+
+	int sum = 0;
+	uint64_t start = deps::GetMonoTimeUs();
+	for (size_t i = 0; i < compareCount; ++i)
+	{
+		sum += legacyIDs[i & 1].compare(legacyIDs[(i + 1) & 1]);
+	}
+	report("legacy compare", compareCount, deps::GetMonoTimeUs() - start);
+
+	start = deps::GetMonoTimeUs();
+	for (size_t i = 0; i < compareCount; ++i)
+	{
+		sum += compactIDs[i & 1].compare(compactIDs[(i + 1) & 1]);
+	}
+	report("compact compare", compareCount, deps::GetMonoTimeUs() - start);
+	printf("checksum:%d\n", sum);
+	return 0;
+}
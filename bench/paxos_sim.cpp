@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "sys/util.h"
+#include "sim/sim_cluster.h"
+
+/**
+ * 协议层压测：N个PaxosNode在一个进程里通过内存消息队列通信，时间是虚拟的，没有socket和fsync。
+ * 输出共识吞吐、每次决议的消息数、leader被隔离以后的故障切换时间，同样的参数和种子结果完全一样。
+ * 
+ * 用法: paxos_sim [-n 节点数] [-l 单向延迟us] [-j 延迟抖动us] [-p 丢包率] [-f 落盘耗时us]
+ * 	[-w accept窗口] [-b 攒批命令数] [-L 未完成命令数] [-v 命令大小] [-d 运行时长ms]
+ * 	[-F 隔离leader的时间ms，0表示不隔离] [-s 随机数种子] [-t 只发给quorum个Acceptor]
+ * 	[-P prepare阶段quorum] [-A accept阶段quorum] [-M 初始Acceptor个数，0表示不限制成员，其余节点是观察者]
+ * 	[-R 成员变更周期ms：轮流加入一个非成员、移除编号最小的成员，0表示不变更]
+ * 	[-r leader上保持的ReadIndex读请求个数，0表示不读] [-E 租约时长us，0表示不使用租约]
+ * 	[-S 每执行多少个实例做一次快照并截断，0表示不做快照] [-G 隔离一个非leader成员的时间ms，-F时恢复它并隔离leader]
+ * 	[-K 切断leader和编号最小的其他成员之间链路的时间ms，两边都还能和其余节点通信]
+ * 
+ * 快照场景: paxos_sim -S 2000 -G 1000 -F 3000，落后的节点回来时其他节点已经截断了它缺的实例，
+ * 	它只能装载快照追上，不管谁当选leader，所有节点执行到同一个实例时状态都必须一样
+ * 旧leader场景: paxos_sim -E 0 -K 1000，编号小的节点收不到leader的心跳，用更大的议题编号当选；
+ * 	旧leader收不到它的心跳，还在通过中间的节点发accept，被拒绝以后必须重新prepare，不能抬高编号接着发
+ */
+
+struct Reconfigure
+{
+	//成员变更走复制日志，压测负载不停；新旧配置的quorum必须相交，一次只加或者只减一个节点
+	static void step(SimCluster* cluster, uint64_t periodUs, size_t* steps)
+	{
+		cluster->schedule(periodUs, std::bind(&Reconfigure::step, cluster, periodUs, steps));
+		SimNode* leader = cluster->getLeader();
+		if (leader == nullptr)
+		{
+			return;
+		}
+		const Membership& latest = leader->getPaxosNode().getMemberships().latest();
+		Membership next(latest.m_acceptors, 0, 0);
+		bool add = (*steps % 2 == 0 && latest.m_acceptors.size() < cluster->size()) || latest.m_acceptors.size() <= 1;
+		if (add)
+		{
+			//从编号最大的成员往后找第一个非成员，成员集合在所有节点上轮转
+			NodeID nodeID = *latest.m_acceptors.rbegin();
+			do
+			{
+				nodeID = nodeID % cluster->size() + 1;
+			} while (latest.contains(nodeID));
+			next.m_acceptors.insert(nodeID);
+		}
+		else
+		{
+			next.m_acceptors.erase(next.m_acceptors.begin());
+		}
+		if (cluster->proposeMembership(next))
+		{
+			printf("  %llums: propose membership %s -> %s\n", (unsigned long long)(SimCluster::now() / 1000), 
+				latest.toString().c_str(), next.toString().c_str());
+			++*steps;
+		}
+	}
+};
+
+int main(int argc, char** argv)
+{
+	SimConfig config;
+	size_t load = 256;
+	size_t valueSize = 64;
+	uint64_t durationMs = 5000;
+	uint64_t failoverAtMs = 0;
+	uint64_t reconfigurePeriodMs = 0;
+	size_t reads = 0;
+	uint64_t lagAtMs = 0;
+	uint64_t cutAtMs = 0;
+
+	int c = 0;
+	while ((c = getopt(argc, argv, "n:l:j:p:f:w:b:L:v:d:F:s:tP:A:M:R:r:E:D:B:S:G:K:")) != -1)
+	{
+		switch (c)
+		{
+			case 'n': config.m_nodeCount = atoi(optarg); break;
+			case 'l': config.m_latencyUs = atoll(optarg); break;
+			case 'j': config.m_jitterUs = atoll(optarg); break;
+			case 'p': config.m_lossRate = atof(optarg); break;
+			case 'f': config.m_fsyncUs = atoll(optarg); break;
+			case 'w': config.m_acceptWindow = atoi(optarg); break;
+			case 'b': config.m_batchCount = atoi(optarg); break;
+			case 'L': load = atoi(optarg); break;
+			case 'v': valueSize = atoi(optarg); break;
+			case 'd': durationMs = atoll(optarg); break;
+			case 'F': failoverAtMs = atoll(optarg); break;
+			case 's': config.m_seed = atoll(optarg); break;
+			case 't': config.m_thrifty = true; break;
+			case 'P': config.m_prepareQuorum = atoi(optarg); break;
+			case 'A': config.m_acceptQuorum = atoi(optarg); break;
+			case 'M': config.m_acceptors = atoi(optarg); break;
+			case 'R': reconfigurePeriodMs = atoll(optarg); break;
+			case 'r': reads = atoi(optarg); break;
+			case 'E': config.m_leaseUs = atoll(optarg); break;
+			case 'D': config.m_payloadThreshold = atoi(optarg); break;
+			case 'B': config.m_bandwidth = atoll(optarg) * 1000000; break;
+			case 'S': config.m_snapshotInterval = atoll(optarg); break;
+			case 'G': lagAtMs = atoll(optarg); break;
+			case 'K': cutAtMs = atoll(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-n nodes] [-l latencyUs] [-j jitterUs] [-p lossRate] [-f fsyncUs] "
+					"[-w acceptWindow] [-b batchCount] [-L load] [-v valueSize] [-d durationMs] "
+					"[-F failoverAtMs] [-s seed] [-t] [-P prepareQuorum] [-A acceptQuorum] [-M acceptors] "
+					"[-R reconfigurePeriodMs] [-r reads] [-E leaseUs] [-D payloadThreshold] [-B bandwidthMBps] "
+					"[-S snapshotInterval] [-G lagAtMs] [-K cutAtMs]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (config.m_nodeCount == 0 || config.m_seed == 0 || config.m_acceptors > config.m_nodeCount)
+	{
+		fprintf(stderr, "node count and seed must be positive, acceptors must not exceed nodes\n");
+		return 1;
+	}
+	size_t voters = config.m_acceptors > 0 ? config.m_acceptors : config.m_nodeCount;
+	size_t majority = voters / 2 + 1;
+	size_t prepareQuorum = config.m_prepareQuorum > 0 ? config.m_prepareQuorum : majority;
+	size_t acceptQuorum = config.m_acceptQuorum > 0 ? config.m_acceptQuorum : majority;
+	if (prepareQuorum > voters || acceptQuorum > voters || prepareQuorum + acceptQuorum <= voters)
+	{
+		fprintf(stderr, "quorums must satisfy prepare + accept > acceptors and not exceed acceptors\n");
+		return 1;
+	}
+	if (reconfigurePeriodMs > 0 && config.m_acceptors == 0)
+	{
+		fprintf(stderr, "membership changes need an initial acceptor set (-M)\n");
+		return 1;
+	}
+	if (lagAtMs > 0 && (failoverAtMs <= lagAtMs || failoverAtMs >= durationMs))
+	{
+		fprintf(stderr, "lagging a node (-G) needs a later failover (-F) within the duration\n");
+		return 1;
+	}
+	if (cutAtMs > 0 && (cutAtMs >= durationMs || lagAtMs > 0 || failoverAtMs > 0))
+	{
+		fprintf(stderr, "cutting the leader's link (-K) must be within the duration and without -G or -F\n");
+		return 1;
+	}
+
+	printf("nodes:%zd latency:%lluus jitter:%lluus loss:%.4f fsync:%lluus window:%zd batch:%zd load:%zd "
+		"value:%zd thrifty:%d acceptors:%zd q1:%zd q2:%zd reads:%zd lease:%lluus payload:%zd bandwidth:%lluMB/s "
+		"seed:%llu\n", config.m_nodeCount, 
+		(unsigned long long)config.m_latencyUs, (unsigned long long)config.m_jitterUs, config.m_lossRate, 
+		(unsigned long long)config.m_fsyncUs, config.m_acceptWindow, config.m_batchCount, load, valueSize, 
+		config.m_thrifty, voters, prepareQuorum, acceptQuorum, reads, (unsigned long long)config.m_leaseUs, 
+		config.m_payloadThreshold, (unsigned long long)(config.m_bandwidth / 1000000), 
+		(unsigned long long)config.m_seed);
+
+	uint64_t wallStart = deps::GetMonoTimeUs();
+	SimCluster cluster(config);
+	uint64_t startUs = SimCluster::now();
+
+	struct Load
+	{
+		static void generate(SimCluster* cluster, size_t load, size_t valueSize, size_t reads)
+		{
+			cluster->generateLoad(load, valueSize);
+			cluster->generateReads(reads);
+			cluster->schedule(1000, std::bind(&Load::generate, cluster, load, valueSize, reads));
+		}
+	};
+	cluster.schedule(0, std::bind(&Load::generate, &cluster, load, valueSize, reads));
+	size_t reconfigureSteps = 0;
+	if (reconfigurePeriodMs > 0)
+	{
+		cluster.schedule(reconfigurePeriodMs * 1000, 
+			std::bind(&Reconfigure::step, &cluster, reconfigurePeriodMs * 1000, &reconfigureSteps));
+	}
+
+	//先隔离一个非leader成员让它落后，隔离leader的同时放它回来
+	NodeID lagging = INVALID_NODE_ID;
+	if (lagAtMs > 0)
+	{
+		cluster.runUntil(startUs + lagAtMs * 1000);
+		SimNode* leader = cluster.getLeader();
+		for (NodeID nodeID = 1; nodeID <= cluster.size(); ++nodeID)
+		{
+			PaxosNode& node = cluster.getNode(nodeID).getPaxosNode();
+			if ((leader == nullptr || nodeID != leader->getNodeID()) && !node.isObserver())
+			{
+				lagging = nodeID;
+				break;
+			}
+		}
+		if (lagging != INVALID_NODE_ID)
+		{
+			std::vector<int> partitions(cluster.size(), 0);
+			partitions[lagging - 1] = 1;
+			cluster.partition(partitions);
+		}
+	}
+
+	//切断leader和编号最小的其他成员之间的链路，leader编号更大时新leader的议题编号抬高以后会小于旧leader
+	NodeID cutLeader = INVALID_NODE_ID;
+	NodeID cutPeer = INVALID_NODE_ID;
+	if (cutAtMs > 0)
+	{
+		cluster.runUntil(startUs + cutAtMs * 1000);
+		SimNode* leader = cluster.getLeader();
+		for (NodeID nodeID = 1; leader != nullptr && nodeID <= cluster.size(); ++nodeID)
+		{
+			if (nodeID != leader->getNodeID() && !cluster.getNode(nodeID).getPaxosNode().isObserver())
+			{
+				cutLeader = leader->getNodeID();
+				cutPeer = nodeID;
+				cluster.cut(cutLeader, cutPeer);
+				break;
+			}
+		}
+	}
+
+	//隔离当前leader，记录其他节点第一次决议出新实例的时间
+	NodeID isolated = INVALID_NODE_ID;
+	uint64_t failoverMarkUs = 0;
+	uint64_t decisionsBeforeFailover = 0;
+	if (failoverAtMs > 0 && failoverAtMs < durationMs)
+	{
+		cluster.runUntil(startUs + failoverAtMs * 1000);
+		SimNode* leader = cluster.getLeader();
+		if (leader != nullptr)
+		{
+			isolated = leader->getNodeID();
+			std::vector<int> partitions(cluster.size(), 0);
+			partitions[isolated - 1] = 1;
+			cluster.partition(partitions);
+			failoverMarkUs = SimCluster::now();
+			decisionsBeforeFailover = cluster.getDecisions();
+		}
+	}
+	cluster.runUntil(startUs + durationMs * 1000);
+	uint64_t wallUs = deps::GetMonoTimeUs() - wallStart;
+
+	uint64_t decisions = cluster.getDecisions();
+	printf("virtual:%llums wall:%llums speedup:%.1fx\n", (unsigned long long)durationMs, 
+		(unsigned long long)wallUs / 1000, wallUs > 0 ? durationMs * 1000.0 / wallUs : 0.0);
+	printf("decisions:%llu decisions/s:%llu commands:%llu commands/s:%llu\n", (unsigned long long)decisions, 
+		(unsigned long long)(decisions * 1000 / durationMs), (unsigned long long)cluster.getCommands(), 
+		(unsigned long long)(cluster.getCommands() * 1000 / durationMs));
+	printf("messages:%llu dropped:%llu per decision:%.2f\n", (unsigned long long)cluster.getTotalMessages(), 
+		(unsigned long long)cluster.getDroppedMessages(), 
+		decisions > 0 ? (double)cluster.getTotalMessages() / decisions : 0.0);
+	for (int i = 0; i < SimCluster::MSG_TYPE_COUNT; ++i)
+	{
+		SimCluster::MessageType type = (SimCluster::MessageType)i;
+		printf("  %-14s %-12llu per decision:%.2f\n", SimCluster::getMessageName(type), 
+			(unsigned long long)cluster.getMessageCount(type), 
+			decisions > 0 ? (double)cluster.getMessageCount(type) / decisions : 0.0);
+	}
+	LatencyHistogram prepareLatency, acceptLatency, commitLatency;
+	cluster.takeLatencies(prepareLatency, acceptLatency, commitLatency);
+	printf("accept p50:%lluus p99:%lluus commit p50:%lluus p99:%lluus prepare p50:%lluus samples:%llu\n",
+		(unsigned long long)acceptLatency.percentile(50), (unsigned long long)acceptLatency.percentile(99),
+		(unsigned long long)commitLatency.percentile(50), (unsigned long long)commitLatency.percentile(99),
+		(unsigned long long)prepareLatency.percentile(50), (unsigned long long)prepareLatency.count());
+	if (isolated != INVALID_NODE_ID)
+	{
+		uint64_t first = cluster.getFirstDecisionAfter(failoverMarkUs);
+		if (first > 0)
+		{
+			printf("failover: leader node:%u isolated at %llums, next decision after %.1fms, decisions after:%llu\n", 
+				isolated, (unsigned long long)failoverAtMs, (first - failoverMarkUs) / 1000.0, 
+				(unsigned long long)(decisions - decisionsBeforeFailover));
+		}
+		else
+		{
+			printf("failover: leader node:%u isolated at %llums, no decision afterwards\n", 
+				isolated, (unsigned long long)failoverAtMs);
+		}
+	}
+	if (cutLeader != INVALID_NODE_ID)
+	{
+		printf("cut: link between leader node:%u and node:%u at %llums\n", cutLeader, cutPeer, 
+			(unsigned long long)cutAtMs);
+	}
+	if (reads > 0)
+	{
+		//没有租约时每轮心跳确认一批读请求，读的吞吐取决于每轮心跳带的读请求个数
+		const LatencyHistogram& readLatency = cluster.getReadLatency();
+		printf("reads:%llu reads/s:%llu per heartbeat round:%.2f p50:%lluus p99:%lluus stale:%llu\n", 
+			(unsigned long long)cluster.getReads(), (unsigned long long)(cluster.getReads() * 1000 / durationMs),
+			cluster.getMessageCount(SimCluster::MSG_HEARTBEAT) > 0 ? (double)cluster.getReads() * cluster.size() / 
+				cluster.getMessageCount(SimCluster::MSG_HEARTBEAT) : 0.0,
+			(unsigned long long)readLatency.percentile(50), (unsigned long long)readLatency.percentile(99),
+			(unsigned long long)cluster.getStaleReads());
+	}
+	//leader在accept、心跳和空闲时的提交通知里捎带提交位置，其他节点据此学习自己批准过的议题
+	printf("commit index:");
+	for (NodeID nodeID = 1; nodeID <= cluster.size(); ++nodeID)
+	{
+		printf(" %u:%llu", nodeID, (unsigned long long)cluster.getNode(nodeID).getPaxosNode().getCommitInstanceID());
+	}
+	printf("\n");
+	//不在最新配置里的节点是观察者，只学习leader推送的实例，有界陈旧读按本地状态落后leader的时间判断
+	printf("read staleness:");
+	for (NodeID nodeID = 1; nodeID <= cluster.size(); ++nodeID)
+	{
+		PaxosNode& node = cluster.getNode(nodeID).getPaxosNode();
+		uint64_t staleness = node.getReadStaleness();
+		printf(" %u%s:", nodeID, node.isObserver() ? "(observer)" : "");
+		if (staleness == UINT64_MAX)
+		{
+			printf("-");
+		}
+		else
+		{
+			printf("%lluus", (unsigned long long)staleness);
+		}
+	}
+	printf("\n");
+	//每个节点发出的value字节数，分发payload时leader只发一份，转发的流量分摊到其他节点上
+	printf("sent MB:");
+	for (NodeID nodeID = 1; nodeID <= cluster.size(); ++nodeID)
+	{
+		printf(" %u%s:%.1f", nodeID, cluster.getNode(nodeID).getPaxosNode().isLeader() ? "(leader)" : "", 
+			cluster.getSentBytes(nodeID) / 1000000.0);
+	}
+	printf("\n");
+	if (reconfigurePeriodMs > 0)
+	{
+		SimNode* leader = cluster.getLeader();
+		printf("membership: proposed:%zd decided:%llu final:%s\n", reconfigureSteps, 
+			(unsigned long long)cluster.getMembershipChanges(), 
+			leader != nullptr ? leader->getPaxosNode().getMemberships().latest().toString().c_str() : "none");
+	}
+	if (config.m_snapshotInterval > 0)
+	{
+		//快照和装载快照的节点也要和按日志执行的节点状态一致
+		printf("replicas: applied");
+		for (NodeID nodeID = 1; nodeID <= cluster.size(); ++nodeID)
+		{
+			printf(" %u%s:%llu", nodeID, nodeID == lagging ? "(lagged)" : "", 
+				(unsigned long long)cluster.getNode(nodeID).getAppliedInstanceID());
+		}
+		printf(" snapshots:%llu installed:%llu diverged:%llu\n", (unsigned long long)cluster.getSnapshots(), 
+			(unsigned long long)cluster.getInstalledSnapshots(), (unsigned long long)cluster.getDivergences());
+	}
+	printf("safety violations:%llu\n", (unsigned long long)cluster.getSafetyViolations());
+	return cluster.getSafetyViolations() == 0 && cluster.getDivergences() == 0 && 
+		cluster.getStaleReads() == 0 ? 0 : 2;
+}
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "sys/util.h"
+#include "net/packet.h"
+#include "paxos/proto.h"
+
+/**
+ * paxos/proto.h里所有消息的编解码压测：每种消息在不同负载大小下的编码字节数、
+ * Encoder序列化和Decoder反序列化的耗时。修改线上格式以后和之前的输出对比。
+ * 解码用常驻的消息对象，和MessageDispatcher的收包路径一致。
+ * 
+ * 用法: proto_bench [iterations]
+ */
+
+static uint64_t g_sink = 0;
+static size_t g_iterations = 200000;
+
+template<typename Msg>
+static void bench(const char* name, const std::string& param, const Msg& msg)
+{
+	deps::Encoder probe;
+	probe.serialize(Msg::cmd, msg);
+	std::string packet(probe.data(), probe.size());
+	//大包少跑几轮，每一行的总耗时差不多
+	size_t iterations = g_iterations * 256 / (packet.size() + 256);
+	if (iterations < 1000)
+	{
+		iterations = 1000;
+	}
+
+	uint64_t start = deps::GetMonoTimeUs();
+	for (size_t i = 0; i < iterations; ++i)
+	{
+		deps::Encoder encoder;
+		encoder.serialize(Msg::cmd, msg);
+		g_sink += encoder.size();
+	}
+	uint64_t encodeUs = deps::GetMonoTimeUs() - start;
+
+	Msg decoded;
+	start = deps::GetMonoTimeUs();
+	for (size_t i = 0; i < iterations; ++i)
+	{
+		deps::PacketHeader header;
+		deps::Decoder decoder(packet.data(), packet.size());
+		decoder.deserialize(header, decoded);
+	}
+	uint64_t decodeUs = deps::GetMonoTimeUs() - start;
+
+	printf("%-12s %-16s bytes/op:%-8zd encode ns/op:%-10llu decode ns/op:%-10llu iterations:%zd\n", 
+		name, param.c_str(), packet.size(), (unsigned long long)(encodeUs * 1000 / iterations), 
+		(unsigned long long)(decodeUs * 1000 / iterations), iterations);
+}
+
+static PeerInfo makePeer(size_t i)
+{
+	PeerInfo peer;
+	peer.m_id = "node_" + std::to_string(i);
+	peer.m_nodeID = i + 1;
+	peer.m_addr.m_ip = 0x0100007f + (i << 24);
+	peer.m_addr.m_port = 10000 + i;
+	return peer;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		g_iterations = atoi(argv[1]);
+	}
+	printf("iterations:%zd (scaled down for large packets)\n", g_iterations);
+
+	const ProposalID proposalID(12345, 3);
+	const size_t peerCounts[] = {0, 16, 256, 1024};
+	const size_t valueSizes[] = {0, 64, 1024, 16384, 32768};
+	const size_t instanceCounts[] = {0, 1, 16, 64, 256};
+
+	for (auto count : peerCounts)
+	{
+		PingMessage ping;
+		ping.m_timestamp = deps::GetMonoTimeMs();
+		ping.m_myInfo = makePeer(0);
+		ping.m_fromVersion = 0;
+		ping.m_toVersion = count;
+		for (size_t i = 0; i < count; ++i)
+		{
+			ping.m_peers.insert(makePeer(i));
+		}
+		bench("ping", "peers=" + std::to_string(count), ping);
+	}
+
+	PongMessage pong;
+	pong.m_timestamp = deps::GetMonoTimeMs();
+	pong.m_myInfo = makePeer(0);
+	pong.m_ackVersion = 0;
+	bench("pong", "-", pong);
+
+	HeartbeatMessage heartbeat;
+	heartbeat.m_from = 1;
+	heartbeat.m_groupID = 0;
+	heartbeat.m_leaderUID = 1;
+	heartbeat.m_leaderProposalID = proposalID;
+	heartbeat.m_timestamp = deps::GetMonoTimeUs();
+	heartbeat.m_leaseDuration = 80000;
+	heartbeat.m_commitInstanceID = 1000000;
+	bench("heartbeat", "-", heartbeat);
+
+	LeaseGrantMessage grant;
+	grant.m_from = 2;
+	grant.m_groupID = 0;
+	grant.m_leaderProposalID = proposalID;
+	grant.m_timestamp = deps::GetMonoTimeUs();
+	bench("lease_grant", "-", grant);
+
+	CommitMessage commit;
+	commit.m_from = 1;
+	commit.m_groupID = 0;
+	commit.m_proposalID = proposalID;
+	commit.m_commitInstanceID = 1000000;
+	bench("commit", "-", commit);
+
+	PrepareMessage prepare;
+	prepare.m_from = 1;
+	prepare.m_groupID = 0;
+	prepare.m_proposalID = proposalID;
+	prepare.m_instanceID = 1000000;
+	bench("prepare", "-", prepare);
+
+	for (auto count : instanceCounts)
+	{
+		PromiseMessage promise;
+		promise.m_from = 2;
+		promise.m_groupID = 0;
+		promise.m_proposalID = proposalID;
+		promise.m_instanceID = 1000000;
+		for (size_t i = 0; i < count; ++i)
+		{
+			promise.m_acceptedInstances.push_back(PaxosInstance(1000000 + i, proposalID, std::string(64, 'v')));
+		}
+		bench("promise", "instances=" + std::to_string(count), promise);
+	}
+
+	for (auto size : valueSizes)
+	{
+		AcceptMessage accept;
+		accept.m_from = 1;
+		accept.m_groupID = 0;
+		accept.m_proposalID = proposalID;
+		accept.m_instanceID = 1000000;
+		accept.m_proposalValue.assign(size, 'v');
+		accept.m_valueStreamID = 0;
+		accept.m_commitInstanceID = 1000000;
+		bench("accept", "value=" + std::to_string(size), accept);
+
+		PermitMessage permit;
+		permit.m_from = 2;
+		permit.m_groupID = 0;
+		permit.m_proposalID = proposalID;
+		permit.m_instanceID = 1000000;
+		permit.m_acceptedValue.assign(size, 'v');
+		permit.m_valueStreamID = 0;
+		bench("permit", "value=" + std::to_string(size), permit);
+	}
+
+	PrepareAckMessage prepareAck;
+	prepareAck.m_from = 2;
+	prepareAck.m_groupID = 0;
+	prepareAck.m_proposalID = proposalID;
+	prepareAck.m_promiseID = ProposalID(12346, 2);
+	prepareAck.m_truncatedInstanceID = 0;
+	bench("prepare_ack", "-", prepareAck);
+
+	AcceptAckMessage acceptAck;
+	acceptAck.m_from = 2;
+	acceptAck.m_groupID = 0;
+	acceptAck.m_proposalID = proposalID;
+	acceptAck.m_instanceID = 1000000;
+	acceptAck.m_promiseID = ProposalID(12346, 2);
+	acceptAck.m_truncatedInstanceID = 0;
+	bench("accept_ack", "-", acceptAck);
+
+	ValueChunkMessage chunk;
+	chunk.m_from = 1;
+	chunk.m_groupID = 0;
+	chunk.m_streamID = 1;
+	chunk.m_totalSize = 4 * 1024 * 1024;
+	chunk.m_offset = 0;
+	chunk.m_data.assign(32 * 1024, 'v');
+	bench("value_chunk", "data=32768", chunk);
+
+	printf("sink:%llu\n", (unsigned long long)g_sink);
+	return 0;
+}
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "sim/sim_cluster.h"
+
+/**
+ * Flexible Paxos压测：在模拟集群上比较不同的prepare/accept quorum组合(Q1 + Q2 > N)。
+ * 稳定的leader只走accept阶段，提交延迟由Q2决定；运行到一半时隔离leader，新leader要凑齐Q1个承诺，
+ * Q1越大换主越慢，Q1等于节点数时选不出新leader。Q2为1时被隔离的leader自己还能继续决议，
+ * 所以换主时间按照其他节点成为leader的时间统计，而不是下一次决议的时间。
+ *
+ * 用法: quorum_bench [-l 单向延迟us] [-j 延迟抖动us] [-f 落盘耗时us] [-L 未完成命令数] [-v 命令大小]
+ * 	[-d 运行时长ms] [-s 随机数种子] [-t 只发给quorum个Acceptor]
+ */
+
+struct QuorumConfig
+{
+	size_t m_nodeCount;
+	size_t m_prepareQuorum;
+	size_t m_acceptQuorum;
+};
+
+static const QuorumConfig CONFIGS[] = {
+	{5, 3, 3}, {5, 4, 2}, {5, 5, 1},
+	{7, 4, 4}, {7, 5, 3}, {7, 6, 2}, {7, 7, 1},
+};
+
+struct Load
+{
+	static void generate(SimCluster* cluster, size_t load, size_t valueSize)
+	{
+		cluster->generateLoad(load, valueSize);
+		cluster->schedule(1000, std::bind(&Load::generate, cluster, load, valueSize));
+	}
+};
+
+static void run(SimConfig config, const QuorumConfig& quorum, size_t load, size_t valueSize, uint64_t durationMs)
+{
+	config.m_nodeCount = quorum.m_nodeCount;
+	config.m_prepareQuorum = quorum.m_prepareQuorum;
+	config.m_acceptQuorum = quorum.m_acceptQuorum;
+
+	SimCluster cluster(config);
+	uint64_t startUs = SimCluster::now();
+	cluster.schedule(0, std::bind(&Load::generate, &cluster, load, valueSize));
+
+	//前一半是稳定状态，只统计这一段的延迟
+	uint64_t failoverAtMs = durationMs / 2;
+	cluster.runUntil(startUs + failoverAtMs * 1000);
+	uint64_t steadyDecisions = cluster.getDecisions();
+	uint64_t steadyMessages = cluster.getTotalMessages();
+	LatencyHistogram prepareLatency, acceptLatency, commitLatency;
+	cluster.takeLatencies(prepareLatency, acceptLatency, commitLatency);
+
+	SimNode* leader = cluster.getLeader();
+	uint64_t failoverMarkUs = SimCluster::now();
+	if (leader != nullptr)
+	{
+		std::vector<int> partitions(cluster.size(), 0);
+		partitions[leader->getNodeID() - 1] = 1;
+		cluster.partition(partitions);
+	}
+	//每1ms检查一次有没有别的节点成为leader
+	uint64_t endUs = startUs + durationMs * 1000;
+	uint64_t electedUs = 0;
+	while (SimCluster::now() < endUs)
+	{
+		cluster.runUntil(std::min(SimCluster::now() + 1000, endUs));
+		SimNode* current = cluster.getLeader();
+		if (electedUs == 0 && leader != nullptr && current != nullptr && current != leader)
+		{
+			electedUs = SimCluster::now();
+		}
+	}
+
+	std::string failover = "none";
+	if (electedUs > 0)
+	{
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%.0fms", (electedUs - failoverMarkUs) / 1000.0);
+		failover = buffer;
+	}
+	printf("%-5zd %-3zd %-3zd %-11llu %-9.2f %-10llu %-10llu %-10llu %-10llu %-10s %llu\n",
+		quorum.m_nodeCount, quorum.m_prepareQuorum, quorum.m_acceptQuorum,
+		(unsigned long long)(steadyDecisions * 1000 / failoverAtMs),
+		steadyDecisions > 0 ? (double)steadyMessages / steadyDecisions : 0.0,
+		(unsigned long long)acceptLatency.percentile(50), (unsigned long long)acceptLatency.percentile(99),
+		(unsigned long long)commitLatency.percentile(50), (unsigned long long)commitLatency.percentile(99),
+		failover.c_str(), (unsigned long long)cluster.getSafetyViolations());
+}
+
+int main(int argc, char** argv)
+{
+	SimConfig config;
+	config.m_jitterUs = 400;
+	size_t load = 256;
+	size_t valueSize = 64;
+	uint64_t durationMs = 4000;
+
+	int c = 0;
+	while ((c = getopt(argc, argv, "l:j:f:L:v:d:s:t")) != -1)
+	{
+		switch (c)
+		{
+			case 'l': config.m_latencyUs = atoll(optarg); break;
+			case 'j': config.m_jitterUs = atoll(optarg); break;
+			case 'f': config.m_fsyncUs = atoll(optarg); break;
+			case 'L': load = atoi(optarg); break;
+			case 'v': valueSize = atoi(optarg); break;
+			case 'd': durationMs = atoll(optarg); break;
+			case 's': config.m_seed = atoll(optarg); break;
+			case 't': config.m_thrifty = true; break;
+			default:
+				fprintf(stderr, "usage: %s [-l latencyUs] [-j jitterUs] [-f fsyncUs] [-L load] [-v valueSize] "
+					"[-d durationMs] [-s seed] [-t]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (durationMs < 2 || config.m_seed == 0)
+	{
+		fprintf(stderr, "duration must be at least 2ms and seed must be positive\n");
+		return 1;
+	}
+
+	printf("latency:%lluus jitter:%lluus fsync:%lluus load:%zd value:%zd duration:%llums thrifty:%d seed:%llu\n",
+		(unsigned long long)config.m_latencyUs, (unsigned long long)config.m_jitterUs,
+		(unsigned long long)config.m_fsyncUs, load, valueSize, (unsigned long long)durationMs,
+		config.m_thrifty, (unsigned long long)config.m_seed);
+	printf("%-5s %-3s %-3s %-11s %-9s %-10s %-10s %-10s %-10s %-10s %s\n", "nodes", "q1", "q2", "decisions/s",
+		"msgs/dec", "accept p50", "accept p99", "commit p50", "commit p99", "failover", "violations");
+	for (auto& quorum : CONFIGS)
+	{
+		run(config, quorum, load, valueSize, durationMs);
+	}
+	return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef MESSAGE_DISPATCHER_H
+#define MESSAGE_DISPATCHER_H
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <memory>
+
+#include "net/packet.h"
+#include "net/socket_base.h"
+
+/**
+ * @brief 按照subCmd索引的消息分发表。每种消息在注册时创建一个常驻的消息对象，收包时直接反序列化到
+ *  这个对象里再调用类型化的处理函数，稳态路径上不需要为每个包分配内存，也不需要dynamic_cast。
+ *  处理函数不能保存消息对象的引用，下一个同类型的包会覆盖它。
+ */
+template<typename Handler>
+class MessageDispatcher{
+public:
+    typedef bool (*Invoker)(Handler& handler, deps::Marshallable* msg, const char* data, size_t size, deps::SocketBase* s);
+
+    MessageDispatcher():m_slots(){}
+    ~MessageDispatcher(){}
+
+    /**
+     * @brief 注册一种消息，subCmd取Msg::cmd，Method是Handler上的处理函数
+     */
+    template<typename Msg, bool (Handler::*Method)(const deps::PacketHeader&, Msg&, deps::SocketBase*)>
+    void registerMessage(){
+        size_t cmd = Msg::cmd;
+        if(cmd >= m_slots.size()){
+            m_slots.resize(cmd + 1);
+        }
+        m_slots[cmd].m_msg.reset(new Msg());
+        m_slots[cmd].m_invoker = &MessageDispatcher::invoke<Msg, Method>;
+    }
+
+    bool hasMessage(uint16_t cmd) const{
+        return cmd < m_slots.size() && m_slots[cmd].m_invoker != nullptr;
+    }
+
+    /**
+     * @brief 反序列化并且分发一个完整的包
+     */
+    bool dispatch(Handler& handler, uint16_t cmd, const char* data, size_t size, deps::SocketBase* s){
+        if(!hasMessage(cmd)){
+            return false;
+        }
+        Slot& slot = m_slots[cmd];
+        return slot.m_invoker(handler, slot.m_msg.get(), data, size, s);
+    }
+
+private:
+    template<typename Msg, bool (Handler::*Method)(const deps::PacketHeader&, Msg&, deps::SocketBase*)>
+    static bool invoke(Handler& handler, deps::Marshallable* msg, const char* data, size_t size, deps::SocketBase* s){
+        Msg& typed = *static_cast<Msg*>(msg);
+        deps::PacketHeader header;
+        deps::Decoder decoder(data, size);
+        decoder.deserialize(header, typed);
+        return (handler.*Method)(header, typed, s);
+    }
+
+    struct Slot{
+        Slot():m_invoker(nullptr){}
+        Invoker m_invoker;
+        std::shared_ptr<deps::Marshallable> m_msg;
+    };
+
+    std::vector<Slot> m_slots;
+};
+#endif
@@ -1,43 +1,271 @@
 #ifndef EZ_TIMER_H
 #define EZ_TIMER_H
 #include <functional>
+#include <vector>
 #include <stdint.h>
 
 #include "sys/util.h"
 
-class EzTimer{
+/**
+ * @brief 定时器编号，高32位是代数，低32位是节点下标，节点复用以后旧编号自动失效。0表示无效编号
+ */
+typedef uint64_t EzTimerID;
+
+/**
+ * @brief 分层时间轮定时器，精度1毫秒。4层每层64个槽，覆盖约4.6小时，更远的定时器先放在最高层，
+ *  转到时再重新分配。添加、取消、到期都是O(1)，大量的单次重试定时器不会拖慢事件循环。
+ *  nextTimeout给出距离下一个到期时间的毫秒数，事件循环用它作为epoll的等待时间。
+ */
+class EzTimerManager{
 public:
-    EzTimer(long millisecondDelay, std::function<void()> callback):
-        m_period(millisecondDelay), m_lastExecuteTime(0), m_callback(callback){}
-    ~EzTimer(){}
-    void execute(){
-        uint64_t nowMs = deps::GetMonoTimeMs();
-        if(m_lastExecuteTime == 0 || m_lastExecuteTime + (uint64_t)m_period < nowMs){
-            m_lastExecuteTime = nowMs;
-            m_callback();
+    EzTimerManager():m_nodes(), m_freeNodes(), m_nextTick(deps::GetMonoTimeMs()), m_size(0){
+        for(int i = 0; i < WHEEL_LEVELS; ++i){
+            m_bitmaps[i] = 0;
+        }
+        //前面的节点作为每个槽的链表头，最后一个是执行中的链表头
+        m_nodes.resize(SENTINEL_COUNT);
+        for(uint32_t i = 0; i < SENTINEL_COUNT; ++i){
+            m_nodes[i].m_prev = i;
+            m_nodes[i].m_next = i;
         }
     }
-private:
-    long m_period;
-    uint64_t m_lastExecuteTime;
-    std::function<void()> m_callback;
-};
+    ~EzTimerManager(){}
 
+    /**
+     * @brief 添加周期定时器，下一次检查时第一次执行，之后每millisecondPeriod毫秒执行一次
+     */
+    EzTimerID addTimer(long millisecondPeriod, std::function<void()> callback){
+        uint64_t period = millisecondPeriod > 0 ? millisecondPeriod : 1;
+        return add(m_nextTick, period, callback);
+    }
 
-class EzTimerManager{
-public:
-    EzTimerManager():m_timers(){}
-    ~EzTimerManager(){}
-    bool addTimer(long millisecondDelay, std::function<void()> callback){
-        m_timers.push_back(EzTimer(millisecondDelay, callback));
+    /**
+     * @brief 添加单次定时器，millisecondDelay毫秒以后执行一次
+     */
+    EzTimerID addOnceTimer(long millisecondDelay, std::function<void()> callback){
+        uint64_t delay = millisecondDelay > 0 ? millisecondDelay : 0;
+        return add(deps::GetMonoTimeMs() + delay, 0, callback);
+    }
+
+    /**
+     * @brief 取消定时器，定时器已经执行完(单次)或者已经取消时返回false
+     */
+    bool cancelTimer(EzTimerID id){
+        uint32_t index = (uint32_t)id;
+        uint32_t generation = (uint32_t)(id >> 32);
+        if(index < SENTINEL_COUNT || index >= m_nodes.size()){
+            return false;
+        }
+        Node& node = m_nodes[index];
+        if(!node.m_active || node.m_generation != generation){
+            return false;
+        }
+        unlink(index);
+        release(index);
         return true;
     }
+
+    /**
+     * @brief 执行所有到期的定时器
+     */
     void checkTimer(){
-        for(auto& t: m_timers){
-            t.execute();
+        uint64_t nowMs = deps::GetMonoTimeMs();
+        while(m_nextTick <= nowMs){
+            uint32_t slot = m_nextTick & WHEEL_MASK;
+            //低层转完一圈，把高层对应槽的定时器重新分配到低层
+            if(slot == 0){
+                for(int level = 1; level < WHEEL_LEVELS; ++level){
+                    uint32_t index = (m_nextTick >> (level * WHEEL_BITS)) & WHEEL_MASK;
+                    cascade(level * WHEEL_SIZE + index);
+                    if(index != 0){
+                        break;
+                    }
+                }
+            }
+            ++m_nextTick;
+
+            //先把整个槽摘到执行链表上，回调里新加的定时器不会在这一轮执行
+            moveAll(slot, RUNNING_LIST);
+            while(m_nodes[RUNNING_LIST].m_next != RUNNING_LIST){
+                uint32_t index = m_nodes[RUNNING_LIST].m_next;
+                unlink(index);
+                Node& node = m_nodes[index];
+                //回调里可能添加定时器导致节点数组扩容，回调先换出来，执行完再换回去
+                std::function<void()> callback;
+                callback.swap(node.m_callback);
+                uint32_t generation = node.m_generation;
+                bool periodic = node.m_period > 0;
+                if(periodic){
+                    node.m_expire = nowMs + node.m_period;
+                    insert(index);
+                }
+                else{
+                    release(index);
+                }
+                callback();
+                //周期定时器可能在自己的回调里被取消
+                if(periodic && m_nodes[index].m_active && m_nodes[index].m_generation == generation){
+                    m_nodes[index].m_callback.swap(callback);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief 距离下一个定时器到期的毫秒数，没有定时器时返回maxTimeout
+     */
+    int nextTimeout(int maxTimeout){
+        uint64_t nowMs = deps::GetMonoTimeMs();
+        uint64_t deadline = 0;
+        bool found = false;
+        uint64_t tick = m_nextTick;
+        for(int level = 0; level < WHEEL_LEVELS; ++level){
+            if(m_bitmaps[level] == 0){
+                continue;
+            }
+            int shift = level * WHEEL_BITS;
+            //第level层的槽只会在tick是(1<<shift)整数倍的时候处理
+            uint64_t boundary = ((tick + ((uint64_t)1 << shift) - 1) >> shift) << shift;
+            uint32_t start = (boundary >> shift) & WHEEL_MASK;
+            uint64_t rotated = (m_bitmaps[level] >> start) | (start > 0 ? m_bitmaps[level] << (WHEEL_SIZE - start) : 0);
+            uint64_t candidate = boundary + ((uint64_t)__builtin_ctzll(rotated) << shift);
+            if(!found || candidate < deadline){
+                deadline = candidate;
+                found = true;
+            }
+        }
+        if(!found){
+            return maxTimeout;
+        }
+        if(deadline <= nowMs){
+            return 0;
+        }
+        return deadline - nowMs < (uint64_t)maxTimeout ? (int)(deadline - nowMs) : maxTimeout;
+    }
+
+    size_t size() const{
+        return m_size;
+    }
+private:
+    enum{
+        WHEEL_BITS = 6,
+        WHEEL_SIZE = 1 << WHEEL_BITS,
+        WHEEL_MASK = WHEEL_SIZE - 1,
+        WHEEL_LEVELS = 4,
+        RUNNING_LIST = WHEEL_SIZE * WHEEL_LEVELS,
+        SENTINEL_COUNT = RUNNING_LIST + 1,
+    };
+
+    struct Node{
+        Node():m_prev(0), m_next(0), m_list(0), m_generation(0), m_active(false), m_expire(0), m_period(0){}
+        uint32_t m_prev;
+        uint32_t m_next;
+        //所在的链表头
+        uint32_t m_list;
+        uint32_t m_generation;
+        bool m_active;
+        //到期时间，单位毫秒
+        uint64_t m_expire;
+        //周期，单位毫秒，为0表示单次定时器
+        uint64_t m_period;
+        std::function<void()> m_callback;
+    };
+
+    EzTimerID add(uint64_t expire, uint64_t period, std::function<void()>& callback){
+        uint32_t index;
+        if(!m_freeNodes.empty()){
+            index = m_freeNodes.back();
+            m_freeNodes.pop_back();
+        }
+        else{
+            index = m_nodes.size();
+            m_nodes.push_back(Node());
+        }
+        Node& node = m_nodes[index];
+        node.m_active = true;
+        node.m_expire = expire;
+        node.m_period = period;
+        node.m_callback.swap(callback);
+        insert(index);
+        ++m_size;
+        return ((EzTimerID)node.m_generation << 32) | index;
+    }
+
+    void release(uint32_t index){
+        Node& node = m_nodes[index];
+        node.m_active = false;
+        ++node.m_generation;
+        node.m_callback = nullptr;
+        m_freeNodes.push_back(index);
+        --m_size;
+    }
+
+    //按照距离到期的时间选择层和槽
+    void insert(uint32_t index){
+        uint64_t expire = m_nodes[index].m_expire;
+        if(expire < m_nextTick){
+            expire = m_nextTick;
+        }
+        uint64_t delta = expire - m_nextTick;
+        int level = 0;
+        while(level < WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << ((level + 1) * WHEEL_BITS))){
+            ++level;
+        }
+        uint64_t maxDelta = ((uint64_t)1 << (WHEEL_LEVELS * WHEEL_BITS)) - 1;
+        if(delta > maxDelta){
+            expire = m_nextTick + maxDelta;
+        }
+        uint32_t slot = (expire >> (level * WHEEL_BITS)) & WHEEL_MASK;
+        linkTail(level * WHEEL_SIZE + slot, index);
+    }
+
+    void cascade(uint32_t list){
+        moveAll(list, RUNNING_LIST);
+        while(m_nodes[RUNNING_LIST].m_next != RUNNING_LIST){
+            uint32_t index = m_nodes[RUNNING_LIST].m_next;
+            unlink(index);
+            insert(index);
+        }
+    }
+
+    void linkTail(uint32_t list, uint32_t index){
+        Node& node = m_nodes[index];
+        Node& head = m_nodes[list];
+        node.m_list = list;
+        node.m_prev = head.m_prev;
+        node.m_next = list;
+        m_nodes[head.m_prev].m_next = index;
+        head.m_prev = index;
+        if(list < RUNNING_LIST){
+            m_bitmaps[list / WHEEL_SIZE] |= (uint64_t)1 << (list % WHEEL_SIZE);
+        }
+    }
+
+    void unlink(uint32_t index){
+        Node& node = m_nodes[index];
+        m_nodes[node.m_prev].m_next = node.m_next;
+        m_nodes[node.m_next].m_prev = node.m_prev;
+        uint32_t list = node.m_list;
+        node.m_prev = node.m_next = index;
+        if(list < RUNNING_LIST && m_nodes[list].m_next == list){
+            m_bitmaps[list / WHEEL_SIZE] &= ~((uint64_t)1 << (list % WHEEL_SIZE));
+        }
+    }
+
+    //把from链表整个接到to链表尾部
+    void moveAll(uint32_t from, uint32_t to){
+        while(m_nodes[from].m_next != from){
+            uint32_t index = m_nodes[from].m_next;
+            unlink(index);
+            linkTail(to, index);
         }
     }
 private:
-    std::vector<EzTimer> m_timers;
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_freeNodes;
+    uint64_t m_bitmaps[WHEEL_LEVELS];
+    //下一个要处理的tick，单位毫秒
+    uint64_t m_nextTick;
+    size_t m_size;
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,987 @@
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "group.h"
+#include "server.h"
+#include "kv/kv_state_machine.h"
+#include "paxos/wide_codec.h"
+
+PaxosGroup::PaxosGroup(Server& server, uint16_t groupID, StateMachine& stateMachine, NodeID myNodeID,
+	const Membership& membership, size_t acceptWindow, size_t batchCount, size_t benchLoad, 
+	uint64_t snapshotInterval, size_t payloadThreshold):
+	m_server(server),
+	m_groupID(groupID),
+	m_paxosNode(*this, myNodeID, membership, 10000, 100000, 50000, 80000, acceptWindow, batchCount, 16384, 1000, INVALID_NODE_ID),
+	m_stateMachine(stateMachine)
+{
+	m_lastSyncCount = 0;
+	m_appliedInstanceID = 0;
+	m_appliedCommands = 0;
+	m_applyCostUs = 0;
+	m_lastAppliedCommands = 0;
+	m_lastApplyCostUs = 0;
+	m_snapshotInterval = snapshotInterval;
+	m_lastDumpTimestamp = deps::GetMonoTimeMs();
+	m_benchLoad = benchLoad;
+	m_pollBatchTimer = 0;
+	m_nextAcceptInstanceID = 0;
+	m_lastRelayUID = INVALID_NODE_ID;
+	m_paxosNode.setPayloadThreshold(payloadThreshold);
+}
+
+PaxosGroup::~PaxosGroup(){}
+
+bool PaxosGroup::Init(const std::string& dataDir, const std::string& myUID){
+	std::string suffix = myUID + "_" + std::to_string(m_groupID);
+
+	//先加载状态机快照，再用预写日志恢复快照之后的Acceptor状态，重启时间只和快照大小以及日志尾部有关
+	uint64_t snapshotInstanceID = 0;
+	m_snapshotter.open(dataDir + "/snapshot_" + suffix + ".snap");
+	if(!m_snapshotter.load(m_stateMachine, snapshotInstanceID)){
+		return false;
+	}
+	m_appliedInstanceID = snapshotInstanceID;
+
+	//快照之后生效的配置以保存的为准，命令行只是第一次启动时的初始配置
+	m_membershipPath = dataDir + "/membership_" + suffix + ".conf";
+	if(!loadMembership()){
+		return false;
+	}
+
+	//恢复Acceptor状态
+	std::string logPath = dataDir + "/acceptor_" + suffix + ".wal";
+	if(!m_acceptorLog.open(logPath)){
+		return false;
+	}
+	ProposalID promisedID;
+	std::vector<PaxosInstance> acceptedInstances;
+	uint64_t truncatedInstanceID = 0;
+	if(!m_acceptorLog.recover(promisedID, acceptedInstances, truncatedInstanceID)){
+		return false;
+	}
+	//快照先于日志截断落盘，截断位置不会超过快照；超过时说明快照文件丢了，先向别的节点要快照
+	if(truncatedInstanceID > snapshotInstanceID){
+		LOG_ERROR("group:%u acceptor log truncated at instance:%llu beyond snapshot instance:%llu", m_groupID,
+			truncatedInstanceID, snapshotInstanceID);
+	}
+	m_paxosNode.recover(promisedID, acceptedInstances, truncatedInstanceID);
+	m_paxosNode.truncate(snapshotInstanceID);
+
+	EzTimerManager& timerManager = m_server.GetTimerManager();
+	timerManager.addTimer(10, std::bind(&PaxosNode::pulse, &m_paxosNode));
+	timerManager.addTimer(100, std::bind(&PaxosNode::pollLiveness, &m_paxosNode));
+	timerManager.addTimer(100, std::bind(&PaxosGroup::checkSnapshot, this));
+	if(m_benchLoad > 0){
+		timerManager.addTimer(1, std::bind(&PaxosGroup::generateLoad, this));
+	}
+	return true;
+}
+
+uint16_t PaxosGroup::getGroupID() const{
+	return m_groupID;
+}
+
+PaxosNode& PaxosGroup::getPaxosNode(){
+	return m_paxosNode;
+}
+
+/**
+ * @brief 按照key的哈希选择分组。用FNV-1a而不是std::hash，不同机器和不同编译器上结果一致
+*/
+uint16_t PaxosGroup::route(const std::string& key, size_t groupCount){
+	uint64_t h = 14695981039346656037ULL;
+	for(size_t i = 0; i < key.size(); ++i){
+		h ^= (uint8_t)key[i];
+		h *= 1099511628211ULL;
+	}
+	return groupCount > 0 ? h % groupCount : 0;
+}
+
+/**
+ * @brief 打印分组状态，同时把分组的统计追加到json里，由Server的统计定时器调用
+*/
+void PaxosGroup::dumpStatus(JsonWriter& json){
+	bool isLeader = m_paxosNode.isLeader();
+	LOG_INFO("group:%u proposalid:%s isLeader:%d leader node:%u proposalid:%s",
+		m_groupID, m_paxosNode.getMyProposalID().toString().c_str(), isLeader,
+		m_paxosNode.getLeaderUID(), m_paxosNode.getLeaderProposalID().toString().c_str());
+
+	uint64_t syncCount = m_acceptorLog.getSyncCount();
+	LOG_INFO("group:%u acceptor log syncs:%llu records:%llu syncs in last period:%llu", m_groupID,
+		syncCount, m_acceptorLog.getRecordCount(), syncCount - m_lastSyncCount);
+	m_lastSyncCount = syncCount;
+
+	//本地议题的提交吞吐和各阶段延迟分布
+	uint64_t now = deps::GetMonoTimeMs();
+	uint64_t period = now > m_lastDumpTimestamp ? now - m_lastDumpTimestamp : 1;
+	m_lastDumpTimestamp = now;
+	LatencyHistogram prepareLatency, acceptLatency, commitLatency;
+	m_paxosNode.takeLatencies(prepareLatency, acceptLatency, commitLatency);
+	LOG_INFO("group:%u accept window:%zd inflight:%zd pending:%zd batched:%zd commit instance:%llu commits/s:%llu",
+		m_groupID, m_paxosNode.getAcceptWindow(), m_paxosNode.numInflightProposals(),
+		m_paxosNode.numPendingProposals(), m_paxosNode.numBatchedProposals(),
+		m_paxosNode.getCommitInstanceID(), commitLatency.count() * 1000 / period);
+	LOG_INFO("group:%u prepare p50:%lluus p99:%lluus accept p50:%lluus p99:%lluus p999:%lluus "
+		"commit p50:%lluus p99:%lluus p999:%lluus", m_groupID,
+		prepareLatency.percentile(50), prepareLatency.percentile(99),
+		acceptLatency.percentile(50), acceptLatency.percentile(99), acceptLatency.percentile(99.9),
+		commitLatency.percentile(50), commitLatency.percentile(99), commitLatency.percentile(99.9));
+
+	//状态机执行吞吐，和共识吞吐分开统计
+	uint64_t applied = m_appliedCommands - m_lastAppliedCommands;
+	uint64_t applyCost = m_applyCostUs - m_lastApplyCostUs;
+	m_lastAppliedCommands = m_appliedCommands;
+	m_lastApplyCostUs = m_applyCostUs;
+	LOG_INFO("group:%u applied instance:%llu commands/s:%llu apply cost:%llums ops/s while applying:%llu",
+		m_groupID, m_appliedInstanceID, applied * 1000 / period, applyCost / 1000,
+		applyCost > 0 ? applied * 1000000 / applyCost : 0);
+	uint64_t staleness = m_paxosNode.getReadStaleness();
+	LOG_INFO("group:%u lease held:%d remaining:%lluus pending reads:%zd observer:%d read staleness:%lldus", m_groupID, 
+		m_paxosNode.hasLease(), m_paxosNode.getLeaseRemaining(), m_paxosNode.numPendingReads(), 
+		m_paxosNode.isObserver(), staleness == UINT64_MAX ? -1LL : (long long)staleness);
+	LOG_INFO("group:%u payloads:%zd bytes:%llu", m_groupID, m_paxosNode.numPayloads(), m_paxosNode.getPayloadBytes());
+	const MembershipSchedule& memberships = m_paxosNode.getMemberships();
+	LOG_INFO("group:%u membership:%s from instance:%llu", m_groupID, memberships.latest().toString().c_str(),
+		memberships.getLatestStart());
+	LOG_INFO("group:%u snapshot instance:%llu size:%llu running:%d acceptor log size:%llu", m_groupID,
+		m_snapshotter.getSnapshotInstanceID(), m_snapshotter.getSnapshotSize(),
+		m_snapshotter.isRunning(), m_acceptorLog.getFileSize());
+
+	json.beginObject();
+	json.field("group", m_groupID);
+	json.field("leader", isLeader);
+	json.field("leader_node", m_paxosNode.getLeaderUID());
+	json.field("commit_instance", m_paxosNode.getCommitInstanceID());
+	json.field("applied_instance", m_appliedInstanceID);
+	json.field("inflight", m_paxosNode.numInflightProposals());
+	json.field("pending", m_paxosNode.numPendingProposals());
+	json.field("batched", m_paxosNode.numBatchedProposals());
+	json.field("pending_reads", m_paxosNode.numPendingReads());
+	json.field("observer", m_paxosNode.isObserver());
+	//不知道落后多少时不输出
+	if(staleness != UINT64_MAX){
+		json.field("read_staleness_us", staleness);
+	}
+	json.field("payloads", m_paxosNode.numPayloads());
+	json.field("payload_bytes", m_paxosNode.getPayloadBytes());
+	json.field("membership", memberships.latest().toString());
+	json.field("membership_start", memberships.getLatestStart());
+	json.field("commits_per_sec", commitLatency.count() * 1000 / period);
+	json.field("applied_per_sec", applied * 1000 / period);
+	json.field("syncs", syncCount);
+	json.histogram("prepare_us", prepareLatency);
+	json.histogram("accept_us", acceptLatency);
+	json.histogram("commit_us", commitLatency);
+	json.endObject();
+}
+
+/**
+ * @brief 状态机每执行m_snapshotInterval个实例写一次快照，快照在子进程里写，不阻塞事件循环。
+ * 	快照完成以后截断Acceptor和Learner里快照之前的实例，并且压缩预写日志，内存和磁盘不会无限增长。
+*/
+void PaxosGroup::checkSnapshot(){
+	uint64_t instanceID = 0;
+	if(m_snapshotter.poll(instanceID)){
+		truncateLog(instanceID);
+		return;
+	}
+
+	if(m_snapshotInterval > 0 && !m_snapshotter.isRunning() &&
+		m_appliedInstanceID >= m_snapshotter.getSnapshotInstanceID() + m_snapshotInterval){
+		m_snapshotter.start(m_stateMachine, m_appliedInstanceID);
+	}
+}
+
+void PaxosGroup::truncateLog(uint64_t instanceID){
+	//先把还没有落盘的状态写掉，压缩时日志里不会丢掉任何批准
+	persistAcceptor();
+	m_paxosNode.truncate(instanceID);
+
+	ProposalID promisedID;
+	std::vector<PaxosInstance> acceptedInstances;
+	uint64_t truncatedInstanceID = 0;
+	m_paxosNode.getAcceptorState(promisedID, acceptedInstances, truncatedInstanceID);
+	m_acceptorLog.compact(promisedID, acceptedInstances, truncatedInstanceID);
+}
+
+/**
+ * @brief 装载落后时请求来的快照：快照和配置都比本地新时才装载，快照落盘并且替换状态机以后，
+ * 	和自己写完快照一样截断日志，Learner从快照点开始继续学习
+*/
+void PaxosGroup::installSnapshot(NodeID fromUID, const SnapshotMessage& msg){
+	if(msg.m_instanceID <= m_appliedInstanceID || msg.m_memberships.empty() ||
+		msg.m_membershipStarts.size() != msg.m_memberships.size()){
+		return;
+	}
+	uint64_t instanceID = 0;
+	if(!m_snapshotter.install(m_stateMachine, msg.m_data, instanceID) || instanceID != msg.m_instanceID){
+		LOG_ERROR("group:%u install snapshot instance:%llu from node:%u failed", m_groupID, msg.m_instanceID, fromUID);
+		return;
+	}
+	LOG_INFO("group:%u install snapshot instance:%llu from node:%u applied instance:%llu", m_groupID, instanceID,
+		fromUID, m_appliedInstanceID);
+	m_appliedInstanceID = instanceID;
+	m_paxosNode.installSnapshot(instanceID, msg.m_membershipStarts, msg.m_memberships);
+	saveMembership();
+	truncateLog(instanceID);
+}
+
+/**
+ * @brief 压测：leader保持m_benchLoad个还没有达成一致的议题(闭环压测)
+*/
+void PaxosGroup::generateLoad(){
+	if(!m_paxosNode.isLeader()){
+		return;
+	}
+	static const std::string value(64, 'x');
+	std::string command;
+	for(size_t i = m_paxosNode.numPendingProposals(); i < m_benchLoad; ++i){
+		KvStateMachine::encodePut("bench_" + std::to_string(random() % 100000), value, command);
+		m_paxosNode.propose(command);
+	}
+	schedulePollBatch();
+}
+
+/**
+ * @brief 有命令在攒批时挂一个单次定时器，空闲时不需要每毫秒醒来检查攒批
+*/
+void PaxosGroup::schedulePollBatch(){
+	if(m_pollBatchTimer != 0 || m_paxosNode.numBatchedProposals() == 0){
+		return;
+	}
+	m_pollBatchTimer = m_server.GetTimerManager().addOnceTimer(1, std::bind(&PaxosGroup::onPollBatchTimer, this));
+}
+
+void PaxosGroup::onPollBatchTimer(){
+	m_pollBatchTimer = 0;
+	m_paxosNode.pollBatch();
+	schedulePollBatch();
+}
+
+/**
+ * @brief 同一个实例再次挂定时器时先取消旧的，定时器的精度是毫秒，不足1ms按1ms算
+*/
+void PaxosGroup::scheduleResend(uint64_t instanceID, uint64_t delayUs){
+	EzTimerManager& timerManager = m_server.GetTimerManager();
+	auto itr = m_resendTimers.find(instanceID);
+	if(itr != m_resendTimers.end()){
+		timerManager.cancelTimer(itr->second);
+	}
+	m_resendTimers[instanceID] = timerManager.addOnceTimer((delayUs + 999) / 1000, 
+		std::bind(&PaxosGroup::onResendTimer, this, instanceID));
+}
+
+void PaxosGroup::cancelResend(uint64_t instanceID){
+	auto itr = m_resendTimers.find(instanceID);
+	if(itr != m_resendTimers.end()){
+		m_server.GetTimerManager().cancelTimer(itr->second);
+		m_resendTimers.erase(itr);
+	}
+}
+
+void PaxosGroup::onResendTimer(uint64_t instanceID){
+	m_resendTimers.erase(instanceID);
+	m_paxosNode.resendAccept(instanceID);
+}
+
+/**
+ * @brief 一次事件循环里积攒的所有承诺和批准一起写入预写日志，只fsync一次，落盘以后再发送Promise/Permit
+*/
+void PaxosGroup::persistAcceptor(){
+	if(!m_paxosNode.persistenceRequired()){
+		return;
+	}
+
+	ProposalID promisedID;
+	std::vector<PaxosInstance> acceptedInstances;
+	m_paxosNode.getPendingPersistence(promisedID, acceptedInstances);
+	if(!m_acceptorLog.append(promisedID, acceptedInstances)){
+		//没有落盘不能发出承诺，写了一半的记录已经截掉，留到下一次事件循环重试；fsync失败时进程已经退出
+		LOG_ERROR("group:%u persist acceptor promisedid:%s instances:%zd failed",
+			m_groupID, promisedID.toString().c_str(), acceptedInstances.size());
+		return;
+	}
+	m_paxosNode.persisted();
+}
+
+/**
+ * @brief 处理发给本机的消息，处理过程中新产生的本地消息留到下一次，事件循环不阻塞等待
+*/
+void PaxosGroup::pollLocal(){
+	std::deque<std::function<void()>> messages;
+	messages.swap(m_localMessages);
+	for(auto& message : messages){
+		message();
+	}
+}
+
+bool PaxosGroup::hasLocalMessages() const{
+	return !m_localMessages.empty();
+}
+
+bool PaxosGroup::takeLocalAcceptor(std::set<NodeID>& acceptors){
+	return acceptors.erase(m_server.GetMyNodeID()) > 0;
+}
+
+void PaxosGroup::pollCommit(){
+	m_paxosNode.pollCommit();
+}
+
+void PaxosGroup::pollReads(){
+	m_paxosNode.pollReads();
+}
+
+/**
+ * @brief 提交一个议题到复制日志，只有leader会真正发起accept请求，其他节点会先缓存下来
+*/
+void PaxosGroup::Propose(const std::string& value){
+	m_paxosNode.propose(value);
+	schedulePollBatch();
+}
+
+/**
+ * @brief 成员变更作为一个命令写进复制日志，所有节点在同一个实例上应用。
+ * 	leader先检查一遍新旧配置的quorum是否相交，不相交的变更即使写进日志也会被所有节点忽略
+*/
+bool PaxosGroup::ProposeMembership(const Membership& membership){
+	if(!m_paxosNode.isLeader()){
+		NodeID leaderUID = m_paxosNode.getLeaderUID();
+		if(leaderUID == INVALID_NODE_ID || leaderUID == m_server.GetMyNodeID()){
+			LOG_ERROR("group:%u membership:%s no leader", m_groupID, membership.toString().c_str());
+			return false;
+		}
+		MembershipChangeMessage change;
+		change.m_from = m_server.GetMyNodeID();
+		change.m_groupID = m_groupID;
+		change.m_membership = membership;
+		m_server.SendMessageToNode(MembershipChangeMessage::cmd, change, leaderUID);
+		return true;
+	}
+
+	const Membership& latest = m_paxosNode.getMemberships().latest();
+	if(!latest.canChangeTo(membership)){
+		LOG_ERROR("group:%u membership %s -> %s rejected, quorums may not intersect", m_groupID,
+			latest.toString().c_str(), membership.toString().c_str());
+		return false;
+	}
+	std::string command;
+	Membership::encodeCommand(membership, command);
+	Propose(command);
+	return true;
+}
+
+/**
+ * @brief leader持有租约时直接读本地状态机，不需要网络往返。没有租约时返回false，需要走共识读
+*/
+bool PaxosGroup::LeaseRead(const std::string& query, std::string& result){
+	if(!m_paxosNode.hasLease()){
+		return false;
+	}
+	m_stateMachine.read(query, result);
+	return true;
+}
+
+/**
+ * @brief 没有租约时的线性一致读：确认自己还是leader并且状态机执行到读请求到达时的提交位置以后读本地状态机，
+ * 	同一轮心跳确认期间到达的读请求共用一轮确认。leader身份确认失败时回调的第一个参数为false，需要重试
+*/
+bool PaxosGroup::ReadIndex(const std::string& query, const std::function<void(bool, const std::string&)>& callback){
+	StateMachine& stateMachine = m_stateMachine;
+	return m_paxosNode.readIndex([&stateMachine, query, callback](bool confirmed){
+		std::string result;
+		if(confirmed){
+			stateMachine.read(query, result);
+		}
+		callback(confirmed, result);
+	});
+}
+
+/**
+ * @brief 本地状态机执行到了leader在maxStalenessUs微秒之前通告的提交位置时直接读，不经过网络。
+ * 	读到的可能不是最新的值，但是不会早于这个时间界限；不知道落后多少时返回false
+*/
+bool PaxosGroup::StaleRead(const std::string& query, uint64_t maxStalenessUs, std::string& result){
+	if(m_paxosNode.getReadStaleness() > maxStalenessUs){
+		return false;
+	}
+	m_stateMachine.read(query, result);
+	return true;
+}
+
+/**
+ * @brief 发送prepare请求
+ *
+ * @param proposalID
+ */
+void PaxosGroup::sendPrepare(const ProposalID& proposalID, uint64_t instanceID){
+	//prepare重试之前停顿的Acceptor已经被换掉了，不用特别处理。
+	//起始实例之后还可能有没生效的新配置，每个配置里都要选够Q1个
+	std::vector<const Membership*> memberships;
+	m_paxosNode.getMemberships().getMemberships(instanceID, memberships);
+	m_majorityAcceptors.clear();
+	for(auto membership : memberships){
+		std::set<NodeID> acceptors;
+		m_server.SelectMajorityAcceptors(acceptors, *membership, membership->getPrepareQuorumSize(), false);
+		if(acceptors.empty()){
+			LOG_ERROR("group:%u membership:%s choosen acceptors failed", m_groupID, membership->toString().c_str());
+			return;
+		}
+		m_majorityAcceptors.insert(acceptors.begin(), acceptors.end());
+	}
+	PrepareMessage prepare;
+	prepare.m_proposalID = proposalID;
+	prepare.m_instanceID = instanceID;
+	prepare.m_from = m_server.GetMyNodeID();
+	prepare.m_groupID = m_groupID;
+
+	if(takeLocalAcceptor(m_majorityAcceptors)){
+		NodeID myNodeID = m_server.GetMyNodeID();
+		m_localMessages.push_back([this, myNodeID, proposalID, instanceID](){
+			m_paxosNode.receivePrepare(myNodeID, proposalID, instanceID);
+		});
+	}
+	m_server.SendMessageToNodes(PrepareMessage::cmd, prepare, m_majorityAcceptors);
+}
+
+/**
+ * @brief 发送prepare请求的承诺
+ *
+ * @param toUID
+ * @param proposalID
+ * @param instanceID
+ * @param acceptedInstances
+ */
+void PaxosGroup::sendPromise(NodeID toUID, const ProposalID& proposalID,
+	uint64_t instanceID, const std::vector<PaxosInstance>& acceptedInstances){
+	if(toUID == m_server.GetMyNodeID()){
+		m_localMessages.push_back([this, toUID, proposalID, instanceID, acceptedInstances](){
+			m_paxosNode.receivePromise(toUID, proposalID, instanceID, acceptedInstances);
+		});
+		return;
+	}
+	PromiseMessage promise;
+	promise.m_from = m_server.GetMyNodeID();
+	promise.m_groupID = m_groupID;
+	promise.m_proposalID = proposalID;
+	promise.m_instanceID = instanceID;
+	promise.m_acceptedInstances = acceptedInstances;
+
+	//放不进一个包的value拆成分片先发，Promise里对应的实例只带分片流编号
+	std::vector<PacketBuffer> packets;
+	size_t inlineBytes = 0;
+	for(size_t i = 0; i < promise.m_acceptedInstances.size(); ++i){
+		std::string& value = promise.m_acceptedInstances[i].m_acceptedValue;
+		if(WideCodec::fitsPacket(inlineBytes + value.size(), (i + 1) * 4)){
+			inlineBytes += value.size();
+			continue;
+		}
+		promise.m_valueStreamIDs.resize(promise.m_acceptedInstances.size(), 0);
+		promise.m_valueStreamIDs[i] = m_server.EncodeValueStream(m_groupID, value, packets);
+		value.clear();
+	}
+	if(packets.empty()){
+		m_server.SendMessageToNode(PromiseMessage::cmd, promise, toUID);
+		return;
+	}
+	packets.push_back(Server::EncodePacket(PromiseMessage::cmd, promise));
+	m_server.SendBulkToNode(packets, toUID);
+}
+
+/**
+ * @brief 发送accept请求
+ *
+ * @param proposalID
+ * @param instanceID
+ * @param proposalValue
+ * @param commitInstanceID leader已经确定的实例编号上界，Acceptor顺带学习
+ */
+void PaxosGroup::sendAccept(const ProposalID&  proposalID, uint64_t instanceID,
+	const std::string& proposalValue, uint64_t commitInstanceID){
+	//比已经发过的实例小说明是重发或者新leader恢复，发给所有Acceptor
+	bool resend = instanceID < m_nextAcceptInstanceID;
+	if(!resend){
+		m_nextAcceptInstanceID = instanceID + 1;
+	}
+	const Membership& membership = m_paxosNode.getMemberships().at(instanceID);
+	m_server.SelectMajorityAcceptors(m_majorityAcceptors, membership, membership.getAcceptQuorumSize(), resend);
+	if(m_majorityAcceptors.empty()){
+		LOG_ERROR("group:%u choosen acceptors failed", m_groupID);
+		return;
+	}
+	if(takeLocalAcceptor(m_majorityAcceptors)){
+		NodeID myNodeID = m_server.GetMyNodeID();
+		m_localMessages.push_back([this, myNodeID, proposalID, instanceID, proposalValue, commitInstanceID](){
+			m_paxosNode.receiveAcceptRequest(myNodeID, proposalID, instanceID, proposalValue);
+			m_paxosNode.receiveCommit(myNodeID, proposalID, commitInstanceID);
+		});
+		if(m_majorityAcceptors.empty()){
+			return;
+		}
+	}
+	AcceptMessage accept;
+	accept.m_from = m_server.GetMyNodeID();
+	accept.m_groupID = m_groupID;
+	accept.m_proposalID = proposalID;
+	accept.m_instanceID = instanceID;
+	accept.m_valueStreamID = 0;
+	accept.m_commitInstanceID = commitInstanceID;
+
+	//几MB的value拆成分片走批量发送队列，分片编码一次所有Acceptor共用
+	if(!WideCodec::fitsPacket(proposalValue.size(), 1)){
+		std::vector<PacketBuffer> packets;
+		accept.m_valueStreamID = m_server.EncodeValueStream(m_groupID, proposalValue, packets);
+		packets.push_back(Server::EncodePacket(AcceptMessage::cmd, accept));
+		m_server.SendBulkToNodes(packets, m_majorityAcceptors);
+		return;
+	}
+	accept.m_proposalValue = proposalValue;
+	m_server.SendMessageToNodes(AcceptMessage::cmd, accept, m_majorityAcceptors);
+}
+
+/**
+ * @brief 发送accept请求的批准
+ *
+ * @param proposerUID
+ * @param proposalID
+ * @param instanceID
+ * @param acceptedValue
+ */
+void PaxosGroup::sendPermit(NodeID proposerUID, const ProposalID&  proposalID,
+	uint64_t instanceID, const std::string& acceptedValue)
+{
+	if(proposerUID == m_server.GetMyNodeID()){
+		m_localMessages.push_back([this, proposerUID, proposalID, instanceID, acceptedValue](){
+			m_paxosNode.receivePermit(proposerUID, proposalID, instanceID, acceptedValue);
+		});
+		return;
+	}
+	PermitMessage premit;
+	premit.m_from = m_server.GetMyNodeID();
+	premit.m_groupID = m_groupID;
+	premit.m_proposalID = proposalID;
+	premit.m_instanceID = instanceID;
+	premit.m_valueStreamID = 0;
+
+	if(!WideCodec::fitsPacket(acceptedValue.size(), 1)){
+		std::vector<PacketBuffer> packets;
+		premit.m_valueStreamID = m_server.EncodeValueStream(m_groupID, acceptedValue, packets);
+		packets.push_back(Server::EncodePacket(PermitMessage::cmd, premit));
+		m_server.SendBulkToNode(packets, proposerUID);
+		return;
+	}
+	premit.m_acceptedValue = acceptedValue;
+	m_server.SendMessageToNode(PermitMessage::cmd, premit, proposerUID);
+}
+
+/**
+ * @brief 实例达成一致，解码攒批的命令交给状态机执行
+ *
+ * @param instanceID 实例编号
+ * @param proposalID 选定的协议编号
+ * @param value 选定的协议值
+ */
+void PaxosGroup::onResolution(uint64_t instanceID, const ProposalID&  proposalID,
+	const std::string& value)
+{
+	std::vector<std::string> commands;
+	if(!ProposalBatcher::decode(value, commands)){
+		LOG_ERROR("group:%u instance:%llu proposalid:%s decode batch failed", m_groupID, instanceID,
+			proposalID.toString().c_str());
+		return;
+	}
+	LOG_DEBUG("group:%u instance:%llu resolved proposalid:%s size:%zd commands:%zd", m_groupID, instanceID,
+		proposalID.toString().c_str(), value.size(), commands.size());
+
+	uint64_t start = deps::GetMonoTimeUs();
+	std::string result;
+	Membership membership;
+	for(auto& command : commands){
+		if(Membership::decodeCommand(command, membership)){
+			uint64_t latestStart = m_paxosNode.getMemberships().getLatestStart();
+			if(m_paxosNode.changeMembership(instanceID, membership) &&
+				m_paxosNode.getMemberships().getLatestStart() != latestStart){
+				saveMembership();
+			}
+			continue;
+		}
+		if(!m_stateMachine.apply(instanceID, command, result)){
+			LOG_ERROR("group:%u instance:%llu apply command size:%zd failed", m_groupID, instanceID, command.size());
+		}
+	}
+	m_applyCostUs += deps::GetMonoTimeUs() - start;
+	m_appliedCommands += commands.size();
+	m_appliedInstanceID = instanceID + 1;
+}
+
+/**
+ * @brief 保存最新的配置和生效的实例编号，一行文本：起始实例 Q1 Q2 Acceptor列表。先写临时文件再改名，
+ * 	中途崩溃时旧文件还是完整的
+*/
+bool PaxosGroup::saveMembership(){
+	const MembershipSchedule& memberships = m_paxosNode.getMemberships();
+	const Membership& latest = memberships.latest();
+	std::string tmpPath = m_membershipPath + ".tmp";
+	FILE* file = fopen(tmpPath.c_str(), "w");
+	if(file == nullptr){
+		LOG_ERROR("group:%u open %s failed (%s)", m_groupID, tmpPath.c_str(), strerror(errno));
+		return false;
+	}
+	fprintf(file, "%llu %u %u", (unsigned long long)memberships.getLatestStart(), latest.m_prepareQuorum,
+		latest.m_acceptQuorum);
+	for(auto nodeID : latest.m_acceptors){
+		fprintf(file, " %u", nodeID);
+	}
+	fprintf(file, "\n");
+	bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+	fclose(file);
+	if(!ok || rename(tmpPath.c_str(), m_membershipPath.c_str()) != 0){
+		LOG_ERROR("group:%u save membership to %s failed (%s)", m_groupID, m_membershipPath.c_str(), strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief 没有配置文件说明是第一次启动，使用构造时的初始配置
+*/
+bool PaxosGroup::loadMembership(){
+	FILE* file = fopen(m_membershipPath.c_str(), "r");
+	if(file == nullptr){
+		return errno == ENOENT;
+	}
+	unsigned long long startInstanceID = 0;
+	unsigned int prepareQuorum = 0, acceptQuorum = 0, nodeID = 0;
+	Membership membership;
+	bool ok = fscanf(file, "%llu %u %u", &startInstanceID, &prepareQuorum, &acceptQuorum) == 3;
+	while(ok && fscanf(file, "%u", &nodeID) == 1){
+		membership.m_acceptors.insert(nodeID);
+	}
+	fclose(file);
+	membership.m_prepareQuorum = prepareQuorum;
+	membership.m_acceptQuorum = acceptQuorum;
+	if(!ok || !membership.isValid()){
+		LOG_ERROR("group:%u invalid membership file %s", m_groupID, m_membershipPath.c_str());
+		return false;
+	}
+	m_paxosNode.restoreMembership(startInstanceID, membership);
+	LOG_INFO("group:%u restore membership:%s from instance:%llu", m_groupID, membership.toString().c_str(),
+		startInstanceID);
+	return true;
+}
+
+/**
+ * @brief 发送prepare请求的ack
+ *
+ * @param proposerUID
+ * @param proposalID
+ * @param promisedID
+ * @param truncatedInstanceID
+ */
+void PaxosGroup::sendPrepareNACK(NodeID proposerUID, const ProposalID& proposalID,
+	const ProposalID& promisedID, uint64_t truncatedInstanceID)
+{
+	if(proposerUID == m_server.GetMyNodeID()){
+		m_localMessages.push_back([this, proposerUID, proposalID, promisedID, truncatedInstanceID](){
+			m_paxosNode.receivePrepareNACK(proposerUID, proposalID, promisedID, truncatedInstanceID);
+		});
+		return;
+	}
+	PrepareAckMessage ack;
+	ack.m_from = m_server.GetMyNodeID();
+	ack.m_groupID = m_groupID;
+	ack.m_proposalID = proposalID;
+	ack.m_promiseID = promisedID;
+	ack.m_truncatedInstanceID = truncatedInstanceID;
+	m_server.SendMessageToNode(PrepareAckMessage::cmd, ack, proposerUID);
+}
+
+/**
+ * @brief 发送accept请求的ack
+ *
+ * @param proposerUID
+ * @param proposalID
+ * @param instanceID
+ * @param promisedID
+ * @param truncatedInstanceID
+ */
+void PaxosGroup::sendAcceptNACK(NodeID proposerUID, const ProposalID& proposalID,
+	uint64_t instanceID, const ProposalID& promisedID, uint64_t truncatedInstanceID)
+{
+	if(proposerUID == m_server.GetMyNodeID()){
+		m_localMessages.push_back([this, proposerUID, proposalID, instanceID, promisedID, truncatedInstanceID](){
+			m_paxosNode.receiveAcceptNACK(proposerUID, proposalID, instanceID, promisedID, truncatedInstanceID);
+		});
+		return;
+	}
+	AcceptAckMessage ack;
+	ack.m_from = m_server.GetMyNodeID();
+	ack.m_groupID = m_groupID;
+	ack.m_proposalID = proposalID;
+	ack.m_instanceID = instanceID;
+	ack.m_promiseID = promisedID;
+	ack.m_truncatedInstanceID = truncatedInstanceID;
+	m_server.SendMessageToNode(AcceptAckMessage::cmd, ack, proposerUID);
+}
+
+/**
+ * @brief 尝试获取leader
+*/
+void PaxosGroup::onLeadershipAcquired()
+{
+
+}
+
+/**
+ * @brief 丢失leader
+*/
+void PaxosGroup::onLeadershipLost()
+{
+
+}
+
+/**
+ * @brief leader变更
+*/
+void PaxosGroup::onLeadershipChange(NodeID previousLeaderUID, NodeID newLeaderUID)
+{
+
+}
+
+/**
+ * @brief 发送心跳
+*/
+void PaxosGroup::sendHeartbeat(NodeID leaderUID, const ProposalID& leaderProposalID,
+	uint64_t timestamp, uint64_t leaseDuration, uint64_t commitInstanceID)
+{
+	HeartbeatMessage heartbeat;
+	heartbeat.m_from = m_server.GetMyNodeID();
+	heartbeat.m_groupID = m_groupID;
+	heartbeat.m_leaderUID = leaderUID;
+	heartbeat.m_leaderProposalID = leaderProposalID;
+	heartbeat.m_timestamp = timestamp;
+	heartbeat.m_leaseDuration = leaseDuration;
+	heartbeat.m_commitInstanceID = commitInstanceID;
+	m_server.SendMessageToAllPeer(HeartbeatMessage::cmd, heartbeat);
+	LOG_DEBUG("group:%u send heartbeat message leader node:%u proposalid:%s",
+		m_groupID, leaderUID, leaderProposalID.toString().c_str());
+}
+
+/**
+ * @brief leader空闲时通知所有节点提交位置，包括不在配置里的节点
+*/
+void PaxosGroup::sendCommit(const ProposalID& proposalID, uint64_t commitInstanceID)
+{
+	CommitMessage commit;
+	commit.m_from = m_server.GetMyNodeID();
+	commit.m_groupID = m_groupID;
+	commit.m_proposalID = proposalID;
+	commit.m_commitInstanceID = commitInstanceID;
+	m_server.SendMessageToAllPeer(CommitMessage::cmd, commit);
+}
+
+/**
+ * @brief 把达成一致的实例推给观察者，toUID为INVALID_NODE_ID时发给所有不在最新配置里的节点。
+ * 	放不进一个包的value和Promise一样拆成分片先发
+*/
+void PaxosGroup::sendChosen(NodeID toUID, const ProposalID& proposalID,
+	const std::vector<PaxosInstance>& chosenInstances, uint64_t commitInstanceID)
+{
+	std::set<NodeID> observers;
+	if(toUID != INVALID_NODE_ID){
+		observers.insert(toUID);
+	}
+	else{
+		m_server.GetObservers(m_paxosNode.getMemberships().latest(), observers);
+	}
+	if(observers.empty()){
+		return;
+	}
+	ChosenMessage chosen;
+	chosen.m_from = m_server.GetMyNodeID();
+	chosen.m_groupID = m_groupID;
+	chosen.m_proposalID = proposalID;
+	chosen.m_commitInstanceID = commitInstanceID;
+	chosen.m_chosenInstances = chosenInstances;
+
+	std::vector<PacketBuffer> packets;
+	size_t inlineBytes = 0;
+	for(size_t i = 0; i < chosen.m_chosenInstances.size(); ++i){
+		std::string& value = chosen.m_chosenInstances[i].m_acceptedValue;
+		if(WideCodec::fitsPacket(inlineBytes + value.size(), (i + 1) * 4)){
+			inlineBytes += value.size();
+			continue;
+		}
+		chosen.m_valueStreamIDs.resize(chosen.m_chosenInstances.size(), 0);
+		chosen.m_valueStreamIDs[i] = m_server.EncodeValueStream(m_groupID, value, packets);
+		value.clear();
+	}
+	if(packets.empty()){
+		m_server.SendMessageToNodes(ChosenMessage::cmd, chosen, observers);
+		return;
+	}
+	packets.push_back(Server::EncodePacket(ChosenMessage::cmd, chosen));
+	m_server.SendBulkToNodes(packets, observers);
+}
+
+void PaxosGroup::sendLearnRequest(NodeID leaderUID, uint64_t fromInstanceID)
+{
+	if(leaderUID == INVALID_NODE_ID){
+		return;
+	}
+	LearnRequestMessage request;
+	request.m_from = m_server.GetMyNodeID();
+	request.m_groupID = m_groupID;
+	request.m_fromInstanceID = fromInstanceID;
+	m_server.SendMessageToNode(LearnRequestMessage::cmd, request, leaderUID);
+}
+
+/**
+ * @brief 分发时只发给一个节点并要求它转发，转发节点轮流选，leader的出口每个payload只发一份，
+ * 	转发的流量分摊到其他节点上
+*/
+void PaxosGroup::sendPayload(NodeID toUID, const std::string& digest, const std::string& payload)
+{
+	PayloadMessage msg;
+	msg.m_from = m_server.GetMyNodeID();
+	msg.m_groupID = m_groupID;
+	msg.m_relay = 0;
+	msg.m_digest = digest;
+	msg.m_valueStreamID = 0;
+
+	std::set<NodeID> nodes;
+	if(toUID != INVALID_NODE_ID){
+		nodes.insert(toUID);
+	}
+	else{
+		std::set<NodeID> others;
+		m_server.GetOtherNodes(others);
+		if(others.empty()){
+			return;
+		}
+		//跳过停顿的节点，转发节点挂了时其他节点要等请求payload超时
+		auto itr = others.upper_bound(m_lastRelayUID);
+		for(size_t i = 0; i < others.size(); ++i){
+			if(itr == others.end()){
+				itr = others.begin();
+			}
+			if(!m_server.IsNodeStalled(*itr)){
+				break;
+			}
+			++itr;
+		}
+		if(itr == others.end()){
+			itr = others.begin();
+		}
+		m_lastRelayUID = *itr;
+		nodes.insert(m_lastRelayUID);
+		msg.m_relay = others.size() > 1 ? 1 : 0;
+	}
+	sendPayloadToNodes(msg, payload, nodes);
+}
+
+void PaxosGroup::relayPayload(NodeID sourceUID, const std::string& digest, const std::string& payload)
+{
+	std::set<NodeID> nodes;
+	m_server.GetOtherNodes(nodes);
+	nodes.erase(sourceUID);
+	if(nodes.empty()){
+		return;
+	}
+	PayloadMessage msg;
+	msg.m_from = m_server.GetMyNodeID();
+	msg.m_groupID = m_groupID;
+	msg.m_relay = 0;
+	msg.m_digest = digest;
+	msg.m_valueStreamID = 0;
+	sendPayloadToNodes(msg, payload, nodes);
+}
+
+void PaxosGroup::sendPayloadToNodes(PayloadMessage& msg, const std::string& payload, const std::set<NodeID>& nodes)
+{
+	if(!WideCodec::fitsPacket(payload.size() + msg.m_digest.size(), 2)){
+		std::vector<PacketBuffer> packets;
+		msg.m_valueStreamID = m_server.EncodeValueStream(m_groupID, payload, packets);
+		packets.push_back(Server::EncodePacket(PayloadMessage::cmd, msg));
+		m_server.SendBulkToNodes(packets, nodes);
+		return;
+	}
+	msg.m_payload = payload;
+	m_server.SendMessageToNodes(PayloadMessage::cmd, msg, nodes);
+}
+
+void PaxosGroup::sendPayloadRequest(NodeID toUID, const std::string& digest)
+{
+	std::set<NodeID> nodes;
+	if(toUID != INVALID_NODE_ID){
+		nodes.insert(toUID);
+	}
+	else{
+		m_server.GetOtherNodes(nodes);
+	}
+	if(nodes.empty()){
+		return;
+	}
+	PayloadRequestMessage request;
+	request.m_from = m_server.GetMyNodeID();
+	request.m_groupID = m_groupID;
+	request.m_digest = digest;
+	m_server.SendMessageToNodes(PayloadRequestMessage::cmd, request, nodes);
+}
+
+void PaxosGroup::sendSnapshotRequest(NodeID toUID, uint64_t instanceID)
+{
+	SnapshotRequestMessage request;
+	request.m_from = m_server.GetMyNodeID();
+	request.m_groupID = m_groupID;
+	request.m_instanceID = instanceID;
+	m_server.SendMessageToNode(SnapshotRequestMessage::cmd, request, toUID);
+}
+
+/**
+ * @brief 发送最近一次完成的快照文件，快照不比请求方的提交位置新时不发，请求方会换别的节点或者等下一次快照。
+ * 	快照文件拆成分片走批量发送队列
+*/
+void PaxosGroup::sendSnapshot(NodeID toUID, uint64_t instanceID)
+{
+	if(m_snapshotter.getSnapshotInstanceID() <= instanceID){
+		LOG_INFO("group:%u snapshot instance:%llu not newer than node:%u instance:%llu", m_groupID,
+			m_snapshotter.getSnapshotInstanceID(), toUID, instanceID);
+		return;
+	}
+	SnapshotMessage msg;
+	msg.m_from = m_server.GetMyNodeID();
+	msg.m_groupID = m_groupID;
+	msg.m_valueStreamID = 0;
+	std::string content;
+	if(!m_snapshotter.read(content, msg.m_instanceID)){
+		return;
+	}
+	m_paxosNode.getSnapshotMemberships(msg.m_instanceID, msg.m_membershipStarts, msg.m_memberships);
+	LOG_INFO("group:%u send snapshot instance:%llu size:%zd to node:%u", m_groupID, msg.m_instanceID,
+		content.size(), toUID);
+
+	if(!WideCodec::fitsPacket(content.size(), 1)){
+		std::vector<PacketBuffer> packets;
+		msg.m_valueStreamID = m_server.EncodeValueStream(m_groupID, content, packets);
+		packets.push_back(Server::EncodePacket(SnapshotMessage::cmd, msg));
+		m_server.SendBulkToNode(packets, toUID);
+		return;
+	}
+	msg.m_data.swap(content);
+	m_server.SendMessageToNode(SnapshotMessage::cmd, msg, toUID);
+}
+
+/**
+ * @brief 授予leader租约
+*/
+void PaxosGroup::sendLeaseGrant(NodeID leaderUID, const ProposalID& leaderProposalID,
+	uint64_t timestamp)
+{
+	LeaseGrantMessage grant;
+	grant.m_from = m_server.GetMyNodeID();
+	grant.m_groupID = m_groupID;
+	grant.m_leaderProposalID = leaderProposalID;
+	grant.m_timestamp = timestamp;
+	m_server.SendMessageToNode(LeaseGrantMessage::cmd, grant, leaderUID);
+}
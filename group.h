@@ -0,0 +1,181 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <deque>
+#include <functional>
+
+#include "paxos/proto.h"
+#include "paxos/paxos_node.h"
+#include "paxos/messenger.h"
+#include "paxos/acceptor_log.h"
+#include "paxos/state_machine.h"
+#include "paxos/snapshot.h"
+
+#include "eztimer.h"
+#include "stats.h"
+
+class Server;
+
+/**
+ * @brief 一个独立的Paxos分组：自己的复制日志、Acceptor预写日志、快照和状态机。
+ * 	同一个事件循环上的所有分组共用Server的对端连接，消息里带分组编号区分。
+ */
+class PaxosGroup : public Messenger
+{
+public:
+	PaxosGroup(Server& server, uint16_t groupID, StateMachine& stateMachine, NodeID myNodeID,
+		const Membership& membership, size_t acceptWindow, size_t batchCount, size_t benchLoad, uint64_t snapshotInterval,
+		size_t payloadThreshold);
+	~PaxosGroup();
+
+	//加载快照和预写日志，注册定时器
+	bool Init(const std::string& dataDir, const std::string& myUID);
+	//提交一个议题到复制日志
+	void Propose(const std::string& value);
+	//通过复制日志变更Acceptor成员，不是leader时转发给leader
+	bool ProposeMembership(const Membership& membership);
+	//leader持有租约时直接读本地状态机
+	bool LeaseRead(const std::string& query, std::string& result);
+	//ReadIndex线性一致读，不写日志；不是leader时返回false
+	bool ReadIndex(const std::string& query, const std::function<void(bool, const std::string&)>& callback);
+	//有界陈旧读：本地状态落后leader不超过maxStalenessUs微秒时直接读本地状态机，观察者也可以读
+	bool StaleRead(const std::string& query, uint64_t maxStalenessUs, std::string& result);
+	//处理发给本机Acceptor和本机Proposer的消息
+	void pollLocal();
+	//还有没处理的本地消息时事件循环不能阻塞等待
+	bool hasLocalMessages() const;
+	//Acceptor状态落盘(group commit)
+	void persistAcceptor();
+	//事件循环结束时，空闲的leader把新的提交位置通知给其他节点
+	void pollCommit();
+	//事件循环结束时，这一轮到达的ReadIndex读请求合并成一轮心跳确认
+	void pollReads();
+	//装载别的节点发来的快照，本地提交位置落后于它的截断位置时用来追赶
+	void installSnapshot(NodeID fromUID, const SnapshotMessage& msg);
+	//打印状态并且把分组的统计追加到json
+	void dumpStatus(JsonWriter& json);
+
+	uint16_t getGroupID() const;
+	PaxosNode& getPaxosNode();
+
+	//按照key的哈希选择分组，所有节点上的结果一致
+	static uint16_t route(const std::string& key, size_t groupCount);
+
+    //发送prepare请求
+    virtual void sendPrepare(const ProposalID& proposalID, uint64_t instanceID);
+    //发送prepare请求的承诺
+    virtual void sendPromise(NodeID toUID, const ProposalID& proposalID,
+        uint64_t instanceID, const std::vector<PaxosInstance>& acceptedInstances);
+    //发送accept请求
+    virtual void sendAccept(const ProposalID&  proposalID, uint64_t instanceID,
+		const std::string& proposalValue, uint64_t commitInstanceID);
+    //发送accept请求的批准
+    virtual void sendPermit(NodeID proposerUID, const ProposalID&  proposalID,
+		uint64_t instanceID, const std::string& acceptedValue);
+    //解决
+    virtual void onResolution(uint64_t instanceID, const ProposalID&  proposalID,
+		const std::string& value);
+	//发送prepare请求的ack
+	virtual void sendPrepareNACK(NodeID proposerUID, const ProposalID& proposalID,
+		const ProposalID& promisedID, uint64_t truncatedInstanceID);
+	//发送accept请求的ack
+	virtual void sendAcceptNACK(NodeID proposerUID, const ProposalID& proposalID,
+		uint64_t instanceID, const ProposalID& promisedID, uint64_t truncatedInstanceID);
+	//尝试获取leader
+	virtual void onLeadershipAcquired();
+	//丢失主
+	virtual void onLeadershipLost();
+	//主变更
+	virtual void onLeadershipChange(NodeID previousLeaderUID, NodeID newLeaderUID);
+	//发送心跳
+	virtual void sendHeartbeat(NodeID leaderUID, const ProposalID& leaderProposalID,
+		uint64_t timestamp, uint64_t leaseDuration, uint64_t commitInstanceID);
+	//空闲时的提交通知
+	virtual void sendCommit(const ProposalID& proposalID, uint64_t commitInstanceID);
+	//授予leader租约
+	virtual void sendLeaseGrant(NodeID leaderUID, const ProposalID& leaderProposalID,
+		uint64_t timestamp);
+	//把达成一致的实例推给观察者
+	virtual void sendChosen(NodeID toUID, const ProposalID& proposalID,
+		const std::vector<PaxosInstance>& chosenInstances, uint64_t commitInstanceID);
+	//观察者向leader请求补发
+	virtual void sendLearnRequest(NodeID leaderUID, uint64_t fromInstanceID);
+	//分发、回复payload
+	virtual void sendPayload(NodeID toUID, const std::string& digest, const std::string& payload);
+	//把leader分发的payload转发给其余节点
+	virtual void relayPayload(NodeID sourceUID, const std::string& digest, const std::string& payload);
+	//请求payload
+	virtual void sendPayloadRequest(NodeID toUID, const std::string& digest);
+	//请求快照
+	virtual void sendSnapshotRequest(NodeID toUID, uint64_t instanceID);
+	//把本地快照发给落后的节点
+	virtual void sendSnapshot(NodeID toUID, uint64_t instanceID);
+	//每个还没有达成一致的实例一个单次重发定时器
+	virtual void scheduleResend(uint64_t instanceID, uint64_t delayUs);
+	virtual void cancelResend(uint64_t instanceID);
+private:
+	//压测：leader保持m_benchLoad个还没有达成一致的议题
+	void generateLoad();
+	//定时检查是否需要写快照，快照完成以后截断日志
+	void checkSnapshot();
+	//快照完成或者装载以后截断instanceID之前的实例并且压缩预写日志
+	void truncateLog(uint64_t instanceID);
+	//有命令在攒批时才挂一个单次定时器检查攒批延迟
+	void schedulePollBatch();
+	void onPollBatchTimer();
+	void onResendTimer(uint64_t instanceID);
+	//选中的Acceptor里有本机时摘出来在本地投递，返回是否有本机
+	bool takeLocalAcceptor(std::set<NodeID>& acceptors);
+	//成员变更生效以后写到文件里，重启时不用从头重放日志
+	bool saveMembership();
+	bool loadMembership();
+	//放不进一个包的payload拆成分片走批量发送队列
+	void sendPayloadToNodes(PayloadMessage& msg, const std::string& payload, const std::set<NodeID>& nodes);
+private:
+	//所在的事件循环
+	Server& m_server;
+	//分组编号
+	uint16_t m_groupID;
+	PaxosNode m_paxosNode;
+	//复制状态机
+	StateMachine& m_stateMachine;
+	//已经执行到的实例编号，小于它的实例都已经交给状态机执行
+	uint64_t m_appliedInstanceID;
+	//累计执行的命令数
+	uint64_t m_appliedCommands;
+	//累计执行命令的耗时，单位微秒
+	uint64_t m_applyCostUs;
+	//上次dumpStatus时执行的命令数和耗时
+	uint64_t m_lastAppliedCommands;
+	uint64_t m_lastApplyCostUs;
+	//状态机快照
+	Snapshotter m_snapshotter;
+	//每执行多少个实例写一次快照
+	uint64_t m_snapshotInterval;
+	//Acceptor预写日志
+	AcceptorLog m_acceptorLog;
+	//上次dumpStatus时的fsync次数
+	uint64_t m_lastSyncCount;
+	//上次dumpStatus的时间戳，单位毫秒
+	uint64_t m_lastDumpTimestamp;
+	//压测时保持的未完成议题个数，为0表示不压测
+	size_t m_benchLoad;
+	//检查攒批延迟的单次定时器，0表示没有挂定时器
+	EzTimerID m_pollBatchTimer;
+	//实例编号到它的accept重发定时器
+	std::map<uint64_t, EzTimerID> m_resendTimers;
+	//成员配置文件
+	std::string m_membershipPath;
+	//这次请求发给的Acceptors集合
+	std::set<NodeID> m_majorityAcceptors;
+	//发给本机Acceptor的prepare/accept和发给本机Proposer的回复，不经过网络，
+	//在事件循环里和收到的网络消息一样处理：本机的承诺和批准也要等同一次group commit落盘
+	std::deque<std::function<void()>> m_localMessages;
+	//已经发过accept请求的最大实例编号加1，用来区分重发
+	uint64_t m_nextAcceptInstanceID;
+	//上一个payload的转发节点，分发时轮流选
+	NodeID m_lastRelayUID;
+};
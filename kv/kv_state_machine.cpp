@@ -0,0 +1,238 @@
+#include "kv_state_machine.h"
+
+#include <string.h>
+#include <vector>
+
+#include "net/packet.h"
+#include "sys/log.h"
+#include "paxos/wide_codec.h"
+
+KvStateMachine::KvStateMachine():m_table(1024),m_appliedCount(0){}
+
+KvStateMachine::~KvStateMachine(){}
+
+/**
+ * @brief 执行一条命令。get返回value，put/delete/CAS返回"1"表示成功，"0"表示失败
+ * 
+ * @param instanceID 命令所在的实例编号
+ * @param command 编码后的KvCommand
+ * @param result 执行结果
+ */
+bool KvStateMachine::apply(uint64_t instanceID, const std::string& command, std::string& result)
+{
+	KvCommand cmd;
+	if (!decode(command, cmd))
+	{
+		LOG_ERROR("instance:%llu invalid kv command size:%zd", instanceID, command.size());
+		return false;
+	}
+
+	++m_appliedCount;
+	switch (cmd.m_op)
+	{
+		case KV_OP_PUT:
+			m_table.put(cmd.m_key, cmd.m_value);
+			result = "1";
+			break;
+		case KV_OP_GET:
+			if (!m_table.get(cmd.m_key, result))
+			{
+				result.clear();
+			}
+			break;
+		case KV_OP_DELETE:
+			result = m_table.remove(cmd.m_key) ? "1" : "0";
+			break;
+		case KV_OP_CAS:
+		{
+			std::string current;
+			if (m_table.get(cmd.m_key, current) && current == cmd.m_expected)
+			{
+				m_table.put(cmd.m_key, cmd.m_value);
+				result = "1";
+			}
+			else
+			{
+				result = "0";
+			}
+			break;
+		}
+		default:
+			LOG_ERROR("instance:%llu unknown kv op:%u", instanceID, cmd.m_op);
+			return false;
+	}
+	return true;
+}
+
+static bool writeString(SnapshotWriter& writer, const std::string& s)
+{
+	uint32_t len = s.size();
+	return writer.write(&len, sizeof(len)) && writer.write(s.data(), s.size());
+}
+
+static bool readString(const std::string& data, size_t& offset, std::string& s)
+{
+	uint32_t len = 0;
+	if (data.size() - offset < sizeof(len))
+	{
+		return false;
+	}
+	memcpy(&len, data.data() + offset, sizeof(len));
+	offset += sizeof(len);
+	if (data.size() - offset < len)
+	{
+		return false;
+	}
+	s.assign(data, offset, len);
+	offset += len;
+	return true;
+}
+
+/**
+ * @brief 快照格式：元素个数，然后依次是长度前缀的key和value。在写快照的子进程里执行，
+ * 	遍历哈希表和写出都不分配内存
+ */
+bool KvStateMachine::snapshot(SnapshotWriter& writer)
+{
+	uint64_t count = m_table.size();
+	bool ok = writer.write(&count, sizeof(count));
+	m_table.foreach([&writer, &ok](const std::string& key, const std::string& value){
+		ok = ok && writeString(writer, key) && writeString(writer, value);
+	});
+	return ok;
+}
+
+bool KvStateMachine::restore(const std::string& data)
+{
+	uint64_t count = 0;
+	if (data.size() < sizeof(count))
+	{
+		return false;
+	}
+	memcpy(&count, data.data(), sizeof(count));
+
+	m_table.clear();
+	size_t offset = sizeof(count);
+	std::string key, value;
+	for (uint64_t i = 0; i < count; ++i)
+	{
+		if (!readString(data, offset, key) || !readString(data, offset, value))
+		{
+			LOG_ERROR("kv snapshot broken at entry:%llu offset:%zd", i, offset);
+			m_table.clear();
+			return false;
+		}
+		m_table.put(key, value);
+	}
+	return true;
+}
+
+/**
+ * @brief 只读查询，query就是key
+ */
+bool KvStateMachine::read(const std::string& query, std::string& result)
+{
+	return m_table.get(query, result);
+}
+
+/**
+ * @brief 直接读本地状态，不经过共识
+ */
+bool KvStateMachine::get(const std::string& key, std::string& value) const
+{
+	return m_table.get(key, value);
+}
+
+size_t KvStateMachine::size() const
+{
+	return m_table.size();
+}
+
+uint64_t KvStateMachine::getAppliedCount() const
+{
+	return m_appliedCount;
+}
+
+void KvStateMachine::encodePut(const std::string& key, const std::string& value, std::string& command)
+{
+	KvCommand cmd;
+	cmd.m_op = KV_OP_PUT;
+	cmd.m_key = key;
+	cmd.m_value = value;
+	encode(cmd, command);
+}
+
+void KvStateMachine::encodeGet(const std::string& key, std::string& command)
+{
+	KvCommand cmd;
+	cmd.m_op = KV_OP_GET;
+	cmd.m_key = key;
+	encode(cmd, command);
+}
+
+void KvStateMachine::encodeDelete(const std::string& key, std::string& command)
+{
+	KvCommand cmd;
+	cmd.m_op = KV_OP_DELETE;
+	cmd.m_key = key;
+	encode(cmd, command);
+}
+
+void KvStateMachine::encodeCas(const std::string& key, const std::string& expected, 
+	const std::string& value, std::string& command)
+{
+	KvCommand cmd;
+	cmd.m_op = KV_OP_CAS;
+	cmd.m_key = key;
+	cmd.m_expected = expected;
+	cmd.m_value = value;
+	encode(cmd, command);
+}
+
+void KvStateMachine::encode(const KvCommand& cmd, std::string& command)
+{
+	//几MB的value超过deps包的长度上限，改用宽编码
+	if (!WideCodec::fitsPacket(cmd.m_key.size() + cmd.m_value.size() + cmd.m_expected.size() + 1, 4))
+	{
+		std::string op(1, (char)cmd.m_op);
+		std::vector<const std::string*> fields;
+		fields.push_back(&op);
+		fields.push_back(&cmd.m_key);
+		fields.push_back(&cmd.m_value);
+		fields.push_back(&cmd.m_expected);
+		WideCodec::encode(KV_COMMAND_WIDE_MAGIC, fields, command);
+		return;
+	}
+
+	deps::Encoder encoder;
+	encoder.serialize(KvCommand::cmd, cmd);
+	command.assign(encoder.data(), encoder.size());
+}
+
+bool KvStateMachine::decode(const std::string& command, KvCommand& cmd)
+{
+	if (WideCodec::isWide(command))
+	{
+		std::vector<std::string> fields;
+		if (!WideCodec::decode(command, KV_COMMAND_WIDE_MAGIC, fields) || fields.size() != 4 || fields[0].size() != 1)
+		{
+			return false;
+		}
+		cmd.m_op = (uint8_t)fields[0][0];
+		cmd.m_key.swap(fields[1]);
+		cmd.m_value.swap(fields[2]);
+		cmd.m_expected.swap(fields[3]);
+		return true;
+	}
+	if (command.size() < deps::Decoder::minSize() || 
+		deps::Decoder::pickLen(command.data()) != command.size() ||
+		deps::Decoder::pickSubCmd(command.data()) != KvCommand::cmd)
+	{
+		return false;
+	}
+
+	deps::PacketHeader header;
+	deps::Decoder decoder(command.data(), command.size());
+	decoder.deserialize(header, cmd);
+	return true;
+}
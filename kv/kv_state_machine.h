@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "net/marshall.h"
+#include "paxos/state_machine.h"
+#include "kv_table.h"
+
+enum{
+	KV_OP_PUT = 1,
+	KV_OP_GET,
+	KV_OP_DELETE,
+	KV_OP_CAS,
+};
+
+enum{
+	KV_PROTO_COMMAND = 1,
+};
+
+//value放不进deps包的命令用宽编码，魔数"KVCM"
+const uint32_t KV_COMMAND_WIDE_MAGIC = 0x4d43564b;
+
+/**
+ * @brief KV状态机的命令
+ * 
+ */
+struct KvCommand : public deps::Marshallable{
+	enum{cmd = KV_PROTO_COMMAND};
+	KvCommand():m_op(0){}
+	uint8_t m_op;
+	std::string m_key;
+	std::string m_value;
+	//CAS时期望的旧值
+	std::string m_expected;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_op << m_key << m_value << m_expected;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_op >> m_key >> m_value >> m_expected;
+	}
+};
+
+/**
+ * @brief 内存KV状态机，支持put/get/delete/CAS
+ * 
+ */
+class KvStateMachine : public StateMachine
+{
+public:
+	KvStateMachine();
+	virtual ~KvStateMachine();
+
+	virtual bool apply(uint64_t instanceID, const std::string& command, std::string& result);
+	virtual bool read(const std::string& query, std::string& result);
+	virtual bool snapshot(SnapshotWriter& writer);
+	virtual bool restore(const std::string& data);
+
+	bool get(const std::string& key, std::string& value) const;
+	size_t size() const;
+	uint64_t getAppliedCount() const;
+
+	static void encodePut(const std::string& key, const std::string& value, std::string& command);
+	static void encodeGet(const std::string& key, std::string& command);
+	static void encodeDelete(const std::string& key, std::string& command);
+	static void encodeCas(const std::string& key, const std::string& expected, 
+		const std::string& value, std::string& command);
+	static void encode(const KvCommand& cmd, std::string& command);
+	static bool decode(const std::string& command, KvCommand& cmd);
+private:
+	KvTable m_table;
+	//累计执行的命令数
+	uint64_t m_appliedCount;
+};
@@ -0,0 +1,141 @@
+#include "kv_table.h"
+
+#include <functional>
+
+KvTable::KvTable(size_t initCapacity):m_size(0),m_used(0)
+{
+	size_t capacity = 16;
+	while (capacity < initCapacity)
+	{
+		capacity <<= 1;
+	}
+	m_hashes.assign(capacity, EMPTY);
+	m_entries.resize(capacity);
+}
+
+KvTable::~KvTable(){}
+
+/**
+ * @brief 计算key的哈希值，保证不会和EMPTY、TOMBSTONE冲突
+ */
+uint64_t KvTable::hash(const std::string& key)
+{
+	uint64_t h = std::hash<std::string>()(key);
+	return h > TOMBSTONE ? h : h + 2;
+}
+
+/**
+ * @brief 查找key所在的槽位，找不到返回m_hashes.size()
+ */
+size_t KvTable::find(const std::string& key, uint64_t h) const
+{
+	size_t mask = m_hashes.size() - 1;
+	for (size_t i = h & mask; ; i = (i + 1) & mask)
+	{
+		uint64_t slot = m_hashes[i];
+		if (slot == EMPTY)
+		{
+			return m_hashes.size();
+		}
+		if (slot == h && m_entries[i].m_key == key)
+		{
+			return i;
+		}
+	}
+}
+
+bool KvTable::get(const std::string& key, std::string& value) const
+{
+	size_t i = find(key, hash(key));
+	if (i == m_hashes.size())
+	{
+		return false;
+	}
+	value = m_entries[i].m_value;
+	return true;
+}
+
+void KvTable::put(const std::string& key, const std::string& value)
+{
+	uint64_t h = hash(key);
+	size_t i = find(key, h);
+	if (i != m_hashes.size())
+	{
+		m_entries[i].m_value = value;
+		return;
+	}
+
+	//负载因子超过0.7扩容，墓碑太多时原地重建
+	if ((m_used + 1) * 10 > m_hashes.size() * 7)
+	{
+		rehash(m_size * 2 >= m_hashes.size() ? m_hashes.size() * 2 : m_hashes.size());
+	}
+
+	size_t mask = m_hashes.size() - 1;
+	for (i = h & mask; m_hashes[i] > TOMBSTONE; i = (i + 1) & mask);
+	if (m_hashes[i] == EMPTY)
+	{
+		++m_used;
+	}
+	m_hashes[i] = h;
+	m_entries[i].m_key = key;
+	m_entries[i].m_value = value;
+	++m_size;
+}
+
+bool KvTable::remove(const std::string& key)
+{
+	size_t i = find(key, hash(key));
+	if (i == m_hashes.size())
+	{
+		return false;
+	}
+	m_hashes[i] = TOMBSTONE;
+	std::string().swap(m_entries[i].m_key);
+	std::string().swap(m_entries[i].m_value);
+	--m_size;
+	return true;
+}
+
+size_t KvTable::size() const
+{
+	return m_size;
+}
+
+size_t KvTable::capacity() const
+{
+	return m_hashes.size();
+}
+
+void KvTable::clear()
+{
+	m_hashes.assign(m_hashes.size(), EMPTY);
+	m_entries.assign(m_entries.size(), Entry());
+	m_size = 0;
+	m_used = 0;
+}
+
+void KvTable::rehash(size_t capacity)
+{
+	std::vector<uint64_t> hashes(capacity, EMPTY);
+	std::vector<Entry> entries(capacity);
+	size_t mask = capacity - 1;
+	for (size_t i = 0; i < m_hashes.size(); ++i)
+	{
+		if (m_hashes[i] <= TOMBSTONE)
+		{
+			continue;
+		}
+		size_t j = m_hashes[i] & mask;
+		while (hashes[j] != EMPTY)
+		{
+			j = (j + 1) & mask;
+		}
+		hashes[j] = m_hashes[i];
+		entries[j].m_key.swap(m_entries[i].m_key);
+		entries[j].m_value.swap(m_entries[i].m_value);
+	}
+	m_hashes.swap(hashes);
+	m_entries.swap(entries);
+	m_used = m_size;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 开放寻址(线性探测)哈希表。探测时只扫描连续存放的哈希值数组，哈希值相等才去比较key，
+ * 	减少cache miss。删除使用墓碑标记，墓碑和有效元素一起计入负载因子。
+ * 
+ */
+class KvTable
+{
+struct Entry
+{
+	std::string m_key;
+	std::string m_value;
+};
+
+public:
+	KvTable(size_t initCapacity = 16);
+	~KvTable();
+
+	bool get(const std::string& key, std::string& value) const;
+	void put(const std::string& key, const std::string& value);
+	bool remove(const std::string& key);
+	size_t size() const;
+	size_t capacity() const;
+	void clear();
+
+	template<typename Visitor>
+	void foreach(Visitor visitor) const
+	{
+		for (size_t i = 0; i < m_hashes.size(); ++i)
+		{
+			if (m_hashes[i] > TOMBSTONE)
+			{
+				visitor(m_entries[i].m_key, m_entries[i].m_value);
+			}
+		}
+	}
+private:
+	static uint64_t hash(const std::string& key);
+	size_t find(const std::string& key, uint64_t h) const;
+	void rehash(size_t capacity);
+private:
+	enum : uint64_t { EMPTY = 0, TOMBSTONE = 1 };
+
+	//每个槽位的哈希值，EMPTY表示空槽，TOMBSTONE表示已经删除
+	std::vector<uint64_t> m_hashes;
+	std::vector<Entry> m_entries;
+	//有效元素个数
+	size_t m_size;
+	//有效元素加上墓碑的个数
+	size_t m_used;
+};
@@ -13,7 +13,12 @@
 #include "sys/log.h"
 #include "net/socket_base.h"
 
+#include <thread>
+#include <vector>
+#include <sstream>
+
 #include "server.h"
+#include "kv/kv_state_machine.h"
 
 int set_openfd_limit(unsigned long limitSize){
 	struct rlimit limit;
@@ -73,7 +78,7 @@ int main(int argc, char** argv){
 	}
 
 	if(argc < 2){
-		fprintf(stderr, "Usage: %s log_path -s myID -t tcp/udp -x localIP -y localPort -m dstIP -n dstPort\n", argv[0]);
+		fprintf(stderr, "Usage: %s log_path -s myID -k nodeID -t tcp/udp -x localIP -y localPort -m dstIP -n dstPort -d dataDir -w acceptWindow -b batchCount -l benchLoad -i snapshotInterval -g groupCount -c loopCount -o statsDir -q thrifty/hedged -P prepareQuorum -A acceptQuorum -M acceptorNodeIDs -D payloadThreshold\n", argv[0]);
 		return -1;
 	}
 
@@ -102,16 +107,33 @@ int main(int argc, char** argv){
 	srandom(time(NULL));
 
 	char* myID;
+	char* nodeID = nullptr;
 	char *localIp = nullptr;
 	char* dstIp = nullptr;
 	char* localPort = nullptr;
 	char* dstPort = nullptr;
 	char* conntype = nullptr;
-    while( (ret = getopt(argc, argv, "s:x:y:m:n:t:")) != -1 ){
+	char* dataDir = nullptr;
+	char* acceptWindow = nullptr;
+	char* batchCount = nullptr;
+	char* benchLoad = nullptr;
+	char* snapshotInterval = nullptr;
+	char* groupCount = nullptr;
+	char* loopCount = nullptr;
+	char* statsDir = nullptr;
+	char* quorumMode = nullptr;
+	char* prepareQuorum = nullptr;
+	char* acceptQuorum = nullptr;
+	char* acceptors = nullptr;
+	char* payloadThreshold = nullptr;
+    while( (ret = getopt(argc, argv, "s:k:x:y:m:n:t:d:w:b:l:i:g:c:o:q:P:A:M:D:")) != -1 ){
         switch(ret){
 			case 's':
 				myID = optarg;
 				break;
+			case 'k':
+				nodeID = optarg;
+				break;
 			case 't':
 				conntype = optarg;
 				break;
@@ -127,31 +149,164 @@ int main(int argc, char** argv){
 			case 'n':
 				dstPort = optarg;
 				break;
+			case 'd':
+				dataDir = optarg;
+				break;
+			case 'w':
+				acceptWindow = optarg;
+				break;
+			case 'b':
+				batchCount = optarg;
+				break;
+			case 'l':
+				benchLoad = optarg;
+				break;
+			case 'i':
+				snapshotInterval = optarg;
+				break;
+			case 'g':
+				groupCount = optarg;
+				break;
+			case 'c':
+				loopCount = optarg;
+				break;
+			case 'o':
+				statsDir = optarg;
+				break;
+			case 'q':
+				quorumMode = optarg;
+				break;
+			case 'P':
+				prepareQuorum = optarg;
+				break;
+			case 'A':
+				acceptQuorum = optarg;
+				break;
+			case 'M':
+				acceptors = optarg;
+				break;
+			case 'D':
+				payloadThreshold = optarg;
+				break;
 			default:
 				break;
 		}
     }
 
 	std::string mySID = myID != nullptr ? myID : "123456789";
+	int iNodeID = nodeID != nullptr ? atoi(nodeID) : 1;
 	std::string localSip = localIp != nullptr ? localIp : "127.0.0.1";
 	int iLocalPort = localPort != nullptr ? atoi(localPort) : 10000;
 	std::string dstSip = dstIp != nullptr ? dstIp : "127.0.0.1";
 	int iDstSPort = dstPort != nullptr ? atoi(dstPort) : 20000;
+	std::string sDataDir = dataDir != nullptr ? dataDir : ".";
+	int iAcceptWindow = acceptWindow != nullptr ? atoi(acceptWindow) : 1;
+	int iBatchCount = batchCount != nullptr ? atoi(batchCount) : 64;
+	int iBenchLoad = benchLoad != nullptr ? atoi(benchLoad) : 0;
+	int iSnapshotInterval = snapshotInterval != nullptr ? atoi(snapshotInterval) : 100000;
+	int iGroupCount = groupCount != nullptr ? atoi(groupCount) : 1;
+	int iLoopCount = loopCount != nullptr ? atoi(loopCount) : 1;
+	std::string sStatsDir = statsDir != nullptr ? statsDir : "";
+	//不小于这个字节数的议题value先把payload分发给各个节点，共识消息里只带摘要，0表示不分开。
+	//所有节点必须一致，重启时预写日志按它把payload换回摘要
+	int iPayloadThreshold = payloadThreshold != nullptr ? atoi(payloadThreshold) : 0;
+	//初始的Acceptor成员，逗号分隔的节点编号，之后的变更通过复制日志进行。不指定时不限制成员，
+	//任何节点的响应都计数，quorum大小必须显式给出。指定时不在成员里的节点是观察者，不投票，
+	//只接收leader推送的已经达成一致的实例，提供有界陈旧读
+	Membership membership;
+	std::string sAcceptors = acceptors != nullptr ? acceptors : "";
+	std::stringstream acceptorStream(sAcceptors);
+	std::string acceptorID;
+	while(std::getline(acceptorStream, acceptorID, ',')){
+		int iAcceptorID = atoi(acceptorID.c_str());
+		if(iAcceptorID <= INVALID_NODE_ID || iAcceptorID > 0xffff){
+			LOG_ERROR("acceptor node id:%s out of range", acceptorID.c_str());
+			return -8;
+		}
+		membership.m_acceptors.insert(iAcceptorID);
+	}
+	//Flexible Paxos：任意prepare quorum和accept quorum必须相交，即两者之和大于Acceptor总数，0表示多数派
+	int defaultQuorum = membership.isOpen() ? 3 : 0;
+	int iPrepareQuorum = prepareQuorum != nullptr ? atoi(prepareQuorum) : defaultQuorum;
+	int iAcceptQuorum = acceptQuorum != nullptr ? atoi(acceptQuorum) : defaultQuorum;
 	deps::SocketType type = deps::SocketType::tcp;
 	if(conntype != nullptr && strncmp(conntype,"udp", 3) == 0){
 		type = deps::SocketType::udp;
 	}
+	QuorumMode eQuorumMode = QuorumMode::thrifty;
+	if(quorumMode != nullptr && strcmp(quorumMode, "hedged") == 0){
+		eQuorumMode = QuorumMode::hedged;
+	}
 
 	LOG_INFO("pname:%s pid:%d log path %s", argv[0], pid, logfile.c_str());
-	LOG_INFO("mySID: %s, type:%s localIP: %s, localPort: %d, dstIP: %s, dstPort: %d", 
-		mySID.c_str(), deps::SocketBase::toString(type).c_str(), localSip.c_str(), 
-		iLocalPort, dstSip.c_str(), iDstSPort);
-	Server server(mySID, 3);
-	if(!server.Init(type, localSip, iLocalPort, dstSip, iDstSPort)){
-		return -1;
+	if(iNodeID <= INVALID_NODE_ID || iNodeID > 0xffff){
+		LOG_ERROR("node id:%d out of range", iNodeID);
+		return -5;
+	}
+	if(iGroupCount <= 0 || iGroupCount > 0xffff || iLoopCount <= 0 || iLoopCount > iGroupCount){
+		LOG_ERROR("group count:%d loop count:%d invalid", iGroupCount, iLoopCount);
+		return -6;
+	}
+	membership.m_prepareQuorum = iPrepareQuorum > 0 ? iPrepareQuorum : 0;
+	membership.m_acceptQuorum = iAcceptQuorum > 0 ? iAcceptQuorum : 0;
+	if(iPrepareQuorum < 0 || iAcceptQuorum < 0 || iPrepareQuorum > 0xffff || iAcceptQuorum > 0xffff ||
+		!membership.isValid()){
+		LOG_ERROR("prepare quorum:%d accept quorum:%d acceptors:%s invalid", iPrepareQuorum, iAcceptQuorum,
+			sAcceptors.c_str());
+		return -7;
+	}
+	if(iPayloadThreshold < 0){
+		LOG_ERROR("payload threshold:%d invalid", iPayloadThreshold);
+		return -9;
+	}
+
+	LOG_INFO("mySID: %s, nodeID: %d, type:%s localIP: %s, localPort: %d, dstIP: %s, dstPort: %d, dataDir: %s, "
+		"acceptWindow: %d, batchCount: %d, benchLoad: %d, snapshotInterval: %d, groups: %d, loops: %d, statsDir: %s, quorumMode: %s, "
+		"membership: %s, payloadThreshold: %d", 
+		mySID.c_str(), iNodeID, deps::SocketBase::toString(type).c_str(), localSip.c_str(), 
+		iLocalPort, dstSip.c_str(), iDstSPort, sDataDir.c_str(), iAcceptWindow, iBatchCount, iBenchLoad,
+		iSnapshotInterval, iGroupCount, iLoopCount, sStatsDir.c_str(),
+		eQuorumMode == QuorumMode::hedged ? "hedged" : "thrifty", membership.toString().c_str(), iPayloadThreshold);
+
+	//每个核一个事件循环，第i个事件循环监听基础端口加i，只和对端的第i个事件循环建连接。
+	//对端连接不在事件循环之间共享，每个连接只在一个线程里读写；同一个事件循环上的分组共用连接
+	std::vector<Server*> servers;
+	for(int i = 0; i < iLoopCount; ++i){
+		Server* server = new Server(mySID, iNodeID, i);
+		if(!server->Init(type, localSip, iLocalPort + i, dstSip, iDstSPort + i)){
+			return -1;
+		}
+		server->SetStatsDir(sStatsDir);
+		server->SetQuorumMode(eQuorumMode);
+		servers.push_back(server);
+	}
+
+	//分组g放在第g % iLoopCount个事件循环上，所有节点的分配方式相同
+	std::vector<KvStateMachine*> stateMachines;
+	std::vector<PaxosGroup*> groups;
+	for(int g = 0; g < iGroupCount; ++g){
+		Server* server = servers[g % iLoopCount];
+		KvStateMachine* stateMachine = new KvStateMachine();
+		PaxosGroup* group = new PaxosGroup(*server, g, *stateMachine, iNodeID, membership, 
+			iAcceptWindow, iBatchCount, iBenchLoad, iSnapshotInterval, iPayloadThreshold);
+		if(!group->Init(sDataDir, mySID)){
+			return -1;
+		}
+		server->AddGroup(group);
+		stateMachines.push_back(stateMachine);
+		groups.push_back(group);
+	}
+
+	//分组表和分组的初始化在启动线程之前完成，之后其他线程只能通过Server::PostPropose提交命令
+	std::vector<std::thread> threads;
+	for(int i = 1; i < iLoopCount; ++i){
+		threads.push_back(std::thread(&Server::Run, servers[i]));
 	}
-	if(!server.Run()){
+	if(!servers[0]->Run()){
 		return -1;
 	}
+	for(auto& t : threads){
+		t.join();
+	}
     return 0;
 }
\ No newline at end of file
@@ -1,43 +1,80 @@
 #include "acceptor.h"
-#include "sys/util.h"
+#include "clock.h"
 
-Acceptor::Acceptor(Messenger& messenger, const std::string& acceptorUID, int livenessWindow):m_messenger(messenger)
+Acceptor::Acceptor(Messenger& messenger, NodeID acceptorUID, int livenessWindow, int leaseDuration):
+	m_messenger(messenger)
 {
 	m_acceptorUID = acceptorUID;
 	m_livenessWindow = livenessWindow;
-	m_lastPrepareTimestamp   = deps::GetMonoTimeUs();
+	m_pendingPromiseUID = INVALID_NODE_ID;
+	m_pendingPromiseInstanceID = 0;
+	m_lastPrepareTimestamp   = PaxosClock::nowUs();
+	m_leaseHolderUID = INVALID_NODE_ID;
+	m_leaseExpireTimestamp = 0;
+	m_leaseDuration = leaseDuration;
+	m_restartFenceTimestamp = 0;
+	m_truncatedInstanceID = 0;
+	m_active = true;
 }
 
 Acceptor::~Acceptor(){}
 
 /**
- * @brief 接收到prepare请求
- * 
+ * @brief 接收到prepare请求，承诺对所有编号大于等于instanceID的实例生效
+ *
  * @param fromUID Proposer的UID
  * @param proposalID 议题编号
+ * @param instanceID 承诺覆盖的起始实例编号
  */
-void Acceptor::receivePrepare(const std::string& fromUID, const ProposalID& proposalID) 
+void Acceptor::receivePrepare(NodeID fromUID, const ProposalID& proposalID, uint64_t instanceID)
 {
-	if (m_promisedID.isValid() && proposalID == m_promisedID) 
-	{ 
-		//已经承诺过这个协议编号
+	if (instanceID < m_truncatedInstanceID)
+	{
+		//截断的实例已经不知道批准过什么，承诺里带不回这些实例，Proposer会把它们当成空洞填上别的值。
+		//拒绝并且告诉它截断位置，它要先装载快照
+		if (m_active)
+		{
+			m_messenger.sendPrepareNACK(fromUID, proposalID, m_promisedID, m_truncatedInstanceID);
+		}
+		return;
+	}
+
+	uint64_t now = PaxosClock::nowUs();
+	if ((m_leaseHolderUID != INVALID_NODE_ID && fromUID != m_leaseHolderUID && now < m_leaseExpireTimestamp) ||
+		now < m_restartFenceTimestamp)
+	{
+		//租约期内不对其他Proposer做出承诺，leader才能在租约期内直接读本地状态。
+		//重启后不知道租约给了谁，等一个租约时长，重启前授予的租约一定过期了
 		if (m_active)
+		{
+			m_messenger.sendPrepareNACK(fromUID, proposalID, m_promisedID, m_truncatedInstanceID);
+		}
+		return;
+	}
+
+	if (m_promisedID.isValid() && proposalID == m_promisedID)
+	{
+		//已经承诺过这个协议编号
+		if (m_active && m_pendingPromiseUID == INVALID_NODE_ID)
 		{
 			//发送承诺
-			m_messenger.sendPromise(fromUID, proposalID, m_acceptedID, m_acceptedValue);
+			std::vector<PaxosInstance> acceptedInstances;
+			getAcceptedInstances(instanceID, acceptedInstances);
+			m_messenger.sendPromise(fromUID, proposalID, instanceID, acceptedInstances);
 		}
 	}
-	else if (!m_promisedID.isValid() || proposalID > m_promisedID) 
+	else if (!m_promisedID.isValid() || proposalID > m_promisedID)
 	{
 		//协议编号大于已经承诺的协议编号，拒绝响应。是想要给已经给出承诺的协议一个缓冲时间来提交协议。
 		//防止发生连续的prepare请求，导致acceptor不断的承诺新的协议编号。原来的Proposer没有办法
 		//只能继续递增协议号，导致新的Proposer无法提交协议。
-		if (m_pendingPromiseUID.empty()) 
+		if (m_pendingPromiseUID == INVALID_NODE_ID)
 		{
 			m_promisedID = proposalID;
 			if (m_active)
 			{
 				m_pendingPromiseUID = fromUID;
+				m_pendingPromiseInstanceID = instanceID;
 			}
 		}
 	}
@@ -47,105 +84,254 @@ void Acceptor::receivePrepare(const std::string& fromUID, const ProposalID& prop
 		//不是承诺消息，Proposer不能用它来当做发起accept请求的依据。
 		if (m_active)
 		{
-			m_messenger.sendPrepareNACK(fromUID, proposalID, m_promisedID);
+			m_messenger.sendPrepareNACK(fromUID, proposalID, m_promisedID, m_truncatedInstanceID);
 		}
 	}
-	m_lastPrepareTimestamp = deps::GetMonoTimeUs();
+	m_lastPrepareTimestamp = PaxosClock::nowUs();
 }
 
 /**
- * @brief 接收到accept请求
- * 
+ * @brief 接收到某个实例上的accept请求
+ *
  * @param fromUID Proposer的UID
  * @param proposalID 议题编号
+ * @param instanceID 实例编号
  * @param value 议题value
  */
-void Acceptor::receiveAcceptRequest(const std::string& fromUID, const ProposalID& proposalID, 
-	const std::string& value) 
+void Acceptor::receiveAcceptRequest(NodeID fromUID, const ProposalID& proposalID,
+	uint64_t instanceID, const std::string& value)
 {
-	if (m_acceptedID.isValid() && proposalID == m_acceptedID && m_acceptedValue == value) 
+	if (instanceID < m_truncatedInstanceID)
 	{
-		//已经批准过这个协议，包括编号和value都相等
+		//截断的实例早已达成一致，不能再批准
 		if (m_active)
+		{
+			m_messenger.sendAcceptNACK(fromUID, proposalID, instanceID, m_promisedID, m_truncatedInstanceID);
+		}
+		return;
+	}
+
+	auto itr = m_instances.find(instanceID);
+	if (itr != m_instances.end() && proposalID == itr->second.m_acceptedID &&
+		itr->second.m_acceptedValue == value)
+	{
+		//已经批准过这个协议，包括编号和value都相等
+		if (m_active && m_pendingAccepts.find(instanceID) == m_pendingAccepts.end())
 		{
 			//发送批准
-			m_messenger.sendPermit(fromUID, proposalID, value);
+			m_messenger.sendPermit(fromUID, proposalID, instanceID, value);
 		}
 	}
-	else if (!m_promisedID.isValid() || proposalID > m_promisedID || proposalID == m_promisedID) 
+	else if (!m_promisedID.isValid() || proposalID > m_promisedID || proposalID == m_promisedID)
 	{
-		if (m_pendingAcceptUID.empty()) 
+		if (m_pendingAccepts.find(instanceID) == m_pendingAccepts.end())
 		{
-			m_promisedID    = proposalID;
-			m_acceptedID    = proposalID;
-			m_acceptedValue = value;
-			
+			m_promisedID = proposalID;
+			m_instances[instanceID] = PaxosInstance(instanceID, proposalID, value);
+
 			if (m_active)
 			{
-				m_pendingAcceptUID = fromUID;
+				m_pendingAccepts[instanceID] = fromUID;
 			}
 		}
 	}
-	else 
+	else
 	{
 		if (m_active)
 		{
-			m_messenger.sendAcceptNACK(fromUID, proposalID, m_promisedID);
+			m_messenger.sendAcceptNACK(fromUID, proposalID, instanceID, m_promisedID, m_truncatedInstanceID);
 		}
 	}
 }
 
+/**
+ * @brief 收到leader的租约申请。只有不小于已承诺编号的leader才能拿到租约，
+ * 	租约从收到申请的时刻开始计时，比leader从发送时刻开始计时更晚到期，保证leader先于Acceptor认为租约过期。
+ * 
+ * @param fromUID leader的UID
+ * @param proposalID leader的议题编号
+ * @param timestamp leader发送申请时的时间戳，原样带回
+ * @param leaseDuration 租约时长，单位微秒，为0时只确认leader身份，不授予租约
+ */
+void Acceptor::receiveLeaseRequest(NodeID fromUID, const ProposalID& proposalID, 
+	uint64_t timestamp, uint64_t leaseDuration)
+{
+	if (m_promisedID.isValid() && proposalID < m_promisedID)
+	{
+		return;
+	}
+
+	uint64_t now = PaxosClock::nowUs();
+	if (m_leaseHolderUID != INVALID_NODE_ID && fromUID != m_leaseHolderUID && now < m_leaseExpireTimestamp)
+	{
+		//别的leader的租约还没有到期
+		return;
+	}
+	if (now < m_restartFenceTimestamp)
+	{
+		//重启前授予的租约可能还没有到期，不授予租约也不确认leader身份
+		return;
+	}
+
+	//不使用租约时也回复，确认leader的ReadIndex读请求
+	if (leaseDuration > 0)
+	{
+		m_leaseHolderUID = fromUID;
+		m_leaseExpireTimestamp = now + leaseDuration;
+	}
+	if (m_active)
+	{
+		m_messenger.sendLeaseGrant(fromUID, proposalID, timestamp);
+	}
+}
+
 bool Acceptor::isPrepareExpire()
 {
-	uint64_t waitTime = deps::GetMonoTimeUs() - m_lastPrepareTimestamp;
+	uint64_t waitTime = PaxosClock::nowUs() - m_lastPrepareTimestamp;
 	return waitTime > m_livenessWindow;
 }
 
-ProposalID Acceptor::getPromisedID() 
+ProposalID Acceptor::getPromisedID()
 {
     return m_promisedID;
 }
 
-ProposalID Acceptor::getAcceptedID() 
+ProposalID Acceptor::getAcceptedID(uint64_t instanceID)
+{
+	auto itr = m_instances.find(instanceID);
+	if (itr == m_instances.end())
+	{
+		return ProposalID();
+	}
+    return itr->second.m_acceptedID;
+}
+
+std::string Acceptor::getAcceptedValue(uint64_t instanceID)
 {
-    return m_acceptedID;
+	auto itr = m_instances.find(instanceID);
+	if (itr == m_instances.end())
+	{
+		return "";
+	}
+    return itr->second.m_acceptedValue;
 }
 
-std::string Acceptor::getAcceptedValue() 
+/**
+ * @brief 获取编号大于等于fromInstanceID的实例上已经批准的议题
+ */
+void Acceptor::getAcceptedInstances(uint64_t fromInstanceID, std::vector<PaxosInstance>& instances)
 {
-    return m_acceptedValue;
+	instances.clear();
+	for (auto itr = m_instances.lower_bound(fromInstanceID); itr != m_instances.end(); ++itr)
+	{
+		instances.push_back(itr->second);
+	}
+}
+
+/**
+ * @brief 获取实例上已经批准的议题，没有批准过时返回false
+ */
+bool Acceptor::getAcceptedInstance(uint64_t instanceID, PaxosInstance& instance)
+{
+	auto itr = m_instances.find(instanceID);
+	if (itr == m_instances.end())
+	{
+		return false;
+	}
+	instance = itr->second;
+	return true;
 }
 
 
 bool Acceptor::persistenceRequired()
 {
-	bool ret = !m_pendingAcceptUID.empty() || !m_pendingPromiseUID.empty();
+	bool ret = !m_pendingAccepts.empty() || m_pendingPromiseUID != INVALID_NODE_ID;
 	return ret;
 }
-	
 
-void Acceptor::recover(const ProposalID& promisedID, const ProposalID& acceptedID, const std::string& acceptedValue) 
+/**
+ * @brief 获取等待持久化的批准，和承诺的议题编号一起写入预写日志
+ */
+void Acceptor::getPendingInstances(std::vector<PaxosInstance>& instances)
+{
+	instances.clear();
+	for (auto& pending : m_pendingAccepts)
+	{
+		instances.push_back(m_instances[pending.first]);
+	}
+}
+
+/**
+ * @brief 删除编号小于instanceID的实例，这些实例已经包含在状态机快照里。截断位置只会前进，
+ * 	随压缩后的预写日志一起落盘
+ */
+void Acceptor::truncate(uint64_t instanceID)
+{
+	if (instanceID > m_truncatedInstanceID)
+	{
+		m_truncatedInstanceID = instanceID;
+	}
+	auto itr = m_instances.begin();
+	while (itr != m_instances.end() && itr->first < instanceID)
+	{
+		if (m_pendingAccepts.find(itr->first) != m_pendingAccepts.end())
+		{
+			//还没有落盘的批准留到persisted以后
+			++itr;
+			continue;
+		}
+		m_instances.erase(itr++);
+	}
+}
+
+uint64_t Acceptor::getTruncatedInstanceID()
+{
+	return m_truncatedInstanceID;
+}
+
+/**
+ * @brief 重启后用预写日志恢复承诺和批准过的实例。使用租约时一个租约时长内不做承诺
+ */
+void Acceptor::recover(const ProposalID& promisedID, const std::vector<PaxosInstance>& acceptedInstances,
+	uint64_t truncatedInstanceID)
 {
 	m_promisedID    = promisedID;
-	m_acceptedID    = acceptedID;
-	m_acceptedValue = acceptedValue;
+	m_truncatedInstanceID = truncatedInstanceID;
+	if (m_leaseDuration > 0)
+	{
+		//租约没有落盘，没有承诺记录也可能授予过租约，重启后一律等一个租约时长
+		m_restartFenceTimestamp = PaxosClock::nowUs() + m_leaseDuration;
+	}
+	m_instances.clear();
+	for (auto& instance : acceptedInstances)
+	{
+		if (instance.m_instanceID >= truncatedInstanceID)
+		{
+			m_instances[instance.m_instanceID] = instance;
+		}
+	}
 }
 
-void Acceptor::persisted() 
+void Acceptor::persisted()
 {
-	if (m_active) 
+	if (m_active)
 	{
-		if (!m_pendingPromiseUID.empty())
+		if (m_pendingPromiseUID != INVALID_NODE_ID)
 		{
-			m_messenger.sendPromise(m_pendingPromiseUID, m_promisedID, m_acceptedID, m_acceptedValue);
+			std::vector<PaxosInstance> acceptedInstances;
+			getAcceptedInstances(m_pendingPromiseInstanceID, acceptedInstances);
+			m_messenger.sendPromise(m_pendingPromiseUID, m_promisedID,
+				m_pendingPromiseInstanceID, acceptedInstances);
 		}
-		if (!m_pendingAcceptUID.empty())
+		for (auto& pending : m_pendingAccepts)
 		{
-			m_messenger.sendPermit(m_pendingAcceptUID, m_acceptedID, m_acceptedValue);
+			PaxosInstance& instance = m_instances[pending.first];
+			m_messenger.sendPermit(pending.second, instance.m_acceptedID,
+				instance.m_instanceID, instance.m_acceptedValue);
 		}
 	}
-	m_pendingPromiseUID.clear();
-	m_pendingAcceptUID.clear();
+	m_pendingPromiseUID = INVALID_NODE_ID;
+	m_pendingAccepts.clear();
 }
 
 
@@ -157,4 +343,4 @@ bool Acceptor::isActive()
 void Acceptor::setActive(bool active)
 {
 	m_active = active;
-}
\ No newline at end of file
+}
@@ -2,47 +2,68 @@
 
 #include <string>
 #include <memory>
+#include <map>
+#include <vector>
 
 #include "proposalid.h"
+#include "instance.h"
 #include "messenger.h"
 
-class Acceptor 
+class Acceptor
 {
 public:
-	Acceptor(Messenger& messenger, const std::string& acceptorUID, int livenessWindow);
+	Acceptor(Messenger& messenger, NodeID acceptorUID, int livenessWindow, int leaseDuration);
 	~Acceptor();
 
-	void receivePrepare(const std::string& fromUID, const ProposalID& proposalID);
-	void receiveAcceptRequest(const std::string& fromUID, const ProposalID& proposalID, 
-		const std::string& value);
+	void receivePrepare(NodeID fromUID, const ProposalID& proposalID, uint64_t instanceID);
+	void receiveAcceptRequest(NodeID fromUID, const ProposalID& proposalID,
+		uint64_t instanceID, const std::string& value);
 	bool isPrepareExpire();
+	void receiveLeaseRequest(NodeID fromUID, const ProposalID& proposalID, 
+		uint64_t timestamp, uint64_t leaseDuration);
 
 	ProposalID getPromisedID();
-	ProposalID getAcceptedID();
-	std::string getAcceptedValue();
+	ProposalID getAcceptedID(uint64_t instanceID);
+	std::string getAcceptedValue(uint64_t instanceID);
+	void getAcceptedInstances(uint64_t fromInstanceID, std::vector<PaxosInstance>& instances);
+	bool getAcceptedInstance(uint64_t instanceID, PaxosInstance& instance);
 
 	bool persistenceRequired();
-	void recover(const ProposalID& promisedID, const ProposalID& acceptedID, const std::string& acceptedValue);
+	void getPendingInstances(std::vector<PaxosInstance>& instances);
+	void truncate(uint64_t instanceID);
+	uint64_t getTruncatedInstanceID();
+	void recover(const ProposalID& promisedID, const std::vector<PaxosInstance>& acceptedInstances,
+		uint64_t truncatedInstanceID);
 	void persisted();
 	bool isActive();
 	void setActive(bool active);
 private:
     Messenger& m_messenger;
-	std::string  m_acceptorUID;
+	NodeID  m_acceptorUID;
 	//保活窗口的大小，单位微秒
-	uint64_t m_livenessWindow; 
-	//对prepare请求做出承诺的议题编号
+	uint64_t m_livenessWindow;
+	//对prepare请求做出承诺的议题编号，对所有实例生效
 	ProposalID m_promisedID;
 	//已经对Proposer(m_pendingPromiseUID)的prepare请求做出承诺
-	std::string  m_pendingPromiseUID;
+	NodeID  m_pendingPromiseUID;
+	//等待持久化的承诺覆盖的起始实例编号
+	uint64_t m_pendingPromiseInstanceID;
 	//对prepare请求做出承诺的时间戳
 	uint64_t m_lastPrepareTimestamp;
-	//已经批准的议题的最大编号
-	ProposalID m_acceptedID;
-	//已经批准的议题value
-	std::string m_acceptedValue;
-	//等待接收该Proposer(m_pendingAcceptUID)的accept请求的
-	std::string  m_pendingAcceptUID;
-	
+	//持有租约的leader，租约期内不对其他Proposer做出承诺
+	NodeID m_leaseHolderUID;
+	//租约到期的单调时钟，单位微秒
+	uint64_t m_leaseExpireTimestamp;
+	//租约时长，单位微秒，为0时不使用租约
+	uint64_t m_leaseDuration;
+	//租约状态不落盘，重启前授予的租约可能还没有到期，这个时间之前不对任何Proposer做出承诺，也不授予租约
+	uint64_t m_restartFenceTimestamp;
+	//每个实例上已经批准的议题编号和value
+	std::map<uint64_t, PaxosInstance> m_instances;
+	//编号小于它的实例已经包含在快照里并且删掉了，这些实例上的prepare和accept请求一律拒绝
+	uint64_t m_truncatedInstanceID;
+	//等待持久化的accept请求：实例编号 -> Proposer的UID
+	std::map<uint64_t, NodeID> m_pendingAccepts;
+
 	bool m_active;
 };
@@ -0,0 +1,461 @@
+#include "acceptor_log.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <map>
+
+#include "net/packet.h"
+#include "sys/log.h"
+#include "wide_codec.h"
+
+/**
+ * @brief 改名以后目录项也要落盘，否则掉电以后目录里可能还是旧文件
+ */
+static bool syncParentDirectory(const std::string& path)
+{
+	size_t pos = path.rfind('/');
+	std::string dir = pos == std::string::npos ? "." : (pos == 0 ? "/" : path.substr(0, pos));
+	int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	bool ok = ::fsync(fd) == 0;
+	::close(fd);
+	return ok;
+}
+
+//每条记录后面的校验和的字节数
+static const size_t CHECKSUM_SIZE = sizeof(uint32_t);
+
+/**
+ * @brief CRC32(IEEE)。记录的长度字段完好但内容只写了一半时靠它发现，不会把残缺的内容解码出来
+ */
+static uint32_t crc32(const char* data, size_t size)
+{
+	static uint32_t table[256] = {0};
+	if (table[1] == 0)
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+			{
+				c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+	}
+	uint32_t crc = 0xFFFFFFFFU;
+	for (size_t i = 0; i < size; ++i)
+	{
+		crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc ^ 0xFFFFFFFFU;
+}
+
+AcceptorLog::AcceptorLog():m_fd(-1),m_syncCount(0),m_recordCount(0),m_fileSize(0),m_directoryDirty(false){}
+
+AcceptorLog::~AcceptorLog()
+{
+	close();
+}
+
+/**
+ * @brief 打开预写日志文件，不存在则创建
+ * 
+ * @param path 日志文件路径
+ */
+bool AcceptorLog::open(const std::string& path)
+{
+	m_path = path;
+	m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (m_fd < 0)
+	{
+		LOG_ERROR("open acceptor log %s failed (%s)", path.c_str(), strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void AcceptorLog::close()
+{
+	if (m_fd >= 0)
+	{
+		::close(m_fd);
+		m_fd = -1;
+	}
+}
+
+/**
+ * @brief 重放整个日志，恢复出承诺的议题编号和每个实例上最后批准的议题。
+ * 	尾部写了一半的记录(进程在写日志的时候崩溃)和校验和不对的记录会被截断。
+ * 	空日志先写入格式头，旧格式的日志按恢复出的状态重写成带校验和的格式。
+ * 
+ * @param promisedID 承诺的议题编号
+ * @param acceptedInstances 按照实例编号排好序的已经批准的实例
+ * @param truncatedInstanceID 上次压缩时的截断位置
+ */
+bool AcceptorLog::recover(ProposalID& promisedID, std::vector<PaxosInstance>& acceptedInstances, 
+	uint64_t& truncatedInstanceID)
+{
+	truncatedInstanceID = 0;
+	if (m_fd < 0)
+	{
+		return false;
+	}
+
+	std::string content;
+	char buf[65536];
+	ssize_t n = 0;
+	while ((n = ::pread(m_fd, buf, sizeof(buf), content.size())) > 0)
+	{
+		content.append(buf, n);
+	}
+	if (n < 0)
+	{
+		LOG_ERROR("read acceptor log %s failed (%s)", m_path.c_str(), strerror(errno));
+		return false;
+	}
+
+	std::map<uint64_t, PaxosInstance> instances;
+	size_t offset = 0;
+	//分片拼出来的value，交给紧跟着的AcceptorLogRecord
+	AcceptorLogValueChunk chunk;
+	std::string chunkedValue;
+	uint64_t chunkedInstanceID = 0;
+	//最后一条完整的AcceptorLogRecord之后的位置，只有分片没有记录的尾部也要截断
+	size_t committedOffset = 0;
+	//第一条记录是格式头时每条记录后面跟着校验和
+	bool checksummed = content.size() >= deps::Decoder::minSize() && 
+		deps::Decoder::pickSubCmd(content.data()) == AcceptorLogHeader::cmd;
+	size_t trailerSize = checksummed ? CHECKSUM_SIZE : 0;
+	while (content.size() - offset >= deps::Decoder::minSize())
+	{
+		const char* data = content.data() + offset;
+		uint16_t recordSize = deps::Decoder::pickLen(data);
+		if (recordSize < deps::Decoder::minSize() || recordSize + trailerSize > content.size() - offset)
+		{
+			break;
+		}
+		if (checksummed)
+		{
+			uint32_t checksum = 0;
+			memcpy(&checksum, data + recordSize, CHECKSUM_SIZE);
+			if (checksum != crc32(data, recordSize))
+			{
+				LOG_ERROR("acceptor log %s offset:%zd checksum mismatch", m_path.c_str(), offset);
+				break;
+			}
+		}
+
+		uint16_t recordType = deps::Decoder::pickSubCmd(data);
+		deps::PacketHeader header;
+		deps::Decoder decoder(data, recordSize);
+		if (recordType == AcceptorLogHeader::cmd)
+		{
+			if (offset != 0)
+			{
+				LOG_ERROR("acceptor log %s offset:%zd unexpected header", m_path.c_str(), offset);
+				break;
+			}
+			AcceptorLogHeader logHeader;
+			decoder.deserialize(header, logHeader);
+			offset += recordSize + trailerSize;
+			committedOffset = offset;
+			continue;
+		}
+		if (recordType == AcceptorLogValueChunk::cmd)
+		{
+			decoder.deserialize(header, chunk);
+			if (chunk.m_offset == 0)
+			{
+				chunkedValue.clear();
+				chunkedInstanceID = chunk.m_instanceID;
+			}
+			if (chunk.m_instanceID != chunkedInstanceID || chunk.m_offset != chunkedValue.size())
+			{
+				LOG_ERROR("acceptor log %s offset:%zd broken value chunk", m_path.c_str(), offset);
+				break;
+			}
+			chunkedValue.append(chunk.m_data);
+			offset += recordSize + trailerSize;
+			continue;
+		}
+		if (recordType == AcceptorLogTruncate::cmd)
+		{
+			AcceptorLogTruncate truncate;
+			decoder.deserialize(header, truncate);
+			if (truncate.m_instanceID > truncatedInstanceID)
+			{
+				truncatedInstanceID = truncate.m_instanceID;
+			}
+			offset += recordSize + trailerSize;
+			committedOffset = offset;
+			continue;
+		}
+		if (recordType != AcceptorLogRecord::cmd)
+		{
+			LOG_ERROR("acceptor log %s offset:%zd unknown record", m_path.c_str(), offset);
+			break;
+		}
+
+		AcceptorLogRecord record;
+		decoder.deserialize(header, record);
+
+		promisedID = record.m_promisedID;
+		for (auto& instance : record.m_acceptedInstances)
+		{
+			PaxosInstance& recovered = instances[instance.m_instanceID];
+			recovered = instance;
+			if (!chunkedValue.empty() && instance.m_instanceID == chunkedInstanceID && 
+				chunkedValue.size() == chunk.m_totalSize)
+			{
+				recovered.m_acceptedValue.swap(chunkedValue);
+			}
+		}
+		chunkedValue.clear();
+		offset += recordSize + trailerSize;
+		committedOffset = offset;
+		++m_recordCount;
+	}
+	offset = committedOffset;
+
+	if (offset < content.size())
+	{
+		LOG_ERROR("acceptor log %s truncate broken tail %zd -> %zd", m_path.c_str(), content.size(), offset);
+		if (::ftruncate(m_fd, offset) < 0)
+		{
+			LOG_ERROR("truncate acceptor log %s failed (%s)", m_path.c_str(), strerror(errno));
+			return false;
+		}
+	}
+
+	m_fileSize = offset;
+	acceptedInstances.clear();
+	for (auto& instance : instances)
+	{
+		acceptedInstances.push_back(instance.second);
+	}
+	LOG_INFO("acceptor log %s recovered records:%llu promisedid:%s instances:%zd truncated:%llu", m_path.c_str(), 
+		m_recordCount, promisedID.toString().c_str(), acceptedInstances.size(), truncatedInstanceID);
+
+	if (m_fileSize == 0)
+	{
+		//新日志先写格式头，之后追加的记录都带校验和
+		std::string buffer;
+		AcceptorLogHeader logHeader;
+		logHeader.m_version = AcceptorLogHeader::CHECKSUM_VERSION;
+		appendRecord(AcceptorLogHeader::cmd, logHeader, buffer);
+		if (!writeAll(m_fd, buffer) || ::fdatasync(m_fd) < 0)
+		{
+			LOG_ERROR("write acceptor log %s header failed (%s)", m_path.c_str(), strerror(errno));
+			return false;
+		}
+		m_fileSize = buffer.size();
+		return true;
+	}
+	if (!checksummed)
+	{
+		//旧格式的记录没有校验和，不能往后面追加带校验和的记录
+		LOG_INFO("acceptor log %s rewrite with checksums", m_path.c_str());
+		return compact(promisedID, acceptedInstances, truncatedInstanceID);
+	}
+	return true;
+}
+
+/**
+ * @brief 把一批承诺和批准写入日志，整批只调用一次fdatasync
+ * 
+ * @param promisedID 当前承诺的议题编号
+ * @param acceptedInstances 这一批新批准的实例
+ */
+bool AcceptorLog::append(const ProposalID& promisedID, const std::vector<PaxosInstance>& acceptedInstances)
+{
+	if (m_fd < 0)
+	{
+		return false;
+	}
+	if (m_directoryDirty)
+	{
+		if (!syncParentDirectory(m_path))
+		{
+			LOG_ERROR("sync directory of acceptor log %s failed (%s)", m_path.c_str(), strerror(errno));
+			return false;
+		}
+		m_directoryDirty = false;
+	}
+
+	//每个实例单独一条记录，避免一条记录超过编码长度的限制
+	std::string buffer;
+	if (acceptedInstances.empty())
+	{
+		encodeRecord(promisedID, nullptr, buffer);
+	}
+	for (auto& instance : acceptedInstances)
+	{
+		encodeRecord(promisedID, &instance, buffer);
+	}
+
+	if (!writeAll(m_fd, buffer))
+	{
+		LOG_ERROR("write acceptor log %s failed (%s)", m_path.c_str(), strerror(errno));
+		//写了一半的记录留在文件里，下一次追加会接在它后面，恢复时从这里截断会把后面已经落盘的记录一起丢掉
+		if (::ftruncate(m_fd, m_fileSize) < 0)
+		{
+			LOG_ERROR("truncate acceptor log %s to %llu failed (%s), abort", m_path.c_str(), 
+				m_fileSize, strerror(errno));
+			abort();
+		}
+		return false;
+	}
+	m_fileSize += buffer.size();
+
+	if (::fdatasync(m_fd) < 0)
+	{
+		//失败的脏页可能已经被丢掉并且标记为干净，再fsync也会成功，不能重试，只能重启以后从日志恢复
+		LOG_ERROR("sync acceptor log %s failed (%s), abort", m_path.c_str(), strerror(errno));
+		abort();
+	}
+	++m_syncCount;
+	return true;
+}
+
+/**
+ * @brief 快照以后压缩日志：把截断位置和Acceptor当前的状态写到新文件，落盘以后替换旧日志
+ * 
+ * @param promisedID 当前承诺的议题编号
+ * @param acceptedInstances 快照以后还需要保留的实例
+ * @param truncatedInstanceID 截断位置，重启以后Acceptor继续拒绝更早实例上的请求
+ */
+bool AcceptorLog::compact(const ProposalID& promisedID, const std::vector<PaxosInstance>& acceptedInstances, 
+	uint64_t truncatedInstanceID)
+{
+	if (m_fd < 0)
+	{
+		return false;
+	}
+
+	std::string buffer;
+	AcceptorLogHeader logHeader;
+	logHeader.m_version = AcceptorLogHeader::CHECKSUM_VERSION;
+	appendRecord(AcceptorLogHeader::cmd, logHeader, buffer);
+	AcceptorLogTruncate truncate;
+	truncate.m_instanceID = truncatedInstanceID;
+	appendRecord(AcceptorLogTruncate::cmd, truncate, buffer);
+	if (acceptedInstances.empty())
+	{
+		encodeRecord(promisedID, nullptr, buffer);
+	}
+	for (auto& instance : acceptedInstances)
+	{
+		encodeRecord(promisedID, &instance, buffer);
+	}
+
+	std::string tmpPath = m_path + ".tmp";
+	int fd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (fd < 0)
+	{
+		LOG_ERROR("open acceptor log %s failed (%s)", tmpPath.c_str(), strerror(errno));
+		return false;
+	}
+	if (!writeAll(fd, buffer) || ::fsync(fd) < 0 || ::rename(tmpPath.c_str(), m_path.c_str()) < 0)
+	{
+		LOG_ERROR("compact acceptor log %s failed (%s)", m_path.c_str(), strerror(errno));
+		::close(fd);
+		::unlink(tmpPath.c_str());
+		return false;
+	}
+	//目录项没有落盘时掉电会恢复出旧日志，之后追加到新文件里的承诺和批准就丢了，落盘之前append一直失败
+	m_directoryDirty = !syncParentDirectory(m_path);
+	if (m_directoryDirty)
+	{
+		LOG_ERROR("sync directory of acceptor log %s failed (%s)", m_path.c_str(), strerror(errno));
+	}
+
+	LOG_INFO("acceptor log %s compacted %llu -> %zd instances:%zd truncated:%llu", m_path.c_str(), 
+		m_fileSize, buffer.size(), acceptedInstances.size(), truncatedInstanceID);
+	::close(m_fd);
+	m_fd = fd;
+	m_fileSize = buffer.size();
+	++m_syncCount;
+	return true;
+}
+
+bool AcceptorLog::writeAll(int fd, const std::string& buffer)
+{
+	size_t written = 0;
+	while (written < buffer.size())
+	{
+		ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		written += n;
+	}
+	return true;
+}
+
+uint64_t AcceptorLog::getFileSize() const
+{
+	return m_fileSize;
+}
+
+void AcceptorLog::encodeRecord(const ProposalID& promisedID, const PaxosInstance* instance, std::string& buffer)
+{
+	AcceptorLogRecord record;
+	record.m_promisedID = promisedID;
+	if (instance != nullptr)
+	{
+		record.m_acceptedInstances.push_back(*instance);
+	}
+
+	//value放不进一条记录，先拆成分片记录写在前面
+	if (instance != nullptr && !WideCodec::fitsPacket(instance->m_acceptedValue.size(), 1))
+	{
+		const std::string& value = instance->m_acceptedValue;
+		AcceptorLogValueChunk chunk;
+		chunk.m_instanceID = instance->m_instanceID;
+		chunk.m_totalSize = value.size();
+		for (size_t offset = 0; offset < value.size(); offset += VALUE_CHUNK_SIZE)
+		{
+			chunk.m_offset = offset;
+			chunk.m_data.assign(value, offset, VALUE_CHUNK_SIZE);
+			appendRecord(AcceptorLogValueChunk::cmd, chunk, buffer);
+		}
+		record.m_acceptedInstances.back().m_acceptedValue.clear();
+	}
+
+	appendRecord(AcceptorLogRecord::cmd, record, buffer);
+	++m_recordCount;
+}
+
+/**
+ * @brief 编码一条记录，后面跟上记录内容的CRC32
+ */
+void AcceptorLog::appendRecord(uint16_t cmd, const deps::Marshallable& record, std::string& buffer)
+{
+	deps::Encoder encoder;
+	encoder.serialize(cmd, record);
+	buffer.append(encoder.data(), encoder.size());
+	uint32_t checksum = crc32(encoder.data(), encoder.size());
+	buffer.append((const char*)&checksum, CHECKSUM_SIZE);
+}
+
+uint64_t AcceptorLog::getSyncCount() const
+{
+	return m_syncCount;
+}
+
+uint64_t AcceptorLog::getRecordCount() const
+{
+	return m_recordCount;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "net/marshall.h"
+#include "proposalid.h"
+#include "instance.h"
+
+enum{
+	PAXOS_LOG_ACCEPTOR_RECORD = 1,
+	PAXOS_LOG_VALUE_CHUNK,
+	PAXOS_LOG_TRUNCATE,
+	PAXOS_LOG_HEADER,
+};
+
+/**
+ * @brief 日志文件的第一条记录，带格式版本。有这条记录的日志每条记录后面跟4字节的CRC32，
+ * 	没有这条记录的是旧格式，恢复以后马上按新格式重写
+ * 
+ */
+struct AcceptorLogHeader : public deps::Marshallable{
+	enum{cmd = PAXOS_LOG_HEADER};
+	enum{CHECKSUM_VERSION = 2};
+	uint32_t m_version;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_version;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_version;
+	}
+};
+
+/**
+ * @brief Acceptor预写日志的一条记录：承诺的议题编号和一个新批准的实例
+ * 
+ */
+struct AcceptorLogRecord : public deps::Marshallable{
+	enum{cmd = PAXOS_LOG_ACCEPTOR_RECORD};
+	ProposalID m_promisedID;
+	std::vector<PaxosInstance> m_acceptedInstances;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_promisedID << m_acceptedInstances;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_promisedID >> m_acceptedInstances;
+	}
+};
+
+/**
+ * @brief 一条记录放不下的议题value拆成若干分片记录，紧跟着写value为空的AcceptorLogRecord，
+ * 	恢复时把分片拼回这条记录里
+ * 
+ */
+struct AcceptorLogValueChunk : public deps::Marshallable{
+	enum{cmd = PAXOS_LOG_VALUE_CHUNK};
+	uint64_t m_instanceID;
+	//value的总长度
+	uint32_t m_totalSize;
+	//这个分片在value里的偏移
+	uint32_t m_offset;
+	std::string m_data;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_instanceID << m_totalSize << m_offset << m_data;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_instanceID >> m_totalSize >> m_offset >> m_data;
+	}
+};
+
+/**
+ * @brief 压缩时写在日志开头：编号小于m_instanceID的实例已经包含在快照里，Acceptor不再接受这些实例上的请求
+ * 
+ */
+struct AcceptorLogTruncate : public deps::Marshallable{
+	enum{cmd = PAXOS_LOG_TRUNCATE};
+	uint64_t m_instanceID;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_instanceID;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_instanceID;
+	}
+};
+
+/**
+ * @brief Acceptor的预写日志，只追加写。一次事件循环里积攒的所有承诺和批准合并成一次fsync(group commit)，
+ * 	落盘以后才能把Promise/Permit消息发出去。写失败时截掉写了一半的记录再重试，fsync失败时进程退出：
+ * 	失败的脏页可能已经被内核丢掉，重试成功也不代表之前写的内容落盘了。
+ * 
+ */
+class AcceptorLog
+{
+public:
+	AcceptorLog();
+	~AcceptorLog();
+
+	bool open(const std::string& path);
+	void close();
+	bool recover(ProposalID& promisedID, std::vector<PaxosInstance>& acceptedInstances, 
+		uint64_t& truncatedInstanceID);
+	bool append(const ProposalID& promisedID, const std::vector<PaxosInstance>& acceptedInstances);
+	bool compact(const ProposalID& promisedID, const std::vector<PaxosInstance>& acceptedInstances, 
+		uint64_t truncatedInstanceID);
+	uint64_t getFileSize() const;
+
+	uint64_t getSyncCount() const;
+	uint64_t getRecordCount() const;
+private:
+	void encodeRecord(const ProposalID& promisedID, const PaxosInstance* instance, std::string& buffer);
+	static void appendRecord(uint16_t cmd, const deps::Marshallable& record, std::string& buffer);
+	static bool writeAll(int fd, const std::string& buffer);
+private:
+	std::string m_path;
+	int m_fd;
+	//累计fsync的次数
+	uint64_t m_syncCount;
+	//累计写入的记录数
+	uint64_t m_recordCount;
+	//日志文件大小
+	uint64_t m_fileSize;
+	//压缩以后改名的目录项还没有落盘
+	bool m_directoryDirty;
+};
@@ -0,0 +1,151 @@
+#include "batcher.h"
+
+#include "net/packet.h"
+#include "clock.h"
+#include "sys/log.h"
+#include "wide_codec.h"
+
+/**
+ * @brief Construct a new ProposalBatcher object
+ * 
+ * @param maxCount 一批最多的命令个数
+ * @param maxBytes 一批最多的字节数
+ * @param maxDelayUs 最早的命令最多等待的时间，单位微秒
+ * @param flushCallback 打包好的议题value的处理函数
+ */
+ProposalBatcher::ProposalBatcher(size_t maxCount, size_t maxBytes, uint64_t maxDelayUs, 
+	std::function<void(const std::string&)> flushCallback):
+	m_maxCount(maxCount > 0 ? maxCount : 1), m_maxBytes(maxBytes), m_maxDelayUs(maxDelayUs),
+	m_flushCallback(flushCallback), m_bytes(0), m_firstTimestamp(0)
+{
+}
+
+ProposalBatcher::~ProposalBatcher(){}
+
+/**
+ * @brief 加入一个命令，个数或者字节数达到上限时立即打包
+ * 
+ * @param value 命令
+ */
+void ProposalBatcher::add(const std::string& value)
+{
+	//加入以后会超过字节上限，先把已经攒下的打包
+	if (!m_values.empty() && m_bytes + value.size() > m_maxBytes)
+	{
+		flush();
+	}
+
+	if (m_values.empty())
+	{
+		m_firstTimestamp = PaxosClock::nowUs();
+	}
+	m_values.push_back(value);
+	m_bytes += value.size();
+
+	if (m_values.size() >= m_maxCount || m_bytes >= m_maxBytes)
+	{
+		flush();
+	}
+}
+
+/**
+ * @brief 定时检查，最早的命令等待超过最大延迟时打包
+ */
+void ProposalBatcher::poll()
+{
+	if (!m_values.empty() && PaxosClock::nowUs() - m_firstTimestamp >= m_maxDelayUs)
+	{
+		flush();
+	}
+}
+
+/**
+ * @brief 把攒下的命令打包成一个议题value
+ */
+void ProposalBatcher::flush()
+{
+	if (m_values.empty())
+	{
+		return;
+	}
+
+	std::string batch;
+	encode(m_values, batch);
+	m_values.clear();
+	m_bytes = 0;
+	m_firstTimestamp = 0;
+
+	m_flushCallback(batch);
+}
+
+/**
+ * @brief 攒下的命令个数
+ */
+size_t ProposalBatcher::size() const
+{
+	return m_values.size();
+}
+
+/**
+ * @brief 打包命令，单个命令或者整批超过deps包长度上限时改用宽编码
+ */
+void ProposalBatcher::encode(const std::vector<std::string>& values, std::string& batch)
+{
+	size_t bytes = 0;
+	for (auto& value : values)
+	{
+		bytes += value.size();
+	}
+	if (!WideCodec::fitsPacket(bytes, values.size()))
+	{
+		std::vector<const std::string*> fields;
+		for (auto& value : values)
+		{
+			fields.push_back(&value);
+		}
+		WideCodec::encode(PAXOS_BATCH_WIDE_MAGIC, fields, batch);
+		return;
+	}
+
+	ProposalBatch msg;
+	msg.m_values = values;
+
+	deps::Encoder encoder;
+	encoder.serialize(ProposalBatch::cmd, msg);
+	batch.assign(encoder.data(), encoder.size());
+}
+
+/**
+ * @brief 解包议题value，空value(空洞填充的no-op)解出来是空的命令列表
+ */
+bool ProposalBatcher::decode(const std::string& batch, std::vector<std::string>& values)
+{
+	values.clear();
+	if (batch.empty())
+	{
+		return true;
+	}
+	if (WideCodec::isWide(batch))
+	{
+		if (!WideCodec::decode(batch, PAXOS_BATCH_WIDE_MAGIC, values))
+		{
+			LOG_ERROR("invalid wide proposal batch size:%zd", batch.size());
+			return false;
+		}
+		return true;
+	}
+	if (batch.size() < deps::Decoder::minSize() || 
+		deps::Decoder::pickLen(batch.data()) != batch.size() ||
+		deps::Decoder::pickSubCmd(batch.data()) != ProposalBatch::cmd)
+	{
+		LOG_ERROR("invalid proposal batch size:%zd", batch.size());
+		return false;
+	}
+
+	ProposalBatch msg;
+	deps::PacketHeader header;
+	deps::Decoder decoder(batch.data(), batch.size());
+	decoder.deserialize(header, msg);
+	values.swap(msg.m_values);
+	return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "net/marshall.h"
+
+enum{
+	PAXOS_BATCH_PROPOSAL = 1,
+};
+
+//放不进deps包的大批次用宽编码，魔数"PXBT"
+const uint32_t PAXOS_BATCH_WIDE_MAGIC = 0x54425850;
+
+/**
+ * @brief 打包在一个议题value里的多个客户端命令
+ * 
+ */
+struct ProposalBatch : public deps::Marshallable{
+	enum{cmd = PAXOS_BATCH_PROPOSAL};
+	std::vector<std::string> m_values;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_values;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_values;
+	}
+};
+
+/**
+ * @brief leader在Proposer前面的攒批阶段：命令个数、字节数达到上限，或者最早的命令等待超过最大延迟时，
+ * 	把攒下的命令打包成一个议题value提交，多个命令只需要一轮Accept/Permit。
+ * 
+ */
+class ProposalBatcher
+{
+public:
+	ProposalBatcher(size_t maxCount, size_t maxBytes, uint64_t maxDelayUs, 
+		std::function<void(const std::string&)> flushCallback);
+	~ProposalBatcher();
+
+	void add(const std::string& value);
+	void poll();
+	void flush();
+	size_t size() const;
+
+	static void encode(const std::vector<std::string>& values, std::string& batch);
+	static bool decode(const std::string& batch, std::vector<std::string>& values);
+private:
+	//一批最多的命令个数
+	size_t m_maxCount;
+	//一批最多的字节数
+	size_t m_maxBytes;
+	//最早的命令最多等待的时间，单位微秒
+	uint64_t m_maxDelayUs;
+	//打包好的议题value交给Proposer
+	std::function<void(const std::string&)> m_flushCallback;
+
+	//攒下的命令
+	std::vector<std::string> m_values;
+	//攒下的字节数
+	size_t m_bytes;
+	//最早的命令进入攒批的时间戳，单位微秒
+	uint64_t m_firstTimestamp;
+};
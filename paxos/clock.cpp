@@ -0,0 +1,15 @@
+#include "clock.h"
+
+#include "sys/util.h"
+
+PaxosClock::Source PaxosClock::s_source = deps::GetMonoTimeUs;
+
+uint64_t PaxosClock::nowUs()
+{
+	return s_source();
+}
+
+void PaxosClock::setSource(Source source)
+{
+	s_source = source;
+}
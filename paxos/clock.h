@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief 协议层用的单调时钟，单位微秒。默认是deps::GetMonoTimeUs，模拟器换成虚拟时钟以后
+ * 	心跳超时、租约、攒批延迟都按虚拟时间推进，结果可以复现
+ * 
+ */
+class PaxosClock
+{
+public:
+	typedef uint64_t (*Source)();
+
+	static uint64_t nowUs();
+	//只能在启动时、还没有创建PaxosNode之前替换
+	static void setSource(Source source);
+private:
+	static Source s_source;
+};
@@ -0,0 +1,120 @@
+#include "histogram.h"
+
+LatencyHistogram::LatencyHistogram()
+{
+	reset();
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+	++m_counts[indexOf(value)];
+	++m_count;
+	m_sum += value;
+	if (m_count == 1 || value < m_min)
+	{
+		m_min = value;
+	}
+	if (value > m_max)
+	{
+		m_max = value;
+	}
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+	if (m_count == 0)
+	{
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(p / 100 * m_count + 0.5);
+	if (rank == 0)
+	{
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		seen += m_counts[i];
+		if (seen >= rank)
+		{
+			uint64_t upper = upperBoundOf(i);
+			return upper < m_max ? upper : m_max;
+		}
+	}
+	return m_max;
+}
+
+uint64_t LatencyHistogram::count() const
+{
+	return m_count;
+}
+
+uint64_t LatencyHistogram::min() const
+{
+	return m_min;
+}
+
+uint64_t LatencyHistogram::max() const
+{
+	return m_max;
+}
+
+uint64_t LatencyHistogram::mean() const
+{
+	return m_count > 0 ? m_sum / m_count : 0;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+	if (other.m_count == 0)
+	{
+		return;
+	}
+	for (size_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		m_counts[i] += other.m_counts[i];
+	}
+	if (m_count == 0 || other.m_min < m_min)
+	{
+		m_min = other.m_min;
+	}
+	if (other.m_max > m_max)
+	{
+		m_max = other.m_max;
+	}
+	m_count += other.m_count;
+	m_sum += other.m_sum;
+}
+
+void LatencyHistogram::reset()
+{
+	memset(m_counts, 0, sizeof(m_counts));
+	m_count = 0;
+	m_sum = 0;
+	m_min = 0;
+	m_max = 0;
+}
+
+size_t LatencyHistogram::indexOf(uint64_t value)
+{
+	if (value < LINEAR_COUNT)
+	{
+		return value;
+	}
+	//最高位是第msb位，右移以后保留SUB_BUCKET_BITS+1位，最高位一定是1
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - SUB_BUCKET_BITS;
+	uint64_t mantissa = value >> shift;
+	return LINEAR_COUNT + (shift - 1) * SUB_BUCKET_COUNT + (mantissa - SUB_BUCKET_COUNT);
+}
+
+uint64_t LatencyHistogram::upperBoundOf(size_t index)
+{
+	if (index < LINEAR_COUNT)
+	{
+		return index;
+	}
+	int shift = (index - LINEAR_COUNT) / SUB_BUCKET_COUNT + 1;
+	uint64_t mantissa = (index - LINEAR_COUNT) % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+	return ((mantissa + 1) << shift) - 1;
+}
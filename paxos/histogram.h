@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief HDR风格的对数线性直方图，记录微秒级的耗时。每个2的幂区间再分成32个子桶，
+ * 	相对误差不超过1/32，覆盖整个uint64范围。固定大小的数组，记录是O(1)且不分配内存，线上可以一直开着。
+ * 
+ */
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void record(uint64_t value);
+	//百分位数，p取0到100，返回所在子桶的上界(不超过记录过的最大值)
+	uint64_t percentile(double p) const;
+	uint64_t count() const;
+	uint64_t min() const;
+	uint64_t max() const;
+	uint64_t mean() const;
+	void merge(const LatencyHistogram& other);
+	void reset();
+private:
+	enum{
+		SUB_BUCKET_BITS = 5,
+		SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS,
+		//小于2*SUB_BUCKET_COUNT的值每个值一个桶，之后每个2的幂区间SUB_BUCKET_COUNT个桶
+		LINEAR_COUNT = SUB_BUCKET_COUNT * 2,
+		BUCKET_COUNT = LINEAR_COUNT + (64 - SUB_BUCKET_BITS - 1) * SUB_BUCKET_COUNT,
+	};
+	static size_t indexOf(uint64_t value);
+	static uint64_t upperBoundOf(size_t index);
+private:
+	uint64_t m_counts[BUCKET_COUNT];
+	uint64_t m_count;
+	uint64_t m_sum;
+	uint64_t m_min;
+	uint64_t m_max;
+};
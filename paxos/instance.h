@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "net/marshall.h"
+#include "proposalid.h"
+
+/**
+ * @brief 复制日志中的一个实例(slot)：Acceptor在该实例上批准的议题编号和议题value
+ *
+ */
+struct PaxosInstance : public deps::Marshallable
+{
+	PaxosInstance():m_instanceID(0){}
+	PaxosInstance(uint64_t instanceID, const ProposalID& acceptedID, const std::string& acceptedValue):
+		m_instanceID(instanceID), m_acceptedID(acceptedID), m_acceptedValue(acceptedValue){}
+	~PaxosInstance(){}
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_instanceID << m_acceptedID << m_acceptedValue;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_instanceID >> m_acceptedID >> m_acceptedValue;
+	}
+
+	//实例编号
+	uint64_t m_instanceID;
+	//该实例上批准的议题编号
+	ProposalID m_acceptedID;
+	//该实例上批准的议题value
+	std::string m_acceptedValue;
+};
@@ -1,102 +1,240 @@
 #include "learner.h"
 
-Learner::Learner(Messenger& messenger, const std::string& learnerUID, int quorumSize ):m_messenger(messenger)
+Learner::Learner(Messenger& messenger, NodeID learnerUID, 
+	const MembershipSchedule& memberships, const PayloadStore& payloads):
+	m_messenger(messenger),m_memberships(memberships),m_payloads(payloads)
 {
     m_learnerUID = learnerUID;
-    m_quorumSize = quorumSize;
+    m_commitInstanceID = 0;
+    m_active = true;
 }
 
 Learner::~Learner(){}
 
 /**
- * @brief 整个状态机是否已经结束
+ * @brief 实例是否已经达成一致
  * 
- * @return true 
- * @return false 
+ * @param instanceID 实例编号
  */
-bool Learner::isComplete() 
+bool Learner::isChosen(uint64_t instanceID) 
 {
-	//议题已经达成最终一致
-    return !m_finalValue.empty();
+    return instanceID < m_commitInstanceID || m_chosen.find(instanceID) != m_chosen.end();
 }
 
 /**
  * @brief 
  * @fromUID Acceptor的UID
  * @proposalID accept请求携带的议题编号
+ * @instanceID 实例编号
  * @acceptedValue accept请求携带的议题值
+ * @return 该实例是否因为这次批准而达成一致
  */
-void Learner::receiveAccepted(const std::string& fromUID, const ProposalID& proposalID, 
-    const std::string& acceptedValue) 
+bool Learner::receiveAccepted(NodeID fromUID, const ProposalID& proposalID, 
+    uint64_t instanceID, const std::string& acceptedValue) 
 {
-	//状态机已经结束
-    if (isComplete())
+	//实例已经达成一致
+    if (isChosen(instanceID))
     {
-        return;
+        return false;
     }
 
     //议题编号无效
     if(!proposalID.isValid())
     {
-        return;
+        return false;
     }
 
+    Instance& instance = m_instances[instanceID];
+
 	//Acceptor的新议题的编号小于等于老议题编号，直接丢弃accept请求
-    auto itrOld = m_acceptors.find(fromUID);
-    if(itrOld != m_acceptors.end() && (proposalID < itrOld->second || proposalID == itrOld->second))
+    auto itrOld = instance.m_acceptors.find(fromUID);
+    if(itrOld != instance.m_acceptors.end() && (proposalID < itrOld->second || proposalID == itrOld->second))
     {
-        return;
+        return false;
     }
-    //记录Acceptor批准的新的议题状态
-    m_acceptors[fromUID] = proposalID;
     
     //更新老议题的状态
-    if (itrOld != m_acceptors.end())
+    if (itrOld != instance.m_acceptors.end())
     {
-		Proposal& oldProposal = m_proposals[itrOld->second];
+		Proposal& oldProposal = instance.m_proposals[itrOld->second];
 		oldProposal.m_retentionCount -= 1;
 		if (oldProposal.m_retentionCount == 0)
 		{
-			m_proposals.erase(itrOld->second);
+			instance.m_proposals.erase(itrOld->second);
 		}
     }
+    //记录Acceptor批准的新的议题状态
+    instance.m_acceptors[fromUID] = proposalID;
     
 	//更新新议题的状态
-    auto itrNew = m_proposals.find(proposalID);
-    if (itrNew == m_proposals.end())
+    auto itrNew = instance.m_proposals.find(proposalID);
+    if (itrNew == instance.m_proposals.end())
     {
-        m_proposals.insert(std::make_pair(proposalID, Proposal(0, 0, acceptedValue)));
+        itrNew = instance.m_proposals.insert(std::make_pair(proposalID, Proposal(0, acceptedValue))).first;
 	}
-    else
+    itrNew->second.m_voters.insert(fromUID);
+    itrNew->second.m_retentionCount += 1;
+    if (!checkChosen(instanceID))
+    {
+        return false;
+    }
+    resolve();
+    return true;
+}
+
+/**
+ * @brief leader已经确定这个实例达成一致，本地批准过的同一个议题就是选定的值，直接按顺序通知
+ */
+void Learner::receiveCommit(const PaxosInstance& instance)
+{
+    if (instance.m_instanceID < m_commitInstanceID || m_chosen.find(instance.m_instanceID) != m_chosen.end())
+    {
+        return;
+    }
+    m_instances.erase(instance.m_instanceID);
+    m_chosen[instance.m_instanceID] = instance;
+    m_newlyChosen.push_back(instance);
+    resolve();
+}
+
+/**
+ * @brief 按照实例上生效的配置检查是否有议题拿到了accept quorum，只有配置里的Acceptor计票
+ * 
+ * @return 实例是否达成一致
+ */
+bool Learner::checkChosen(uint64_t instanceID)
+{
+    //更早的成员变更还没有通知到，不知道这个实例上生效的配置
+    if (instanceID >= m_commitInstanceID + m_memberships.getAlpha())
+    {
+        return false;
+    }
+    auto itr = m_instances.find(instanceID);
+    if (itr == m_instances.end())
+    {
+        return false;
+    }
+    const Membership& membership = m_memberships.at(instanceID);
+    for (auto& proposal : itr->second.m_proposals)
+    {
+        if (membership.isAcceptQuorum(proposal.second.m_voters))
+        {
+            PaxosInstance chosen(instanceID, proposal.first, proposal.second.m_value);
+            m_chosen[instanceID] = chosen;
+            m_newlyChosen.push_back(chosen);
+            m_instances.erase(itr);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 按照实例编号的顺序通知已经达成一致的议题，遇到空洞或者payload还没有到的摘要就停下来
+ * 
+ */
+void Learner::resolve()
+{
+    auto itr = m_chosen.begin();
+    while (itr != m_chosen.end() && itr->first == m_commitInstanceID)
     {
-        itrNew->second.m_acceptCount    += 1;
-        itrNew->second.m_retentionCount += 1;
-        //批准个数满足大多数的条件
-        if (itrNew->second.m_acceptCount >= m_quorumSize) 
+        PaxosInstance& instance = itr->second;
+        const std::string* value = &instance.m_acceptedValue;
+        if (PayloadStore::isDigest(*value))
         {
-            m_finalProposalID = proposalID;
-            m_finalValue      = acceptedValue;
-            m_proposals.clear();
-            m_acceptors.clear();
-            
-            m_messenger.onResolution(proposalID, acceptedValue);
+            value = m_payloads.find(*value);
+            if (value == nullptr)
+            {
+                break;
+            }
         }
+        //通知时可能发生成员变更，先把窗口移过去，新进入窗口的实例按照变更后的配置重新计票
+        uint64_t windowEnd = m_commitInstanceID + m_memberships.getAlpha();
+        m_messenger.onResolution(instance.m_instanceID, instance.m_acceptedID, *value);
+        ++m_commitInstanceID;
+        m_chosen.erase(itr);
+        auto pending = m_instances.lower_bound(windowEnd);
+        while (pending != m_instances.end() && pending->first < m_commitInstanceID + m_memberships.getAlpha())
+        {
+            uint64_t instanceID = (pending++)->first;
+            checkChosen(instanceID);
+        }
+        itr = m_chosen.begin();
     }
 }
 
-std::string Learner::getFinalValue() 
+/**
+ * @brief 取走上次取走以后达成一致的实例，包括因为窗口移动才达成一致的实例
+ */
+void Learner::takeChosen(std::vector<PaxosInstance>& chosen)
+{
+    chosen.clear();
+    chosen.swap(m_newlyChosen);
+}
+
+/**
+ * @brief 获取下一个需要按顺序通知的实例编号
+ */
+uint64_t Learner::getCommitInstanceID() 
+{
+    return m_commitInstanceID;
+}
+
+/**
+ * @brief 获取已经达成一致但是前面还有空洞，没有按顺序通知出去的实例个数
+ */
+size_t Learner::numUnresolvedChosen()
+{
+    return m_chosen.size();
+}
+
+/**
+ * @brief 下一个要通知的实例已经达成一致，选定的是摘要并且本地还没有对应的payload
+ */
+bool Learner::getMissingPayload(std::string& digest)
 {
-    return m_finalValue;
+    auto itr = m_chosen.begin();
+    if (itr == m_chosen.end() || itr->first != m_commitInstanceID)
+    {
+        return false;
+    }
+    const std::string& value = itr->second.m_acceptedValue;
+    if (!PayloadStore::isDigest(value) || m_payloads.contains(value))
+    {
+        return false;
+    }
+    digest = value;
+    return true;
 }
 
-ProposalID Learner::getFinalProposalID() 
+void Learner::receivePayload(const std::string& digest)
 {
-    return m_finalProposalID;
+    auto itr = m_chosen.begin();
+    if (itr != m_chosen.end() && itr->first == m_commitInstanceID && itr->second.m_acceptedValue == digest)
+    {
+        resolve();
+    }
 }
 
-int Learner::getQuorumSize() 
+/**
+ * @brief 编号小于instanceID的实例已经包含在状态机快照里，丢弃这些实例的状态，不再通知
+ */
+void Learner::truncate(uint64_t instanceID) 
 {
-    return m_quorumSize;
+    m_instances.erase(m_instances.begin(), m_instances.lower_bound(instanceID));
+    m_chosen.erase(m_chosen.begin(), m_chosen.lower_bound(instanceID));
+    if (m_commitInstanceID < instanceID)
+    {
+        m_commitInstanceID = instanceID;
+        //窗口整体移动，窗口里积攒的投票重新计票
+        auto pending = m_instances.begin();
+        while (pending != m_instances.end() && pending->first < m_commitInstanceID + m_memberships.getAlpha())
+        {
+            uint64_t pendingID = (pending++)->first;
+            checkChosen(pendingID);
+        }
+    }
+    resolve();
 }
 
 bool Learner::isActive()
@@ -107,4 +245,4 @@ bool Learner::isActive()
 void Learner::setActive(bool active)
 {
 	m_active = active;
-}
\ No newline at end of file
+}
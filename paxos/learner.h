@@ -2,9 +2,13 @@
 
 #include "proposalid.h"
 #include "messenger.h"
+#include "membership.h"
+#include "payload.h"
 
 #include <string>
 #include <map>
+#include <set>
+#include <vector>
 
 class Learner
 {
@@ -12,40 +16,65 @@ class Learner
 struct Proposal
 {
 	Proposal(){}
-    Proposal(int acceptCount, int retentionCount, const std::string& value) : 
-		m_acceptCount(acceptCount),m_retentionCount(retentionCount),m_value(value){}
+    Proposal(int retentionCount, const std::string& value) : 
+		m_retentionCount(retentionCount),m_value(value){}
 	~Proposal(){}
-	//只要是批准过该议题的都加1
-    int    m_acceptCount;
+	//批准过该议题的Acceptor，按照实例上生效的配置判断是否构成quorum
+    std::set<NodeID> m_voters;
 	//只有当前还保持批准状态才算
     int    m_retentionCount;
     std::string m_value;
 };
 
+//单个实例上还没有达成一致时的投票状态
+struct Instance
+{
+	//记录Proposal的状态
+	std::map<ProposalID, Proposal> m_proposals;
+	//记录Acceptor的状态
+	std::map<NodeID, ProposalID>  m_acceptors;
+};
+
 public:
-    Learner(Messenger& messenger, const std::string& learnerUID, int quorumSize);
+    Learner(Messenger& messenger, NodeID learnerUID, const MembershipSchedule& memberships, 
+		const PayloadStore& payloads);
 	~Learner();
-	bool isComplete();
-	void receiveAccepted(const std::string& fromUID, const ProposalID& proposalID, 
-		const std::string& acceptedValue);
+	bool isChosen(uint64_t instanceID);
+	bool receiveAccepted(NodeID fromUID, const ProposalID& proposalID, 
+		uint64_t instanceID, const std::string& acceptedValue);
+	//leader通知已经达成一致的实例，不需要计票
+	void receiveCommit(const PaxosInstance& instance);
 		
-    std::string getFinalValue();
-	ProposalID getFinalProposalID();
-	int getQuorumSize();
+	//取走上次取走以后达成一致的实例
+	void takeChosen(std::vector<PaxosInstance>& chosen);
+	uint64_t getCommitInstanceID();
+	size_t numUnresolvedChosen();
+	//下一个要通知的实例已经达成一致，但是摘要对应的payload还没有到
+	bool getMissingPayload(std::string& digest);
+	//收到了payload，继续按顺序通知
+	void receivePayload(const std::string& digest);
+	void truncate(uint64_t instanceID);
 	bool isActive();
 	void setActive(bool active);
+private:
+	bool checkChosen(uint64_t instanceID);
+	void resolve();
 private:
 	Messenger& m_messenger;
-	std::string    m_learnerUID;
-	int            m_quorumSize;
-	//记录Proposal的状态
-	std::map<ProposalID, Proposal> m_proposals;
-	//记录Acceptor的状态
-	std::map<std::string,  ProposalID>  m_acceptors;
-	//最终达成一致的议题值
-	std::string m_finalValue;
-	//最终达成一致的议题编号
-	ProposalID m_finalProposalID;
+	NodeID    m_learnerUID;
+	//每个实例上生效的配置。[m_commitInstanceID, m_commitInstanceID + alpha)之外的实例
+	//可能还有没有通知到的成员变更，先只记票，不判断是否达成一致
+	const MembershipSchedule& m_memberships;
+	//通知时把摘要换回payload
+	const PayloadStore& m_payloads;
+	//还没有达成一致的实例
+	std::map<uint64_t, Instance> m_instances;
+	//已经达成一致但是还没有按顺序通知出去的实例
+	std::map<uint64_t, PaxosInstance> m_chosen;
+	//下一个需要按顺序通知的实例编号，小于它的实例都已经达成一致并且通知过
+	uint64_t m_commitInstanceID;
+	//达成一致以后还没有被取走的实例
+	std::vector<PaxosInstance> m_newlyChosen;
 
 	bool m_active;
-};
\ No newline at end of file
+};
@@ -0,0 +1,263 @@
+#include "membership.h"
+
+#include "net/packet.h"
+
+Membership::Membership():m_prepareQuorum(0), m_acceptQuorum(0)
+{
+}
+
+Membership::Membership(const std::set<NodeID>& acceptors, size_t prepareQuorum, size_t acceptQuorum):
+	m_acceptors(acceptors), m_prepareQuorum(prepareQuorum), m_acceptQuorum(acceptQuorum)
+{
+}
+
+bool Membership::isOpen() const
+{
+	return m_acceptors.empty();
+}
+
+bool Membership::contains(NodeID nodeID) const
+{
+	return isOpen() || m_acceptors.find(nodeID) != m_acceptors.end();
+}
+
+size_t Membership::getPrepareQuorumSize() const
+{
+	return m_prepareQuorum > 0 ? m_prepareQuorum : m_acceptors.size() / 2 + 1;
+}
+
+size_t Membership::getAcceptQuorumSize() const
+{
+	return m_acceptQuorum > 0 ? m_acceptQuorum : m_acceptors.size() / 2 + 1;
+}
+
+size_t Membership::countVotes(const std::set<NodeID>& voters) const
+{
+	if (isOpen())
+	{
+		return voters.size();
+	}
+	size_t count = 0;
+	for (auto nodeID : voters)
+	{
+		if (m_acceptors.find(nodeID) != m_acceptors.end())
+		{
+			++count;
+		}
+	}
+	return count;
+}
+
+bool Membership::isPrepareQuorum(const std::set<NodeID>& voters) const
+{
+	return countVotes(voters) >= getPrepareQuorumSize();
+}
+
+bool Membership::isAcceptQuorum(const std::set<NodeID>& voters) const
+{
+	return countVotes(voters) >= getAcceptQuorumSize();
+}
+
+/**
+ * @brief 不限制成员时Acceptor总数未知，只能由部署保证quorum大小
+ */
+bool Membership::isValid() const
+{
+	if (isOpen())
+	{
+		return m_prepareQuorum > 0 && m_acceptQuorum > 0;
+	}
+	size_t prepareQuorum = getPrepareQuorumSize();
+	size_t acceptQuorum = getAcceptQuorumSize();
+	return prepareQuorum <= m_acceptors.size() && acceptQuorum <= m_acceptors.size() &&
+		prepareQuorum + acceptQuorum > m_acceptors.size();
+}
+
+/**
+ * @brief 新旧配置交替生效的那段时间里，换主的leader可能只在其中一个配置里拿到承诺，
+ * 	所以旧配置的Q1要和新配置的任意Q2相交，新配置的Q1也要和旧配置的任意Q2相交。
+ * 	从不限制成员切换到限制成员时没法判断，只检查新配置本身
+ */
+bool Membership::canChangeTo(const Membership& next) const
+{
+	if (!next.isValid() || next.isOpen())
+	{
+		return false;
+	}
+	if (isOpen())
+	{
+		return true;
+	}
+	std::set<NodeID> all(m_acceptors);
+	all.insert(next.m_acceptors.begin(), next.m_acceptors.end());
+	//两个quorum都尽量用只属于自己那边的节点，剩下的落在交集里，个数之和超过并集大小才一定相交
+	return getPrepareQuorumSize() + next.getAcceptQuorumSize() > all.size() &&
+		next.getPrepareQuorumSize() + getAcceptQuorumSize() > all.size();
+}
+
+bool Membership::operator==(const Membership& other) const
+{
+	return m_acceptors == other.m_acceptors && getPrepareQuorumSize() == other.getPrepareQuorumSize() &&
+		getAcceptQuorumSize() == other.getAcceptQuorumSize();
+}
+
+bool Membership::operator!=(const Membership& other) const
+{
+	return !(*this == other);
+}
+
+std::string Membership::toString() const
+{
+	std::string str = "{";
+	for (auto nodeID : m_acceptors)
+	{
+		if (str.size() > 1)
+		{
+			str += ",";
+		}
+		str += std::to_string(nodeID);
+	}
+	if (isOpen())
+	{
+		str += "*";
+	}
+	str += "} q1:" + std::to_string(getPrepareQuorumSize()) + " q2:" + std::to_string(getAcceptQuorumSize());
+	return str;
+}
+
+void Membership::encodeCommand(const Membership& membership, std::string& command)
+{
+	deps::Encoder encoder;
+	encoder.serialize(PAXOS_MEMBERSHIP_COMMAND, membership);
+	command.assign(encoder.data(), encoder.size());
+}
+
+/**
+ * @brief 不是成员变更命令时返回false，交给状态机执行
+ */
+bool Membership::decodeCommand(const std::string& command, Membership& membership)
+{
+	if (command.size() < deps::Decoder::minSize() ||
+		deps::Decoder::pickLen(command.data()) != command.size() ||
+		deps::Decoder::pickSubCmd(command.data()) != PAXOS_MEMBERSHIP_COMMAND)
+	{
+		return false;
+	}
+	deps::PacketHeader header;
+	deps::Decoder decoder(command.data(), command.size());
+	decoder.deserialize(header, membership);
+	return true;
+}
+
+void Membership::marshal(deps::Pack & pk) const
+{
+	pk << m_acceptors << m_prepareQuorum << m_acceptQuorum;
+}
+
+void Membership::unmarshal(const deps::Unpack &up)
+{
+	m_acceptors.clear();
+	up >> m_acceptors >> m_prepareQuorum >> m_acceptQuorum;
+}
+
+MembershipSchedule::MembershipSchedule(const Membership& initial, size_t alpha)
+{
+	m_memberships[0] = initial;
+	m_alpha = alpha > 0 ? alpha : 1;
+}
+
+size_t MembershipSchedule::getAlpha() const
+{
+	return m_alpha;
+}
+
+void MembershipSchedule::add(uint64_t startInstanceID, const Membership& membership)
+{
+	//之后生效的配置作废，重新从快照恢复时会再次添加
+	m_memberships.erase(m_memberships.lower_bound(startInstanceID), m_memberships.end());
+	m_memberships[startInstanceID] = membership;
+}
+
+const Membership& MembershipSchedule::at(uint64_t instanceID) const
+{
+	//第一个配置从0开始生效，upper_bound不会返回begin
+	auto itr = m_memberships.upper_bound(instanceID);
+	--itr;
+	return itr->second;
+}
+
+const Membership& MembershipSchedule::latest() const
+{
+	return m_memberships.rbegin()->second;
+}
+
+uint64_t MembershipSchedule::getLatestStart() const
+{
+	return m_memberships.rbegin()->first;
+}
+
+void MembershipSchedule::getMemberships(uint64_t instanceID, std::vector<const Membership*>& memberships) const
+{
+	memberships.clear();
+	auto itr = m_memberships.upper_bound(instanceID);
+	--itr;
+	for (; itr != m_memberships.end(); ++itr)
+	{
+		memberships.push_back(&itr->second);
+	}
+}
+
+bool MembershipSchedule::isPrepareQuorum(uint64_t instanceID, const std::set<NodeID>& voters) const
+{
+	auto itr = m_memberships.upper_bound(instanceID);
+	--itr;
+	for (; itr != m_memberships.end(); ++itr)
+	{
+		if (!itr->second.isPrepareQuorum(voters))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool MembershipSchedule::isAcceptQuorum(uint64_t instanceID, const std::set<NodeID>& voters) const
+{
+	auto itr = m_memberships.upper_bound(instanceID);
+	--itr;
+	for (; itr != m_memberships.end(); ++itr)
+	{
+		if (!itr->second.isAcceptQuorum(voters))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void MembershipSchedule::truncate(uint64_t instanceID)
+{
+	auto itr = m_memberships.upper_bound(instanceID);
+	--itr;
+	if (itr != m_memberships.begin())
+	{
+		//保留的第一个配置从0开始生效，at()对更早的实例也有结果
+		Membership membership = itr->second;
+		m_memberships.erase(m_memberships.begin(), ++itr);
+		m_memberships[0] = membership;
+	}
+}
+
+void MembershipSchedule::getSchedule(uint64_t instanceID, uint64_t endInstanceID, std::vector<uint64_t>& starts, 
+	std::vector<Membership>& memberships) const
+{
+	starts.clear();
+	memberships.clear();
+	auto itr = m_memberships.upper_bound(instanceID);
+	--itr;
+	for (; itr != m_memberships.end() && (starts.empty() || itr->first < endInstanceID); ++itr)
+	{
+		starts.push_back(itr->first);
+		memberships.push_back(itr->second);
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <set>
+#include <map>
+#include <vector>
+
+#include "net/marshall.h"
+#include "proposalid.h"
+
+enum{
+	//成员变更命令和状态机命令打包在同一个批次里，子命令号不能和状态机命令的子命令号冲突
+	PAXOS_MEMBERSHIP_COMMAND = 0x4d50,
+};
+
+/**
+ * @brief 一个配置：有投票权的Acceptor集合和两个阶段的quorum大小(Flexible Paxos)。
+ * 	Acceptor集合为空表示不限制成员，任何节点的响应都计数，兼容没有配置成员的部署。
+ */
+struct Membership : public deps::Marshallable
+{
+	Membership();
+	Membership(const std::set<NodeID>& acceptors, size_t prepareQuorum, size_t acceptQuorum);
+
+	bool isOpen() const;
+	bool contains(NodeID nodeID) const;
+	//quorum大小，配置里为0时取多数派
+	size_t getPrepareQuorumSize() const;
+	size_t getAcceptQuorumSize() const;
+	//voters里有投票权的节点个数
+	size_t countVotes(const std::set<NodeID>& voters) const;
+	bool isPrepareQuorum(const std::set<NodeID>& voters) const;
+	bool isAcceptQuorum(const std::set<NodeID>& voters) const;
+	//任意prepare quorum和任意accept quorum相交
+	bool isValid() const;
+	//切换到next以后，新旧配置之间任意prepare quorum和accept quorum也相交，一次只能加减少量节点
+	bool canChangeTo(const Membership& next) const;
+	bool operator==(const Membership& other) const;
+	bool operator!=(const Membership& other) const;
+	std::string toString() const;
+
+	//成员变更作为普通命令写进复制日志，用前缀和业务命令区分
+	static void encodeCommand(const Membership& membership, std::string& command);
+	static bool decodeCommand(const std::string& command, Membership& membership);
+
+	virtual void marshal(deps::Pack & pk) const;
+	virtual void unmarshal(const deps::Unpack &up);
+
+	std::set<NodeID> m_acceptors;
+	uint16_t m_prepareQuorum;
+	uint16_t m_acceptQuorum;
+};
+
+/**
+ * @brief 按照实例编号生效的配置序列(alpha窗口)。实例c上决议的成员变更从c + alpha开始生效，
+ * 	leader同时只会给[第一个未决实例, 第一个未决实例 + alpha)分配实例，用新配置的实例一定在变更达成一致之后才会发出。
+ * 	换主时新leader在所有还可能生效的配置里都要拿到prepare quorum。
+ */
+class MembershipSchedule
+{
+public:
+	//alpha取accept窗口的倍数，丢包造成的空洞在这个范围内不会挡住后面的实例
+	enum { ALPHA_WINDOWS = 16 };
+
+	MembershipSchedule(const Membership& initial, size_t alpha);
+
+	//成员变更在决议以后隔多少个实例生效(alpha)
+	size_t getAlpha() const;
+	//startInstanceID开始生效的配置
+	void add(uint64_t startInstanceID, const Membership& membership);
+	//instanceID上生效的配置
+	const Membership& at(uint64_t instanceID) const;
+	const Membership& latest() const;
+	uint64_t getLatestStart() const;
+	//instanceID以及之后生效的所有配置
+	void getMemberships(uint64_t instanceID, std::vector<const Membership*>& memberships) const;
+	//voters在instanceID以及之后生效的每个配置里都构成quorum
+	bool isPrepareQuorum(uint64_t instanceID, const std::set<NodeID>& voters) const;
+	bool isAcceptQuorum(uint64_t instanceID, const std::set<NodeID>& voters) const;
+	//只保留instanceID上生效的配置和之后的配置
+	void truncate(uint64_t instanceID);
+	//instanceID上生效的配置和在endInstanceID之前开始生效的配置，按起始实例排列
+	void getSchedule(uint64_t instanceID, uint64_t endInstanceID, std::vector<uint64_t>& starts, 
+		std::vector<Membership>& memberships) const;
+private:
+	//生效的起始实例编号 -> 配置
+	std::map<uint64_t, Membership> m_memberships;
+	size_t m_alpha;
+};
@@ -1,41 +1,69 @@
 #pragma once
 
 #include "proposalid.h"
+#include "instance.h"
 #include <functional>
+#include <vector>
 
 class Messenger
 {
 public:
-    //发送prepare请求
-    virtual void sendPrepare(const ProposalID& proposalID) = 0;
-    //发送prepare请求的承诺
-    virtual void sendPromise(const std::string& toUID, const ProposalID& proposalID, 
-        const ProposalID& acceptID, const std::string& acceptValue) = 0;
-    //发送accept请求
-    virtual void sendAccept(const ProposalID&  proposalID, 
-		const std::string& proposalValue) = 0;
+    //发送prepare请求，承诺的范围是所有编号大于等于instanceID的实例
+    virtual void sendPrepare(const ProposalID& proposalID, uint64_t instanceID) = 0;
+    //发送prepare请求的承诺，携带编号大于等于instanceID的实例上已经批准的议题
+    virtual void sendPromise(NodeID toUID, const ProposalID& proposalID, 
+        uint64_t instanceID, const std::vector<PaxosInstance>& acceptedInstances) = 0;
+    //发送accept请求，捎带leader已经确定的实例编号上界commitInstanceID
+    virtual void sendAccept(const ProposalID&  proposalID, uint64_t instanceID, 
+		const std::string& proposalValue, uint64_t commitInstanceID) = 0;
     //发送accept请求的批准
-    virtual void sendPermit(const std::string& proposerUID, const ProposalID&  proposalID, 
-		const std::string& acceptedValue) = 0;
-    //发送已经选定的协议号
-    virtual void onResolution(const ProposalID&  proposalID, 
+    virtual void sendPermit(NodeID proposerUID, const ProposalID&  proposalID, 
+		uint64_t instanceID, const std::string& acceptedValue) = 0;
+    //按照实例编号顺序通知已经选定的议题
+    virtual void onResolution(uint64_t instanceID, const ProposalID&  proposalID, 
 		const std::string& value) = 0;
 
-	//发送prepare请求的ack
-	virtual void sendPrepareNACK(const std::string& proposerUID, const ProposalID& proposalID, 
-		const ProposalID& promisedID)= 0;
-	//发送accept请求的ack
-	virtual void sendAcceptNACK(const std::string& proposerUID, const ProposalID& proposalID, 
-		const ProposalID& promisedID) = 0;
+	//发送prepare请求的ack，捎带Acceptor截断到的实例编号
+	virtual void sendPrepareNACK(NodeID proposerUID, const ProposalID& proposalID, 
+		const ProposalID& promisedID, uint64_t truncatedInstanceID)= 0;
+	//发送accept请求的ack，捎带Acceptor截断到的实例编号
+	virtual void sendAcceptNACK(NodeID proposerUID, const ProposalID& proposalID, 
+		uint64_t instanceID, const ProposalID& promisedID, uint64_t truncatedInstanceID) = 0;
 	
 	//尝试成为leader
 	virtual void onLeadershipAcquired() = 0;
 	//自己失去leader权限
 	virtual void onLeadershipLost() = 0;
 	//leadership发生变更，UID或者proposalID只要发生变更都可以认为leadership发生变更
-	virtual void onLeadershipChange(const std::string& previousLeaderUID, 
-		const std::string& newLeaderUID) = 0;
+	virtual void onLeadershipChange(NodeID previousLeaderUID, 
+		NodeID newLeaderUID) = 0;
 	
-	//发送心跳
-	virtual void sendHeartbeat(const std::string& leaderUID, const ProposalID& leaderProposalID) = 0;
+	//发送心跳，同时向Acceptor申请leaseDuration微秒的租约，捎带leader已经确定的实例编号上界
+	virtual void sendHeartbeat(NodeID leaderUID, const ProposalID& leaderProposalID,
+		uint64_t timestamp, uint64_t leaseDuration, uint64_t commitInstanceID) = 0;
+	//leader空闲时通知所有节点：小于commitInstanceID的实例都已经达成一致
+	virtual void sendCommit(const ProposalID& proposalID, uint64_t commitInstanceID) = 0;
+	//授予leader租约
+	virtual void sendLeaseGrant(NodeID leaderUID, const ProposalID& leaderProposalID,
+		uint64_t timestamp) = 0;
+	//leader把达成一致的实例推给观察者，toUID为INVALID_NODE_ID时发给所有观察者
+	virtual void sendChosen(NodeID toUID, const ProposalID& proposalID,
+		const std::vector<PaxosInstance>& chosenInstances, uint64_t commitInstanceID) = 0;
+	//观察者向leader请求补发编号大于等于fromInstanceID的实例
+	virtual void sendLearnRequest(NodeID leaderUID, uint64_t fromInstanceID) = 0;
+	//发送摘要对应的payload。toUID为INVALID_NODE_ID时分发给其他所有节点(包括观察者)，
+	//通信层可以只发给一个节点并要求它转发，leader的出口流量和节点个数无关
+	virtual void sendPayload(NodeID toUID, const std::string& digest, const std::string& payload) = 0;
+	//收到要求转发的payload，发给除了自己和sourceUID以外的所有节点
+	virtual void relayPayload(NodeID sourceUID, const std::string& digest, const std::string& payload) = 0;
+	//请求摘要对应的payload，toUID为INVALID_NODE_ID时问所有节点
+	virtual void sendPayloadRequest(NodeID toUID, const std::string& digest) = 0;
+	//提交位置落后于toUID截断到的位置，请求覆盖instanceID之前实例的快照
+	virtual void sendSnapshotRequest(NodeID toUID, uint64_t instanceID) = 0;
+	//本地快照覆盖的实例比instanceID多时把快照发给toUID
+	virtual void sendSnapshot(NodeID toUID, uint64_t instanceID) = 0;
+	//delayUs微秒以后调用PaxosNode::resendAccept(instanceID)，同一个实例再次挂定时器时替换旧的
+	virtual void scheduleResend(uint64_t instanceID, uint64_t delayUs) = 0;
+	//实例已经达成一致，取消它的重发定时器
+	virtual void cancelResend(uint64_t instanceID) = 0;
 };
\ No newline at end of file
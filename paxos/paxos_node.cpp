@@ -1,25 +1,54 @@
 #include "paxos_node.h"
 
 #include <functional>
+#include <algorithm>
 
-#include "sys/util.h"
+#include "clock.h"
 #include "sys/log.h"
 
-PaxosNode::PaxosNode(Messenger& messenger, const std::string& nodeUID, 
-		int quorumSize, int heartbeatPeriod, int heartbeatTimeout, 
-		int livenessWindow, std::string leaderUID):
+//所有成员在提交位置之前保留的实例个数，落后更多的节点只能通过快照追赶
+static const size_t OBSERVER_RETAIN_INSTANCES = 1024;
+//有节点装载快照追赶时最多保留的实例个数，覆盖默认的快照间隔，快照之后的实例不会在它追上之前被丢掉
+static const size_t CATCHUP_RETAIN_INSTANCES = 131072;
+//一次补发的实例个数上限
+static const size_t OBSERVER_LEARN_BATCH = 256;
+//记录的leader提交位置个数上限，超过时丢掉最早的，陈旧程度只会偏大
+static const size_t LEADER_COMMIT_SAMPLES = 1024;
+//快照可能很大，请求以后等这么多个心跳超时还没有装载时再请求一次
+static const uint64_t SNAPSHOT_REQUEST_TIMEOUTS = 10;
+
+PaxosNode::PaxosNode(Messenger& messenger, NodeID nodeUID, 
+		const Membership& membership, int heartbeatPeriod, int heartbeatTimeout, 
+		int livenessWindow, int leaseDuration, size_t acceptWindow, size_t batchCount, size_t batchBytes, 
+		uint64_t batchDelayUs, NodeID leaderUID):
 		m_messenger(messenger),
-		m_proposer(messenger, nodeUID, quorumSize),
-		m_acceptor(messenger, nodeUID, livenessWindow),
-		m_learner(messenger, nodeUID, quorumSize)
+		m_memberships(membership, acceptWindow * MembershipSchedule::ALPHA_WINDOWS),
+		m_proposer(messenger, nodeUID, m_memberships, acceptWindow),
+		m_acceptor(messenger, nodeUID, livenessWindow, leaseDuration),
+		m_learner(messenger, nodeUID, m_memberships, m_payloads),
+		m_batcher(batchCount, batchBytes, batchDelayUs, 
+			std::bind(&PaxosNode::proposeBatch, this, std::placeholders::_1))
 {
 	m_heartbeatPeriod = heartbeatPeriod;
 	m_heartbeatTimeout = heartbeatTimeout;
-	m_lastHeartbeatTimestamp = deps::GetMonoTimeUs();
+	m_lastHeartbeatTimestamp = PaxosClock::nowUs();
+	m_leaseDuration = leaseDuration;
+	m_leaseExpireTimestamp = 0;
+	m_leaseReadInstanceID = 0;
+	m_confirmedHeartbeatTimestamp = 0;
+	m_freshTimestamp = 0;
+	m_learnTimestamp = 0;
+	m_learnedInstanceID = 0;
+	m_payloadThreshold = 0;
+	m_truncatedInstanceID = 0;
+	m_snapshotSourceUID = INVALID_NODE_ID;
+	m_snapshotRequestTimestamp = 0;
+	m_retainInstanceID = 0;
+	m_retainTimestamp = 0;
 	m_leaderUID = leaderUID;
 	m_nodeUID = nodeUID;
 
-	if (!m_leaderUID.empty() && m_nodeUID == m_leaderUID)
+	if (m_leaderUID != INVALID_NODE_ID && m_nodeUID == m_leaderUID)
 	{
 		m_proposer.setLeader(true);
 	}
@@ -53,7 +82,7 @@ void PaxosNode::setActive(bool active)
 	m_learner.setActive(active);
 }
 
-std::string PaxosNode::getLeaderUID()
+NodeID PaxosNode::getLeaderUID()
 {
 	return m_leaderUID;
 }
@@ -84,7 +113,7 @@ void PaxosNode::prepare(bool incrementProposalNumber)
 
 bool PaxosNode::isLeaderAlive() 
 {
-	return deps::GetMonoTimeUs() - m_lastHeartbeatTimestamp <= m_heartbeatTimeout;
+	return PaxosClock::nowUs() - m_lastHeartbeatTimestamp <= m_heartbeatTimeout;
 }
 
 bool PaxosNode::isPrepareExpire()
@@ -94,6 +123,12 @@ bool PaxosNode::isPrepareExpire()
 
 void PaxosNode::pollLiveness()
 {
+	if (isSnapshotRequired())
+	{
+		//别的Acceptor已经截断了本地还没有学到的实例，本地日志补不上这些空洞，装载快照以前不参与选主
+		requestSnapshot();
+		return;
+	}
 	/**
 	 * 发送prepare消息的条件：
 	 * 1. 本地存储的leader信息已经过期，需要重新获取leader信息，目的是为了后续能发送prepare消息。
@@ -101,6 +136,11 @@ void PaxosNode::pollLiveness()
 	*/
 	if (!isLeaderAlive() && isPrepareExpire()) 
 	{
+		//观察者不参与选主，避免和成员抢占Acceptor的承诺
+		if (isObserver())
+		{
+			return;
+		}
 		if (isAcquiringLeadership())
 		{
 			/**
@@ -120,22 +160,23 @@ void PaxosNode::pollLiveness()
 	}
 }
 
-void PaxosNode::receiveHeartbeat(const std::string& localLeaderUID, const ProposalID& localLeaderPrososalID)
+void PaxosNode::receiveHeartbeat(NodeID localLeaderUID, const ProposalID& localLeaderPrososalID)
 {
 	//第一个收到的议题一定会被批准，或者收到的议题编号大于已经批准的最大议题编号也会被批准
 	if (!m_leaderProposalID.isValid() || localLeaderPrososalID > m_leaderProposalID) {
 		m_acquiringLeadership = false;
-		std::string oldLeaderUID = m_leaderUID;
+		NodeID oldLeaderUID = m_leaderUID;
 
-		LOG_INFO("leadership uid:%s proposalid:%s -> uid:%s proposalid:%s", 
-			oldLeaderUID.c_str(), m_leaderProposalID.toString().c_str(),
-			localLeaderUID.c_str(), localLeaderPrososalID.toString().c_str());
+		LOG_INFO("leadership uid:%u proposalid:%s -> uid:%u proposalid:%s", 
+			oldLeaderUID, m_leaderProposalID.toString().c_str(),
+			localLeaderUID, localLeaderPrososalID.toString().c_str());
 
 		m_leaderUID        = localLeaderUID;
 		m_leaderProposalID = localLeaderPrososalID;
 		
 		if (m_proposer.isLeader() && localLeaderUID != m_proposer.getProposerUID()){
 			m_proposer.setLeader(false);
+			failReads();
 			m_messenger.onLeadershipLost();
 			m_proposer.observeProposal(localLeaderUID, localLeaderPrososalID);
 		}
@@ -143,10 +184,202 @@ void PaxosNode::receiveHeartbeat(const std::string& localLeaderUID, const Propos
 		m_messenger.onLeadershipChange(oldLeaderUID, localLeaderUID);
 	}
 	
-	//说明本地存储的leadership是最新的，等一段时间以后再向集群索要最新的leadership
-	if (m_leaderProposalID.isValid() && m_leaderProposalID == localLeaderPrososalID)
+	//说明本地存储的leadership是最新的，等一段时间以后再向集群索要最新的leadership。
+	//本地Acceptor已经承诺了更大的编号时这个leader的accept和心跳确认都会被拒绝，不算存活，
+	//否则发起更大编号的候选者收到它的心跳就停止竞选，两边都凑不够quorum，读写一直卡住
+	ProposalID promisedID = m_acceptor.getPromisedID();
+	if (m_leaderProposalID.isValid() && m_leaderProposalID == localLeaderPrososalID &&
+		!(promisedID.isValid() && localLeaderPrososalID < promisedID))
+	{
+		m_lastHeartbeatTimestamp = PaxosClock::nowUs();
+	}
+}
+
+/**
+ * @brief 收到leader心跳里的租约申请，交给Acceptor决定是否授予
+ */
+void PaxosNode::receiveLeaseRequest(NodeID fromUID, const ProposalID& proposalID, 
+	uint64_t timestamp, uint64_t leaseDuration)
+{
+	//观察者的确认不计入quorum，不用回复
+	if (isObserver())
+	{
+		return;
+	}
+	m_acceptor.receiveLeaseRequest(fromUID, proposalID, timestamp, leaseDuration);
+}
+
+/**
+ * @brief 收到Acceptor对心跳的确认。同一轮心跳收到Q2个确认以后，租约从这一轮心跳的发送时刻开始计时，
+ * 	再减去1/10的时钟漂移余量；不使用租约时Acceptor也会确认，用来确认ReadIndex读请求的leader身份。
+ * 
+ * @param fromUID Acceptor的UID
+ * @param proposalID 授予租约的leader议题编号
+ * @param timestamp 这一轮心跳的发送时间戳
+ */
+void PaxosNode::receiveLeaseGrant(NodeID fromUID, const ProposalID& proposalID, uint64_t timestamp)
+{
+	if (!m_proposer.isLeader() || proposalID != m_proposer.getProposalID() || 
+		timestamp <= m_confirmedHeartbeatTimestamp)
+	{
+		return;
+	}
+
+	std::set<NodeID>& grants = m_leaseGrants[timestamp];
+	grants.insert(fromUID);
+	//新leader要拿到Q1个承诺，Q2个授予和任意Q1相交，租约期间不会有别的leader。
+	//确认时这些Acceptor都没有承诺更大的议题编号，所以这一轮心跳发出时别的leader还不可能提交新的实例
+	if (m_memberships.isAcceptQuorum(m_learner.getCommitInstanceID(), grants))
+	{
+		m_confirmedHeartbeatTimestamp = timestamp;
+		if (m_leaseDuration > 0)
+		{
+			m_leaseExpireTimestamp = timestamp + m_leaseDuration - m_leaseDuration / 10;
+		}
+		//更早的心跳轮次已经没有意义了
+		m_leaseGrants.erase(m_leaseGrants.begin(), m_leaseGrants.upper_bound(timestamp));
+		confirmReads(timestamp);
+	}
+
+	//丢弃已经不可能产生有效租约的心跳轮次，确认丢了的轮次上的读请求由后面的轮次确认
+	uint64_t now = PaxosClock::nowUs();
+	uint64_t window = std::max(m_leaseDuration, m_heartbeatTimeout);
+	while (!m_leaseGrants.empty() && m_leaseGrants.begin()->first + window < now)
 	{
-		m_lastHeartbeatTimestamp = deps::GetMonoTimeUs();
+		m_leaseGrants.erase(m_leaseGrants.begin());
+	}
+}
+
+/**
+ * @brief leader是否持有有效租约，持有租约时可以直接读本地状态，不需要经过网络
+ */
+bool PaxosNode::hasLease()
+{
+	return m_proposer.isLeader() && 
+		m_learner.getCommitInstanceID() >= m_leaseReadInstanceID &&
+		PaxosClock::nowUs() < m_leaseExpireTimestamp;
+}
+
+/**
+ * @brief 租约剩余时间，单位微秒
+ */
+uint64_t PaxosNode::getLeaseRemaining()
+{
+	uint64_t now = PaxosClock::nowUs();
+	return hasLease() ? m_leaseExpireTimestamp - now : 0;
+}
+
+/**
+ * @brief ReadIndex读：读位置是读请求到达时的提交位置，新任期恢复出来的实例也要包含在内。
+ * 	持有租约时直接回调；否则读请求等到事件循环结束时挂到下一轮心跳上，一轮心跳的确认对这一轮之前到达的
+ * 	所有读请求生效，读的吞吐取决于每轮心跳带多少读请求，和共识的轮数无关。
+ * 
+ * @param callback leader身份确认并且状态机执行到读位置以后调用，可能在这个函数里直接调用
+ * @return 不是leader时返回false，不会回调
+ */
+bool PaxosNode::readIndex(const ReadCallback& callback)
+{
+	if (!m_proposer.isLeader())
+	{
+		return false;
+	}
+	if (hasLease())
+	{
+		callback(true);
+		return true;
+	}
+	uint64_t readInstanceID = std::max(m_learner.getCommitInstanceID(), m_leaseReadInstanceID);
+	m_pendingReads.push_back(ReadRequest(readInstanceID, callback));
+	return true;
+}
+
+/**
+ * @brief 没有在等确认的心跳轮次时发一轮，否则等这一轮确认以后把期间到达的读请求合并成下一轮
+ */
+void PaxosNode::pollReads()
+{
+	if (m_proposer.isLeader() && m_confirmingReads.empty() && !m_pendingReads.empty())
+	{
+		broadcastHeartbeat();
+	}
+}
+
+/**
+ * @brief 还没有完成的读请求个数
+ */
+size_t PaxosNode::numPendingReads()
+{
+	size_t count = m_pendingReads.size() + m_confirmedReads.size();
+	for (auto& item : m_confirmingReads)
+	{
+		count += item.second.size();
+	}
+	return count;
+}
+
+void PaxosNode::broadcastHeartbeat()
+{
+	uint64_t now = PaxosClock::nowUs();
+	if (!m_pendingReads.empty())
+	{
+		std::vector<ReadRequest>& reads = m_confirmingReads[now];
+		reads.insert(reads.end(), m_pendingReads.begin(), m_pendingReads.end());
+		m_pendingReads.clear();
+	}
+	m_messenger.sendHeartbeat(m_proposer.getProposerUID(), m_proposer.getProposalID(), 
+		now, m_leaseDuration, m_learner.getCommitInstanceID());
+}
+
+void PaxosNode::confirmReads(uint64_t timestamp)
+{
+	auto end = m_confirmingReads.upper_bound(timestamp);
+	for (auto itr = m_confirmingReads.begin(); itr != end; ++itr)
+	{
+		for (auto& read : itr->second)
+		{
+			m_confirmedReads.insert(std::make_pair(read.m_readInstanceID, read.m_callback));
+		}
+	}
+	m_confirmingReads.erase(m_confirmingReads.begin(), end);
+	serveReads();
+}
+
+void PaxosNode::serveReads()
+{
+	uint64_t commitInstanceID = m_learner.getCommitInstanceID();
+	while (!m_confirmedReads.empty() && m_confirmedReads.begin()->first <= commitInstanceID)
+	{
+		//回调里可能发起新的读请求，先从队列里摘下来
+		ReadCallback callback = m_confirmedReads.begin()->second;
+		m_confirmedReads.erase(m_confirmedReads.begin());
+		callback(true);
+	}
+}
+
+void PaxosNode::failReads()
+{
+	std::vector<ReadCallback> callbacks;
+	for (auto& read : m_pendingReads)
+	{
+		callbacks.push_back(read.m_callback);
+	}
+	for (auto& item : m_confirmingReads)
+	{
+		for (auto& read : item.second)
+		{
+			callbacks.push_back(read.m_callback);
+		}
+	}
+	for (auto& item : m_confirmedReads)
+	{
+		callbacks.push_back(item.second);
+	}
+	m_pendingReads.clear();
+	m_confirmingReads.clear();
+	m_confirmedReads.clear();
+	for (auto& callback : callbacks)
+	{
+		callback(false);
 	}
 }
 
@@ -155,10 +388,15 @@ void PaxosNode::receiveHeartbeat(const std::string& localLeaderUID, const Propos
 */
 void PaxosNode::pulse()
 {
+	requestMissingPayload();
 	if (m_proposer.isLeader()) 
 	{
 		receiveHeartbeat(m_proposer.getProposerUID(), m_proposer.getProposalID());
-		m_messenger.sendHeartbeat(m_proposer.getProposerUID(), m_proposer.getProposalID());
+		broadcastHeartbeat();
+	}
+	else if (numPendingReads() > 0)
+	{
+		failReads();
 	}
 }
 
@@ -175,20 +413,72 @@ void PaxosNode::acquireLeadership()
 	}
 }
 
-void PaxosNode::receivePrepare(const std::string& fromUID, const ProposalID& proposalID)
+/**
+ * @brief 提交一个新的命令，命令先进入攒批，打包成议题以后分配到下一个空闲的实例上
+ * 
+ * @param value 命令
+ */
+void PaxosNode::propose(const std::string& value)
+{
+	m_batcher.add(value);
+}
+
+/**
+ * @brief 大的批次先把payload分发出去，再把摘要交给Proposer排序。payload和accept走不同的路径，
+ * 	Acceptor先收到accept时挂起等payload，Permit、Promise、推送里都只带摘要
+ */
+void PaxosNode::proposeBatch(const std::string& value)
+{
+	if (m_payloadThreshold == 0 || value.size() < m_payloadThreshold)
+	{
+		m_proposer.setProposal(value);
+		return;
+	}
+	std::string digest;
+	PayloadStore::makeDigest(value, digest);
+	m_payloads.add(digest, value, m_learner.getCommitInstanceID());
+	m_messenger.sendPayload(INVALID_NODE_ID, digest, value);
+	m_proposer.setProposal(digest);
+}
+
+/**
+ * @brief 定时检查攒批是否超过最大延迟
+ */
+void PaxosNode::pollBatch()
+{
+	m_batcher.poll();
+}
+
+void PaxosNode::receivePrepare(NodeID fromUID, const ProposalID& proposalID, uint64_t instanceID)
 {
-	m_acceptor.receivePrepare(fromUID, proposalID);
+	m_acceptor.receivePrepare(fromUID, proposalID, instanceID);
 }
 
-void PaxosNode::receivePromise(const std::string& fromUID, const ProposalID& proposalID, const ProposalID& prevAcceptedID, const std::string& prevAcceptedValue)
+void PaxosNode::receivePromise(NodeID fromUID, const ProposalID& proposalID, 
+	uint64_t instanceID, const std::vector<PaxosInstance>& acceptedInstances)
 {
-	std::string preLeaderID = m_leaderUID;
+	//补不上截断的实例时不能成为leader，否则这些实例会被当成空洞填上别的值
+	if (isSnapshotRequired())
+	{
+		return;
+	}
+	NodeID preLeaderID = m_leaderUID;
+	bool wasLeader = m_proposer.isLeader();
 	
-	m_proposer.receivePromise(fromUID, proposalID, prevAcceptedID, prevAcceptedValue);
+	m_proposer.receivePromise(fromUID, proposalID, instanceID, acceptedInstances);
+
+	if (!wasLeader && m_proposer.isLeader())
+	{
+		//新的任期，之前任期的租约作废，恢复出来的实例全部达成一致以后才能用租约读
+		m_leaseGrants.clear();
+		m_leaseExpireTimestamp = 0;
+		m_confirmedHeartbeatTimestamp = 0;
+		m_leaseReadInstanceID = m_proposer.getNextInstanceID();
+	}
 	
-	if (preLeaderID.empty() && m_proposer.isLeader()) 
+	if (preLeaderID == INVALID_NODE_ID && m_proposer.isLeader()) 
 	{
-		std::string oldLeaderUID = m_proposer.getProposerUID();
+		NodeID oldLeaderUID = m_proposer.getProposerUID();
 		
 		m_leaderUID           = m_proposer.getProposerUID();
 		m_leaderProposalID    = m_proposer.getProposalID();
@@ -200,30 +490,740 @@ void PaxosNode::receivePromise(const std::string& fromUID, const ProposalID& pro
 	}
 }
 
-void PaxosNode::receivePrepareNACK(const std::string& fromUID, const ProposalID& proposalID, const ProposalID& promisedID)
+/**
+ * @brief Acceptor只批准本地已经有payload的摘要，选定的摘要至少在Q2个Acceptor上有payload，
+ * 	任何节点缺payload时都能取到。payload还在路上时先挂起，收到以后再批准，等太久说明转发丢了，向leader要
+ */
+void PaxosNode::receiveAcceptRequest(NodeID fromUID, const ProposalID& proposalID, 
+	uint64_t instanceID, const std::string& value)
+{
+	ProposalID promisedID = m_acceptor.getPromisedID();
+	if (PayloadStore::isDigest(value) && !m_payloads.contains(value) && 
+		!(promisedID.isValid() && proposalID < promisedID))
+	{
+		auto itr = m_payloadAccepts.find(instanceID);
+		uint64_t timestamp = itr != m_payloadAccepts.end() && itr->second.m_digest == value ? 
+			itr->second.m_timestamp : PaxosClock::nowUs();
+		m_payloadAccepts[instanceID] = PayloadAccept(fromUID, proposalID, value, timestamp);
+		return;
+	}
+	if (PayloadStore::isDigest(value))
+	{
+		m_payloads.reference(value, instanceID);
+	}
+	m_acceptor.receiveAcceptRequest(fromUID, proposalID, instanceID, value);
+}
+
+void PaxosNode::receivePermit(NodeID fromUID, const ProposalID& proposalID, 
+	uint64_t instanceID, const std::string& acceptedValue)
+{
+	if (m_learner.receiveAccepted(fromUID, proposalID, instanceID, acceptedValue))
+	{
+		m_proposer.observeChosen(instanceID);
+		onChosen();
+	}
+}
+
+/**
+ * @brief leader捎带在accept、心跳或者提交通知里的实例编号上界，小于它的实例都已经达成一致。
+ * 	Acceptor用同一个议题编号批准过的value就是leader在这个实例上提出的value，也就是选定的值，
+ * 	不需要每个Acceptor把Permit发给所有Learner。只学习从本地提交位置开始连续的一段，
+ * 	没有批准过的实例(thrifty模式没有被选中或者丢包)挡住后面的实例
+ * 
+ * @param fromUID leader的UID
+ * @param proposalID leader的议题编号
+ * @param commitInstanceID leader已经确定的实例编号上界
+ */
+void PaxosNode::receiveCommit(NodeID fromUID, const ProposalID& proposalID, uint64_t commitInstanceID)
+{
+	if (m_proposer.isLeader())
+	{
+		return;
+	}
+	uint64_t instanceID = m_learner.getCommitInstanceID();
+	if (commitInstanceID > instanceID)
+	{
+		PaxosInstance instance;
+		while (instanceID < commitInstanceID && m_acceptor.getAcceptedInstance(instanceID, instance) && 
+			instance.m_acceptedID == proposalID)
+		{
+			m_learner.receiveCommit(instance);
+			++instanceID;
+		}
+		onChosen();
+	}
+	//先学完本地批准过的实例，还卡在空洞上时才请求补发
+	observeLeaderCommit(proposalID, commitInstanceID);
+}
+
+/**
+ * @brief 一次批准可能让多个实例达成一致：按顺序通知时成员变更生效，窗口里积攒的投票重新计票
+ */
+void PaxosNode::onChosen()
+{
+	std::vector<PaxosInstance> chosen;
+	m_learner.takeChosen(chosen);
+	uint64_t commitInstanceID = m_learner.getCommitInstanceID();
+	m_proposer.setFirstUnchosenID(commitInstanceID);
+	for (auto& instance : chosen)
+	{
+		m_proposer.receiveResolution(instance.m_instanceID, instance.m_acceptedValue);
+	}
+	if (!chosen.empty())
+	{
+		publishChosen(chosen);
+	}
+	m_payloadAccepts.erase(m_payloadAccepts.begin(), m_payloadAccepts.lower_bound(commitInstanceID));
+	requestMissingPayload();
+	if (commitInstanceID > m_learnedInstanceID)
+	{
+		m_learnedInstanceID = commitInstanceID;
+		m_learnTimestamp = PaxosClock::nowUs();
+		if (!m_recentChosen.empty())
+		{
+			m_resolveTimestamps.push_back(std::make_pair(commitInstanceID, m_learnTimestamp));
+		}
+		while (!m_leaderCommits.empty() && m_leaderCommits.front().first <= commitInstanceID)
+		{
+			m_freshTimestamp = m_leaderCommits.front().second;
+			m_leaderCommits.pop_front();
+		}
+	}
+	serveReads();
+}
+
+/**
+ * @brief 每个事件循环结束时调用：leader空闲，提交位置前进了但是没有accept请求可以捎带时，
+ * 	单独发一条提交通知，这一轮里达成一致的所有实例合并成一条
+ */
+void PaxosNode::pollCommit()
+{
+	if (m_proposer.takeCommitNotification())
+	{
+		m_messenger.sendCommit(m_proposer.getProposalID(), m_learner.getCommitInstanceID());
+	}
+}
+
+void PaxosNode::publishChosen(const std::vector<PaxosInstance>& chosen)
+{
+	//观察者不会成为leader，也不用保留。成员都要保留：thrifty模式不在accept quorum里的成员
+	//和观察者一样要向leader请求补发。被移出配置的leader在新leader选出来之前还要继续推送
+	if (isObserver() && !m_proposer.isLeader())
+	{
+		return;
+	}
+	for (auto& instance : chosen)
+	{
+		m_recentChosen[instance.m_instanceID] = instance;
+	}
+	//提交位置之后乱序达成一致的实例都留着。重发补上空洞时提交位置一下前进很多，
+	//丢了推送的观察者这时才发现后面的空洞，刚执行的实例至少再留一个心跳超时
+	uint64_t now = PaxosClock::nowUs();
+	bool catchingUp = now - m_retainTimestamp <= m_heartbeatTimeout * SNAPSHOT_REQUEST_TIMEOUTS && 
+		m_recentChosen.size() <= CATCHUP_RETAIN_INSTANCES;
+	while (m_recentChosen.size() > OBSERVER_RETAIN_INSTANCES + m_learner.numUnresolvedChosen())
+	{
+		uint64_t instanceID = m_recentChosen.begin()->first;
+		if (catchingUp && instanceID >= m_retainInstanceID)
+		{
+			break;
+		}
+		while (!m_resolveTimestamps.empty() && m_resolveTimestamps.front().first <= instanceID)
+		{
+			m_resolveTimestamps.pop_front();
+		}
+		if (m_resolveTimestamps.empty() || now - m_resolveTimestamps.front().second < m_heartbeatTimeout)
+		{
+			break;
+		}
+		m_recentChosen.erase(m_recentChosen.begin());
+	}
+	if (m_proposer.isLeader())
+	{
+		m_messenger.sendChosen(INVALID_NODE_ID, m_proposer.getProposalID(), chosen, m_learner.getCommitInstanceID());
+	}
+}
+
+/**
+ * @brief leader推送的都是它学到的选定值，旧leader的推送也一样，可以直接学习，不需要计票
+ * 
+ * @param fromUID leader的UID
+ * @param proposalID leader当前的议题编号
+ * @param chosenInstances 达成一致的实例
+ * @param commitInstanceID leader已经确定的实例编号上界
+ */
+void PaxosNode::receiveChosen(NodeID fromUID, const ProposalID& proposalID, 
+	const std::vector<PaxosInstance>& chosenInstances, uint64_t commitInstanceID)
+{
+	if (m_proposer.isLeader())
+	{
+		return;
+	}
+	for (auto& instance : chosenInstances)
+	{
+		m_learner.receiveCommit(instance);
+	}
+	onChosen();
+	observeLeaderCommit(proposalID, commitInstanceID);
+}
+
+/**
+ * @brief 从保留的实例里补发一段，包括leader自己还没有按顺序通知的实例。
+ * 	落后超过保留范围时给它发快照，并且从当前保留的位置开始留着，装载的快照比这里新时就能接着学
+ */
+void PaxosNode::receiveLearnRequest(NodeID fromUID, uint64_t fromInstanceID)
+{
+	if (!m_proposer.isLeader())
+	{
+		return;
+	}
+	auto itr = m_recentChosen.lower_bound(fromInstanceID);
+	if (itr == m_recentChosen.end() || itr->first != fromInstanceID)
+	{
+		//这个实例leader自己也还没有学到，等它达成一致时推送
+		if (fromInstanceID >= m_learner.getCommitInstanceID())
+		{
+			return;
+		}
+		uint64_t now = PaxosClock::nowUs();
+		uint64_t timeout = m_heartbeatTimeout * SNAPSHOT_REQUEST_TIMEOUTS;
+		if (now - m_retainTimestamp > timeout)
+		{
+			m_retainInstanceID = m_recentChosen.empty() ? m_learner.getCommitInstanceID() : m_recentChosen.begin()->first;
+		}
+		m_retainTimestamp = now;
+		//快照可能很大，装载之前请求方每个心跳周期都会再请求一次
+		uint64_t& sentTimestamp = m_snapshotSentTimestamps[fromUID];
+		if (sentTimestamp > 0 && now - sentTimestamp <= timeout)
+		{
+			return;
+		}
+		sentTimestamp = now;
+		LOG_INFO("node:%u learn from instance:%llu not retained, retain from instance:%llu, send snapshot", 
+			fromUID, fromInstanceID, m_retainInstanceID);
+		m_messenger.sendSnapshot(fromUID, fromInstanceID);
+		return;
+	}
+	std::vector<PaxosInstance> instances;
+	for (; itr != m_recentChosen.end() && instances.size() < OBSERVER_LEARN_BATCH; ++itr)
+	{
+		instances.push_back(itr->second);
+	}
+	m_messenger.sendChosen(fromUID, m_proposer.getProposalID(), instances, m_learner.getCommitInstanceID());
+}
+
+bool PaxosNode::isObserver() const
+{
+	const Membership& membership = m_memberships.latest();
+	return !membership.isOpen() && !membership.contains(m_nodeUID);
+}
+
+/**
+ * @brief 只相信当前leader的提交位置，被隔离的旧leader的提交位置会让本地显得比实际更新。
+ * 	观察者不在accept请求的接收者里，推送丢了就会一直卡在空洞上；thrifty模式不在accept quorum里的成员、
+ * 	被隔离过的成员也没有批准过空洞上的实例。一个心跳周期没有进展时向leader请求补发
+ */
+void PaxosNode::observeLeaderCommit(const ProposalID& proposalID, uint64_t commitInstanceID)
+{
+	if (!m_leaderProposalID.isValid() || proposalID != m_leaderProposalID)
+	{
+		return;
+	}
+	uint64_t now = PaxosClock::nowUs();
+	uint64_t instanceID = m_learner.getCommitInstanceID();
+	if (commitInstanceID <= instanceID)
+	{
+		m_freshTimestamp = now;
+	}
+	else if (m_leaderCommits.empty() || m_leaderCommits.back().first < commitInstanceID)
+	{
+		m_leaderCommits.push_back(std::make_pair(commitInstanceID, now));
+		if (m_leaderCommits.size() > LEADER_COMMIT_SAMPLES)
+		{
+			m_leaderCommits.pop_front();
+		}
+	}
+	//leader自己也可能卡在空洞上，后面的实例已经到了也说明中间丢了推送。
+	//下一个实例的accept或者选定值只是在等payload时不算卡住，补发的value会和payload重复
+	std::string digest;
+	if ((commitInstanceID > instanceID || m_learner.numUnresolvedChosen() > 0) && 
+		now - m_learnTimestamp > m_heartbeatPeriod && !m_learner.getMissingPayload(digest) && 
+		m_payloadAccepts.find(instanceID) == m_payloadAccepts.end())
+	{
+		m_learnTimestamp = now;
+		m_messenger.sendLearnRequest(m_leaderUID, instanceID);
+	}
+}
+
+/**
+ * @brief leader持有租约时为0，否则是最近一轮确认leader身份的心跳到现在的时间。其他节点是本地状态
+ * 	最近一次赶上leader通告的提交位置到现在的时间，不含通告在路上的单向延迟
+ */
+uint64_t PaxosNode::getReadStaleness()
+{
+	uint64_t now = PaxosClock::nowUs();
+	if (m_proposer.isLeader())
+	{
+		if (hasLease())
+		{
+			return 0;
+		}
+		//上一任期恢复出来的实例还没有执行完
+		if (m_learner.getCommitInstanceID() < m_leaseReadInstanceID)
+		{
+			return UINT64_MAX;
+		}
+		return m_confirmedHeartbeatTimestamp > 0 && now >= m_confirmedHeartbeatTimestamp ? 
+			now - m_confirmedHeartbeatTimestamp : UINT64_MAX;
+	}
+	return m_freshTimestamp > 0 && now >= m_freshTimestamp ? now - m_freshTimestamp : UINT64_MAX;
+}
+
+void PaxosNode::setPayloadThreshold(size_t bytes)
+{
+	m_payloadThreshold = bytes;
+}
+
+/**
+ * @brief 收到payload：校验摘要，按要求转发，批准挂起的accept请求，继续卡在这个摘要上的按顺序通知
+ */
+void PaxosNode::receivePayload(NodeID fromUID, const std::string& digest, const std::string& payload, bool relay)
+{
+	if (!m_payloads.add(digest, payload, m_learner.getCommitInstanceID()))
+	{
+		LOG_ERROR("payload from node:%u size:%zd does not match digest", fromUID, payload.size());
+		return;
+	}
+	if (relay)
+	{
+		m_messenger.relayPayload(fromUID, digest, payload);
+	}
+	m_payloadRequests.erase(digest);
+	for (auto itr = m_payloadAccepts.begin(); itr != m_payloadAccepts.end(); )
+	{
+		if (itr->second.m_digest != digest)
+		{
+			++itr;
+			continue;
+		}
+		uint64_t instanceID = itr->first;
+		PayloadAccept accept = itr->second;
+		itr = m_payloadAccepts.erase(itr);
+		m_payloads.reference(digest, instanceID);
+		m_acceptor.receiveAcceptRequest(accept.m_fromUID, accept.m_proposalID, instanceID, digest);
+	}
+	m_learner.receivePayload(digest);
+	onChosen();
+}
+
+/**
+ * @brief 有payload就直接回复。leader自己也没有时(新leader恢复出来的实例)向所有节点要，
+ * 	批准过这个摘要的Acceptor一定有，请求方下次请求时就能取到
+ */
+void PaxosNode::receivePayloadRequest(NodeID fromUID, const std::string& digest)
 {
+	const std::string* payload = m_payloads.find(digest);
+	if (payload != nullptr)
+	{
+		m_messenger.sendPayload(fromUID, digest, *payload);
+		return;
+	}
+	if (m_proposer.isLeader())
+	{
+		requestPayload(INVALID_NODE_ID, digest);
+	}
+}
+
+void PaxosNode::requestMissingPayload()
+{
+	std::string digest;
+	if (m_learner.getMissingPayload(digest))
+	{
+		//leader自己缺payload时问所有节点
+		requestPayload(m_proposer.isLeader() ? INVALID_NODE_ID : m_leaderUID, digest);
+	}
+	//转发节点挂了或者丢包，payload不会再来了
+	uint64_t now = PaxosClock::nowUs();
+	for (auto& item : m_payloadAccepts)
+	{
+		const PayloadAccept& accept = item.second;
+		if (now - accept.m_timestamp > m_heartbeatTimeout)
+		{
+			requestPayload(accept.m_fromUID, accept.m_digest);
+		}
+	}
+	for (auto itr = m_payloadRequests.begin(); itr != m_payloadRequests.end(); )
+	{
+		if (now - itr->second > m_heartbeatTimeout)
+		{
+			itr = m_payloadRequests.erase(itr);
+		}
+		else
+		{
+			++itr;
+		}
+	}
+}
+
+void PaxosNode::requestPayload(NodeID toUID, const std::string& digest)
+{
+	uint64_t now = PaxosClock::nowUs();
+	auto itr = m_payloadRequests.find(digest);
+	if (itr != m_payloadRequests.end() && now - itr->second <= m_heartbeatTimeout)
+	{
+		return;
+	}
+	m_payloadRequests[digest] = now;
+	m_messenger.sendPayloadRequest(toUID == m_nodeUID ? INVALID_NODE_ID : toUID, digest);
+}
+
+void PaxosNode::expandPayloads(std::vector<PaxosInstance>& instances)
+{
+	for (auto& instance : instances)
+	{
+		if (!PayloadStore::isDigest(instance.m_acceptedValue))
+		{
+			continue;
+		}
+		const std::string* payload = m_payloads.find(instance.m_acceptedValue);
+		if (payload != nullptr)
+		{
+			instance.m_acceptedValue = *payload;
+		}
+	}
+}
+
+/**
+ * @brief 内存里的payload个数
+ */
+size_t PaxosNode::numPayloads()
+{
+	return m_payloads.size();
+}
+
+/**
+ * @brief 内存里的payload字节数
+ */
+uint64_t PaxosNode::getPayloadBytes()
+{
+	return m_payloads.getBytes();
+}
+
+void PaxosNode::receivePrepareNACK(NodeID fromUID, const ProposalID& proposalID, const ProposalID& promisedID, 
+	uint64_t truncatedInstanceID)
+{
+	if (truncatedInstanceID > m_learner.getCommitInstanceID())
+	{
+		//承诺要覆盖的实例已经被这个Acceptor截断，重新prepare也一样被拒绝，先装载快照
+		observeTruncation(fromUID, truncatedInstanceID);
+		return;
+	}
+
+	//只有当前这次prepare的第一个拒绝才重新prepare，重新prepare以后编号变了，旧的拒绝都会被忽略。
+	//否则每个拒绝都发起一轮prepare，几个节点同时竞争leader时prepare的数量成指数增长
+	bool current = proposalID == m_proposer.getProposalID();
+	bool leader = m_proposer.isLeader();
 	m_proposer.receivePrepareNACK(fromUID, proposalID, promisedID);
+	if (leader && !m_proposer.isLeader())
+	{
+		stepDown(fromUID, promisedID);
+	}
 	
-	if (m_acquiringLeadership)
+	if (m_acquiringLeadership && current)
 	{
 		prepare(true);
 	}		
 }
 
-void PaxosNode::receiveAcceptNACK(const std::string& fromUID, const ProposalID& proposalID, const ProposalID& promisedID)
+void PaxosNode::receiveAcceptNACK(NodeID fromUID, const ProposalID& proposalID, 
+	uint64_t instanceID, const ProposalID& promisedID, uint64_t truncatedInstanceID)
 {
-	m_proposer.receiveAcceptNACK(fromUID, proposalID, promisedID);
-	
+	if (instanceID < truncatedInstanceID)
+	{
+		//实例已经被这个Acceptor截断，不是因为承诺了更大的编号。本地也已经学到时只是过时的重发；
+		//否则本地在补截断之前的空洞，补上的值可能和已经选定的不同，不能继续当leader
+		if (truncatedInstanceID > m_learner.getCommitInstanceID())
+		{
+			observeTruncation(fromUID, truncatedInstanceID);
+			if (m_proposer.isLeader())
+			{
+				stepDown(fromUID, proposalID);
+			}
+		}
+		return;
+	}
+
+	//先按原来的议题编号记下拒绝，Proposer看到更大的编号以后自己的编号就变了
 	if (proposalID == m_proposer.getProposalID())
+	{
 		m_acceptNACKs.insert(fromUID);
+	}
+
+	bool leader = m_proposer.isLeader();
+	m_proposer.receiveAcceptNACK(fromUID, proposalID, instanceID, promisedID);
 	
-	if (m_proposer.isLeader() && m_acceptNACKs.size() >= m_proposer.getQuorumSize()) 
+	//别的Proposer已经prepare了更大的编号，Proposer放弃了leader身份，后续accept要先重新prepare
+	if (leader && (!m_proposer.isLeader() || 
+		m_memberships.isAcceptQuorum(m_learner.getCommitInstanceID(), m_acceptNACKs)))
+	{
+		stepDown(fromUID, promisedID);
+	}
+}
+
+void PaxosNode::stepDown(NodeID fromUID, const ProposalID& proposalID)
+{
+	m_proposer.setLeader(false);
+	m_leaderUID = INVALID_NODE_ID;
+	m_leaderProposalID = ProposalID();
+	failReads();
+	m_messenger.onLeadershipLost();
+	m_messenger.onLeadershipChange(m_proposer.getProposerUID(), m_leaderUID);
+	m_proposer.observeProposal(fromUID, proposalID);
+}
+
+void PaxosNode::observeTruncation(NodeID fromUID, uint64_t truncatedInstanceID)
+{
+	if (truncatedInstanceID > m_truncatedInstanceID)
 	{
-		m_proposer.setLeader(false);
-		m_leaderUID = "";
-		m_leaderProposalID = ProposalID();
-		m_messenger.onLeadershipLost();
-		m_messenger.onLeadershipChange(m_proposer.getProposerUID(), m_leaderUID);
-		m_proposer.observeProposal(fromUID, proposalID);
+		LOG_INFO("node:%u truncated to instance:%llu, commit instance:%llu, snapshot required", fromUID, 
+			truncatedInstanceID, m_learner.getCommitInstanceID());
+		m_truncatedInstanceID = truncatedInstanceID;
+		m_snapshotSourceUID = fromUID;
+		m_snapshotRequestTimestamp = 0;
+		m_retainInstanceID = 0;
+		m_retainTimestamp = 0;
 	}
+	requestSnapshot();
+}
+
+void PaxosNode::requestSnapshot()
+{
+	//重启时本地日志的截断位置比快照新，不知道谁截断的，问leader
+	NodeID toUID = m_snapshotSourceUID != INVALID_NODE_ID ? m_snapshotSourceUID : m_leaderUID;
+	if (!isSnapshotRequired() || toUID == INVALID_NODE_ID || toUID == m_nodeUID)
+	{
+		return;
+	}
+	uint64_t now = PaxosClock::nowUs();
+	if (m_snapshotRequestTimestamp > 0 && now - m_snapshotRequestTimestamp <= m_heartbeatTimeout * SNAPSHOT_REQUEST_TIMEOUTS)
+	{
+		return;
+	}
+	m_snapshotRequestTimestamp = now;
+	m_messenger.sendSnapshotRequest(toUID, m_learner.getCommitInstanceID());
+}
+
+bool PaxosNode::isSnapshotRequired()
+{
+	return m_learner.getCommitInstanceID() < m_truncatedInstanceID;
+}
+
+/**
+ * @brief 快照在PaxosNode外面，交给通信层判断本地快照是否比请求方新
+ */
+void PaxosNode::receiveSnapshotRequest(NodeID fromUID, uint64_t instanceID)
+{
+	m_messenger.sendSnapshot(fromUID, instanceID);
+}
+
+/**
+ * @brief 实例的重发定时器到期，还没有达成一致时重发它的accept请求
+ */
+void PaxosNode::resendAccept(uint64_t instanceID)
+{
+	m_proposer.resendAccept(instanceID);
+}
+
+/**
+ * @brief 获取下一个需要按顺序通知的实例编号，小于它的实例都已经达成一致
+ */
+uint64_t PaxosNode::getCommitInstanceID()
+{
+	return m_learner.getCommitInstanceID();
+}
+
+/**
+ * @brief 获取同时进行accept的实例个数上限
+ */
+size_t PaxosNode::getAcceptWindow()
+{
+	return m_proposer.getAcceptWindow();
+}
+
+/**
+ * @brief 获取正在进行accept的实例个数
+ */
+size_t PaxosNode::numInflightProposals()
+{
+	return m_proposer.numInflightProposals();
+}
+
+/**
+ * @brief 获取还没有达成一致的本地议题个数，包括还在攒批的命令
+ */
+size_t PaxosNode::numPendingProposals()
+{
+	return m_proposer.numPendingProposals() + m_batcher.size();
+}
+
+/**
+ * @brief 获取还在攒批的命令个数
+ */
+size_t PaxosNode::numBatchedProposals()
+{
+	return m_batcher.size();
+}
+
+/**
+ * @brief 取走各阶段的耗时直方图，单位微秒
+ */
+void PaxosNode::takeLatencies(LatencyHistogram& prepareLatency, LatencyHistogram& acceptLatency, 
+	LatencyHistogram& commitLatency)
+{
+	m_proposer.takeLatencies(prepareLatency, acceptLatency, commitLatency);
+}
+
+/**
+ * @brief Acceptor是否有还没有落盘的承诺或者批准
+ */
+bool PaxosNode::persistenceRequired()
+{
+	return m_acceptor.persistenceRequired();
+}
+
+/**
+ * @brief 获取需要写入预写日志的Acceptor状态
+ */
+void PaxosNode::getPendingPersistence(ProposalID& promisedID, std::vector<PaxosInstance>& acceptedInstances)
+{
+	promisedID = m_acceptor.getPromisedID();
+	m_acceptor.getPendingInstances(acceptedInstances);
+	expandPayloads(acceptedInstances);
+}
+
+/**
+ * @brief Acceptor状态已经落盘，发送积攒的承诺和批准
+ */
+void PaxosNode::persisted()
+{
+	m_acceptor.persisted();
+}
+
+/**
+ * @brief 用预写日志恢复Acceptor状态。日志里存的是payload，按同样的阈值换回摘要，和其他Acceptor批准的值一致
+ */
+void PaxosNode::recover(const ProposalID& promisedID, const std::vector<PaxosInstance>& acceptedInstances, 
+	uint64_t truncatedInstanceID)
+{
+	m_truncatedInstanceID = truncatedInstanceID;
+	if (m_payloadThreshold == 0)
+	{
+		m_acceptor.recover(promisedID, acceptedInstances, truncatedInstanceID);
+		return;
+	}
+	std::vector<PaxosInstance> instances(acceptedInstances);
+	for (auto& instance : instances)
+	{
+		if (instance.m_acceptedValue.size() < m_payloadThreshold)
+		{
+			continue;
+		}
+		std::string digest;
+		PayloadStore::makeDigest(instance.m_acceptedValue, digest);
+		m_payloads.add(digest, instance.m_acceptedValue, instance.m_instanceID);
+		instance.m_acceptedValue.swap(digest);
+	}
+	m_acceptor.recover(promisedID, instances, truncatedInstanceID);
+}
+
+/**
+ * @brief 获取Acceptor完整的状态，用来压缩预写日志
+ */
+void PaxosNode::getAcceptorState(ProposalID& promisedID, std::vector<PaxosInstance>& acceptedInstances, 
+	uint64_t& truncatedInstanceID)
+{
+	promisedID = m_acceptor.getPromisedID();
+	truncatedInstanceID = m_acceptor.getTruncatedInstanceID();
+	m_acceptor.getAcceptedInstances(0, acceptedInstances);
+	expandPayloads(acceptedInstances);
+}
+
+/**
+ * @brief 编号小于instanceID的实例已经包含在状态机快照里，截断Acceptor和Learner的状态
+ */
+void PaxosNode::truncate(uint64_t instanceID)
+{
+	m_acceptor.truncate(instanceID);
+	m_learner.truncate(instanceID);
+	m_memberships.truncate(instanceID);
+	m_payloads.truncate(instanceID);
+	onChosen();
+}
+
+/**
+ * @brief 在instanceID之前决议出来的变更从决议位置加alpha开始生效，可能晚于instanceID；
+ * 	instanceID之后决议出来的变更装载快照的节点会自己学到
+ */
+void PaxosNode::getSnapshotMemberships(uint64_t instanceID, std::vector<uint64_t>& starts, 
+	std::vector<Membership>& memberships)
+{
+	m_memberships.getSchedule(instanceID, instanceID + m_memberships.getAlpha(), starts, memberships);
+}
+
+/**
+ * @brief 快照里的配置替换本地配置，再把快照之前的实例全部截断，Learner从instanceID开始学习
+ */
+void PaxosNode::installSnapshot(uint64_t instanceID, const std::vector<uint64_t>& starts, 
+	const std::vector<Membership>& memberships)
+{
+	LOG_INFO("install snapshot instance:%llu commit instance:%llu memberships:%zd", instanceID, 
+		m_learner.getCommitInstanceID(), memberships.size());
+	for (size_t i = 0; i < starts.size() && i < memberships.size(); ++i)
+	{
+		m_memberships.add(starts[i], memberships[i]);
+	}
+	truncate(instanceID);
+}
+
+/**
+ * @brief 实例instanceID上决议出了成员变更，从instanceID + alpha开始生效，alpha是accept窗口。
+ * 	leader只给第一个未决实例之后alpha个实例分配编号，用到新配置的实例一定在变更达成一致以后才会发出。
+ * 	所有节点按照同样的日志做同样的判断：上一次变更还没有生效，或者新旧配置的quorum不相交时忽略这次变更
+ * 
+ * @return 变更是否被接受
+ */
+bool PaxosNode::changeMembership(uint64_t instanceID, const Membership& membership)
+{
+	const Membership& latest = m_memberships.latest();
+	if (membership == latest)
+	{
+		return true;
+	}
+	uint64_t startInstanceID = instanceID + m_memberships.getAlpha();
+	if (m_memberships.getLatestStart() > instanceID)
+	{
+		LOG_ERROR("instance:%llu membership %s rejected, change to %s still pending", instanceID, 
+			membership.toString().c_str(), latest.toString().c_str());
+		return false;
+	}
+	if (!latest.canChangeTo(membership))
+	{
+		LOG_ERROR("instance:%llu membership %s -> %s rejected, quorums may not intersect", instanceID, 
+			latest.toString().c_str(), membership.toString().c_str());
+		return false;
+	}
+	LOG_INFO("instance:%llu membership %s -> %s from instance:%llu", instanceID, latest.toString().c_str(), 
+		membership.toString().c_str(), startInstanceID);
+	m_memberships.add(startInstanceID, membership);
+	return true;
+}
+
+void PaxosNode::restoreMembership(uint64_t startInstanceID, const Membership& membership)
+{
+	m_memberships.add(startInstanceID, membership);
+}
+
+const MembershipSchedule& PaxosNode::getMemberships() const
+{
+	return m_memberships;
 }
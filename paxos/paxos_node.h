@@ -5,13 +5,23 @@
 #include "proposalid.h"
 #include "proposer.h"
 #include "learner.h"
+#include "batcher.h"
+#include "membership.h"
+#include "payload.h"
+
+#include <functional>
+#include <deque>
+
+//ReadIndex读请求的回调，true表示leader身份已经确认并且状态机已经执行到读位置，false表示已经不是leader
+typedef std::function<void(bool)> ReadCallback;
 
 class PaxosNode
 {
 public:
-	PaxosNode(Messenger& messenger, const std::string& nodeUID, 
-		int quorumSize, int heartbeatPeriod, int heartbeatTimeout, 
-		int livenessWindow, std::string leaderUID = "");
+	PaxosNode(Messenger& messenger, NodeID nodeUID, 
+		const Membership& membership, int heartbeatPeriod, int heartbeatTimeout, 
+		int livenessWindow, int leaseDuration, size_t acceptWindow, size_t batchCount, size_t batchBytes, 
+		uint64_t batchDelayUs, NodeID leaderUID = INVALID_NODE_ID);
 	~PaxosNode();
 
 	ProposalID getMyProposalID() const;
@@ -19,7 +29,7 @@ public:
 	
 	bool isActive();
 	void setActive(bool active);
-	std::string getLeaderUID();
+	NodeID getLeaderUID();
 	ProposalID getLeaderProposalID();
 	void setLeaderProposalID( const ProposalID& newLeaderUID ); 
 	bool isAcquiringLeadership();
@@ -27,25 +37,145 @@ public:
 	bool isLeaderAlive();
 	bool isPrepareExpire();
 	void pollLiveness();
-	void receiveHeartbeat(const std::string& fromUID, const ProposalID& proposalID); 
+	void receiveHeartbeat(NodeID fromUID, const ProposalID& proposalID); 
+	void receiveLeaseRequest(NodeID fromUID, const ProposalID& proposalID, 
+		uint64_t timestamp, uint64_t leaseDuration);
+	void receiveLeaseGrant(NodeID fromUID, const ProposalID& proposalID, uint64_t timestamp);
+	bool hasLease();
+	uint64_t getLeaseRemaining();
+	//线性一致读：确认自己还是leader并且执行到读请求到达时的提交位置以后回调，不写日志。不是leader时返回false
+	bool readIndex(const ReadCallback& callback);
+	//事件循环结束时调用，这一轮到达的读请求合并成一轮心跳确认
+	void pollReads();
+	size_t numPendingReads();
 	void pulse();
 	void acquireLeadership();
-	void receivePrepare(const std::string& fromUID, const ProposalID& proposalID);
-	void receivePromise(const std::string& fromUID, const ProposalID& proposalID, 
-		const ProposalID& prevAcceptedID, const std::string& prevAcceptedValue);
-	void receivePrepareNACK(const std::string& fromUID, const ProposalID& proposalID, 
-		const ProposalID& promisedID);
-	void receiveAcceptNACK(const std::string& fromUID, const ProposalID& proposalID, 
-		const ProposalID& promisedID);
+	void propose(const std::string& value);
+	void pollBatch();
+	void receivePrepare(NodeID fromUID, const ProposalID& proposalID, uint64_t instanceID);
+	void receivePromise(NodeID fromUID, const ProposalID& proposalID, 
+		uint64_t instanceID, const std::vector<PaxosInstance>& acceptedInstances);
+	void receiveAcceptRequest(NodeID fromUID, const ProposalID& proposalID, 
+		uint64_t instanceID, const std::string& value);
+	void receivePermit(NodeID fromUID, const ProposalID& proposalID, 
+		uint64_t instanceID, const std::string& acceptedValue);
+	void receiveCommit(NodeID fromUID, const ProposalID& proposalID, uint64_t commitInstanceID);
+	void pollCommit();
+	//观察者收到leader推送或者补发的已经达成一致的实例
+	void receiveChosen(NodeID fromUID, const ProposalID& proposalID, 
+		const std::vector<PaxosInstance>& chosenInstances, uint64_t commitInstanceID);
+	//leader收到观察者的补发请求
+	void receiveLearnRequest(NodeID fromUID, uint64_t fromInstanceID);
+	//配置限制了成员并且自己不在最新配置里：不投票也不参与选主，只学习leader推送的实例
+	bool isObserver() const;
+	//本地状态落后leader的时间，单位微秒，不知道时返回UINT64_MAX。有界陈旧读用它判断能不能直接读本地状态
+	uint64_t getReadStaleness();
+	//不小于bytes的议题value先分发payload，共识消息里只带摘要，0表示不分开
+	void setPayloadThreshold(size_t bytes);
+	//收到payload，relay表示发送方要求转发给其余节点
+	void receivePayload(NodeID fromUID, const std::string& digest, const std::string& payload, bool relay);
+	void receivePayloadRequest(NodeID fromUID, const std::string& digest);
+	size_t numPayloads();
+	uint64_t getPayloadBytes();
+	void receivePrepareNACK(NodeID fromUID, const ProposalID& proposalID, 
+		const ProposalID& promisedID, uint64_t truncatedInstanceID);
+	void receiveAcceptNACK(NodeID fromUID, const ProposalID& proposalID, 
+		uint64_t instanceID, const ProposalID& promisedID, uint64_t truncatedInstanceID);
+	//落后的节点请求快照
+	void receiveSnapshotRequest(NodeID fromUID, uint64_t instanceID);
+	//提交位置落后于别的Acceptor截断到的位置，装载快照以前不参与选主
+	bool isSnapshotRequired();
+	void resendAccept(uint64_t instanceID);
+	uint64_t getCommitInstanceID();
+	size_t getAcceptWindow();
+	size_t numInflightProposals();
+	size_t numPendingProposals();
+	size_t numBatchedProposals();
+	void takeLatencies(LatencyHistogram& prepareLatency, LatencyHistogram& acceptLatency, 
+		LatencyHistogram& commitLatency);
+
+	bool persistenceRequired();
+	void getPendingPersistence(ProposalID& promisedID, std::vector<PaxosInstance>& acceptedInstances);
+	void persisted();
+	void recover(const ProposalID& promisedID, const std::vector<PaxosInstance>& acceptedInstances, 
+		uint64_t truncatedInstanceID);
+	void getAcceptorState(ProposalID& promisedID, std::vector<PaxosInstance>& acceptedInstances, 
+		uint64_t& truncatedInstanceID);
+	void truncate(uint64_t instanceID);
+	//快照点instanceID需要带上的配置：instanceID上生效的配置，和之前决议出来还没有生效的配置
+	void getSnapshotMemberships(uint64_t instanceID, std::vector<uint64_t>& starts, 
+		std::vector<Membership>& memberships);
+	//装载了别的节点的快照，状态机已经执行到instanceID，快照里的配置替换本地配置
+	void installSnapshot(uint64_t instanceID, const std::vector<uint64_t>& starts, 
+		const std::vector<Membership>& memberships);
+
+	//实例instanceID上决议出了成员变更
+	bool changeMembership(uint64_t instanceID, const Membership& membership);
+	//重启时恢复保存的配置
+	void restoreMembership(uint64_t startInstanceID, const Membership& membership);
+	const MembershipSchedule& getMemberships() const;
+private:
+	//攒好的一批命令交给Proposer，大的批次换成摘要
+	void proposeBatch(const std::string& value);
+	//按顺序通知卡在payload还没有到的摘要上，或者accept请求等payload超过一个心跳超时时请求payload
+	void requestMissingPayload();
+	//同一个摘要一个心跳超时内只请求一次
+	void requestPayload(NodeID toUID, const std::string& digest);
+	//写预写日志时把摘要换回payload，日志不依赖内存里的payload
+	void expandPayloads(std::vector<PaxosInstance>& instances);
+	//Learner达成一致的实例交给Proposer
+	void onChosen();
+	//leader把达成一致的实例推给观察者，所有成员保留最近的一段，成为leader以后用来补发
+	void publishChosen(const std::vector<PaxosInstance>& chosen);
+	//记录leader通告的提交位置，本地执行到这个位置时说明本地状态在收到通告的时刻和leader一样新
+	void observeLeaderCommit(const ProposalID& proposalID, uint64_t commitInstanceID);
+	//发出一轮心跳，还在等待的读请求挂到这一轮上
+	void broadcastHeartbeat();
+	//发送时间不晚于timestamp的心跳轮次确认的读请求，leader身份已经确认
+	void confirmReads(uint64_t timestamp);
+	//执行状态机已经执行到读位置的读请求
+	void serveReads();
+	//不再是leader，所有读请求失败
+	void failReads();
+	//收到quorum个拒绝或者发现自己补不上截断的实例，放弃leader
+	void stepDown(NodeID fromUID, const ProposalID& proposalID);
+	//Acceptor拒绝时带回的截断位置超过本地提交位置，记下来并且向它请求快照
+	void observeTruncation(NodeID fromUID, uint64_t truncatedInstanceID);
+	//一个心跳超时内只请求一次快照
+	void requestSnapshot();
+private:
+	struct ReadRequest
+	{
+		ReadRequest(uint64_t readInstanceID, const ReadCallback& callback):
+			m_readInstanceID(readInstanceID), m_callback(callback){}
+		//读请求到达时的读位置，状态机执行到这里以后才能读
+		uint64_t m_readInstanceID;
+		ReadCallback m_callback;
+	};
+	//payload还没有到，挂起的accept请求
+	struct PayloadAccept
+	{
+		PayloadAccept():m_fromUID(INVALID_NODE_ID), m_timestamp(0){}
+		PayloadAccept(NodeID fromUID, const ProposalID& proposalID, const std::string& digest, uint64_t timestamp):
+			m_fromUID(fromUID), m_proposalID(proposalID), m_digest(digest), m_timestamp(timestamp){}
+		NodeID m_fromUID;
+		ProposalID m_proposalID;
+		std::string m_digest;
+		//第一次收到的时间
+		uint64_t m_timestamp;
+	};
 private:
 	Messenger& m_messenger;	//通信接口
+	MembershipSchedule m_memberships;	//每个实例上生效的配置，Proposer和Learner共用
+	PayloadStore m_payloads;	//摘要对应的payload，Learner通知时换回
 	Proposer m_proposer;	//proposer状态机
 	Acceptor m_acceptor;	//acceptor状态机
 	Learner  m_learner;		//learner状态机
-	std::string m_nodeUID;	//节点UID
+	ProposalBatcher m_batcher;	//proposer前面的攒批
+	NodeID m_nodeUID;	//节点UID
 
 	//leader UID
-	std::string	m_leaderUID;
+	NodeID	m_leaderUID;
 	//leader 协议编号
 	ProposalID	m_leaderProposalID;
 
@@ -56,7 +186,56 @@ private:
 	//心跳超时时间
 	uint64_t   	m_heartbeatTimeout;
 
+	//leader租约时长，单位微秒，为0表示不使用租约
+	uint64_t	m_leaseDuration;
+	//leader租约到期的单调时钟，单位微秒
+	uint64_t	m_leaseExpireTimestamp;
+	//每一轮心跳(按发送时间戳区分)授予租约的Acceptor
+	std::map<uint64_t, std::set<NodeID> >	m_leaseGrants;
+	//成为leader时需要先达成一致的实例编号，之前的实例全部执行以后才能用租约读本地状态
+	uint64_t	m_leaseReadInstanceID;
+	//最近一轮得到quorum确认的心跳的发送时间戳
+	uint64_t	m_confirmedHeartbeatTimestamp;
+	//还没有挂到心跳轮次上的读请求
+	std::vector<ReadRequest>	m_pendingReads;
+	//心跳发送时间戳 -> 这一轮心跳发出之前到达的读请求
+	std::map<uint64_t, std::vector<ReadRequest> >	m_confirmingReads;
+	//leader身份已经确认，等待状态机执行到读位置的读请求，按照读位置排序
+	std::multimap<uint64_t, ReadCallback>	m_confirmedReads;
+
+	//最近达成一致的实例，补发给丢了推送的观察者和卡在空洞上的成员
+	std::map<uint64_t, PaxosInstance>	m_recentChosen;
+	//有节点落后于保留范围、装载快照追赶时，从这个实例开始都保留，直到一段时间没有再请求
+	uint64_t	m_retainInstanceID;
+	uint64_t	m_retainTimestamp;
+	//节点 -> 上次因为落后于保留范围给它发快照的时间
+	std::map<NodeID, uint64_t>	m_snapshotSentTimestamps;
+	//提交位置前进到哪里和前进的时间，小于它的实例在这个时间执行
+	std::deque<std::pair<uint64_t, uint64_t> >	m_resolveTimestamps;
+	//本地还没有执行到的leader提交位置和收到通告的时间，按提交位置递增
+	std::deque<std::pair<uint64_t, uint64_t> >	m_leaderCommits;
+	//本地状态最近一次确认和leader一样新的时间，为0表示还不知道
+	uint64_t	m_freshTimestamp;
+	//上次提交位置前进或者请求补发的时间
+	uint64_t	m_learnTimestamp;
+	//上次onChosen时的提交位置
+	uint64_t	m_learnedInstanceID;
+
+	//议题value不小于这个字节数时换成摘要，0表示不分开
+	size_t	m_payloadThreshold;
+	//实例编号 -> payload还没有到的accept请求
+	std::map<uint64_t, PayloadAccept>	m_payloadAccepts;
+	//已经请求的摘要 -> 请求时间
+	std::map<std::string, uint64_t>	m_payloadRequests;
+
+	//已知的Acceptor截断到的最大实例编号，本地提交位置落后于它时只能装载快照追赶
+	uint64_t	m_truncatedInstanceID;
+	//截断到这个位置的Acceptor，向它请求快照
+	NodeID	m_snapshotSourceUID;
+	//上次请求快照的时间
+	uint64_t	m_snapshotRequestTimestamp;
+
 	//是否需要向集群索要最新的leadership
 	bool	m_acquiringLeadership;
-	std::set<std::string>	m_acceptNACKs;
+	std::set<NodeID>	m_acceptNACKs;
 };
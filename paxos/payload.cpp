@@ -0,0 +1,127 @@
+#include "payload.h"
+
+#include "wide_codec.h"
+
+//64位FNV-1a
+static uint64_t hashFNV(const std::string& data)
+{
+	uint64_t value = 0xcbf29ce484222325ULL;
+	for (unsigned char c : data)
+	{
+		value ^= c;
+		value *= 0x100000001b3ULL;
+	}
+	return value;
+}
+
+//黄金分割乘数加移位异或，和FNV的乘数、初始值都不同，一个撞上时另一个也撞上的概率可以忽略
+static uint64_t hashMix(const std::string& data)
+{
+	uint64_t value = 0x9e3779b97f4a7c15ULL;
+	for (unsigned char c : data)
+	{
+		value ^= c;
+		value *= 0x9e3779b97f4a7c15ULL;
+		value ^= value >> 29;
+	}
+	return value;
+}
+
+PayloadStore::PayloadStore():m_bytes(0)
+{
+}
+
+PayloadStore::~PayloadStore()
+{
+}
+
+/**
+ * @brief 计算payload的摘要
+ */
+void PayloadStore::makeDigest(const std::string& payload, std::string& digest)
+{
+	digest.clear();
+	digest.reserve(PAXOS_PAYLOAD_DIGEST_SIZE);
+	WideCodec::appendUint32(digest, PAXOS_PAYLOAD_DIGEST_MAGIC);
+	WideCodec::appendUint32(digest, payload.size());
+	uint64_t hashes[2] = {hashFNV(payload), hashMix(payload)};
+	for (auto value : hashes)
+	{
+		WideCodec::appendUint32(digest, (uint32_t)value);
+		WideCodec::appendUint32(digest, (uint32_t)(value >> 32));
+	}
+}
+
+bool PayloadStore::isDigest(const std::string& value)
+{
+	return value.size() == PAXOS_PAYLOAD_DIGEST_SIZE &&
+		WideCodec::readUint32(value.data()) == PAXOS_PAYLOAD_DIGEST_MAGIC;
+}
+
+bool PayloadStore::add(const std::string& digest, const std::string& payload, uint64_t instanceID)
+{
+	if (contains(digest))
+	{
+		return true;
+	}
+	std::string expected;
+	makeDigest(payload, expected);
+	if (expected != digest)
+	{
+		return false;
+	}
+	Payload& item = m_payloads[digest];
+	item.m_value = payload;
+	item.m_instanceID = instanceID;
+	m_bytes += payload.size();
+	return true;
+}
+
+const std::string* PayloadStore::find(const std::string& digest) const
+{
+	auto itr = m_payloads.find(digest);
+	return itr == m_payloads.end() ? nullptr : &itr->second.m_value;
+}
+
+bool PayloadStore::contains(const std::string& digest) const
+{
+	return m_payloads.find(digest) != m_payloads.end();
+}
+
+void PayloadStore::reference(const std::string& digest, uint64_t instanceID)
+{
+	auto itr = m_payloads.find(digest);
+	if (itr != m_payloads.end() && itr->second.m_instanceID < instanceID)
+	{
+		itr->second.m_instanceID = instanceID;
+	}
+}
+
+/**
+ * @brief 没有被任何实例引用的payload(leader分发以后没来得及提出就换了leader)在截断越过收到时的提交位置以后丢弃
+ */
+void PayloadStore::truncate(uint64_t instanceID)
+{
+	for (auto itr = m_payloads.begin(); itr != m_payloads.end(); )
+	{
+		if (itr->second.m_instanceID < instanceID)
+		{
+			m_bytes -= itr->second.m_value.size();
+			itr = m_payloads.erase(itr);
+		}
+		else
+		{
+			++itr;
+		}
+	}
+}
+
+size_t PayloadStore::size() const
+{
+	return m_payloads.size();
+}
+
+uint64_t PayloadStore::getBytes() const
+{
+	return m_bytes;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+//payload摘要的魔数"PXPD"
+const uint32_t PAXOS_PAYLOAD_DIGEST_MAGIC = 0x44505850;
+//摘要的长度：4字节魔数，4字节payload长度，两个8字节哈希
+const size_t PAXOS_PAYLOAD_DIGEST_SIZE = 24;
+
+/**
+ * @brief 大议题value的内容和排序分开：leader先把payload分发给各个节点，共识消息(accept、Permit、Promise、
+ * 	推送)里只带定长的摘要。Acceptor只批准本地已经有payload的摘要，选定的摘要至少在Q2个Acceptor上有payload；
+ * 	Learner按顺序通知时把摘要换回payload，状态机看到的还是原来的value。
+ * 	摘要是魔数、长度和两个64位哈希，不是密码学哈希，只防止不同的value意外撞上，集群内的节点互相信任。
+ * 	摘要是24字节，deps的包开头是包长度，同样24字节的包开头不可能是魔数，和普通value不会混淆。
+ *
+ */
+class PayloadStore
+{
+public:
+	PayloadStore();
+	~PayloadStore();
+
+	static void makeDigest(const std::string& payload, std::string& digest);
+	static bool isDigest(const std::string& value);
+
+	//payload和摘要对不上时返回false，不保存。instanceID是收到时的提交位置，截断到它之后才会丢弃
+	bool add(const std::string& digest, const std::string& payload, uint64_t instanceID);
+	//没有时返回nullptr
+	const std::string* find(const std::string& digest) const;
+	bool contains(const std::string& digest) const;
+	//实例instanceID引用了这个摘要，截断越过它之前不能丢弃
+	void reference(const std::string& digest, uint64_t instanceID);
+	//编号小于instanceID的实例已经包含在状态机快照里，丢弃只被这些实例引用的payload
+	void truncate(uint64_t instanceID);
+
+	size_t size() const;
+	uint64_t getBytes() const;
+private:
+	struct Payload
+	{
+		std::string m_value;
+		//引用它的最大实例编号
+		uint64_t m_instanceID;
+	};
+	//摘要 -> payload
+	std::unordered_map<std::string, Payload> m_payloads;
+	//所有payload的字节数
+	uint64_t m_bytes;
+};
@@ -4,6 +4,7 @@
 #include "net/marshall.h"
 #include "sys/util.h"
 #include "net/socket_base.h"
+#include "proposalid.h"
 
 #include <stdint.h>
 #include <string>
@@ -83,11 +84,12 @@ struct PeerAddr: public deps::Marshallable{
 };
 
 struct PeerInfo: public deps::Marshallable{
-	PeerInfo(){}
-	PeerInfo(const PeerInfo& p):m_id(p.m_id), m_addr(p.m_addr), m_rtt(100){
+	PeerInfo():m_nodeID(INVALID_NODE_ID), m_rtt(100){}
+	PeerInfo(const PeerInfo& p):m_id(p.m_id), m_nodeID(p.m_nodeID), m_addr(p.m_addr), m_rtt(100){
 	}
 	PeerInfo& operator = (const PeerInfo& p){
 		m_id = p.m_id;
+		m_nodeID = p.m_nodeID;
 		m_addr = p.m_addr;
 		m_rtt = p.m_rtt;
 		return *this;
@@ -99,11 +101,11 @@ struct PeerInfo: public deps::Marshallable{
 	}
 
 	virtual void marshal(deps::Pack & pk) const{
-		pk << m_id << m_addr;
+		pk << m_id << m_nodeID << m_addr;
 	}
 
 	virtual void unmarshal(const deps::Unpack &up){
-		up >> m_id >> m_addr;
+		up >> m_id >> m_nodeID >> m_addr;
 	}
 
 	bool operator != (const PeerInfo& p) const{
@@ -126,6 +128,8 @@ struct PeerInfo: public deps::Marshallable{
 	}
 
 	std::string m_id;
+	//节点编号，共识消息里用它代替m_id
+	NodeID m_nodeID;
 	PeerAddr m_addr;
 	uint64_t m_rtt;
 };
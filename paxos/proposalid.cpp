@@ -1,8 +1,8 @@
 #include "proposalid.h"
 
-ProposalID::ProposalID():m_number(0),m_uid(""){}
+ProposalID::ProposalID():m_number(0),m_uid(INVALID_NODE_ID){}
 
-ProposalID::ProposalID(int number, std::string uid):m_number(number),m_uid(uid)
+ProposalID::ProposalID(int number, NodeID uid):m_number(number),m_uid(uid)
 {}
 
 ProposalID::ProposalID(const ProposalID& id):m_number(id.m_number),m_uid(id.m_uid)
@@ -21,7 +21,7 @@ ProposalID::~ProposalID()
 
 bool ProposalID::isValid() const
 {
-    if(m_uid.empty())
+    if(m_uid == INVALID_NODE_ID)
     {
         return false;
     }
@@ -46,7 +46,7 @@ void ProposalID::incrementNumber()
 std::string ProposalID::toString() const
 {
     std::string dumpstr;
-    dumpstr.append(std::to_string(m_number).append("_").append(m_uid));
+    dumpstr.append(std::to_string(m_number).append("_").append(std::to_string(m_uid)));
     return dumpstr;
 }
 
@@ -1,9 +1,17 @@
 #pragma once
 
 #include <string>
+#include <stdint.h>
 
 #include "net/marshall.h"
 
+/**
+ * @brief 节点编号：节点加入集群时确定的16位稠密编号，网络消息和议题编号里用它代替字符串id，
+ *  比较议题编号只需要比较整数。0表示无效编号。
+ */
+typedef uint16_t NodeID;
+const NodeID INVALID_NODE_ID = 0;
+
 /**
  * @brief 议题编号：议题编号由一个只能持续递增的数字和一个唯一的标识符组成，具有全局唯一性。
  * 
@@ -12,7 +20,7 @@ class ProposalID : public deps::Marshallable
 {
 public:
     ProposalID();
-    ProposalID(int number, std::string uid);
+    ProposalID(int number, NodeID uid);
     ProposalID(const ProposalID& id);
 	ProposalID& operator=(const ProposalID& id);
     ~ProposalID();
@@ -33,5 +41,5 @@ public:
     void unmarshal(const deps::Unpack &up);
 public:
     uint32_t m_number;
-    std::string m_uid;
+    NodeID m_uid;
 };
\ No newline at end of file
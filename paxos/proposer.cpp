@@ -1,17 +1,35 @@
 #include "proposer.h"
+#include "clock.h"
+
+#include <algorithm>
+
+//还没有往返时间样本时accept的重发等待，单位微秒
+static const uint64_t RESEND_INITIAL_US = 20000;
+//重发等待的上下限，单位微秒。下限是定时器的精度，上限是原来整个窗口一起重发的周期
+static const uint64_t RESEND_MIN_US = 1000;
+static const uint64_t RESEND_MAX_US = 1000000;
 
 /**
  * @brief Construct a new Proposer:: Proposer object
  * 
  * @param messenger 通信接口
  * @param proposerUID proposer的ID
- * @param quorumSize 达成一致要求的最小Acceptor数量
+ * @param memberships 每个实例上生效的配置，决定prepare阶段(Q1)和accept阶段(Q2)的quorum
+ * @param acceptWindow 同时进行accept的实例个数上限
  */
-Proposer::Proposer(Messenger& messenger, const std::string& proposerUID, int quorumSize):m_messenger(messenger)
+Proposer::Proposer(Messenger& messenger, NodeID proposerUID, const MembershipSchedule& memberships, 
+	size_t acceptWindow):m_messenger(messenger),m_memberships(memberships)
 {
     m_proposerUID = proposerUID;
-    m_quorumSize = quorumSize;
+    m_acceptWindow = acceptWindow > 0 ? acceptWindow : 1;
     m_proposalID = ProposalID(0, proposerUID);
+    m_firstUnchosenID = 0;
+    m_notifiedCommitID = 0;
+    m_nextInstanceID = 0;
+    m_prepareTimestamp = 0;
+    m_acceptRtt = 0;
+    m_leader = false;
+    m_active = true;
 }
 
 Proposer::~Proposer()
@@ -38,6 +56,7 @@ void Proposer::prepare( bool incrementProposalNumber )
 		m_active = true;
 		//清空已经收到的Acceptor响应
 		m_promisesReceived.clear();
+		m_recoveredInstances.clear();
 		//其他标志保持不变
 
 		//协议编号加1
@@ -46,45 +65,82 @@ void Proposer::prepare( bool incrementProposalNumber )
 	
 	if (m_active)
 	{
-		//发送prepare请求，prepare请求不需要携带议题value，只需要发送议题编号
-		m_messenger.sendPrepare(m_proposalID);
+		//发送prepare请求，prepare请求不需要携带议题value，只需要发送议题编号和起始实例编号，
+		//承诺对起始实例之后的所有实例都生效，所以leader在后续的实例上可以跳过prepare阶段
+		m_prepareTimestamp = PaxosClock::nowUs();
+		m_messenger.sendPrepare(m_proposalID, m_firstUnchosenID);
 	}
 }
 
 
 /**
- * @brief 设置议题的值
+ * @brief 设置议题的值，议题会按照提交顺序分配到后续的实例上
  * 
  * @param value 议题的值
  */
 void Proposer::setProposal(const std::string& value)
 {
-	if (m_proposedValue.empty()) 
+	m_pendingValues.push_back(Proposal(value, PaxosClock::nowUs()));
+	proposeNext();
+}
+
+/**
+ * @brief 给等待中的议题分配实例编号并且发起accept请求，同一时间最多有m_acceptWindow个实例在进行accept，
+ * 	不需要等前一个实例达成一致。Permit可以乱序返回，Learner负责按照实例编号顺序通知。
+ * 	实例编号小于第一个未决实例加alpha，发出accept时这个实例上生效的配置已经确定。
+ * 
+ */
+void Proposer::proposeNext()
+{
+	//只有leader才能发起accept请求，因为leader表示prepare请求已经收到过大多数Acceptor的批准
+	if (!m_leader || !m_active)
 	{
-		m_proposedValue = value;
-		
-		//只有leader才能发起accept请求，因为leader表示prepare请求已经收到过大多数Acceptor的批准
-		if (m_leader && m_active)
-		{
-			m_messenger.sendAccept(m_proposalID, m_proposedValue);
-		}
+		return;
+	}
+
+	while (m_proposals.size() < m_acceptWindow && !m_pendingValues.empty() &&
+		m_nextInstanceID < m_firstUnchosenID + m_memberships.getAlpha())
+	{
+		uint64_t instanceID = m_nextInstanceID++;
+		Proposal& proposal = m_proposals[instanceID];
+		proposal = m_pendingValues.front();
+		m_pendingValues.pop_front();
+		startAccept(instanceID, proposal);
 	}
 }
 
+/**
+ * @brief 实例第一次发出accept请求，挂上这个实例自己的重发定时器。等待时间是平滑往返时间的2倍，
+ * 	丢了一个accept或者Permit只重发这一个实例，不用等整个窗口的周期重发。
+ * 	不活跃时只挂定时器，恢复活跃以后由定时器发出
+ */
+void Proposer::startAccept(uint64_t instanceID, Proposal& proposal)
+{
+	proposal.m_acceptTimestamp = PaxosClock::nowUs();
+	proposal.m_resent = !m_active;
+	proposal.m_resendDelay = m_acceptRtt > 0 ? 
+		std::min(std::max(m_acceptRtt * 2, RESEND_MIN_US), RESEND_MAX_US) : RESEND_INITIAL_US;
+	if (m_active)
+	{
+		sendAccept(instanceID, proposal.m_value);
+	}
+	m_messenger.scheduleResend(instanceID, proposal.m_resendDelay);
+}
+
 /**
  * @brief 
  * 
  * @param fromUID Acceptor的UID
  * @param proposalID prepare请求的议题编号
- * @param prevAcceptedID Acceptor当前批准的最大议题编号
- * @param prevAcceptedValue Acceptor当前批准的最大议题编号对应的value
+ * @param instanceID prepare请求的起始实例编号
+ * @param acceptedInstances Acceptor在起始实例之后已经批准的议题
  */
-void Proposer::receivePromise(const std::string& fromUID, const ProposalID& proposalID, 
-	const ProposalID& prevAcceptedID, const std::string& prevAcceptedValue)
+void Proposer::receivePromise(NodeID fromUID, const ProposalID& proposalID, 
+	uint64_t instanceID, const std::vector<PaxosInstance>& acceptedInstances)
 {	
 	observeProposal(fromUID, proposalID);
 
-	if (//m_leader ||
+	if (m_leader ||
 		proposalID != m_proposalID || 
 		m_promisesReceived.find(fromUID) != m_promisesReceived.end())
 	{
@@ -94,29 +150,148 @@ void Proposer::receivePromise(const std::string& fromUID, const ProposalID& prop
 
 	m_promisesReceived.insert( fromUID );
 
-	if (!m_lastAcceptedID.isValid() || prevAcceptedID > m_lastAcceptedID)
+	for (auto& accepted : acceptedInstances)
 	{
-		//Acceptor返回的议题编号大于Proposer保存的最大议题编号，更新最大议题的编号和value
-		m_lastAcceptedID = prevAcceptedID;
-		if (!prevAcceptedValue.empty())
+		if (accepted.m_instanceID < m_firstUnchosenID)
+		{
+			continue;
+		}
+		//Acceptor返回的议题编号大于Proposer保存的该实例上的最大议题编号，更新最大议题的编号和value
+		PaxosInstance& recovered = m_recoveredInstances[accepted.m_instanceID];
+		if (!recovered.m_acceptedID.isValid() || accepted.m_acceptedID > recovered.m_acceptedID)
 		{
-			m_proposedValue = prevAcceptedValue;
+			recovered = accepted;
 		}
 	}
 
-	//prepare请求收到了超过半数以上Acceptor的响应，那么可以发送accept请求
-	if (m_promisesReceived.size() >= m_quorumSize) 
+	//prepare请求在起始实例之后可能生效的每个配置里都收到了Q1个Acceptor的响应，那么可以发送accept请求
+	if (m_memberships.isPrepareQuorum(m_firstUnchosenID, m_promisesReceived)) 
 	{
 		//自动成为leader
 		m_leader = true;
+		m_prepareLatency.record(PaxosClock::nowUs() - m_prepareTimestamp);
 
 		//向其他Proposer广播，希望自己的leader得到承认
 		m_messenger.onLeadershipAcquired();
 
-		if (!m_proposedValue.empty() && m_active)
+		//上一任期没有完成的议题，如果没有被别的议题占用实例，重新排队
+		for (auto itr = m_proposals.rbegin(); itr != m_proposals.rend(); ++itr)
+		{
+			auto recoveredItr = m_recoveredInstances.find(itr->first);
+			if (recoveredItr == m_recoveredInstances.end() || 
+				recoveredItr->second.m_acceptedValue != itr->second.m_value)
+			{
+				m_pendingValues.push_front(itr->second);
+			}
+		}
+		m_proposals.clear();
+
+		if (m_nextInstanceID < m_firstUnchosenID)
 		{
-			m_messenger.sendAccept(m_proposalID, m_proposedValue);
+			m_nextInstanceID = m_firstUnchosenID;
 		}
+
+		//已经被批准过的实例必须用最大编号的议题value重新提交，中间的空洞用空value填上
+		if (!m_recoveredInstances.empty())
+		{
+			uint64_t lastInstanceID = m_recoveredInstances.rbegin()->first;
+			for (uint64_t id = m_firstUnchosenID; id <= lastInstanceID; ++id)
+			{
+				auto recoveredItr = m_recoveredInstances.find(id);
+				Proposal& proposal = m_proposals[id];
+				if (recoveredItr != m_recoveredInstances.end())
+				{
+					proposal.m_value = recoveredItr->second.m_acceptedValue;
+				}
+				startAccept(id, proposal);
+			}
+			if (m_nextInstanceID <= lastInstanceID)
+			{
+				m_nextInstanceID = lastInstanceID + 1;
+			}
+			m_recoveredInstances.clear();
+		}
+
+		proposeNext();
+	}
+}
+
+/**
+ * @brief 实例已经达成一致，如果达成一致的不是自己在这个实例上提出的议题，议题重新排队
+ * 
+ * @param instanceID 实例编号
+ * @param value 达成一致的议题值
+ */
+void Proposer::receiveResolution(uint64_t instanceID, const std::string& value)
+{
+	if (instanceID >= m_nextInstanceID)
+	{
+		m_nextInstanceID = instanceID + 1;
+	}
+
+	auto itr = m_proposals.find(instanceID);
+	if (itr != m_proposals.end())
+	{
+		if (itr->second.m_resendDelay > 0)
+		{
+			m_messenger.cancelResend(instanceID);
+		}
+		if (itr->second.m_value != value)
+		{
+			m_pendingValues.push_front(itr->second);
+		}
+		else
+		{
+			uint64_t now = PaxosClock::nowUs();
+			if (itr->second.m_acceptTimestamp > 0)
+			{
+				m_acceptLatency.record(now - itr->second.m_acceptTimestamp);
+			}
+			if (itr->second.m_timestamp > 0)
+			{
+				m_commitLatency.record(now - itr->second.m_timestamp);
+			}
+		}
+		m_proposals.erase(itr);
+	}
+
+	proposeNext();
+}
+
+/**
+ * @brief 发送accept请求，捎带当前的提交位置
+ */
+void Proposer::sendAccept(uint64_t instanceID, const std::string& value)
+{
+	m_notifiedCommitID = m_firstUnchosenID;
+	m_messenger.sendAccept(m_proposalID, instanceID, value, m_firstUnchosenID);
+}
+
+/**
+ * @brief leader空闲(没有进行中的accept)并且提交位置前进以后还没有accept请求捎带出去时返回true，
+ * 	并且记为已经通知。还有accept在进行时，后续的accept或者下一次心跳会带上新的提交位置
+ */
+bool Proposer::takeCommitNotification()
+{
+	if (!m_leader || !m_proposals.empty() || m_firstUnchosenID <= m_notifiedCommitID)
+	{
+		return false;
+	}
+	m_notifiedCommitID = m_firstUnchosenID;
+	return true;
+}
+
+/**
+ * @brief 更新第一个还没有达成一致的实例编号，窗口向后移动以后可以继续分配实例
+ * 
+ * @param instanceID 实例编号
+ */
+void Proposer::setFirstUnchosenID(uint64_t instanceID)
+{
+	if (instanceID > m_firstUnchosenID)
+	{
+		m_firstUnchosenID = instanceID;
+		proposeNext();
 	}
 }
 
@@ -127,7 +302,7 @@ void Proposer::receivePromise(const std::string& fromUID, const ProposalID& prop
  * @param proposalID prepare请求的议题编号
  * @param promisedID Acceptor对于所有prepare请求承诺的最大议题编号
  */
-void Proposer::receivePrepareNACK(const std::string& fromUID, 
+void Proposer::receivePrepareNACK(NodeID fromUID, 
 	const ProposalID& proposalID, const ProposalID& promisedID) 
 {
 	observeProposal(fromUID, promisedID);
@@ -138,10 +313,11 @@ void Proposer::receivePrepareNACK(const std::string& fromUID,
  * 
  * @param fromUID Acceptor的ID
  * @param proposalID acceptor请求的议题编号
+ * @param instanceID acceptor请求的实例编号
  * @param promisedID Acceptor对于所有prepare请求承诺的最大议题编号
  */
-void Proposer::receiveAcceptNACK(const std::string& fromUID, 
-	const ProposalID& proposalID, const ProposalID& promisedID)
+void Proposer::receiveAcceptNACK(NodeID fromUID, 
+	const ProposalID& proposalID, uint64_t instanceID, const ProposalID& promisedID)
 {
 	observeProposal(fromUID, promisedID);
 }
@@ -151,50 +327,71 @@ void Proposer::receiveAcceptNACK(const std::string& fromUID,
  * 
  * @return 协议号
  */
-std::string Proposer::getProposerUID() const
+NodeID Proposer::getProposerUID() const
 {
     return m_proposerUID;
 }
 
 /**
- * @brief 获取共识机制要求的“大多数”的数量值
+ * @brief 获取协议号ID
  * 
- * @return "大多数"的值 
+ * @return 协议号ID 
  */
-
-size_t Proposer::getQuorumSize() 
+ProposalID Proposer::getProposalID() const
 {
-    return m_quorumSize;
+    return m_proposalID;
 }
 
 /**
- * @brief 获取协议号ID
+ * @brief 获取下一个可以分配的实例编号
  * 
- * @return 协议号ID 
+ * @return 实例编号
  */
-ProposalID Proposer::getProposalID() const
+uint64_t Proposer::getNextInstanceID() const
 {
-    return m_proposalID;
+    return m_nextInstanceID;
 }
 
 /**
- * @brief 获取协议值
- * 
- * @return 协议值
+ * @brief 获取还没有达成一致的议题个数
  */
-std::string Proposer::getProposedValue() 
+size_t Proposer::numPendingProposals() 
 {
-    return m_proposedValue;
+    return m_pendingValues.size() + m_proposals.size();
 }
 
 /**
- * @brief 获取所有Acceptor返回的批准的最大协议号ID
+ * @brief 获取正在进行accept的实例个数
+ */
+size_t Proposer::numInflightProposals() 
+{
+    return m_proposals.size();
+}
+
+/**
+ * @brief 获取同时进行accept的实例个数上限
+ */
+size_t Proposer::getAcceptWindow() 
+{
+    return m_acceptWindow;
+}
+
+/**
+ * @brief 取走上次取走以后各阶段的耗时直方图，单位微秒
  * 
- * @return ProposalID 
+ * @param prepareLatency prepare请求到收齐大多数承诺
+ * @param acceptLatency accept请求到达成一致
+ * @param commitLatency 本地议题从提交到达成一致，包括攒批和排队
  */
-ProposalID Proposer::getLastAcceptedID() 
+void Proposer::takeLatencies(LatencyHistogram& prepareLatency, LatencyHistogram& acceptLatency, 
+    LatencyHistogram& commitLatency) 
 {
-    return m_lastAcceptedID;
+    prepareLatency = m_prepareLatency;
+    acceptLatency = m_acceptLatency;
+    commitLatency = m_commitLatency;
+    m_prepareLatency.reset();
+    m_acceptLatency.reset();
+    m_commitLatency.reset();
 }
 
 /**
@@ -206,29 +403,68 @@ int Proposer::numPromises()
 }
 
 /**
- * @brief 更新自己收到Acceptor已经批准的最大议题编号
+ * @brief 更新自己收到Acceptor已经批准的最大议题编号。leader看到更大的编号时放弃leader身份：
+ * 	抬高以后的编号没有prepare过，UID更大时它还压过别人的承诺，直接拿来发accept会在别人已经选定的实例上
+ * 	选出不同的值，必须重新prepare。还没有达成一致的议题留在m_proposals里，下次收齐承诺时和恢复出的值比较后重新排队
  * 
  * @param fromUID 	acceptor的UID
  * @param proposalID 协议号
  */
-void Proposer::observeProposal(const std::string& fromUID, const ProposalID& proposalID) 
+void Proposer::observeProposal(NodeID fromUID, const ProposalID& proposalID) 
 {
 	if (proposalID > m_proposalID)
 	{
 		m_proposalID.setNumber(proposalID.getNumber());
+		m_leader = false;
+		m_promisesReceived.clear();
+		m_recoveredInstances.clear();
 	}
 }
 
 
 /**
- * @brief 重发accept请求
+ * @brief 实例的重发定时器到期，只重发这一个实例的accept请求，下一次等待时间翻倍。
+ * 	已经不是leader时不再重发，重新当选以后收齐承诺时重新发出并且挂定时器
+ * 
+ * @param instanceID 实例编号
+ */
+void Proposer::resendAccept(uint64_t instanceID) 
+{
+	auto itr = m_proposals.find(instanceID);
+	if (itr == m_proposals.end() || !m_leader)
+	{
+		return;
+	}
+	Proposal& proposal = itr->second;
+	proposal.m_resendDelay = std::min(std::max(proposal.m_resendDelay * 2, RESEND_MIN_US), RESEND_MAX_US);
+	if (m_active)
+	{
+		proposal.m_resent = true;
+		sendAccept(instanceID, proposal.m_value);
+	}
+	m_messenger.scheduleResend(instanceID, proposal.m_resendDelay);
+}
+
+/**
+ * @brief 实例拿到了accept quorum，取消重发定时器。没有重发过时用它更新平滑往返时间，
+ * 	按顺序通知可能还要等前面的实例，不能等到那时再取消
  * 
+ * @param instanceID 实例编号
  */
-void Proposer::resendAccept() 
+void Proposer::observeChosen(uint64_t instanceID)
 {
-	if (m_leader && m_active && !m_proposedValue.empty())
-	{		
-		m_messenger.sendAccept(m_proposalID, m_proposedValue);
+	auto itr = m_proposals.find(instanceID);
+	if (itr == m_proposals.end() || itr->second.m_resendDelay == 0)
+	{
+		return;
+	}
+	Proposal& proposal = itr->second;
+	m_messenger.cancelResend(instanceID);
+	proposal.m_resendDelay = 0;
+	if (!proposal.m_resent && proposal.m_acceptTimestamp > 0)
+	{
+		uint64_t rtt = PaxosClock::nowUs() - proposal.m_acceptTimestamp;
+		m_acceptRtt = m_acceptRtt > 0 ? (m_acceptRtt * 7 + rtt) / 8 : rtt;
 	}
 }
 
@@ -1,57 +1,112 @@
 #pragma once
 
 #include "proposalid.h"
+#include "instance.h"
 #include "messenger.h"
+#include "histogram.h"
+#include "membership.h"
 
 #include <string>
 #include <set>
+#include <map>
+#include <deque>
+#include <vector>
 
 class Proposer
 {
+
+struct Proposal
+{
+	Proposal():m_timestamp(0),m_acceptTimestamp(0),m_resendDelay(0),m_resent(false){}
+	Proposal(const std::string& value, uint64_t timestamp):
+		m_value(value),m_timestamp(timestamp),m_acceptTimestamp(0),m_resendDelay(0),m_resent(false){}
+	~Proposal(){}
+	std::string m_value;
+	//提交议题的时间戳，单位微秒，为0表示不是本地提交的议题(恢复出来的议题或者空洞)
+	uint64_t m_timestamp;
+	//发出accept请求的时间戳，单位微秒
+	uint64_t m_acceptTimestamp;
+	//挂着的重发定时器的等待时间，单位微秒，每重发一次翻倍；为0表示没有挂定时器
+	uint64_t m_resendDelay;
+	//重发过的实例不采样往返时间，分不清Permit回复的是哪一次accept
+	bool m_resent;
+};
+
 public:
-    Proposer(Messenger& messenger, const std::string& proposerUID, int quorumSize);
+    Proposer(Messenger& messenger, NodeID proposerUID, const MembershipSchedule& memberships, 
+        size_t acceptWindow);
     ~Proposer();
 
     void prepare(bool incrementProposalNumber);
     void setProposal(const std::string& value);
-    void receivePromise(const std::string& fromUID, const ProposalID& proposalID, 
-        const ProposalID& prevAcceptedID, const std::string& prevAcceptedValue);
-    void observeProposal(const std::string& fromUID, const ProposalID& proposalID);
-    void receivePrepareNACK(const std::string& fromUID, const ProposalID& proposalID, 
+    void receivePromise(NodeID fromUID, const ProposalID& proposalID, 
+        uint64_t instanceID, const std::vector<PaxosInstance>& acceptedInstances);
+    void receiveResolution(uint64_t instanceID, const std::string& value);
+    void setFirstUnchosenID(uint64_t instanceID);
+    bool takeCommitNotification();
+    void observeProposal(NodeID fromUID, const ProposalID& proposalID);
+    void receivePrepareNACK(NodeID fromUID, const ProposalID& proposalID, 
         const ProposalID& promisedID);
-	void receiveAcceptNACK(const std::string& fromUID, const ProposalID& proposalID, 
-        const ProposalID& promisedID);
-    void resendAccept();
+	void receiveAcceptNACK(NodeID fromUID, const ProposalID& proposalID, 
+        uint64_t instanceID, const ProposalID& promisedID);
+    void resendAccept(uint64_t instanceID);
+    void observeChosen(uint64_t instanceID);
 
-    std::string getProposerUID() const;
-    size_t getQuorumSize();
+    NodeID getProposerUID() const;
     ProposalID getProposalID() const;
-    std::string getProposedValue();
-    ProposalID getLastAcceptedID();
+    uint64_t getNextInstanceID() const;
+    size_t numPendingProposals();
+    size_t numInflightProposals();
+    size_t getAcceptWindow();
+    void takeLatencies(LatencyHistogram& prepareLatency, LatencyHistogram& acceptLatency, 
+        LatencyHistogram& commitLatency);
     int numPromises();
 	bool isLeader() const;
 	void setLeader(bool leader);
 	bool isActive();
 	void setActive(bool active);
+private:
+    void proposeNext();
+    void sendAccept(uint64_t instanceID, const std::string& value);
+    void startAccept(uint64_t instanceID, Proposal& proposal);
 private:
     //网络通信接口
     Messenger& m_messenger;
     //Proposer的UID
-    std::string m_proposerUID;
-    //达成一致要求的最小Acceptor数量
-    size_t m_quorumSize;
+    NodeID m_proposerUID;
+    //每个实例上生效的配置。Flexible Paxos：prepare阶段的quorum(Q1)和accept阶段的quorum(Q2)分开配置，
+    //只要任意Q1和任意Q2相交。稳定的leader只走accept阶段，小的Q2降低提交延迟，大的Q1只在换主时付出
+    const MembershipSchedule& m_memberships;
 
-    //提出议题的编号
+    //提出议题的编号，leader在后续所有实例上复用这个编号，不需要重新prepare
     ProposalID m_proposalID;
-    //提出议题的value
-    std::string m_proposedValue;
-    //Acceptor批准的最大的议题编号
-    ProposalID m_lastAcceptedID;
+    //同时进行accept的实例个数上限，实例编号还要落在[m_firstUnchosenID, m_firstUnchosenID + alpha)里
+    size_t m_acceptWindow;
+    //还没有分配实例编号的议题
+    std::deque<Proposal> m_pendingValues;
+    //已经发出accept请求还没有达成一致的实例：实例编号 -> 议题
+    std::map<uint64_t, Proposal> m_proposals;
+    //上次取走以后各阶段的耗时，单位微秒：prepare到收齐承诺，accept到达成一致，本地议题从提交到达成一致
+    LatencyHistogram m_prepareLatency;
+    LatencyHistogram m_acceptLatency;
+    LatencyHistogram m_commitLatency;
+    //发出prepare请求的时间戳，单位微秒
+    uint64_t m_prepareTimestamp;
+    //accept请求到达成一致的平滑往返时间，单位微秒，决定重发定时器的等待时间；为0表示还没有样本
+    uint64_t m_acceptRtt;
+    //已知的第一个还没有达成一致的实例编号，prepare请求从这个实例开始
+    uint64_t m_firstUnchosenID;
+    //最近一次捎带给Acceptor的提交位置
+    uint64_t m_notifiedCommitID;
+    //下一个可以分配的实例编号
+    uint64_t m_nextInstanceID;
+    //prepare阶段Acceptor返回的每个实例上批准的最大编号的议题
+    std::map<uint64_t, PaxosInstance> m_recoveredInstances;
 
     //对当前prepare请求进行承诺的Acceptor列表
-    std::set<std::string> m_promisesReceived;
+    std::set<NodeID> m_promisesReceived;
     //是否是leader
 	bool m_leader;
     //是否是活跃的
 	bool m_active;
-};
\ No newline at end of file
+};
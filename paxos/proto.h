@@ -9,7 +9,9 @@
 #include <set>
 
 #include "proposalid.h"
+#include "instance.h"
 #include "peer.h"
+#include "membership.h"
 
 enum{
 	PAXOS_PROTO_PING_MESSAGE = 1,
@@ -21,21 +23,52 @@ enum{
 	PAXOS_PROTO_PERMIT_MESSAGE,
 	PAXOS_PROTO_PREPARE_ACK_MESSAGE,
 	PAXOS_PROTO_ACCEPT_ACK_MESSAGE,
+	PAXOS_PROTO_LEASE_GRANT_MESSAGE,
+	PAXOS_PROTO_VALUE_CHUNK_MESSAGE,
+	PAXOS_PROTO_MEMBERSHIP_CHANGE_MESSAGE,
+	PAXOS_PROTO_COMMIT_MESSAGE,
+	PAXOS_PROTO_CHOSEN_MESSAGE,
+	PAXOS_PROTO_LEARN_REQUEST_MESSAGE,
+	PAXOS_PROTO_PAYLOAD_MESSAGE,
+	PAXOS_PROTO_PAYLOAD_REQUEST_MESSAGE,
+	PAXOS_PROTO_SNAPSHOT_REQUEST_MESSAGE,
+	PAXOS_PROTO_SNAPSHOT_MESSAGE,
+	PAXOS_PROTO_WAKEUP_MESSAGE,
 };
 
+/**
+ * @brief 消息名字，统计输出用，新增消息时在这里补上
+ */
+inline const char* PaxosMessageName(uint16_t cmd){
+	static const char* names[] = {"unknown", "ping", "pong", "heartbeat", "prepare", "promise",
+		"accept", "permit", "prepare_ack", "accept_ack", "lease_grant", "value_chunk", "membership_change", "commit",
+		"chosen", "learn_request", "payload", "payload_request", "snapshot_request", "snapshot", "wakeup"};
+	return cmd < sizeof(names) / sizeof(names[0]) ? names[cmd] : names[0];
+}
 
+
+//节点加入集群时通过Ping/Pong交换节点信息，包括字符串id、节点编号和地址。
+//每个节点给自己成员表里的条目按加入顺序编上版本号，Ping只带对端还没有确认的那一段增量，
+//成员稳定以后Ping/Pong的大小和集群规模无关
 struct PingMessage : public deps::Marshallable{
 	enum{cmd = PAXOS_PROTO_PING_MESSAGE};
 	uint64_t m_timestamp;
 	PeerInfo m_myInfo;
+	//m_peers和m_removedPeers是发送者成员表里版本在(m_fromVersion, m_toVersion]之间加入和删除的节点
+	uint64_t m_fromVersion;
+	uint64_t m_toVersion;
 	std::set<PeerInfo> m_peers;
+	std::set<std::string> m_removedPeers;
 
 	virtual void marshal(deps::Pack & pk) const{
-		pk << m_timestamp << m_myInfo << m_peers;
+		pk << m_timestamp << m_myInfo << m_fromVersion << m_toVersion << m_peers << m_removedPeers;
 	}
 
 	virtual void unmarshal(const deps::Unpack &up){
-		up >> m_timestamp >> m_myInfo >> m_peers;
+		//消息对象会被复用，先清空容器
+		m_peers.clear();
+		m_removedPeers.clear();
+		up >> m_timestamp >> m_myInfo >> m_fromVersion >> m_toVersion >> m_peers >> m_removedPeers;
 	}
 };
 
@@ -43,67 +76,106 @@ struct PongMessage : public deps::Marshallable{
 	enum{cmd = PAXOS_PROTO_PONG_MESSAGE};
 	uint64_t m_timestamp;
 	PeerInfo m_myInfo;
+	//已经应用到的Ping发送者的成员表版本，发送者下次从这个版本之后开始发增量
+	uint64_t m_ackVersion;
 
 	virtual void marshal(deps::Pack & pk) const{
-		pk << m_timestamp << m_myInfo;
+		pk << m_timestamp << m_myInfo << m_ackVersion;
 	}
 
 	virtual void unmarshal(const deps::Unpack &up){
-		up >> m_timestamp >> m_myInfo;
+		up >> m_timestamp >> m_myInfo >> m_ackVersion;
 	}
 };
 
-//master Proposer发给slave Proposer的心跳
+//master Proposer发给slave Proposer的心跳，同时向Acceptor申请租约
 struct HeartbeatMessage : public deps::Marshallable{
 	enum{cmd = PAXOS_PROTO_HEARTBEAT_MESSAGE};
-	PeerInfo m_myInfo;
-	std::string m_leaderUID;
+	//发送者的节点编号，Ping/Pong交换过PeerInfo以后，共识消息里只带编号
+	NodeID m_from;
+	//Paxos分组编号，同一个连接上多个分组的消息靠它区分
+	uint16_t m_groupID;
+	NodeID m_leaderUID;
+	ProposalID m_leaderProposalID;
+	//leader发送心跳时的单调时钟，单位微秒，Acceptor原样带回
+	uint64_t m_timestamp;
+	//申请的租约时长，单位微秒，为0表示不申请租约
+	uint64_t m_leaseDuration;
+	//leader已经确定的实例编号上界，小于它的实例都已经达成一致
+	uint64_t m_commitInstanceID;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_from << m_groupID << m_leaderUID << m_leaderProposalID << m_timestamp << m_leaseDuration 
+			<< m_commitInstanceID;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_from >> m_groupID >> m_leaderUID >> m_leaderProposalID >> m_timestamp >> m_leaseDuration 
+			>> m_commitInstanceID;
+	}
+};
+
+//Acceptor授予leader租约：租约期内不会对其他Proposer做出承诺
+struct LeaseGrantMessage : public deps::Marshallable{
+	enum{cmd = PAXOS_PROTO_LEASE_GRANT_MESSAGE};
+	NodeID m_from;
+	uint16_t m_groupID;
 	ProposalID m_leaderProposalID;
+	//心跳里leader的时间戳
+	uint64_t m_timestamp;
 
 	virtual void marshal(deps::Pack & pk) const{
-		pk << m_myInfo << m_leaderUID << m_leaderProposalID;
+		pk << m_from << m_groupID << m_leaderProposalID << m_timestamp;
 	}
 
 	virtual void unmarshal(const deps::Unpack &up){
-		up >> m_myInfo >> m_leaderUID >> m_leaderProposalID;
+		up >> m_from >> m_groupID >> m_leaderProposalID >> m_timestamp;
 	}
 };
 
 /**
- * @brief prepare请求协议
+ * @brief prepare请求协议，对所有编号大于等于m_instanceID的实例生效
  * 
  */
 struct PrepareMessage : public deps::Marshallable{
 	enum {cmd = PAXOS_PROTO_PREPARE_MESSAGE};
-	PeerInfo m_myInfo;
+	NodeID m_from;
+	uint16_t m_groupID;
 	ProposalID m_proposalID;
+	uint64_t m_instanceID;
 	
 	virtual void marshal(deps::Pack & pk) const{
-		pk << m_myInfo << m_proposalID;
+		pk << m_from << m_groupID << m_proposalID << m_instanceID;
 	}
 
 	virtual void unmarshal(const deps::Unpack &up){
-		up >> m_myInfo >> m_proposalID;
+		up >> m_from >> m_groupID >> m_proposalID >> m_instanceID;
 	}
 };
 
 /**
- * @brief prepare请求的响应
+ * @brief prepare请求的响应，携带编号大于等于m_instanceID的实例上已经批准的议题
  * 
  */
 struct PromiseMessage : public deps::Marshallable{
 	enum {cmd = PAXOS_PROTO_PROMISE_MESSAGE};
-	PeerInfo m_myInfo;
+	NodeID m_from;
+	uint16_t m_groupID;
 	ProposalID m_proposalID;
-	ProposalID m_acceptID;
-	std::string m_acceptValue;
+	uint64_t m_instanceID;
+	std::vector<PaxosInstance> m_acceptedInstances;
+	//和m_acceptedInstances一一对应的分片流编号，value分片传输时对应的实例value为空。都不分片时为空
+	std::vector<uint64_t> m_valueStreamIDs;
 
 	virtual void marshal(deps::Pack & pk) const{
-		pk << m_myInfo << m_proposalID << m_acceptID << m_acceptValue;
+		pk << m_from << m_groupID << m_proposalID << m_instanceID << m_acceptedInstances << m_valueStreamIDs;
 	}
 
 	virtual void unmarshal(const deps::Unpack &up){
-		up >> m_myInfo >> m_proposalID >> m_acceptID >> m_acceptValue;
+		//消息对象会被复用，先清空容器
+		m_acceptedInstances.clear();
+		m_valueStreamIDs.clear();
+		up >> m_from >> m_groupID >> m_proposalID >> m_instanceID >> m_acceptedInstances >> m_valueStreamIDs;
 	}
 };
 
@@ -113,16 +185,24 @@ struct PromiseMessage : public deps::Marshallable{
  */
 struct AcceptMessage : public deps::Marshallable{
 	enum {cmd = PAXOS_PROTO_ACCEPT_MESSAGE};
-	PeerInfo m_myInfo;
+	NodeID m_from;
+	uint16_t m_groupID;
 	ProposalID m_proposalID;
+	uint64_t m_instanceID;
 	std::string m_proposalValue;
+	//value分片传输时的分片流编号，此时m_proposalValue为空。为0表示value直接放在消息里
+	uint64_t m_valueStreamID;
+	//捎带leader已经确定的实例编号上界，Acceptor用它学习自己批准过的议题
+	uint64_t m_commitInstanceID;
 
 	virtual void marshal(deps::Pack & pk) const{
-		pk << m_myInfo << m_proposalID << m_proposalValue;
+		pk << m_from << m_groupID << m_proposalID << m_instanceID << m_proposalValue << m_valueStreamID 
+			<< m_commitInstanceID;
 	}
 
 	virtual void unmarshal(const deps::Unpack &up){
-		up >> m_myInfo >> m_proposalID >> m_proposalValue;
+		up >> m_from >> m_groupID >> m_proposalID >> m_instanceID >> m_proposalValue >> m_valueStreamID 
+			>> m_commitInstanceID;
 	}
 };
 
@@ -132,16 +212,20 @@ struct AcceptMessage : public deps::Marshallable{
  */
 struct PermitMessage : public deps::Marshallable{
 	enum {cmd = PAXOS_PROTO_PERMIT_MESSAGE};
-	PeerInfo m_myInfo;
+	NodeID m_from;
+	uint16_t m_groupID;
 	ProposalID m_proposalID;
+	uint64_t m_instanceID;
 	std::string m_acceptedValue;
+	//value分片传输时的分片流编号，此时m_acceptedValue为空。为0表示value直接放在消息里
+	uint64_t m_valueStreamID;
 
 	virtual void marshal(deps::Pack & pk) const{
-		pk << m_myInfo << m_proposalID << m_acceptedValue;
+		pk << m_from << m_groupID << m_proposalID << m_instanceID << m_acceptedValue << m_valueStreamID;
 	}
 
 	virtual void unmarshal(const deps::Unpack &up){
-		up >> m_myInfo >> m_proposalID >> m_acceptedValue;
+		up >> m_from >> m_groupID >> m_proposalID >> m_instanceID >> m_acceptedValue >> m_valueStreamID;
 	}
 };
 
@@ -151,16 +235,19 @@ struct PermitMessage : public deps::Marshallable{
  */
 struct PrepareAckMessage : public deps::Marshallable{
 	enum {cmd=PAXOS_PROTO_PREPARE_ACK_MESSAGE};
-	PeerInfo m_myInfo;
+	NodeID m_from;
+	uint16_t m_groupID;
 	ProposalID m_proposalID;
 	ProposalID m_promiseID;
+	//Acceptor截断到的实例编号，更早的实例只在快照里
+	uint64_t m_truncatedInstanceID;
 
 	virtual void marshal(deps::Pack & pk) const{
-		pk << m_myInfo << m_proposalID << m_promiseID;
+		pk << m_from << m_groupID << m_proposalID << m_promiseID << m_truncatedInstanceID;
 	}
 
 	virtual void unmarshal(const deps::Unpack &up){
-		up >> m_myInfo >> m_proposalID >> m_promiseID;
+		up >> m_from >> m_groupID >> m_proposalID >> m_promiseID >> m_truncatedInstanceID;
 	}
 };
 
@@ -170,16 +257,227 @@ struct PrepareAckMessage : public deps::Marshallable{
  */
 struct AcceptAckMessage : public deps::Marshallable{
 	enum {cmd = PAXOS_PROTO_ACCEPT_ACK_MESSAGE};
-	PeerInfo m_myInfo;
+	NodeID m_from;
+	uint16_t m_groupID;
 	ProposalID m_proposalID;
+	uint64_t m_instanceID;
 	ProposalID m_promiseID;
+	//Acceptor截断到的实例编号，更早的实例只在快照里
+	uint64_t m_truncatedInstanceID;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_from << m_groupID << m_proposalID << m_instanceID << m_promiseID << m_truncatedInstanceID;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_from >> m_groupID >> m_proposalID >> m_instanceID >> m_promiseID >> m_truncatedInstanceID;
+	}
+};
+
+/**
+ * @brief 放不进一个包的议题value拆成的分片。同一个流的分片按顺序发送，全部收到以后拼回value，
+ * 	引用这个流的Accept/Permit/Promise消息排在最后一个分片后面发送
+ */
+struct ValueChunkMessage : public deps::Marshallable{
+	enum {cmd = PAXOS_PROTO_VALUE_CHUNK_MESSAGE};
+	NodeID m_from;
+	uint16_t m_groupID;
+	//分片流编号，发送方内唯一
+	uint64_t m_streamID;
+	//value的总长度，32位，不受包长度字段的限制
+	uint32_t m_totalSize;
+	//这个分片在value里的偏移
+	uint32_t m_offset;
+	std::string m_data;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_from << m_groupID << m_streamID << m_totalSize << m_offset << m_data;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_from >> m_groupID >> m_streamID >> m_totalSize >> m_offset >> m_data;
+	}
+};
+
+/**
+ * @brief 管理工具或者非leader节点发给leader的成员变更请求，leader把它作为命令写进复制日志
+ */
+struct MembershipChangeMessage : public deps::Marshallable{
+	enum {cmd = PAXOS_PROTO_MEMBERSHIP_CHANGE_MESSAGE};
+	NodeID m_from;
+	uint16_t m_groupID;
+	Membership m_membership;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_from << m_groupID << m_membership;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_from >> m_groupID >> m_membership;
+	}
+};
+
+/**
+ * @brief leader空闲时的提交通知：没有后续accept可以捎带时，一条消息覆盖所有小于m_commitInstanceID的实例。
+ * 	接收者只学习自己用m_proposalID批准过的议题，value不在消息里
+ */
+struct CommitMessage : public deps::Marshallable{
+	enum {cmd = PAXOS_PROTO_COMMIT_MESSAGE};
+	NodeID m_from;
+	uint16_t m_groupID;
+	ProposalID m_proposalID;
+	uint64_t m_commitInstanceID;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_from << m_groupID << m_proposalID << m_commitInstanceID;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_from >> m_groupID >> m_proposalID >> m_commitInstanceID;
+	}
+};
+
+/**
+ * @brief leader推给观察者的已经达成一致的实例。观察者不在accept请求的接收者里，没有批准过的value可以学习，
+ * 	value直接放在消息里；也是对补发请求的回复
+ */
+struct ChosenMessage : public deps::Marshallable{
+	enum {cmd = PAXOS_PROTO_CHOSEN_MESSAGE};
+	NodeID m_from;
+	uint16_t m_groupID;
+	//leader当前的议题编号，不是实例上选定的议题编号
+	ProposalID m_proposalID;
+	uint64_t m_commitInstanceID;
+	std::vector<PaxosInstance> m_chosenInstances;
+	//和m_chosenInstances一一对应的分片流编号，value分片传输时对应的实例value为空。都不分片时为空
+	std::vector<uint64_t> m_valueStreamIDs;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_from << m_groupID << m_proposalID << m_commitInstanceID << m_chosenInstances << m_valueStreamIDs;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		m_chosenInstances.clear();
+		m_valueStreamIDs.clear();
+		up >> m_from >> m_groupID >> m_proposalID >> m_commitInstanceID >> m_chosenInstances >> m_valueStreamIDs;
+	}
+};
+
+/**
+ * @brief 观察者丢了推送以后向leader请求补发从m_fromInstanceID开始的实例
+ */
+struct LearnRequestMessage : public deps::Marshallable{
+	enum {cmd = PAXOS_PROTO_LEARN_REQUEST_MESSAGE};
+	NodeID m_from;
+	uint16_t m_groupID;
+	uint64_t m_fromInstanceID;
 
 	virtual void marshal(deps::Pack & pk) const{
-		pk << m_myInfo << m_proposalID << m_promiseID;
+		pk << m_from << m_groupID << m_fromInstanceID;
 	}
 
 	virtual void unmarshal(const deps::Unpack &up){
-		up >> m_myInfo >> m_proposalID >> m_promiseID;
+		up >> m_from >> m_groupID >> m_fromInstanceID;
 	}
 };
 
+/**
+ * @brief 议题value的payload，共识消息里只带它的摘要。leader分发时只发给一个节点并要求它转发给其余节点，
+ * 	也是对payload请求的回复
+ */
+struct PayloadMessage : public deps::Marshallable{
+	enum {cmd = PAXOS_PROTO_PAYLOAD_MESSAGE};
+	NodeID m_from;
+	uint16_t m_groupID;
+	//不为0时收到以后转发给除了自己和发送方以外的所有节点
+	uint16_t m_relay;
+	std::string m_digest;
+	std::string m_payload;
+	//放不进一个包的payload分片先发，m_payload为空
+	uint64_t m_valueStreamID;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_from << m_groupID << m_relay << m_digest << m_payload << m_valueStreamID;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_from >> m_groupID >> m_relay >> m_digest >> m_payload >> m_valueStreamID;
+	}
+};
+
+/**
+ * @brief 缺payload的节点(转发丢了的Acceptor、观察者、新leader)请求摘要对应的payload
+ */
+struct PayloadRequestMessage : public deps::Marshallable{
+	enum {cmd = PAXOS_PROTO_PAYLOAD_REQUEST_MESSAGE};
+	NodeID m_from;
+	uint16_t m_groupID;
+	std::string m_digest;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_from << m_groupID << m_digest;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_from >> m_groupID >> m_digest;
+	}
+};
+
+/**
+ * @brief 落后到别的Acceptor已经截断的位置时，本地日志补不上中间的实例，请求覆盖m_instanceID之前实例的快照
+ */
+struct SnapshotRequestMessage : public deps::Marshallable{
+	enum {cmd = PAXOS_PROTO_SNAPSHOT_REQUEST_MESSAGE};
+	NodeID m_from;
+	uint16_t m_groupID;
+	//请求方的提交位置
+	uint64_t m_instanceID;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_from << m_groupID << m_instanceID;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		up >> m_from >> m_groupID >> m_instanceID;
+	}
+};
+
+/**
+ * @brief 状态机快照文件的完整内容，和快照点上生效以及已经决议还没有生效的配置。快照一般放不进一个包，
+ * 	分片先发，m_data为空
+ */
+struct SnapshotMessage : public deps::Marshallable{
+	enum {cmd = PAXOS_PROTO_SNAPSHOT_MESSAGE};
+	NodeID m_from;
+	uint16_t m_groupID;
+	//快照覆盖的实例编号，小于它的实例都包含在快照里
+	uint64_t m_instanceID;
+	//配置生效的起始实例编号，和m_memberships一一对应
+	std::vector<uint64_t> m_membershipStarts;
+	std::vector<Membership> m_memberships;
+	std::string m_data;
+	uint64_t m_valueStreamID;
+
+	virtual void marshal(deps::Pack & pk) const{
+		pk << m_from << m_groupID << m_instanceID << m_membershipStarts << m_memberships << m_data << m_valueStreamID;
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+		m_membershipStarts.clear();
+		m_memberships.clear();
+		up >> m_from >> m_groupID >> m_instanceID >> m_membershipStarts >> m_memberships >> m_data >> m_valueStreamID;
+	}
+};
+
+/**
+ * @brief 其他线程提交命令以后发给本机事件循环的唤醒消息，不带内容，只是让epoll等待马上返回
+ */
+struct WakeupMessage : public deps::Marshallable{
+	enum {cmd = PAXOS_PROTO_WAKEUP_MESSAGE};
+
+	virtual void marshal(deps::Pack & pk) const{
+	}
+
+	virtual void unmarshal(const deps::Unpack &up){
+	}
+};
@@ -0,0 +1,352 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "sys/log.h"
+
+//快照文件头：魔数 + 覆盖的实例编号 + 数据长度
+static const char SNAPSHOT_MAGIC[8] = {'P', 'X', 'S', 'N', 'A', 'P', '0', '1'};
+static const size_t SNAPSHOT_HEADER_SIZE = sizeof(SNAPSHOT_MAGIC) + sizeof(uint64_t) * 2;
+
+static bool writeAll(int fd, const char* data, size_t size)
+{
+	size_t written = 0;
+	while (written < size)
+	{
+		ssize_t n = ::write(fd, data + written, size - written);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		written += n;
+	}
+	return true;
+}
+
+/**
+ * @brief 子进程里写快照文件，只调用write、lseek、fsync这些异步信号安全的函数。
+ * 	内容先攒在固定大小的缓冲区里，数据长度最后回填到文件头
+ */
+class SnapshotFileWriter : public SnapshotWriter
+{
+public:
+	SnapshotFileWriter(int fd, uint64_t instanceID):m_fd(fd), m_used(SNAPSHOT_HEADER_SIZE), m_dataSize(0)
+	{
+		memcpy(m_buffer, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+		memcpy(m_buffer + sizeof(SNAPSHOT_MAGIC), &instanceID, sizeof(instanceID));
+		memcpy(m_buffer + sizeof(SNAPSHOT_MAGIC) + sizeof(instanceID), &m_dataSize, sizeof(m_dataSize));
+	}
+
+	virtual bool write(const void* data, size_t size)
+	{
+		m_dataSize += size;
+		if (m_used + size > sizeof(m_buffer))
+		{
+			if (!writeAll(m_fd, m_buffer, m_used))
+			{
+				return false;
+			}
+			m_used = 0;
+		}
+		if (size >= sizeof(m_buffer))
+		{
+			return writeAll(m_fd, static_cast<const char*>(data), size);
+		}
+		memcpy(m_buffer + m_used, data, size);
+		m_used += size;
+		return true;
+	}
+
+	bool finish()
+	{
+		return writeAll(m_fd, m_buffer, m_used) && 
+			::lseek(m_fd, sizeof(SNAPSHOT_MAGIC) + sizeof(uint64_t), SEEK_SET) >= 0 &&
+			writeAll(m_fd, reinterpret_cast<const char*>(&m_dataSize), sizeof(m_dataSize)) && 
+			::fsync(m_fd) == 0;
+	}
+private:
+	int m_fd;
+	char m_buffer[65536];
+	size_t m_used;
+	uint64_t m_dataSize;
+};
+
+Snapshotter::Snapshotter():m_childPid(-1),m_pendingInstanceID(0),m_snapshotInstanceID(0),m_snapshotSize(0){}
+
+Snapshotter::~Snapshotter(){}
+
+bool Snapshotter::open(const std::string& path)
+{
+	m_path = path;
+	return true;
+}
+
+/**
+ * @brief fork子进程写快照，子进程看到的是fork时刻状态机的副本。多个事件循环线程时fork出来的子进程里
+ * 	只有当前线程，别的线程持有的锁(包括malloc的锁)永远不会释放，所以文件在fork之前打开，
+ * 	子进程只做不分配内存的序列化和异步信号安全的系统调用
+ * 
+ * @param stateMachine 状态机
+ * @param instanceID 状态机已经执行到的实例编号，小于它的实例都包含在快照里
+ */
+bool Snapshotter::start(StateMachine& stateMachine, uint64_t instanceID)
+{
+	if (isRunning() || instanceID <= m_snapshotInstanceID)
+	{
+		return false;
+	}
+
+	std::string tmpPath = m_path + ".tmp";
+	int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		LOG_ERROR("open snapshot %s failed (%s)", tmpPath.c_str(), strerror(errno));
+		return false;
+	}
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		LOG_ERROR("fork snapshot process failed (%s)", strerror(errno));
+		::close(fd);
+		return false;
+	}
+	if (pid == 0)
+	{
+		SnapshotFileWriter writer(fd, instanceID);
+		bool ok = stateMachine.snapshot(writer) && writer.finish();
+		_exit(ok ? 0 : 1);
+	}
+	::close(fd);
+
+	m_childPid = pid;
+	m_pendingInstanceID = instanceID;
+	LOG_INFO("snapshot process pid:%d started instance:%llu", pid, instanceID);
+	return true;
+}
+
+/**
+ * @brief 检查写快照的子进程是否结束，成功的话用新快照替换旧快照
+ * 
+ * @param instanceID 新快照覆盖的实例编号
+ * @return 是否有新快照完成
+ */
+bool Snapshotter::poll(uint64_t& instanceID)
+{
+	if (!isRunning())
+	{
+		return false;
+	}
+
+	int status = 0;
+	pid_t pid = waitpid(m_childPid, &status, WNOHANG);
+	if (pid == 0)
+	{
+		return false;
+	}
+	m_childPid = -1;
+	if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		LOG_ERROR("snapshot process instance:%llu failed status:%d", m_pendingInstanceID, status);
+		return false;
+	}
+
+	std::string tmpPath = m_path + ".tmp";
+	if (::rename(tmpPath.c_str(), m_path.c_str()) < 0)
+	{
+		LOG_ERROR("rename snapshot %s failed (%s)", tmpPath.c_str(), strerror(errno));
+		return false;
+	}
+	//返回以后调用方就会截断日志，改名必须先落盘，否则掉电以后只剩旧快照和截断过的日志
+	if (!syncDirectory())
+	{
+		LOG_ERROR("sync directory of snapshot %s failed (%s)", m_path.c_str(), strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	m_snapshotSize = ::stat(m_path.c_str(), &st) == 0 ? st.st_size : 0;
+	m_snapshotInstanceID = m_pendingInstanceID;
+	instanceID = m_snapshotInstanceID;
+	LOG_INFO("snapshot %s instance:%llu size:%llu done", m_path.c_str(), m_snapshotInstanceID, m_snapshotSize);
+	return true;
+}
+
+bool Snapshotter::isRunning() const
+{
+	return m_childPid > 0;
+}
+
+/**
+ * @brief 启动时加载快照，没有快照文件时状态机从空状态开始
+ * 
+ * @param stateMachine 状态机
+ * @param instanceID 快照覆盖的实例编号
+ */
+bool Snapshotter::load(StateMachine& stateMachine, uint64_t& instanceID)
+{
+	instanceID = 0;
+	std::string content;
+	uint64_t snapshotInstanceID = 0;
+	if (!read(content, snapshotInstanceID))
+	{
+		return errno == ENOENT;
+	}
+
+	if (!stateMachine.restore(content.substr(SNAPSHOT_HEADER_SIZE)))
+	{
+		LOG_ERROR("restore snapshot %s instance:%llu failed", m_path.c_str(), snapshotInstanceID);
+		return false;
+	}
+
+	m_snapshotInstanceID = snapshotInstanceID;
+	m_snapshotSize = content.size();
+	instanceID = snapshotInstanceID;
+	LOG_INFO("snapshot %s instance:%llu size:%llu loaded", m_path.c_str(), instanceID, m_snapshotSize);
+	return true;
+}
+
+/**
+ * @brief 读出整个快照文件并且校验，没有快照文件时返回false，errno为ENOENT
+ * 
+ * @param content 快照文件的内容
+ * @param instanceID 快照覆盖的实例编号
+ */
+bool Snapshotter::read(std::string& content, uint64_t& instanceID)
+{
+	content.clear();
+	int fd = ::open(m_path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		if (errno != ENOENT)
+		{
+			LOG_ERROR("open snapshot %s failed (%s)", m_path.c_str(), strerror(errno));
+		}
+		return false;
+	}
+
+	char buf[65536];
+	ssize_t n = 0;
+	while ((n = ::read(fd, buf, sizeof(buf))) > 0)
+	{
+		content.append(buf, n);
+	}
+	::close(fd);
+
+	if (n < 0 || !parse(content, instanceID))
+	{
+		LOG_ERROR("snapshot %s size:%zd is broken", m_path.c_str(), content.size());
+		errno = EINVAL;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief 用别的节点的快照替换本地快照和状态机。新快照先落盘再替换状态机，重启时和状态机一致；
+ * 	正在写快照时不装载，子进程写完改名会覆盖新快照，请求方超时以后重新请求
+ * 
+ * @param stateMachine 状态机
+ * @param content 快照文件的内容
+ * @param instanceID 快照覆盖的实例编号
+ */
+bool Snapshotter::install(StateMachine& stateMachine, const std::string& content, uint64_t& instanceID)
+{
+	if (isRunning() || !parse(content, instanceID))
+	{
+		return false;
+	}
+	if (instanceID <= m_snapshotInstanceID)
+	{
+		return false;
+	}
+
+	std::string data = content.substr(SNAPSHOT_HEADER_SIZE);
+	std::string tmpPath = m_path + ".tmp";
+	if (!write(tmpPath, instanceID, data) || ::rename(tmpPath.c_str(), m_path.c_str()) < 0 || !syncDirectory())
+	{
+		LOG_ERROR("save snapshot %s instance:%llu failed (%s)", m_path.c_str(), instanceID, strerror(errno));
+		::unlink(tmpPath.c_str());
+		return false;
+	}
+	if (!stateMachine.restore(data))
+	{
+		LOG_ERROR("restore snapshot %s instance:%llu failed", m_path.c_str(), instanceID);
+		return false;
+	}
+
+	m_snapshotInstanceID = instanceID;
+	m_snapshotSize = content.size();
+	LOG_INFO("snapshot %s instance:%llu size:%llu installed", m_path.c_str(), instanceID, m_snapshotSize);
+	return true;
+}
+
+uint64_t Snapshotter::getSnapshotInstanceID() const
+{
+	return m_snapshotInstanceID;
+}
+
+uint64_t Snapshotter::getSnapshotSize() const
+{
+	return m_snapshotSize;
+}
+
+/**
+ * @brief 写快照文件并且落盘，装载别的节点的快照时使用
+ */
+bool Snapshotter::write(const std::string& path, uint64_t instanceID, const std::string& data)
+{
+	int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	uint64_t dataSize = data.size();
+	std::string header(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.append(reinterpret_cast<const char*>(&instanceID), sizeof(instanceID));
+	header.append(reinterpret_cast<const char*>(&dataSize), sizeof(dataSize));
+
+	bool ok = writeAll(fd, header.data(), header.size()) && writeAll(fd, data.data(), data.size());
+	ok = ok && ::fsync(fd) == 0;
+	::close(fd);
+	return ok;
+}
+
+/**
+ * @brief 校验文件头和长度
+ */
+bool Snapshotter::parse(const std::string& content, uint64_t& instanceID)
+{
+	uint64_t dataSize = 0;
+	if (content.size() < SNAPSHOT_HEADER_SIZE || 
+		memcmp(content.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+	{
+		return false;
+	}
+	memcpy(&instanceID, content.data() + sizeof(SNAPSHOT_MAGIC), sizeof(uint64_t));
+	memcpy(&dataSize, content.data() + sizeof(SNAPSHOT_MAGIC) + sizeof(uint64_t), sizeof(uint64_t));
+	return dataSize == content.size() - SNAPSHOT_HEADER_SIZE;
+}
+
+bool Snapshotter::syncDirectory()
+{
+	size_t pos = m_path.rfind('/');
+	std::string dir = pos == std::string::npos ? "." : (pos == 0 ? "/" : m_path.substr(0, pos));
+	int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	bool ok = ::fsync(fd) == 0;
+	::close(fd);
+	return ok;
+}
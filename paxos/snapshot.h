@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+
+#include "state_machine.h"
+
+/**
+ * @brief 状态机快照。fork出子进程，利用写时复制在子进程里序列化状态机并写盘，
+ * 	父进程的事件循环不会被阻塞，只需要定时检查子进程是否结束。
+ * 
+ */
+class Snapshotter
+{
+public:
+	Snapshotter();
+	~Snapshotter();
+
+	bool open(const std::string& path);
+	bool start(StateMachine& stateMachine, uint64_t instanceID);
+	bool poll(uint64_t& instanceID);
+	bool isRunning() const;
+	bool load(StateMachine& stateMachine, uint64_t& instanceID);
+	//读出快照文件的完整内容，发给落后的节点
+	bool read(std::string& content, uint64_t& instanceID);
+	//装载别的节点发来的快照文件内容：先替换本地快照文件，再用它替换状态机
+	bool install(StateMachine& stateMachine, const std::string& content, uint64_t& instanceID);
+
+	uint64_t getSnapshotInstanceID() const;
+	uint64_t getSnapshotSize() const;
+private:
+	static bool write(const std::string& path, uint64_t instanceID, const std::string& data);
+	static bool parse(const std::string& content, uint64_t& instanceID);
+	//改名以后把目录项落盘
+	bool syncDirectory();
+private:
+	std::string m_path;
+	//正在写快照的子进程，-1表示没有
+	pid_t m_childPid;
+	//正在写的快照覆盖的实例编号
+	uint64_t m_pendingInstanceID;
+	//最近一次完成的快照覆盖的实例编号，小于它的实例都已经包含在快照里
+	uint64_t m_snapshotInstanceID;
+	//最近一次完成的快照大小
+	uint64_t m_snapshotSize;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/**
+ * @brief 快照的输出，在写快照的子进程里使用。多线程进程fork出来的子进程只能调用异步信号安全的函数，
+ * 	fork时别的线程可能正持有malloc的锁，所以序列化过程不能分配内存，只能把内容交给这里写文件
+ */
+class SnapshotWriter
+{
+public:
+	virtual ~SnapshotWriter(){}
+	virtual bool write(const void* data, size_t size) = 0;
+};
+
+/**
+ * @brief 复制状态机接口：Learner按照实例编号顺序把达成一致的命令交给状态机执行。
+ * 	同样的命令序列在所有节点上必须产生同样的状态。
+ * 
+ */
+class StateMachine
+{
+public:
+	virtual ~StateMachine(){}
+
+	/**
+	 * @brief 执行一条已经达成一致的命令
+	 * 
+	 * @param instanceID 命令所在的实例编号
+	 * @param command 命令
+	 * @param result 命令的执行结果
+	 * @return 命令是否合法
+	 */
+	virtual bool apply(uint64_t instanceID, const std::string& command, std::string& result) = 0;
+
+	/**
+	 * @brief 只读查询本地状态，不修改状态机，不经过共识
+	 * 
+	 * @param query 查询条件
+	 * @param result 查询结果
+	 * @return 是否查到
+	 */
+	virtual bool read(const std::string& query, std::string& result) = 0;
+
+	/**
+	 * @brief 序列化整个状态机，在写快照的子进程里调用，不能分配内存、加锁或者打日志
+	 * 
+	 * @param writer 序列化结果的输出
+	 */
+	virtual bool snapshot(SnapshotWriter& writer) = 0;
+
+	/**
+	 * @brief 用快照替换整个状态机
+	 * 
+	 * @param data snapshot序列化的结果
+	 */
+	virtual bool restore(const std::string& data) = 0;
+};
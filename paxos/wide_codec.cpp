@@ -0,0 +1,99 @@
+#include "wide_codec.h"
+
+#include "net/packet.h"
+
+//deps的包头、每个字段的长度前缀预留的字节数，估算时宁可多算
+static const size_t PACKET_OVERHEAD = 64;
+static const size_t FIELD_OVERHEAD = 8;
+
+bool WideCodec::fitsPacket(size_t payloadBytes, size_t fieldCount)
+{
+	return payloadBytes + fieldCount * FIELD_OVERHEAD + PACKET_OVERHEAD <= deps::Decoder::maxSize();
+}
+
+bool WideCodec::isWide(const std::string& data)
+{
+	return data.size() > deps::Decoder::maxSize();
+}
+
+/**
+ * @brief 宽编码
+ * 
+ * @param magic 区分数据类型的魔数
+ * @param fields 按顺序编码的字段
+ * @param data 编码结果
+ */
+void WideCodec::encode(uint32_t magic, const std::vector<const std::string*>& fields, std::string& data)
+{
+	size_t total = 8;
+	for (auto field : fields)
+	{
+		total += 4 + field->size();
+	}
+
+	data.clear();
+	data.reserve(total > deps::Decoder::maxSize() ? total : deps::Decoder::maxSize() + 1);
+	appendUint32(data, magic);
+	appendUint32(data, fields.size());
+	for (auto field : fields)
+	{
+		appendUint32(data, field->size());
+		data.append(*field);
+	}
+	//补0到比deps的包长，解码时按照字段长度读，不会读到补的0
+	if (data.size() <= deps::Decoder::maxSize())
+	{
+		data.resize(deps::Decoder::maxSize() + 1, '\0');
+	}
+}
+
+/**
+ * @brief 宽解码，魔数不对或者长度越界时返回false
+ */
+bool WideCodec::decode(const std::string& data, uint32_t magic, std::vector<std::string>& fields)
+{
+	fields.clear();
+	if (!isWide(data) || readUint32(data.data()) != magic)
+	{
+		return false;
+	}
+
+	uint32_t count = readUint32(data.data() + 4);
+	size_t offset = 8;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (data.size() - offset < 4)
+		{
+			return false;
+		}
+		uint32_t size = readUint32(data.data() + offset);
+		offset += 4;
+		if (data.size() - offset < size)
+		{
+			return false;
+		}
+		fields.push_back(data.substr(offset, size));
+		offset += size;
+	}
+	return true;
+}
+
+void WideCodec::appendUint32(std::string& data, uint32_t value)
+{
+	char buf[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		buf[i] = (char)((value >> (i * 8)) & 0xff);
+	}
+	data.append(buf, 4);
+}
+
+uint32_t WideCodec::readUint32(const char* data)
+{
+	uint32_t value = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		value |= (uint32_t)(uint8_t)data[i] << (i * 8);
+	}
+	return value;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//放不进一个deps包的议题value按这个大小拆成分片，网络传输和预写日志共用
+const size_t VALUE_CHUNK_SIZE = 32 * 1024;
+//分片传输的议题value长度上限
+const uint32_t MAX_VALUE_SIZE = 256 * 1024 * 1024;
+
+/**
+ * @brief deps的包长度字段只有16位，放不下的数据(几MB的命令、议题value)用这个宽编码：
+ * 	4字节魔数，4字节字段个数，之后每个字段是4字节长度加内容，整数都按小端存储。
+ * 	编码结果总是比Decoder::maxSize()长(不够时在尾部补0)，按长度就能和deps的包区分开。
+ * 
+ */
+class WideCodec
+{
+public:
+	//字段总长度为payloadBytes、字段个数为fieldCount的数据能否用deps的包编码
+	static bool fitsPacket(size_t payloadBytes, size_t fieldCount);
+	//按长度判断是不是宽编码
+	static bool isWide(const std::string& data);
+
+	static void encode(uint32_t magic, const std::vector<const std::string*>& fields, std::string& data);
+	static bool decode(const std::string& data, uint32_t magic, std::vector<std::string>& fields);
+
+	static void appendUint32(std::string& data, uint32_t value);
+	static uint32_t readUint32(const char* data);
+};
@@ -3,17 +3,19 @@
 killall -9 node
 
 rm /mnt/hgfs/share/shared/cpppaxos/bin/node*.log
+rm /mnt/hgfs/share/shared/cpppaxos/bin/acceptor_*.wal
+rm /mnt/hgfs/share/shared/cpppaxos/bin/snapshot_*.snap
 
 cd /mnt/hgfs/share/shared/cpppaxos/build
 make clean
 make -j4
 
-/mnt/hgfs/share/shared/cpppaxos/bin/node /mnt/hgfs/share/shared/cpppaxos/bin/node1.log -s "12345" -t tcp -y 10000 -n 20000
+/mnt/hgfs/share/shared/cpppaxos/bin/node /mnt/hgfs/share/shared/cpppaxos/bin/node1.log -s "12345" -k 1 -t tcp -y 10000 -n 20000 -d /mnt/hgfs/share/shared/cpppaxos/bin
 sleep 1
-/mnt/hgfs/share/shared/cpppaxos/bin/node /mnt/hgfs/share/shared/cpppaxos/bin/node2.log -s "67890" -t tcp -y 20000 -n 10000
+/mnt/hgfs/share/shared/cpppaxos/bin/node /mnt/hgfs/share/shared/cpppaxos/bin/node2.log -s "67890" -k 2 -t tcp -y 20000 -n 10000 -d /mnt/hgfs/share/shared/cpppaxos/bin
 sleep 1
-/mnt/hgfs/share/shared/cpppaxos/bin/node /mnt/hgfs/share/shared/cpppaxos/bin/node3.log -s "abcde" -t tcp -y 30000 -n 10000
+/mnt/hgfs/share/shared/cpppaxos/bin/node /mnt/hgfs/share/shared/cpppaxos/bin/node3.log -s "abcde" -k 3 -t tcp -y 30000 -n 10000 -d /mnt/hgfs/share/shared/cpppaxos/bin
 sleep 1
-/mnt/hgfs/share/shared/cpppaxos/bin/node /mnt/hgfs/share/shared/cpppaxos/bin/node4.log -s "fghij" -t tcp -y 40000 -n 10000
+/mnt/hgfs/share/shared/cpppaxos/bin/node /mnt/hgfs/share/shared/cpppaxos/bin/node4.log -s "fghij" -k 4 -t tcp -y 40000 -n 10000 -d /mnt/hgfs/share/shared/cpppaxos/bin
 sleep 1
-/mnt/hgfs/share/shared/cpppaxos/bin/node /mnt/hgfs/share/shared/cpppaxos/bin/node5.log -s "klmno" -t tcp -y 50000 -n 10000
+/mnt/hgfs/share/shared/cpppaxos/bin/node /mnt/hgfs/share/shared/cpppaxos/bin/node5.log -s "klmno" -k 5 -t tcp -y 50000 -n 10000 -d /mnt/hgfs/share/shared/cpppaxos/bin
@@ -1,19 +1,70 @@
 #include "server.h"
 #include <memory>
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 #include "paxos/proto.h"
-
-Server::Server(const std::string& myid, int quorumSize):
-	m_paxosNode(*this, myid, quorumSize, 10000, 100000, 50000, "")
+#include "paxos/wide_codec.h"
+#include "paxos/clock.h"
+
+//每轮事件循环每个节点的批量发送队列最多发出的字节数
+static const size_t BULK_BYTES_PER_LOOP = 256 * 1024;
+//一个Ping最多携带的成员表条目，新节点加入时的全量同步分几轮发完
+static const size_t MAX_GOSSIP_PEERS = 64;
+//Acceptor等待回复超过这个时间并且超过4倍往返时间认为停顿了，单位微秒
+static const uint64_t ACCEPTOR_STALL_US = 50 * 1000;
+//每个对端的发送队列最多积压的字节数，超过以后丢弃最老的包，Paxos的超时重发会补上
+static const size_t OUTBOX_MAX_BYTES = 8 * 1024 * 1024;
+//发送队列积压超过这个字节数时批量发送队列不再往里放，大的value等连接恢复再发
+static const size_t OUTBOX_BACKPRESSURE_BYTES = 1024 * 1024;
+//连接失败以后重连的间隔，单位毫秒
+static const uint64_t OUTBOX_RECONNECT_MS = 100;
+//有连接但是一直发不出去时重试发送的最长间隔，单位毫秒，和心跳周期一样，不会比心跳定时器更频繁地唤醒
+static const uint64_t OUTBOX_SEND_RETRY_MS = 10;
+
+Server::Server(const std::string& myid, NodeID myNodeID, int loopIndex):
+	m_valueStreams(10000)
 {
 	m_container = new deps::EpollContainer(1000, 1000);
 	assert(nullptr != m_container);
 
 	m_myUID = myid;
-	m_quorumSize = quorumSize;
+	m_myNodeID = myNodeID;
+	m_loopIndex = loopIndex;
+	m_hasPostedProposals = false;
+	m_wakeupSocket = nullptr;
+	m_wakeupFd = -1;
+	m_nextStreamID = 1;
+	m_outboxDropped = 0;
+	m_membershipVersion = 0;
+	m_quorumMode = QuorumMode::thrifty;
+	m_lastStatsTimestamp = deps::GetMonoTimeMs();
+
+	m_dispatcher.registerMessage<PingMessage, &Server::HandlePingMessage>();
+	m_dispatcher.registerMessage<PongMessage, &Server::HandlePongMessage>();
+	m_dispatcher.registerMessage<HeartbeatMessage, &Server::HandleHeatBeatMessage>();
+	m_dispatcher.registerMessage<PrepareMessage, &Server::HandlePrepareMessage>();
+	m_dispatcher.registerMessage<PromiseMessage, &Server::HandlePromiseMessage>();
+	m_dispatcher.registerMessage<AcceptMessage, &Server::HandleAcceptMessage>();
+	m_dispatcher.registerMessage<PermitMessage, &Server::HandlePermitMessage>();
+	m_dispatcher.registerMessage<CommitMessage, &Server::HandleCommitMessage>();
+	m_dispatcher.registerMessage<ChosenMessage, &Server::HandleChosenMessage>();
+	m_dispatcher.registerMessage<LearnRequestMessage, &Server::HandleLearnRequestMessage>();
+	m_dispatcher.registerMessage<PayloadMessage, &Server::HandlePayloadMessage>();
+	m_dispatcher.registerMessage<PayloadRequestMessage, &Server::HandlePayloadRequestMessage>();
+	m_dispatcher.registerMessage<PrepareAckMessage, &Server::HandlePrepareAckMessage>();
+	m_dispatcher.registerMessage<AcceptAckMessage, &Server::HandleAcceptAckMessage>();
+	m_dispatcher.registerMessage<LeaseGrantMessage, &Server::HandleLeaseGrantMessage>();
+	m_dispatcher.registerMessage<ValueChunkMessage, &Server::HandleValueChunkMessage>();
+	m_dispatcher.registerMessage<MembershipChangeMessage, &Server::HandleMembershipChangeMessage>();
+	m_dispatcher.registerMessage<SnapshotRequestMessage, &Server::HandleSnapshotRequestMessage>();
+	m_dispatcher.registerMessage<SnapshotMessage, &Server::HandleSnapshotMessage>();
+	m_dispatcher.registerMessage<WakeupMessage, &Server::HandleWakeupMessage>();
 
 	m_timerManager.addTimer(5000, std::bind(&Server::SendPingMessage, this));
-	m_timerManager.addTimer(10000, std::bind(&PaxosNode::pulse, m_paxosNode));
-	m_timerManager.addTimer(2000, std::bind(&Server::dumpStatus, this));
+	m_timerManager.addTimer(1000, std::bind(&ValueStreamAssembler::expire, &m_valueStreams));
+	m_timerManager.addTimer(2000, std::bind(&Server::DumpStats, this));
 }
 
 Server::~Server(){
@@ -22,13 +73,6 @@ Server::~Server(){
 	}
 }
 
-void Server::dumpStatus(){
-	bool isLeader = m_paxosNode.isLeader();
-	LOG_INFO("local uid:%s proposalid:%s isLeader:%d leader uid:%s proposalid:%s", 
-		m_myUID.c_str(), m_paxosNode.getMyProposalID().toString().c_str(), isLeader,
-		m_paxosNode.getLeaderUID().c_str(),	m_paxosNode.getLeaderProposalID().toString().c_str());
-}
-
 bool Server::Init(deps::SocketType type, const std::string& localIP, uint16_t localPort, 
 		const std::string& dstIP, uint16_t dstPort){
 
@@ -62,13 +106,147 @@ bool Server::Listen(int port, int backlog, deps::SocketType type){
 	return true;
 }
 
+void Server::AddGroup(PaxosGroup* group){
+	uint16_t groupID = group->getGroupID();
+	if(m_groups.size() <= groupID){
+		m_groups.resize(groupID + 1, nullptr);
+	}
+	m_groups[groupID] = group;
+}
+
+PaxosGroup* Server::GetGroup(uint16_t groupID){
+	return groupID < m_groups.size() ? m_groups[groupID] : nullptr;
+}
+
+/**
+ * @brief 提交一个命令，按照key路由到分组。只能在这个事件循环的线程里调用，其他线程用PostPropose
+*/
+bool Server::Propose(const std::string& key, const std::string& value, size_t groupCount){
+	PaxosGroup* group = GetGroup(PaxosGroup::route(key, groupCount));
+	if(group == nullptr){
+		return false;
+	}
+	group->Propose(value);
+	return true;
+}
+
+/**
+ * @brief 其他线程提交命令。分组表在事件循环启动之前建好，之后只读，可以不加锁查找；
+ * 	PaxosGroup::Propose只能在事件循环线程里调用，命令先放进提交队列，事件循环每轮等待结束以后取走。
+ * 	提交队列由空变成非空时往唤醒连接上写一个唤醒消息，epoll等待马上返回，不用等下一个定时器；
+ * 	唤醒连接还没有建好或者写失败时退回到等下一个定时器，每个分组都有10毫秒的心跳定时器
+*/
+bool Server::PostPropose(uint16_t groupID, const std::string& value){
+	if(GetGroup(groupID) == nullptr){
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(m_proposalMutex);
+	m_postedProposals.push_back(std::make_pair(groupID, value));
+	//事件循环取走之前已经唤醒过，不用再写
+	if(m_hasPostedProposals.exchange(true, std::memory_order_acq_rel)){
+		return true;
+	}
+	int fd = m_wakeupFd.load(std::memory_order_acquire);
+	if(fd >= 0){
+		//只在这里写这个连接，写的时候持有m_proposalMutex，不会和别的提交线程交错；
+		//发送缓冲区满说明还有没读走的唤醒消息，丢掉这一个也不会错过
+		send(fd, m_wakeupPacket->data(), m_wakeupPacket->size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+	}
+	return true;
+}
+
+void Server::drainProposals(){
+	if(!m_hasPostedProposals.load(std::memory_order_acquire)){
+		return;
+	}
+	std::vector<std::pair<uint16_t, std::string>> proposals;
+	{
+		std::lock_guard<std::mutex> lock(m_proposalMutex);
+		proposals.swap(m_postedProposals);
+		m_hasPostedProposals.store(false, std::memory_order_relaxed);
+	}
+	for(auto& proposal : proposals){
+		m_groups[proposal.first]->Propose(proposal.second);
+	}
+}
+
+bool Server::hasLocalMessages() const{
+	for(auto group : m_groups){
+		if(group != nullptr && group->hasLocalMessages()){
+			return true;
+		}
+	}
+	return false;
+}
+
+EzTimerManager& Server::GetTimerManager(){
+	return m_timerManager;
+}
+
+NodeID Server::GetMyNodeID() const{
+	return m_myNodeID;
+}
+
+/**
+ * @brief 事件循环线程绑定到一个核上，分组的状态只在这个线程里访问，不需要加锁
+*/
+void Server::bindCore(){
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if(cores <= 0){
+		return;
+	}
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(m_loopIndex % cores, &cpuset);
+	int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	if(ret != 0){
+		LOG_ERROR("loop:%d bind core:%ld failed (%s)", m_loopIndex, m_loopIndex % cores, strerror(ret));
+	}
+}
+
+/**
+ * @brief 唤醒连接和普通连接一样由deps管理，消息由HandleWakeupMessage处理；连不上时只打日志，
+ * 	其他线程提交的命令等下一个定时器
+*/
+void Server::connectWakeup(){
+	m_wakeupPacket = EncodePacket(WakeupMessage::cmd, WakeupMessage());
+	m_wakeupSocket = Connect(m_localIP, m_localPort, m_socketType);
+	if(m_wakeupSocket == nullptr){
+		LOG_ERROR("loop:%d connect wakeup socket to port:%u failed, posted proposals wait for the next timer",
+			m_loopIndex, m_localPort);
+		return;
+	}
+	m_wakeupFd.store(m_wakeupSocket->GetFd(), std::memory_order_release);
+}
+
 bool Server::Run(){
 	if(!Listen(m_localPort, 10, m_socketType)){
 		return false;
 	}
+	connectWakeup();
+	bindCore();
 	while(true){
-		m_container->HandleSockets();
+		//epoll最多等到下一个定时器到期，空闲时不会空转；批量发送队列里还有数据时不等待，
+		//发送队列里有积压的包时最多等到下一次重连或者下一次重试发送
+		int timeout = m_bulkQueues.empty() && !hasLocalMessages() ? m_timerManager.nextTimeout(1000) : 0;
+		timeout = getOutboxTimeout(timeout);
+		//依赖deps::EpollContainer::HandleSockets(int)，没有这个重载的deps版本编译不过，不退回无参版本：
+		//无参版本按deps自己的间隔等待，定时器和发送队列的等待上限都不再生效
+		m_container->HandleSockets(timeout);
+		drainProposals();
+		for(size_t i = 0; i < m_groups.size(); ++i){
+			if(m_groups[i] != nullptr){
+				//本机的prepare/accept和网络上收到的一起落盘，落盘以后本机的承诺和批准马上交给本机Proposer
+				m_groups[i]->pollLocal();
+				m_groups[i]->persistAcceptor();
+				m_groups[i]->pollLocal();
+				m_groups[i]->pollCommit();
+				m_groups[i]->pollReads();
+			}
+		}
 		m_timerManager.checkTimer();
+		pumpBulkQueues();
+		flushOutboxes();
     }
 	return false;
 }
@@ -94,60 +272,33 @@ int Server::HandlePacket(const char* data, size_t size, deps::SocketBase* s){
     uint32_t seq = deps::Decoder::pickSeq(data);
 	uint16_t subCmd = deps::Decoder::pickSubCmd(data);
 	LOG_TRACE("unpack:\n%s", deps::DumpHex(data, packetSize).c_str());
-
-	std::shared_ptr<deps::Marshallable> pMsg;
-	switch (subCmd){
-		case PingMessage::cmd:
-			pMsg = std::make_shared<PingMessage>();
-			break;
-		case PongMessage::cmd:
-			pMsg = std::make_shared<PongMessage>();
-			break;
-		case HeartbeatMessage::cmd:
-			pMsg = std::make_shared<HeartbeatMessage>();
-			break;
-		case PrepareMessage::cmd:
-			pMsg = std::make_shared<PrepareMessage>();
-			break;
-		case PromiseMessage::cmd:
-			pMsg = std::make_shared<PromiseMessage>();
-			break;
-		case AcceptMessage::cmd:
-			pMsg = std::make_shared<AcceptMessage>();
-			break;
-		case PermitMessage::cmd:
-			pMsg = std::make_shared<PermitMessage>();
-			break;
-		case PrepareAckMessage::cmd:
-			pMsg = std::make_shared<PrepareAckMessage>();
-			break;
-		case AcceptAckMessage::cmd:
-			pMsg = std::make_shared<AcceptAckMessage>();
-			break;
-		default:
-			break;
-	}
-	
-	if(!pMsg){
-		LOG_ERROR("unknow message seq:%u cmd:%u", seq, subCmd);
-		return -1;
+	if(subCmd < MAX_STATS_CMD){
+		++m_recvCounters[subCmd].m_count;
+		m_recvCounters[subCmd].m_bytes += packetSize;
 	}
 
-	deps::PacketHeader header;
-	deps::Decoder decoder(data, packetSize);
-	decoder.deserialize(header, *pMsg);
-
-	if(HandleMessage(header, pMsg, s)){
-		return packetSize;
-	}
-	else{
-		LOG_ERROR("message seq:%u cmd:%u handle failed", seq, subCmd);
+	if(!m_dispatcher.dispatch(*this, subCmd, data, packetSize, s)){
+		if(!m_dispatcher.hasMessage(subCmd)){
+			LOG_ERROR("unknow message seq:%u cmd:%u", seq, subCmd);
+		}
+		else{
+			LOG_ERROR("message seq:%u cmd:%u handle failed", seq, subCmd);
+		}
 		return -1;
 	}
+	return packetSize;
 }
 
 void Server::HandleClose(deps::SocketBase* s){
 	LOG_INFO("close socket:%p fd:%d peer:%s:%u", s, s->GetFd(), inet_ntoa(s->GetPeerAddr().sin_addr), ntohs(s->GetPeerAddr().sin_port));
+	if(s == m_wakeupSocket){
+		//fd关闭以后可能被复用，先让提交线程不再写
+		std::lock_guard<std::mutex> lock(m_proposalMutex);
+		m_wakeupFd.store(-1, std::memory_order_release);
+		m_wakeupSocket = nullptr;
+		LOG_ERROR("loop:%d wakeup socket closed, posted proposals wait for the next timer", m_loopIndex);
+		return;
+	}
 	//TODO 依赖socket状态的地方都要清除
 	auto itr = m_socket2addr.find(s);
 	if(itr != m_socket2addr.end()){
@@ -166,36 +317,6 @@ void Server::HandleClose(deps::SocketBase* s){
 	}
 }
 
-bool Server::HandleMessage(const deps::PacketHeader& header, std::shared_ptr<deps::Marshallable> pMsg, deps::SocketBase* s){
-	bool ret = false;
-	switch (header.getSubCmd()){
-		case PingMessage::cmd:
-			ret = HandlePingMessage(header, std::dynamic_pointer_cast<PingMessage>(pMsg), s);
-			break;
-		case PongMessage::cmd:
-			ret = HandlePongMessage(header, std::dynamic_pointer_cast<PongMessage>(pMsg), s);
-			break;
-		case HeartbeatMessage::cmd:
-			ret = HandleHeatBeatMessage(header, std::dynamic_pointer_cast<HeartbeatMessage>(pMsg), s);
-			break;
-		case PrepareMessage::cmd:
-			break;
-		case PromiseMessage::cmd:
-			break;
-		case AcceptMessage::cmd:
-			break;
-		case PermitMessage::cmd:
-			break;
-		case PrepareAckMessage::cmd:
-			break;
-		case AcceptAckMessage::cmd:
-			break;
-		default:
-			break;
-	}
-	return ret;
-}
-
 /**
  * @brief 获取本地地址
 */
@@ -205,13 +326,14 @@ PeerInfo Server::GetMyNodeInfo(){
 	p.m_addr.m_port = m_localPort;
 	p.m_addr.m_socketType = m_socketType;
 	p.m_id = m_myUID;
+	p.m_nodeID = m_myNodeID;
 	return std::move(p);
 }
 
 /**
- * @brief 同一个peer id的只允许一个地址，并且采取先到先得的原则
+ * @brief 同一个peer id的只允许一个地址和一个节点编号，同一个节点编号也只能属于一个peer id，采取先到先得的原则
 */
-bool Server::AddPeerInfo(std::string peerId, const PeerAddr& addr){
+bool Server::AddPeerInfo(std::string peerId, NodeID nodeID, const PeerAddr& addr){
 	if(peerId.empty()){
 		LOG_ERROR("peer id is empty");
 		return false;
@@ -219,27 +341,55 @@ bool Server::AddPeerInfo(std::string peerId, const PeerAddr& addr){
 	else if(peerId == m_myUID){
 		return false;
 	}
+	else if(nodeID == INVALID_NODE_ID || nodeID == m_myNodeID){
+		LOG_ERROR("peer id:%s node:%u is invalid or conflict with local node", peerId.c_str(), nodeID);
+		return false;
+	}
 
 	auto itr = m_peers.find(peerId);
 	if(itr != m_peers.end()){
 		PeerInfo& peer = itr->second;
-		if(peer.m_addr != addr){
-			LOG_ERROR("peer id:%s already exist but addr %s not match %s", 
-				peerId.c_str(), addr.toString().c_str(), 
-				peer.m_addr.toString().c_str());
+		if(peer.m_addr != addr || peer.m_nodeID != nodeID){
+			LOG_ERROR("peer id:%s already exist but node:%u addr %s not match node:%u %s", 
+				peerId.c_str(), nodeID, addr.toString().c_str(), 
+				peer.m_nodeID, peer.m_addr.toString().c_str());
 			return false;
 		}
 	}
 	else{
+		PeerInfo* other = GetPeerInfo(nodeID);
+		if(other != nullptr){
+			LOG_ERROR("peer id:%s node:%u already used by peer id:%s", 
+				peerId.c_str(), nodeID, other->m_id.c_str());
+			return false;
+		}
 		PeerInfo peerinfo;
 		peerinfo.m_addr = addr;
 		peerinfo.m_id = peerId;
-		m_peers[peerId] = peerinfo;
+		peerinfo.m_nodeID = nodeID;
+		PeerInfo& peer = m_peers[peerId];
+		peer = peerinfo;
+		if(m_nodes.size() <= nodeID){
+			m_nodes.resize(nodeID + 1, nullptr);
+		}
+		m_nodes[nodeID] = &peer;
+		//删除过的节点重新加入，墓碑换成加入的条目
+		if(m_removedPeers.erase(peerId) > 0){
+			eraseMembershipLog(peerId);
+		}
+		m_membershipLog[++m_membershipVersion] = peerId;
 		updateStablePeers(peerId, addr);
 	}
 	return true;
 }
 
+/**
+ * @brief 按照节点编号查找节点，没有找到返回nullptr
+*/
+PeerInfo* Server::GetPeerInfo(NodeID nodeID){
+	return nodeID < m_nodes.size() ? m_nodes[nodeID] : nullptr;
+}
+
 /**
  * @brief 更新节点信息
 */
@@ -252,10 +402,34 @@ void Server::UpdatePeerInfo(std::string peerId, uint64_t rtt){
 }
 
 /**
- * @brief 删除节点
+ * @brief 删除节点。成员表日志里留下新版本的墓碑条目，删除和加入一样随增量传给其他节点
 */
 void Server::RemovePeerInfo(std::string peerId){
-	m_peers.erase(peerId);
+	auto itr = m_peers.find(peerId);
+	if(itr == m_peers.end()){
+		//本地没有这个节点也记下来，挡住别的节点转发来的旧条目
+		m_removedPeers.insert(peerId);
+		return;
+	}
+	NodeID nodeID = itr->second.m_nodeID;
+	if(nodeID < m_nodes.size()){
+		m_nodes[nodeID] = nullptr;
+	}
+	eraseMembershipLog(peerId);
+	m_membershipLog[++m_membershipVersion] = peerId;
+	m_removedPeers.insert(peerId);
+	m_gossipAcked.erase(nodeID);
+	m_gossipApplied.erase(nodeID);
+	m_peers.erase(itr);
+}
+
+void Server::eraseMembershipLog(const std::string& peerId){
+	for(auto log = m_membershipLog.begin(); log != m_membershipLog.end(); ++log){
+		if(log->second == peerId){
+			m_membershipLog.erase(log);
+			break;
+		}
+	}
 }
 
 /**
@@ -273,22 +447,36 @@ void Server::updateStablePeers(std::string peerId, const PeerAddr& addr)
 /**
  * @brief 处理ping消息
 */
-bool Server::HandlePingMessage(const deps::PacketHeader& header, std::shared_ptr<PingMessage> pMsg, deps::SocketBase* s){
-	const std::string& peerId = pMsg->m_myInfo.m_id;
-	const PeerAddr& peerAddr = pMsg->m_myInfo.m_addr;
-	LOG_INFO("peer id:%s %s size:%zd", peerId.c_str(), peerAddr.toString().c_str(), pMsg->m_peers.size());
+bool Server::HandlePingMessage(const deps::PacketHeader& header, PingMessage& msg, deps::SocketBase* s){
+	const std::string& peerId = msg.m_myInfo.m_id;
+	const PeerAddr& peerAddr = msg.m_myInfo.m_addr;
+	LOG_INFO("peer id:%s %s size:%zd", peerId.c_str(), peerAddr.toString().c_str(), msg.m_peers.size());
 
 	//添加发送者信息到peer集合
-	AddPeerInfo(peerId, peerAddr);
+	AddPeerInfo(peerId, msg.m_myInfo.m_nodeID, peerAddr);
 
-	//添加携带的peer信息到peer集合
-	for(auto peer : pMsg->m_peers){
-		AddPeerInfo(peer.m_id, peer.m_addr);
+	//添加携带的成员表增量到peer集合，已经删除的节点不由别人加回来
+	for(auto& peer : msg.m_peers){
+		if(m_removedPeers.find(peer.m_id) == m_removedPeers.end()){
+			AddPeerInfo(peer.m_id, peer.m_nodeID, peer.m_addr);
+		}
+	}
+	//发送者自己还活着，不按别人的旧删除把它删掉
+	for(auto& removedId : msg.m_removedPeers){
+		if(removedId != m_myUID && removedId != peerId){
+			RemovePeerInfo(removedId);
+		}
+	}
+	//增量和已经应用的版本接得上才前进；接不上(自己重启过或者消息乱序)时回复旧版本，对端从那里重发
+	uint64_t& applied = m_gossipApplied[msg.m_myInfo.m_nodeID];
+	if(msg.m_fromVersion <= applied){
+		applied = msg.m_toVersion;
 	}
 
 	PongMessage rsp;
-	rsp.m_timestamp = pMsg->m_timestamp;
+	rsp.m_timestamp = msg.m_timestamp;
 	rsp.m_myInfo = GetMyNodeInfo();
+	rsp.m_ackVersion = applied;
 	LOG_INFO("send pong message to peer id:%s %s", peerId.c_str(), peerAddr.toString().c_str());
 	SendMessage(PongMessage::cmd, rsp, s);
 	return true;
@@ -297,30 +485,347 @@ bool Server::HandlePingMessage(const deps::PacketHeader& header, std::shared_ptr
 /**
  * @brief 处理pong消息
 */
-bool Server::HandlePongMessage(const deps::PacketHeader& header, std::shared_ptr<PongMessage> pMsg, deps::SocketBase* s){
-	uint64_t lastStamp = pMsg->m_timestamp;
+bool Server::HandlePongMessage(const deps::PacketHeader& header, PongMessage& msg, deps::SocketBase* s){
+	uint64_t lastStamp = msg.m_timestamp;
 	uint64_t now = deps::GetMonoTimeMs();
 	uint64_t rtt = now > lastStamp ? now - lastStamp : 0;
-	const std::string& peerId = pMsg->m_myInfo.m_id;
-	PeerAddr& peerAddr = pMsg->m_myInfo.m_addr;
+	const std::string& peerId = msg.m_myInfo.m_id;
+	PeerAddr& peerAddr = msg.m_myInfo.m_addr;
 	LOG_INFO("peer id:%s %s rtt:%llu", peerId.c_str(), peerAddr.toString().c_str(), rtt);
 
 	UpdatePeerInfo(peerId, rtt);
+	recordPeerRtt(msg.m_myInfo.m_nodeID, rtt * 1000);
+	m_gossipAcked[msg.m_myInfo.m_nodeID] = msg.m_ackVersion;
 	return true;
 }
 
+/**
+ * @brief 按照消息里的分组编号找到分组
+*/
+PaxosNode* Server::routeMessage(uint16_t groupID, uint16_t cmd){
+	PaxosGroup* group = GetGroup(groupID);
+	if(group == nullptr){
+		LOG_ERROR("loop:%d group:%u cmd:%u not found", m_loopIndex, groupID, cmd);
+		return nullptr;
+	}
+	return &group->getPaxosNode();
+}
+
 /**
  * @brief 处理心跳消息
 */
-bool Server::HandleHeatBeatMessage(const deps::PacketHeader& header, std::shared_ptr<HeartbeatMessage> pMsg, deps::SocketBase* s){
-	const std::string& peerId = pMsg->m_myInfo.m_id;
-	const PeerAddr& peerAddr = pMsg->m_myInfo.m_addr;
-	const std::string& leaderUID = pMsg->m_leaderUID;
-	const ProposalID& leaderProposalID = pMsg->m_leaderProposalID;
-	LOG_INFO("peer id:%s %s %s", peerId.c_str(), peerAddr.toString().c_str(), 
-		leaderProposalID.toString().c_str());
+bool Server::HandleHeatBeatMessage(const deps::PacketHeader& header, HeartbeatMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, HeartbeatMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	NodeID peerId = msg.m_from;
+	NodeID leaderUID = msg.m_leaderUID;
+	const ProposalID& leaderProposalID = msg.m_leaderProposalID;
+	LOG_DEBUG("peer node:%u leader node:%u %s", peerId, leaderUID, leaderProposalID.toString().c_str());
+
+	node->receiveHeartbeat(leaderUID, leaderProposalID);
+	if(peerId == leaderUID){
+		node->receiveLeaseRequest(leaderUID, leaderProposalID, msg.m_timestamp, msg.m_leaseDuration);
+		node->receiveCommit(leaderUID, leaderProposalID, msg.m_commitInstanceID);
+	}
+	return true;
+}
+
+/**
+ * @brief 处理租约授予消息
+*/
+bool Server::HandleLeaseGrantMessage(const deps::PacketHeader& header, LeaseGrantMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, LeaseGrantMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	NodeID peerId = msg.m_from;
+	onAcceptorReply(peerId);
+	LOG_TRACE("peer node:%u lease grant proposalid:%s timestamp:%llu", peerId, 
+		msg.m_leaderProposalID.toString().c_str(), msg.m_timestamp);
+
+	//租约授予带回的是心跳里自己的时间戳，顺便得到一次微秒级的往返时间
+	uint64_t now = PaxosClock::nowUs();
+	if(now >= msg.m_timestamp){
+		recordPeerRtt(peerId, now - msg.m_timestamp);
+	}
+	node->receiveLeaseGrant(peerId, msg.m_leaderProposalID, msg.m_timestamp);
+	return true;
+}
+
+/**
+ * @brief 处理prepare请求
+*/
+bool Server::HandlePrepareMessage(const deps::PacketHeader& header, PrepareMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, PrepareMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	NodeID peerId = msg.m_from;
+	LOG_DEBUG("peer node:%u prepare proposalid:%s instance:%llu", peerId, 
+		msg.m_proposalID.toString().c_str(), msg.m_instanceID);
 
-	m_paxosNode.receiveHeartbeat(leaderUID, leaderProposalID);
+	node->receivePrepare(peerId, msg.m_proposalID, msg.m_instanceID);
+	return true;
+}
+
+/**
+ * @brief 处理prepare请求的承诺
+*/
+bool Server::HandlePromiseMessage(const deps::PacketHeader& header, PromiseMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, PromiseMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	NodeID peerId = msg.m_from;
+	onAcceptorReply(peerId);
+	LOG_DEBUG("peer node:%u promise proposalid:%s instance:%llu accepted:%zd", peerId, 
+		msg.m_proposalID.toString().c_str(), msg.m_instanceID, msg.m_acceptedInstances.size());
+
+	for(size_t i = 0; i < msg.m_valueStreamIDs.size() && i < msg.m_acceptedInstances.size(); ++i){
+		uint64_t streamID = msg.m_valueStreamIDs[i];
+		if(streamID != 0 && !TakeStreamedValue(peerId, streamID, msg.m_acceptedInstances[i].m_acceptedValue)){
+			LOG_ERROR("peer node:%u promise instance:%llu value stream:%llu incomplete", peerId, 
+				msg.m_acceptedInstances[i].m_instanceID, streamID);
+			return true;
+		}
+	}
+	node->receivePromise(peerId, msg.m_proposalID, msg.m_instanceID, msg.m_acceptedInstances);
+	return true;
+}
+
+/**
+ * @brief 处理accept请求
+*/
+bool Server::HandleAcceptMessage(const deps::PacketHeader& header, AcceptMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, AcceptMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	NodeID peerId = msg.m_from;
+	LOG_DEBUG("peer node:%u accept proposalid:%s instance:%llu", peerId, 
+		msg.m_proposalID.toString().c_str(), msg.m_instanceID);
+
+	//value分片传输时分片排在消息前面，没有收全说明中间丢了分片，等Proposer重发
+	if(msg.m_valueStreamID != 0 && !TakeStreamedValue(peerId, msg.m_valueStreamID, msg.m_proposalValue)){
+		LOG_ERROR("peer node:%u accept instance:%llu value stream:%llu incomplete", peerId, 
+			msg.m_instanceID, msg.m_valueStreamID);
+		return true;
+	}
+	node->receiveAcceptRequest(peerId, msg.m_proposalID, msg.m_instanceID, msg.m_proposalValue);
+	node->receiveCommit(peerId, msg.m_proposalID, msg.m_commitInstanceID);
+	return true;
+}
+
+/**
+ * @brief 处理accept请求的批准
+*/
+bool Server::HandlePermitMessage(const deps::PacketHeader& header, PermitMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, PermitMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	NodeID peerId = msg.m_from;
+	onAcceptorReply(peerId);
+	LOG_DEBUG("peer node:%u permit proposalid:%s instance:%llu", peerId, 
+		msg.m_proposalID.toString().c_str(), msg.m_instanceID);
+
+	if(msg.m_valueStreamID != 0 && !TakeStreamedValue(peerId, msg.m_valueStreamID, msg.m_acceptedValue)){
+		LOG_ERROR("peer node:%u permit instance:%llu value stream:%llu incomplete", peerId, 
+			msg.m_instanceID, msg.m_valueStreamID);
+		return true;
+	}
+	node->receivePermit(peerId, msg.m_proposalID, msg.m_instanceID, msg.m_acceptedValue);
+	return true;
+}
+
+/**
+ * @brief 处理leader空闲时的提交通知
+*/
+bool Server::HandleCommitMessage(const deps::PacketHeader& header, CommitMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, CommitMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	LOG_DEBUG("peer node:%u commit proposalid:%s instance:%llu", msg.m_from, 
+		msg.m_proposalID.toString().c_str(), msg.m_commitInstanceID);
+	node->receiveCommit(msg.m_from, msg.m_proposalID, msg.m_commitInstanceID);
+	return true;
+}
+
+/**
+ * @brief 处理leader推给观察者的已经达成一致的实例
+*/
+bool Server::HandleChosenMessage(const deps::PacketHeader& header, ChosenMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, ChosenMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	NodeID peerId = msg.m_from;
+	LOG_DEBUG("peer node:%u chosen proposalid:%s instances:%zd commit:%llu", peerId, 
+		msg.m_proposalID.toString().c_str(), msg.m_chosenInstances.size(), msg.m_commitInstanceID);
+
+	//分片没有收全的实例去掉，观察者卡在空洞上以后会请求补发
+	std::vector<PaxosInstance>& instances = msg.m_chosenInstances;
+	size_t count = 0;
+	for(size_t i = 0; i < instances.size(); ++i){
+		uint64_t streamID = i < msg.m_valueStreamIDs.size() ? msg.m_valueStreamIDs[i] : 0;
+		if(streamID != 0 && !TakeStreamedValue(peerId, streamID, instances[i].m_acceptedValue)){
+			LOG_ERROR("peer node:%u chosen instance:%llu value stream:%llu incomplete", peerId, 
+				instances[i].m_instanceID, streamID);
+			continue;
+		}
+		if(count != i){
+			instances[count] = std::move(instances[i]);
+		}
+		++count;
+	}
+	instances.resize(count);
+	node->receiveChosen(peerId, msg.m_proposalID, instances, msg.m_commitInstanceID);
+	return true;
+}
+
+/**
+ * @brief 处理观察者的补发请求
+*/
+bool Server::HandleLearnRequestMessage(const deps::PacketHeader& header, LearnRequestMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, LearnRequestMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	LOG_DEBUG("peer node:%u learn from instance:%llu", msg.m_from, msg.m_fromInstanceID);
+	node->receiveLearnRequest(msg.m_from, msg.m_fromInstanceID);
+	return true;
+}
+
+/**
+ * @brief 处理议题value的payload，分片没有收全时丢掉，缺payload的节点会再请求
+*/
+bool Server::HandlePayloadMessage(const deps::PacketHeader& header, PayloadMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, PayloadMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	NodeID peerId = msg.m_from;
+	LOG_DEBUG("peer node:%u payload relay:%u", peerId, msg.m_relay);
+
+	if(msg.m_valueStreamID != 0 && !TakeStreamedValue(peerId, msg.m_valueStreamID, msg.m_payload)){
+		LOG_ERROR("peer node:%u payload value stream:%llu incomplete", peerId, msg.m_valueStreamID);
+		return true;
+	}
+	node->receivePayload(peerId, msg.m_digest, msg.m_payload, msg.m_relay != 0);
+	return true;
+}
+
+/**
+ * @brief 处理payload请求
+*/
+bool Server::HandlePayloadRequestMessage(const deps::PacketHeader& header, PayloadRequestMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, PayloadRequestMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	LOG_DEBUG("peer node:%u payload request", msg.m_from);
+	node->receivePayloadRequest(msg.m_from, msg.m_digest);
+	return true;
+}
+
+/**
+ * @brief 处理prepare请求的ack
+*/
+bool Server::HandlePrepareAckMessage(const deps::PacketHeader& header, PrepareAckMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, PrepareAckMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	NodeID peerId = msg.m_from;
+	onAcceptorReply(peerId);
+	LOG_DEBUG("peer node:%u prepare nack proposalid:%s promiseid:%s truncated:%llu", peerId, 
+		msg.m_proposalID.toString().c_str(), msg.m_promiseID.toString().c_str(), msg.m_truncatedInstanceID);
+
+	node->receivePrepareNACK(peerId, msg.m_proposalID, msg.m_promiseID, msg.m_truncatedInstanceID);
+	return true;
+}
+
+/**
+ * @brief 处理accept请求的ack
+*/
+bool Server::HandleAcceptAckMessage(const deps::PacketHeader& header, AcceptAckMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, AcceptAckMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	NodeID peerId = msg.m_from;
+	onAcceptorReply(peerId);
+	LOG_DEBUG("peer node:%u accept nack proposalid:%s instance:%llu promiseid:%s truncated:%llu", peerId, 
+		msg.m_proposalID.toString().c_str(), msg.m_instanceID, msg.m_promiseID.toString().c_str(), 
+		msg.m_truncatedInstanceID);
+
+	node->receiveAcceptNACK(peerId, msg.m_proposalID, msg.m_instanceID, msg.m_promiseID, msg.m_truncatedInstanceID);
+	return true;
+}
+
+/**
+ * @brief 处理议题value的分片，拼好的value等引用它的消息来取
+*/
+bool Server::HandleValueChunkMessage(const deps::PacketHeader& header, ValueChunkMessage& msg, deps::SocketBase* s){
+	LOG_DEBUG("peer node:%u group:%u stream:%llu offset:%u/%u", msg.m_from, msg.m_groupID, 
+		msg.m_streamID, msg.m_offset, msg.m_totalSize);
+	m_valueStreams.receive(msg);
+	return true;
+}
+
+/**
+ * @brief 处理成员变更请求，不是leader时转发给leader
+*/
+bool Server::HandleMembershipChangeMessage(const deps::PacketHeader& header, MembershipChangeMessage& msg, deps::SocketBase* s){
+	PaxosGroup* group = GetGroup(msg.m_groupID);
+	if(group == nullptr){
+		LOG_ERROR("loop:%d group:%u cmd:%u not found", m_loopIndex, msg.m_groupID, MembershipChangeMessage::cmd);
+		return true;
+	}
+	LOG_INFO("node:%u group:%u membership change to %s", msg.m_from, msg.m_groupID,
+		msg.m_membership.toString().c_str());
+	group->ProposeMembership(msg.m_membership);
+	return true;
+}
+
+/**
+ * @brief 处理落后节点的快照请求
+*/
+bool Server::HandleSnapshotRequestMessage(const deps::PacketHeader& header, SnapshotRequestMessage& msg, deps::SocketBase* s){
+	PaxosNode* node = routeMessage(msg.m_groupID, SnapshotRequestMessage::cmd);
+	if(node == nullptr){
+		return true;
+	}
+	LOG_INFO("peer node:%u group:%u snapshot request instance:%llu", msg.m_from, msg.m_groupID, msg.m_instanceID);
+	node->receiveSnapshotRequest(msg.m_from, msg.m_instanceID);
+	return true;
+}
+
+/**
+ * @brief 处理快照，分片没有收全时丢掉，请求方超时以后会再请求
+*/
+bool Server::HandleSnapshotMessage(const deps::PacketHeader& header, SnapshotMessage& msg, deps::SocketBase* s){
+	PaxosGroup* group = GetGroup(msg.m_groupID);
+	if(group == nullptr){
+		LOG_ERROR("loop:%d group:%u cmd:%u not found", m_loopIndex, msg.m_groupID, SnapshotMessage::cmd);
+		return true;
+	}
+	NodeID peerId = msg.m_from;
+	if(msg.m_valueStreamID != 0 && !TakeStreamedValue(peerId, msg.m_valueStreamID, msg.m_data)){
+		LOG_ERROR("peer node:%u snapshot value stream:%llu incomplete", peerId, msg.m_valueStreamID);
+		return true;
+	}
+	group->installSnapshot(peerId, msg);
+	return true;
+}
+
+/**
+ * @brief 唤醒消息只是让epoll等待返回，提交队列在HandleSockets之后的drainProposals里取走
+*/
+bool Server::HandleWakeupMessage(const deps::PacketHeader& header, WakeupMessage& msg, deps::SocketBase* s){
 	return true;
 }
 
@@ -350,58 +855,274 @@ void Server::SendPingMessage()
 	PingMessage ping;
 	ping.m_timestamp = deps::GetMonoTimeMs();
 	ping.m_myInfo = GetMyNodeInfo();
-	for(auto& peer : m_peers){
-		ping.m_peers.insert(peer.second);
+	std::map<uint64_t, PacketBuffer> packets;
+	for(auto& item : m_peers){
+		PeerInfo& peer = item.second;
+		auto itr = m_gossipAcked.find(peer.m_nodeID);
+		uint64_t fromVersion = itr != m_gossipAcked.end() ? itr->second : 0;
+		SendPacketToPeer(encodePing(ping, fromVersion, packets), peer.m_addr);
+	}
+	//还不知道id的稳定节点发全量
+	for(size_t i = 0; i < m_stablePeers.size(); ++i){
+		PeerInfo& peer = m_stablePeers[i];
+		if(m_peers.find(peer.m_id) == m_peers.end()){
+			SendPacketToPeer(encodePing(ping, 0, packets), peer.m_addr);
+		}
 	}
-	SendMessageToAllPeer(PingMessage::cmd, ping);
-	LOG_INFO("send ping message timestamp:%llu size:%zd", ping.m_timestamp, ping.m_peers.size());
+	LOG_INFO("send ping message timestamp:%llu membership version:%llu peers:%zd encoded:%zd",
+		ping.m_timestamp, m_membershipVersion, m_peers.size(), packets.size());
 }
 
 /**
- * @brief 发送消息给指定的socket
+ * @brief 成员表里版本在fromVersion之后的条目，最多MAX_GOSSIP_PEERS个。成员稳定时对端都确认到了最新版本，
+ * 	所有peer共用一个不带条目的包
 */
-bool Server::SendMessage(uint16_t cmd, const deps::Marshallable& msg, deps::SocketBase* s){
+PacketBuffer Server::encodePing(PingMessage& ping, uint64_t fromVersion, std::map<uint64_t, PacketBuffer>& packets){
+	PacketBuffer& packet = packets[fromVersion];
+	if(packet){
+		return packet;
+	}
+	ping.m_fromVersion = fromVersion;
+	ping.m_toVersion = fromVersion;
+	ping.m_peers.clear();
+	auto itr = m_membershipLog.upper_bound(fromVersion);
+	for(; itr != m_membershipLog.end() && ping.m_peers.size() + ping.m_removedPeers.size() < MAX_GOSSIP_PEERS; 
+		++itr){
+		auto peer = m_peers.find(itr->second);
+		if(peer != m_peers.end()){
+			ping.m_peers.insert(peer->second);
+		}
+		else{
+			ping.m_removedPeers.insert(itr->second);
+		}
+		ping.m_toVersion = itr->first;
+	}
+	//重新加入和再次删除会删掉旧条目，日志里的版本号有空洞，发到末尾时直接确认到最新版本
+	if(itr == m_membershipLog.end() && ping.m_toVersion < m_membershipVersion){
+		ping.m_toVersion = m_membershipVersion;
+	}
+	packet = EncodePacket(PingMessage::cmd, ping);
+	return packet;
+}
+
+/**
+ * @brief 序列化一次，得到的包可以发给任意多个peer
+*/
+PacketBuffer Server::EncodePacket(uint16_t cmd, const deps::Marshallable& msg){
 	deps::Encoder encoder;
 	encoder.serialize(cmd, msg);
-	if(!s->SendPacket(encoder.data(),encoder.size())){
+	return std::make_shared<const std::string>(encoder.data(), encoder.size());
+}
+
+/**
+ * @brief 发送编码好的包给指定的socket
+*/
+bool Server::SendPacket(const PacketBuffer& packet, deps::SocketBase* s){
+	if(!s->SendPacket(packet->data(), packet->size())){
 		LOG_ERROR("fd:%d send packet failed", s->GetFd());
 		return false;
 	}
+	uint16_t subCmd = deps::Decoder::pickSubCmd(packet->data());
+	if(subCmd < MAX_STATS_CMD){
+		++m_sendCounters[subCmd].m_count;
+		m_sendCounters[subCmd].m_bytes += packet->size();
+	}
 	return true;
 }
 
 /**
- * @brief 发送消息给指定的peer
+ * @brief 发送编码好的包给指定的peer。没有连接时发起连接，包先放进发送队列，
+ * 	连接建立以后按顺序发出去，新节点和重连节点收到的第一个Prepare、Accept和心跳不会丢
 */
-void Server::SendMessageToPeer(uint16_t cmd, const deps::Marshallable& msg, PeerAddr& addr){
+void Server::SendPacketToPeer(const PacketBuffer& packet, PeerAddr& addr){
 	auto itr = m_addr2socket.find(addr);
-	if(itr == m_addr2socket.end()){
-		deps::SocketBase* pSocket = Connect(addr.m_ip, addr.m_port, addr.m_socketType);
-		if(pSocket == nullptr){
-			LOG_ERROR("connect to %s failed", addr.toString().c_str());
-			return;
+	//前面还有积压的包时排在后面，保证同一个对端的消息顺序
+	if(itr == m_addr2socket.end() || m_outboxes.count(addr) > 0){
+		//连接在这一轮事件循环结束时发起，同一轮发给这个对端的包一起排队
+		enqueueOutbox(addr, packet);
+		return;
+	}
+	deps::SocketBase* pSocket = itr->second;
+	if(nullptr == pSocket){
+		LOG_ERROR("%s get null socket", addr.toString().c_str());
+		return;
+	}
+	if(!SendPacket(packet, pSocket)){
+		enqueueOutbox(addr, packet);
+	}
+}
+
+void Server::enqueueOutbox(PeerAddr& addr, const PacketBuffer& packet){
+	PeerOutbox& outbox = m_outboxes[addr];
+	//对端断开或者连接还没建立好时每个分组只留最新的心跳，旧心跳的提交位置和时间戳已经过时，不用占满队列
+	if(deps::Decoder::pickSubCmd(packet->data()) == HeartbeatMessage::cmd){
+		deps::PacketHeader header;
+		HeartbeatMessage heartbeat;
+		deps::Decoder decoder(packet->data(), packet->size());
+		decoder.deserialize(header, heartbeat);
+		auto hitr = outbox.m_heartbeats.find(heartbeat.m_groupID);
+		if(hitr != outbox.m_heartbeats.end() && hitr->second >= outbox.m_firstSeq){
+			PacketBuffer& stale = outbox.m_packets[hitr->second - outbox.m_firstSeq];
+			if(stale != nullptr){
+				outbox.m_bytes -= stale->size();
+				stale.reset();
+			}
 		}
-		m_addr2socket[addr] = pSocket;
-		m_socket2addr[pSocket] = addr;
+		outbox.m_heartbeats[heartbeat.m_groupID] = outbox.m_firstSeq + outbox.m_packets.size();
 	}
-	else{
-		deps::SocketBase* pSocket = itr->second;
-		if(nullptr == pSocket){
-			LOG_ERROR("%s get null socket", addr.toString().c_str());
-			return;
+	outbox.m_packets.push_back(packet);
+	outbox.m_bytes += packet->size();
+	//新的消息比老的有用：老的Accept和心跳已经被重发或者新的心跳取代了
+	while(outbox.m_bytes > OUTBOX_MAX_BYTES && outbox.m_packets.size() > 1){
+		const PacketBuffer& front = outbox.m_packets.front();
+		if(front != nullptr){
+			outbox.m_bytes -= front->size();
+			if(m_outboxDropped++ % 1000 == 0){
+				LOG_ERROR("outbox to %s full, dropped:%llu", addr.toString().c_str(), m_outboxDropped);
+			}
+		}
+		outbox.m_packets.pop_front();
+		++outbox.m_firstSeq;
+	}
+}
+
+int Server::getOutboxTimeout(int timeout) const{
+	uint64_t now = 0;
+	for(auto& item : m_outboxes){
+		if(now == 0){
+			now = deps::GetMonoTimeMs();
 		}
-		SendMessage(cmd, msg, pSocket);
+		//有连接的对端至少等1毫秒，和没有退避时一样不空转
+		bool connected = m_addr2socket.count(item.first) > 0;
+		uint64_t nextMs = connected ? std::max(item.second.m_nextSendMs, now + 1) : item.second.m_nextConnectMs;
+		timeout = std::min<int64_t>(timeout, nextMs > now ? nextMs - now : 0);
 	}
+	return timeout;
+}
+
+size_t Server::getOutboxBytes(const PeerAddr& addr) const{
+	auto itr = m_outboxes.find(addr);
+	return itr == m_outboxes.end() ? 0 : itr->second.m_bytes;
 }
 
 /**
- * @brief 发送消息给当前所有的peer
+ * @brief 非阻塞连接还没有建立时socket发送失败，包留在队列头部下一轮再试；
+ * 	两次发起连接至少间隔OUTBOX_RECONNECT_MS，连接失败或者被对端关闭期间新的包继续排队，总量受OUTBOX_MAX_BYTES限制
+*/
+void Server::flushOutboxes(){
+	uint64_t now = 0;
+	for(auto itr = m_outboxes.begin(); itr != m_outboxes.end();){
+		const PeerAddr& addr = itr->first;
+		PeerOutbox& outbox = itr->second;
+		if(now == 0){
+			now = deps::GetMonoTimeMs();
+		}
+		auto sitr = m_addr2socket.find(addr);
+		if(sitr != m_addr2socket.end() && now < outbox.m_nextSendMs){
+			++itr;
+			continue;
+		}
+		if(sitr == m_addr2socket.end()){
+			if(now < outbox.m_nextConnectMs){
+				++itr;
+				continue;
+			}
+			outbox.m_nextConnectMs = now + OUTBOX_RECONNECT_MS;
+			deps::SocketBase* pSocket = Connect(addr.m_ip, addr.m_port, addr.m_socketType);
+			if(pSocket == nullptr){
+				//对端长时间不在时每次重连都会失败，只打第一次和之后每100次
+				if(outbox.m_connectFailures++ % 100 == 0){
+					LOG_ERROR("connect to %s failed:%llu, %zd packets queued", addr.toString().c_str(), 
+						outbox.m_connectFailures, outbox.m_packets.size());
+				}
+				++itr;
+				continue;
+			}
+			outbox.m_connectFailures = 0;
+			sitr = m_addr2socket.insert(std::make_pair(addr, pSocket)).first;
+			m_socket2addr[pSocket] = addr;
+		}
+		deps::SocketBase* pSocket = sitr->second;
+		bool progressed = false;
+		while(pSocket != nullptr && !outbox.m_packets.empty()){
+			const PacketBuffer& packet = outbox.m_packets.front();
+			if(packet != nullptr){
+				if(!pSocket->SendPacket(packet->data(), packet->size())){
+					break;
+				}
+				uint16_t subCmd = deps::Decoder::pickSubCmd(packet->data());
+				if(subCmd < MAX_STATS_CMD){
+					++m_sendCounters[subCmd].m_count;
+					m_sendCounters[subCmd].m_bytes += packet->size();
+				}
+				outbox.m_bytes -= packet->size();
+			}
+			outbox.m_packets.pop_front();
+			++outbox.m_firstSeq;
+			progressed = true;
+		}
+		if(outbox.m_packets.empty()){
+			m_outboxes.erase(itr++);
+			continue;
+		}
+		//一直发不出去时重试间隔从1毫秒倍增到OUTBOX_SEND_RETRY_MS，有进展时每轮事件循环都重试
+		outbox.m_sendRetryMs = progressed ? 0 : std::min(std::max<uint64_t>(outbox.m_sendRetryMs * 2, 1), 
+			OUTBOX_SEND_RETRY_MS);
+		outbox.m_nextSendMs = now + outbox.m_sendRetryMs;
+		++itr;
+	}
+}
+
+/**
+ * @brief 发送消息给指定的socket
+*/
+bool Server::SendMessage(uint16_t cmd, const deps::Marshallable& msg, deps::SocketBase* s){
+	return SendPacket(EncodePacket(cmd, msg), s);
+}
+
+/**
+ * @brief 发送消息给指定的peer
+*/
+void Server::SendMessageToPeer(uint16_t cmd, const deps::Marshallable& msg, PeerAddr& addr){
+	SendPacketToPeer(EncodePacket(cmd, msg), addr);
+}
+
+/**
+ * @brief 按照节点编号发送消息
+*/
+void Server::SendMessageToNode(uint16_t cmd, const deps::Marshallable& msg, NodeID nodeID){
+	PeerInfo* peer = GetPeerInfo(nodeID);
+	if(peer == nullptr){
+		LOG_ERROR("peer node:%u not found", nodeID);
+		return;
+	}
+	SendMessageToPeer(cmd, msg, peer->m_addr);
+}
+
+/**
+ * @brief 发送消息给一组节点，只序列化一次
+*/
+void Server::SendMessageToNodes(uint16_t cmd, const deps::Marshallable& msg, const std::set<NodeID>& nodeIDs){
+	PacketBuffer packet = EncodePacket(cmd, msg);
+	for(auto nodeID : nodeIDs){
+		PeerInfo* peer = GetPeerInfo(nodeID);
+		if(peer == nullptr){
+			LOG_ERROR("peer node:%u not found", nodeID);
+			continue;
+		}
+		SendPacketToPeer(packet, peer->m_addr);
+	}
+}
+
+/**
+ * @brief 发送消息给当前所有的peer，只序列化一次
 */
 void Server::SendMessageToAllPeer(uint16_t cmd, const deps::Marshallable& msg){
+	PacketBuffer packet = EncodePacket(cmd, msg);
 	for(std::map<std::string, PeerInfo>::iterator itr = m_peers.begin(); itr!=m_peers.end(); ++itr){
 		const std::string& peerid = itr->first;
 		PeerInfo& peer = itr->second;
-		SendMessageToPeer(cmd, msg, peer.m_addr);
+		SendPacketToPeer(packet, peer.m_addr);
 		LOG_DEBUG("send message cmd:%hu to peer id:%s %s", cmd, peerid.c_str(), peer.m_addr.toString().c_str());
 	}
 
@@ -409,235 +1130,314 @@ void Server::SendMessageToAllPeer(uint16_t cmd, const deps::Marshallable& msg){
 		PeerInfo& peer  = m_stablePeers[i];
 		//只有在当前的peer集合中没有找到的时候才发送
 		if(m_peers.find(peer.m_id) == m_peers.end()){
-			SendMessageToPeer(cmd, msg, peer.m_addr);
+			SendPacketToPeer(packet, peer.m_addr);
 			LOG_DEBUG("send message cmd:%hu to stable addr[%zd] %s", cmd, i, peer.m_addr.toString().c_str());
 		}
 	}
 	return;
 }
 
-
 /**
- * @brief 选择一个Acceptor大多数构成的集合，采用轮训机制
- * 
- * @param acceptors 
- */
-void Server::SelectMajorityAcceptors(std::set<std::string>& acceptors){
-	if(m_peers.size() < m_quorumSize){
-		return;
+ * @brief 把value按VALUE_CHUNK_SIZE拆成分片，每个分片只编码一次，发给多个节点时共用
+*/
+uint64_t Server::EncodeValueStream(uint16_t groupID, const std::string& value, std::vector<PacketBuffer>& packets){
+	ValueChunkMessage chunk;
+	chunk.m_from = m_myNodeID;
+	chunk.m_groupID = groupID;
+	chunk.m_streamID = m_nextStreamID++;
+	chunk.m_totalSize = value.size();
+	for(size_t offset = 0; offset < value.size(); offset += VALUE_CHUNK_SIZE){
+		chunk.m_offset = offset;
+		chunk.m_data.assign(value, offset, VALUE_CHUNK_SIZE);
+		packets.push_back(EncodePacket(ValueChunkMessage::cmd, chunk));
 	}
+	return chunk.m_streamID;
+}
 
-	acceptors.clear();
+void Server::SendBulkToNode(const std::vector<PacketBuffer>& packets, NodeID nodeID){
+	std::deque<PacketBuffer>& queue = m_bulkQueues[nodeID];
+	queue.insert(queue.end(), packets.begin(), packets.end());
+}
+
+void Server::SendBulkToNodes(const std::vector<PacketBuffer>& packets, const std::set<NodeID>& nodeIDs){
+	for(auto nodeID : nodeIDs){
+		SendBulkToNode(packets, nodeID);
+	}
+}
+
+bool Server::TakeStreamedValue(NodeID from, uint64_t streamID, std::string& value){
+	return m_valueStreams.take(from, streamID, value);
+}
 
-	size_t cnt = 0;
-	auto itr = m_peers.upper_bound(m_maxChoosenAcceptorUID);
-	while(cnt < m_quorumSize){
-		if(itr != m_peers.end()){
-			acceptors.insert(itr->second.m_id);
-			++cnt;
+/**
+ * @brief 每个节点的批量发送队列每轮最多发出BULK_BYTES_PER_LOOP字节，
+ * 	其余的留到下一轮，中间产生的心跳、Permit等小消息直接发送，不用排在几MB的数据后面
+*/
+void Server::pumpBulkQueues(){
+	for(auto itr = m_bulkQueues.begin(); itr != m_bulkQueues.end();){
+		std::deque<PacketBuffer>& queue = itr->second;
+		PeerInfo* peer = GetPeerInfo(itr->first);
+		if(peer == nullptr){
+			LOG_ERROR("peer node:%u not found, drop %zd bulk packets", itr->first, queue.size());
+			queue.clear();
+		}
+		size_t bytes = 0;
+		//对端的发送队列积压太多时先不发，等连接恢复
+		if(peer != nullptr && getOutboxBytes(peer->m_addr) > OUTBOX_BACKPRESSURE_BYTES){
+			++itr;
+			continue;
+		}
+		while(!queue.empty() && bytes < BULK_BYTES_PER_LOOP){
+			bytes += queue.front()->size();
+			SendPacketToPeer(queue.front(), peer->m_addr);
+			queue.pop_front();
+		}
+		if(queue.empty()){
+			m_bulkQueues.erase(itr++);
+		}
+		else{
+			++itr;
 		}
-		itr == m_peers.end() ? itr = m_peers.begin() : ++itr;
 	}
 }
 
 /**
- * @brief 发送prepare请求
+ * @brief 选择这次请求要发给的Acceptor。thrifty模式选往返时间最短并且没有停顿的quorumSize个，
+ * 	hedged模式和重发时发给所有Acceptor，由最先回复的quorum决定结果。只从配置里的Acceptor中选，
+ * 	配置不限制成员时从所有peer中选。本机是Acceptor时总在里面，由PaxosGroup在本地投递，
+ * 	往返时间当作0。凑不够quorumSize个时acceptors为空
  * 
- * @param proposalID 
+ * @param acceptors 
+ * @param membership 请求的实例上生效的配置
+ * @param quorumSize 这个阶段要求的Acceptor数量
+ * @param resend 是否是重发
  */
-void Server::sendPrepare(const ProposalID& proposalID){
-	SelectMajorityAcceptors(m_majorityAcceptors);
-	if(m_majorityAcceptors.empty()){
-		LOG_ERROR("choosen acceptors failed");
+void Server::SelectMajorityAcceptors(std::set<NodeID>& acceptors, const Membership& membership, 
+	size_t quorumSize, bool resend){
+	acceptors.clear();
+	std::vector<NodeID> members;
+	if(membership.contains(m_myNodeID)){
+		members.push_back(m_myNodeID);
+	}
+	for(auto& item : m_peers){
+		if(membership.contains(item.second.m_nodeID)){
+			members.push_back(item.second.m_nodeID);
+		}
+	}
+	if(members.size() < quorumSize){
 		return;
 	}
-	PrepareMessage prepare;
-	prepare.m_proposalID.m_number = proposalID.m_number;
-	prepare.m_proposalID.m_uid = proposalID.m_uid;
-	prepare.m_myInfo = GetMyNodeInfo();
 
-	for(auto acceptorUID : m_majorityAcceptors){
-		auto peerItr = m_peers.find(acceptorUID);
-		if(peerItr != m_peers.end()){
-			auto& peer = peerItr->second;
-			SendMessageToPeer(PrepareMessage::cmd, prepare, peer.m_addr);
+	uint64_t now = PaxosClock::nowUs();
+	//重发说明之前选的多数派没有按时回复，发给所有Acceptor
+	bool all = resend || m_quorumMode == QuorumMode::hedged;
+	std::vector<std::pair<uint64_t, NodeID>> candidates;
+	if(!all){
+		//没有停顿的Acceptor按照往返时间排序，还没有RTT样本的排在后面
+		for(auto nodeID : members){
+			if(nodeID == m_myNodeID){
+				candidates.push_back(std::make_pair(0, nodeID));
+				continue;
+			}
+			const AcceptorHealth& health = m_acceptorHealth[nodeID];
+			if(isAcceptorStalled(health, now)){
+				continue;
+			}
+			candidates.push_back(std::make_pair(health.m_rttUs > 0 ? health.m_rttUs : UINT64_MAX, nodeID));
 		}
+		//没有停顿的Acceptor凑不够多数派时发给所有Acceptor
+		all = candidates.size() < quorumSize;
 	}
-}
-
-/**
- * @brief 发送prepare请求的承诺
- * 
- * @param toUID 
- * @param proposalID 
- * @param acceptID 
- * @param acceptValue 
- */
-void Server::sendPromise(const std::string& toUID, const ProposalID& proposalID, 
-	const ProposalID& acceptID, const std::string& acceptValue){
-	PromiseMessage promise;
-	promise.m_myInfo = GetMyNodeInfo();
-
-	promise.m_proposalID.m_number = proposalID.m_number;
-	promise.m_proposalID.m_uid = proposalID.m_uid;
-	promise.m_acceptID.m_number = acceptID.m_number;
-	promise.m_acceptID.m_uid = acceptID.m_uid;
-	promise.m_acceptValue = acceptValue;
-
-	auto peerItr = m_peers.find(toUID);
-	if(peerItr != m_peers.end()){
-		auto& peer = peerItr->second;
-		SendMessageToPeer(PromiseMessage::cmd, promise, peer.m_addr);
+	if(all){
+		acceptors.insert(members.begin(), members.end());
 	}
 	else{
-		LOG_ERROR("peer id:%s not found", toUID.c_str());
+		std::partial_sort(candidates.begin(), candidates.begin() + quorumSize, candidates.end());
+		for(size_t i = 0; i < quorumSize; ++i){
+			acceptors.insert(candidates[i].second);
+		}
+	}
+	for(auto nodeID : acceptors){
+		if(nodeID == m_myNodeID){
+			continue;
+		}
+		AcceptorHealth& health = m_acceptorHealth[nodeID];
+		if(health.m_waitingSinceUs == 0){
+			health.m_waitingSinceUs = now;
+		}
 	}
 }
 
-/**
- * @brief 发送accept请求
- * 
- * @param proposalID 
- * @param proposalValue 
- */
-void Server::sendAccept(const ProposalID&  proposalID, 
-	const std::string& proposalValue){
-	AcceptMessage accept;
-	accept.m_myInfo = GetMyNodeInfo();
-
-	accept.m_proposalID.m_number = proposalID.m_number;
-	accept.m_proposalID.m_uid = proposalID.m_uid;
-	accept.m_proposalValue = proposalValue;
-
-	for(auto acceptorUID : m_majorityAcceptors){
-		auto peerItr = m_peers.find(acceptorUID);
-		if(peerItr != m_peers.end()){
-			auto& peer = peerItr->second;
-			SendMessageToPeer(AcceptMessage::cmd, accept, peer.m_addr);
+void Server::GetObservers(const Membership& membership, std::set<NodeID>& observers){
+	observers.clear();
+	if(membership.isOpen()){
+		return;
+	}
+	for(auto& item : m_peers){
+		NodeID nodeID = item.second.m_nodeID;
+		if(nodeID != m_myNodeID && !membership.contains(nodeID)){
+			observers.insert(nodeID);
 		}
 	}
 }
 
-/**
- * @brief 发送accept请求的批准
- * 
- * @param proposerUID 
- * @param proposalID 
- * @param acceptedValue 
- */
-void Server::sendPermit(const std::string& proposerUID, const ProposalID&  proposalID, 
-	const std::string& acceptedValue)
-{
-	PermitMessage premit;
-	premit.m_myInfo = GetMyNodeInfo();
-	premit.m_proposalID.m_number = proposalID.m_number;
-	premit.m_proposalID.m_uid = proposalID.m_uid;
-	premit.m_acceptedValue = acceptedValue;
-
-	auto peerItr = m_peers.find(proposerUID);
-	if(peerItr != m_peers.end()){
-		auto& peer = peerItr->second;
-		SendMessageToPeer(PermitMessage::cmd, premit, peer.m_addr);
+void Server::GetOtherNodes(std::set<NodeID>& nodes){
+	nodes.clear();
+	for(auto& item : m_peers){
+		NodeID nodeID = item.second.m_nodeID;
+		if(nodeID != m_myNodeID){
+			nodes.insert(nodeID);
+		}
 	}
 }
 
-/**
- * @brief 发送已经选定的协议号
- * 
- * @param proposalID 选定的协议编号
- * @param value 选定的协议值
- */
-void Server::onResolution(const ProposalID&  proposalID, 
-	const std::string& value)
-{
-
+bool Server::IsNodeStalled(NodeID nodeID){
+	auto itr = m_acceptorHealth.find(nodeID);
+	return itr != m_acceptorHealth.end() && isAcceptorStalled(itr->second, PaxosClock::nowUs());
 }
 
 /**
- * @brief 发送prepare请求的ack
- * 
- * @param proposerUID 
- * @param proposalID 
- * @param promisedID 
- */
-void Server::sendPrepareNACK(const std::string& proposerUID, const ProposalID& proposalID, 
-	const ProposalID& promisedID)
-{
-	PrepareAckMessage ack;
-	ack.m_myInfo = GetMyNodeInfo();
-	ack.m_proposalID.m_number = proposalID.m_number;
-	ack.m_proposalID.m_uid = proposalID.m_uid;
-	ack.m_promiseID.m_number = promisedID.m_number;
-	ack.m_promiseID.m_uid = promisedID.m_uid;
-
-	auto peerItr = m_peers.find(proposerUID);
-	if(peerItr != m_peers.end()){
-		auto& peer = peerItr->second;
-		SendMessageToPeer(PrepareAckMessage::cmd, ack, peer.m_addr);
+ * @brief 停顿的Acceptor在thrifty模式下被换成下一个最快的，租约授予或者重发的回复到了以后恢复
+*/
+bool Server::isAcceptorStalled(const AcceptorHealth& health, uint64_t nowUs){
+	if(health.m_waitingSinceUs == 0 || nowUs <= health.m_waitingSinceUs){
+		return false;
 	}
+	return nowUs - health.m_waitingSinceUs > std::max(ACCEPTOR_STALL_US, health.m_rttUs * 4);
 }
 
-/**
- * @brief 发送accept请求的ack
- * 
- * @param proposerUID 
- * @param proposalID 
- * @param promisedID 
- */
-void Server::sendAcceptNACK(const std::string& proposerUID, const ProposalID& proposalID, 
-	const ProposalID& promisedID)
-{
-	AcceptAckMessage ack;
-	ack.m_myInfo = GetMyNodeInfo();
-	ack.m_proposalID.m_number = proposalID.m_number;
-	ack.m_proposalID.m_uid = proposalID.m_uid;
-	ack.m_promiseID.m_number = promisedID.m_number;
-	ack.m_promiseID.m_uid = promisedID.m_uid;
-
-	auto peerItr = m_peers.find(proposerUID);
-	if(peerItr != m_peers.end()){
-		auto& peer = peerItr->second;
-		SendMessageToPeer(AcceptAckMessage::cmd, ack, peer.m_addr);
-	}
-
+void Server::onAcceptorReply(NodeID nodeID){
+	m_acceptorHealth[nodeID].m_waitingSinceUs = 0;
 }
 
-/**
- * @brief 尝试获取leader
-*/
-void Server::onLeadershipAcquired()
-{
-
+void Server::SetQuorumMode(QuorumMode mode){
+	m_quorumMode = mode;
 }
 
-/**
- * @brief 丢失leader
-*/
-void Server::onLeadershipLost()
-{
+void Server::recordPeerRtt(NodeID nodeID, uint64_t rttUs){
+	m_peerRtts[nodeID].record(rttUs);
+	AcceptorHealth& health = m_acceptorHealth[nodeID];
+	health.m_rttUs = health.m_rttUs > 0 ? (health.m_rttUs * 7 + rttUs) / 8 : rttUs;
+}
 
+void Server::SetStatsDir(const std::string& statsDir){
+	m_statsDir = statsDir;
 }
 
 /**
- * @brief leader变更
+ * @brief 定时打印统计信息。指定了统计目录时每次追加一行JSON，方便压测时用脚本画曲线，
+ * 	速率都是按照上次统计以来的增量计算的，分位数也只包含上次统计以来的样本
 */
-void Server::onLeadershipChange(const std::string& previousLeaderUID, 
-	const std::string& newLeaderUID)
-{
+void Server::DumpStats(){
+	uint64_t now = deps::GetMonoTimeMs();
+	uint64_t period = now > m_lastStatsTimestamp ? now - m_lastStatsTimestamp : 1;
+	m_lastStatsTimestamp = now;
+
+	JsonWriter json;
+	json.beginObject();
+	json.field("time", (uint64_t)time(nullptr));
+	json.field("node", m_myUID);
+	json.field("loop", (uint64_t)m_loopIndex);
+	json.field("period_ms", period);
+
+	//按消息类型的收发计数
+	uint64_t recvCount = 0, recvBytes = 0, sendCount = 0, sendBytes = 0;
+	json.beginObject("messages");
+	for(uint16_t cmd = 0; cmd < MAX_STATS_CMD; ++cmd){
+		const MessageCounter& recv = m_recvCounters[cmd];
+		const MessageCounter& send = m_sendCounters[cmd];
+		if(recv.m_count == 0 && send.m_count == 0){
+			continue;
+		}
+		uint64_t recvDelta = recv.m_count - m_lastRecvCounters[cmd].m_count;
+		uint64_t sendDelta = send.m_count - m_lastSendCounters[cmd].m_count;
+		recvCount += recvDelta;
+		recvBytes += recv.m_bytes - m_lastRecvCounters[cmd].m_bytes;
+		sendCount += sendDelta;
+		sendBytes += send.m_bytes - m_lastSendCounters[cmd].m_bytes;
+
+		std::string name = PaxosMessageName(cmd);
+		if(name == PaxosMessageName(0)){
+			name += "_" + std::to_string(cmd);
+		}
+		json.beginObject(name.c_str());
+		json.field("recv", recv.m_count);
+		json.field("recv_bytes", recv.m_bytes);
+		json.field("recv_per_sec", recvDelta * 1000 / period);
+		json.field("send", send.m_count);
+		json.field("send_bytes", send.m_bytes);
+		json.field("send_per_sec", sendDelta * 1000 / period);
+		json.endObject();
+		m_lastRecvCounters[cmd] = recv;
+		m_lastSendCounters[cmd] = send;
+	}
+	json.endObject();
+	LOG_INFO("loop:%d recv msgs/s:%llu bytes/s:%llu send msgs/s:%llu bytes/s:%llu", m_loopIndex,
+		recvCount * 1000 / period, recvBytes * 1000 / period,
+		sendCount * 1000 / period, sendBytes * 1000 / period);
+
+	//对端往返时间
+	json.beginObject("peer_rtt_us");
+	for(auto& item : m_peerRtts){
+		LatencyHistogram& rtt = item.second;
+		if(rtt.count() == 0){
+			continue;
+		}
+		LOG_INFO("loop:%d peer node:%u rtt samples:%llu p50:%lluus p99:%lluus max:%lluus", m_loopIndex,
+			item.first, rtt.count(), rtt.percentile(50), rtt.percentile(99), rtt.max());
+		json.histogram(std::to_string(item.first).c_str(), rtt);
+		rtt.reset();
+	}
+	json.endObject();
+
+	//队列深度
+	size_t bulkPackets = 0, bulkBytes = 0;
+	for(auto& item : m_bulkQueues){
+		bulkPackets += item.second.size();
+		for(auto& packet : item.second){
+			bulkBytes += packet->size();
+		}
+	}
+	size_t outboxPackets = 0, outboxBytes = 0;
+	for(auto& item : m_outboxes){
+		outboxPackets += item.second.m_packets.size();
+		outboxBytes += item.second.m_bytes;
+		LOG_INFO("loop:%d outbox to %s packets:%zd bytes:%zd", m_loopIndex, item.first.toString().c_str(),
+			item.second.m_packets.size(), item.second.m_bytes);
+	}
+	LOG_INFO("loop:%d bulk queue packets:%zd bytes:%zd outbox packets:%zd bytes:%zd dropped:%llu "
+		"value streams:%zd bytes:%llu timers:%zd", m_loopIndex,
+		bulkPackets, bulkBytes, outboxPackets, outboxBytes, m_outboxDropped,
+		m_valueStreams.size(), m_valueStreams.getBufferedBytes(), m_timerManager.size());
+	json.beginObject("queues");
+	json.field("bulk_packets", bulkPackets);
+	json.field("bulk_bytes", bulkBytes);
+	json.field("outbox_packets", outboxPackets);
+	json.field("outbox_bytes", outboxBytes);
+	json.field("outbox_dropped", m_outboxDropped);
+	json.field("value_streams", m_valueStreams.size());
+	json.field("value_stream_bytes", m_valueStreams.getBufferedBytes());
+	json.field("timers", m_timerManager.size());
+	json.endObject();
+
+	json.beginArray("groups");
+	for(size_t i = 0; i < m_groups.size(); ++i){
+		if(m_groups[i] != nullptr){
+			m_groups[i]->dumpStatus(json);
+		}
+	}
+	json.endArray();
+	json.endObject();
 
+	if(m_statsDir.empty()){
+		return;
+	}
+	std::string path = m_statsDir + "/stats_" + m_myUID + "_" + std::to_string(m_loopIndex) + ".jsonl";
+	FILE* file = fopen(path.c_str(), "a");
+	if(file == nullptr){
+		LOG_ERROR("open stats file:%s failed (%s)", path.c_str(), strerror(errno));
+		return;
+	}
+	fprintf(file, "%s\n", json.str().c_str());
+	fclose(file);
 }
-
-/**
- * @brief 发送心跳
-*/
-void Server::sendHeartbeat(const std::string& leaderUID, const ProposalID& leaderProposalID)
-{	
-	HeartbeatMessage heartbeat;
-	heartbeat.m_myInfo = GetMyNodeInfo();
-	heartbeat.m_leaderUID = leaderUID;
-	heartbeat.m_leaderProposalID.m_number = leaderProposalID.m_number;
-	heartbeat.m_leaderProposalID.m_uid = leaderProposalID.m_uid;
-	SendMessageToAllPeer(HeartbeatMessage::cmd, heartbeat);
-	LOG_INFO("send heartbeat message leader uid:%s proposalid:%s", 
-		leaderUID.c_str(), leaderProposalID.toString().c_str());
-}
\ No newline at end of file
@@ -9,6 +9,9 @@
 #include <map>
 #include <memory>
 #include <sstream>
+#include <deque>
+#include <mutex>
+#include <atomic>
 
 #include "net/tcp_socket.h"
 #include "net/udp_socket.h"
@@ -18,94 +21,253 @@
 #include "sys/log.h"
 
 #include "paxos/proto.h"
-#include "paxos/paxos_node.h"
-#include "paxos/messenger.h"
 
 #include "eztimer.h"
+#include "dispatcher.h"
+#include "group.h"
+#include "value_stream.h"
+#include "stats.h"
+#include "paxos/histogram.h"
 
-class Server : public Messenger, deps::PacketHandler, std::enable_shared_from_this<Server>
+//编码好的包，广播时所有peer共用同一份，不用每个peer重新序列化
+typedef std::shared_ptr<const std::string> PacketBuffer;
+
+//Acceptor多数派的选择方式
+enum class QuorumMode{
+	//只发给往返时间最短的多数派，省带宽
+	thrifty,
+	//发给所有Acceptor，最先回复的多数派决定结果，尾延迟最低
+	hedged,
+};
+
+/**
+ * @brief 一个事件循环：一个epoll、一组对端连接和成员信息，上面跑多个Paxos分组。
+ * 	每个核一个事件循环，分组按照编号分配到事件循环，所有节点上的分配方式相同，
+ * 	第i个事件循环只和对端的第i个事件循环通信(端口为基础端口加i)。
+ * 	同一个事件循环上的分组共用对端连接，事件循环之间不共用：连接数是事件循环数乘以节点数，
+ * 	换来每个连接、发送队列和成员表只在一个线程里访问，不需要加锁，也没有跨线程转发消息的开销。
+ * 	除了PostPropose，所有方法只能在这个事件循环的线程里调用。
+ */
+class Server : public deps::PacketHandler, std::enable_shared_from_this<Server>
 {
 public:
-    Server(const std::string& myid, int quorumSize);
+    Server(const std::string& myid, NodeID myNodeID, int loopIndex);
     ~Server();
 
 	bool Init(deps::SocketType type, const std::string& localIP, uint16_t localPort, 
 		const std::string& dstIP, uint16_t dstPort);
 	bool Run();
 	bool Listen(int port, int backlog, deps::SocketType type);
+	//把分组挂到这个事件循环上，分组的所有消息和定时器都在这个事件循环的线程里处理
+	void AddGroup(PaxosGroup* group);
+	PaxosGroup* GetGroup(uint16_t groupID);
+	//提交一个命令，按照key路由到分组，分组不在这个事件循环上时返回false。只能在事件循环线程里调用
+	bool Propose(const std::string& key, const std::string& value, size_t groupCount);
+	//任何线程都可以调用：命令放进事件循环的提交队列并且唤醒事件循环，事件循环线程下一轮交给分组，分组不在这个事件循环上时返回false
+	bool PostPropose(uint16_t groupID, const std::string& value);
+	EzTimerManager& GetTimerManager();
+	NodeID GetMyNodeID() const;
     virtual int HandlePacket(const char* data, size_t size, deps::SocketBase* s);
 	virtual void HandleClose(deps::SocketBase* s);
-	bool HandleMessage(const deps::PacketHeader& header, std::shared_ptr<deps::Marshallable> pMsg, deps::SocketBase* s);
 	deps::SocketBase* Connect(uint32_t ip, int port, deps::SocketType type);
+	static PacketBuffer EncodePacket(uint16_t cmd, const deps::Marshallable& msg);
+	bool SendPacket(const PacketBuffer& packet, deps::SocketBase* s);
+	void SendPacketToPeer(const PacketBuffer& packet, PeerAddr& addr);
 	bool SendMessage(uint16_t cmd, const deps::Marshallable& msg, deps::SocketBase* s);
 	void SendMessageToPeer(uint16_t cmd, const deps::Marshallable& msg, PeerAddr& addr);
+	void SendMessageToNode(uint16_t cmd, const deps::Marshallable& msg, NodeID nodeID);
+	void SendMessageToNodes(uint16_t cmd, const deps::Marshallable& msg, const std::set<NodeID>& nodeIDs);
 	void SendMessageToAllPeer(uint16_t cmd, const deps::Marshallable& msg);
+	//把放不进一个包的value拆成分片编码好追加到packets，返回分片流编号
+	uint64_t EncodeValueStream(uint16_t groupID, const std::string& value, std::vector<PacketBuffer>& packets);
+	//分片和引用它的消息放进节点的批量发送队列，每轮事件循环只发一部分，不阻塞小的控制消息
+	void SendBulkToNode(const std::vector<PacketBuffer>& packets, NodeID nodeID);
+	void SendBulkToNodes(const std::vector<PacketBuffer>& packets, const std::set<NodeID>& nodeIDs);
+	//取走分片传输拼好的value
+	bool TakeStreamedValue(NodeID from, uint64_t streamID, std::string& value);
+	//设置统计输出目录，每次统计追加一行JSON到目录下的文件，为空表示只打日志
+	void SetStatsDir(const std::string& statsDir);
+	//打印并输出消息计数、对端RTT、队列深度和每个分组的状态
+	void DumpStats();
+	void SetQuorumMode(QuorumMode mode);
 
 	/****************************集群网络结构信息************************/
 	//获取本地地址
 	PeerInfo GetMyNodeInfo();
 	//节点加入集群
-	bool AddPeerInfo(std::string peerId, const PeerAddr& peerAddr);
+	bool AddPeerInfo(std::string peerId, NodeID nodeID, const PeerAddr& peerAddr);
+	//按照节点编号查找节点
+	PeerInfo* GetPeerInfo(NodeID nodeID);
 	//更新节点信息
 	void UpdatePeerInfo(std::string peerId, uint64_t rtt);
 	//删除节点
 	void RemovePeerInfo(std::string peerId);
 	//更新稳定节点信息
 	void updateStablePeers(std::string peerId, const PeerAddr& addr);
+	//删掉节点在成员表日志里的条目，每个节点只保留最新的一条加入或者删除
+	void eraseMembershipLog(const std::string& peerId);
 	
 	//处理ping消息
-	bool HandlePingMessage(const deps::PacketHeader& header, std::shared_ptr<PingMessage> pMsg, deps::SocketBase* s);
+	bool HandlePingMessage(const deps::PacketHeader& header, PingMessage& msg, deps::SocketBase* s);
 	//处理pong消息
-	bool HandlePongMessage(const deps::PacketHeader& header, std::shared_ptr<PongMessage> pMsg, deps::SocketBase* s);
+	bool HandlePongMessage(const deps::PacketHeader& header, PongMessage& msg, deps::SocketBase* s);
 	//发送心跳消息
 	void SendPingMessage();
 	
 	/************************************paxos******************************/
 	//处理心跳消息
-	bool HandleHeatBeatMessage(const deps::PacketHeader& header, std::shared_ptr<HeartbeatMessage> pMsg, deps::SocketBase* s);
-
-	//选择Acceptor大多数
-	void SelectMajorityAcceptors(std::set<std::string>& acceptors);
-    //发送prepare请求
-    virtual void sendPrepare(const ProposalID& proposalID);
-    //发送prepare请求的承诺
-    virtual void sendPromise(const std::string& toUID, const ProposalID& proposalID, 
-        const ProposalID& acceptID, const std::string& acceptValue);
-    //发送accept请求
-    virtual void sendAccept(const ProposalID&  proposalID, 
-		const std::string& proposalValue);
-    //发送accept请求的批准
-    virtual void sendPermit(const std::string& proposerUID, const ProposalID&  proposalID, 
-		const std::string& acceptedValue);
-    //解决
-    virtual void onResolution(const ProposalID&  proposalID, 
-		const std::string& value);
+	bool HandleHeatBeatMessage(const deps::PacketHeader& header, HeartbeatMessage& msg, deps::SocketBase* s);
+	//处理租约授予消息
+	bool HandleLeaseGrantMessage(const deps::PacketHeader& header, LeaseGrantMessage& msg, deps::SocketBase* s);
+	//处理prepare请求
+	bool HandlePrepareMessage(const deps::PacketHeader& header, PrepareMessage& msg, deps::SocketBase* s);
+	//处理prepare请求的承诺
+	bool HandlePromiseMessage(const deps::PacketHeader& header, PromiseMessage& msg, deps::SocketBase* s);
+	//处理accept请求
+	bool HandleAcceptMessage(const deps::PacketHeader& header, AcceptMessage& msg, deps::SocketBase* s);
+	//处理accept请求的批准
+	bool HandlePermitMessage(const deps::PacketHeader& header, PermitMessage& msg, deps::SocketBase* s);
+	//处理leader空闲时的提交通知
+	bool HandleCommitMessage(const deps::PacketHeader& header, CommitMessage& msg, deps::SocketBase* s);
+	//处理leader推给观察者的已经达成一致的实例
+	bool HandleChosenMessage(const deps::PacketHeader& header, ChosenMessage& msg, deps::SocketBase* s);
+	//处理观察者的补发请求
+	bool HandleLearnRequestMessage(const deps::PacketHeader& header, LearnRequestMessage& msg, deps::SocketBase* s);
+	//处理议题value的payload
+	bool HandlePayloadMessage(const deps::PacketHeader& header, PayloadMessage& msg, deps::SocketBase* s);
+	//处理payload请求
+	bool HandlePayloadRequestMessage(const deps::PacketHeader& header, PayloadRequestMessage& msg, deps::SocketBase* s);
+	//处理prepare请求的ack
+	bool HandlePrepareAckMessage(const deps::PacketHeader& header, PrepareAckMessage& msg, deps::SocketBase* s);
+	//处理accept请求的ack
+	bool HandleAcceptAckMessage(const deps::PacketHeader& header, AcceptAckMessage& msg, deps::SocketBase* s);
+	//处理议题value的分片
+	bool HandleValueChunkMessage(const deps::PacketHeader& header, ValueChunkMessage& msg, deps::SocketBase* s);
+	//处理成员变更请求
+	bool HandleMembershipChangeMessage(const deps::PacketHeader& header, MembershipChangeMessage& msg, deps::SocketBase* s);
+	//处理快照请求
+	bool HandleSnapshotRequestMessage(const deps::PacketHeader& header, SnapshotRequestMessage& msg, deps::SocketBase* s);
+	//处理快照
+	bool HandleSnapshotMessage(const deps::PacketHeader& header, SnapshotMessage& msg, deps::SocketBase* s);
+	//处理其他线程提交命令以后的唤醒消息
+	bool HandleWakeupMessage(const deps::PacketHeader& header, WakeupMessage& msg, deps::SocketBase* s);
 
-	//发送prepare请求的ack
-	virtual void sendPrepareNACK(const std::string& proposerUID, const ProposalID& proposalID, 
-		const ProposalID& promisedID);
-	//发送accept请求的ack
-	virtual void sendAcceptNACK(const std::string& proposerUID, const ProposalID& proposalID, 
-		const ProposalID& promisedID);
-	//尝试获取leader
-	virtual void onLeadershipAcquired();
-
-	//丢失主
-	virtual void onLeadershipLost();
-	//主变更
-	virtual void onLeadershipChange(const std::string& previousLeaderUID, 
-		const std::string& newLeaderUID);
-	//发送心跳
-	virtual void sendHeartbeat(const std::string& leaderUID, const ProposalID& leaderProposalID);
+	//从membership里选择这次请求要发给的Acceptor并且记录发送时间，至少quorumSize个，resend表示重发之前没有按时达成quorum的请求
+	void SelectMajorityAcceptors(std::set<NodeID>& acceptors, const Membership& membership, size_t quorumSize, bool resend);
+	//不在membership里的其他节点是观察者，只接收达成一致的实例；不限制成员时没有观察者
+	void GetObservers(const Membership& membership, std::set<NodeID>& observers);
+	//除了自己以外的所有节点，包括观察者
+	void GetOtherNodes(std::set<NodeID>& nodes);
+	//发给这个节点的请求很久没有等到回复，分发payload时不选它转发
+	bool IsNodeStalled(NodeID nodeID);
 private:
-	void dumpStatus();
+	//按照消息里的分组编号找到分组，分组不在这个事件循环上时返回nullptr
+	PaxosNode* routeMessage(uint16_t groupID, uint16_t cmd);
+	//把事件循环线程绑定到第m_loopIndex个核
+	void bindCore();
+	//把其他线程放进提交队列的命令交给分组
+	void drainProposals();
+	//连到自己的监听端口，其他线程提交命令时通过这个连接唤醒epoll等待
+	void connectWakeup();
+	//有分组还有没处理的本地消息
+	bool hasLocalMessages() const;
+	//每个节点的批量发送队列发出一部分
+	void pumpBulkQueues();
+	//连接建立以后把发送队列里积压的包按顺序发出去，没有连接的对端按照退避时间重连
+	void flushOutboxes();
+	//把包追加到对端的发送队列，超过上限时丢弃最老的包
+	void enqueueOutbox(PeerAddr& addr, const PacketBuffer& packet);
+	//发送队列需要的epoll等待上限：最早的一次重连或者重试发送的时间
+	int getOutboxTimeout(int timeout) const;
+	//对端的发送队列积压的字节数
+	size_t getOutboxBytes(const PeerAddr& addr) const;
+	//记录对端的往返时间，单位微秒
+	void recordPeerRtt(NodeID nodeID, uint64_t rttUs);
+	//收到Acceptor的回复，清除等待状态
+	void onAcceptorReply(NodeID nodeID);
+	//编码从fromVersion开始的成员表增量，同一个起始版本的Ping只编码一次
+	PacketBuffer encodePing(PingMessage& ping, uint64_t fromVersion, std::map<uint64_t, PacketBuffer>& packets);
 private:
+	enum{
+		//按照subCmd计数的消息种类上限
+		MAX_STATS_CMD = 32,
+	};
+	struct AcceptorHealth{
+		AcceptorHealth():m_rttUs(0), m_waitingSinceUs(0){}
+		//往返时间的滑动平均，单位微秒，0表示还没有样本
+		uint64_t m_rttUs;
+		//最早一个还没有等到回复的请求的发送时间，0表示没有在等
+		uint64_t m_waitingSinceUs;
+	};
+	//发出去的请求很久没有等到任何回复
+	static bool isAcceptorStalled(const AcceptorHealth& health, uint64_t nowUs);
+	struct PeerOutbox{
+		PeerOutbox():m_bytes(0), m_nextConnectMs(0), m_nextSendMs(0), m_sendRetryMs(0), m_firstSeq(0), 
+			m_connectFailures(0){}
+		//连接建立之前或者socket发不出去时积压的包，被新心跳取代的旧心跳为空
+		std::deque<PacketBuffer> m_packets;
+		//积压的字节数
+		size_t m_bytes;
+		//上次发起连接以后下次允许重连的时间，单位毫秒
+		uint64_t m_nextConnectMs;
+		//有连接但是发不出去时(连接还在建立或者发送缓冲区满)下次重试发送的时间和重试间隔，单位毫秒
+		uint64_t m_nextSendMs;
+		uint64_t m_sendRetryMs;
+		//m_packets第一个包的序号，每个入队的包占一个序号
+		uint64_t m_firstSeq;
+		//分组编号 -> 队列里这个分组最新的心跳的序号
+		std::map<uint16_t, uint64_t> m_heartbeats;
+		//连续发起连接失败的次数
+		uint64_t m_connectFailures;
+	};
+	struct MessageCounter{
+		MessageCounter():m_count(0), m_bytes(0){}
+		uint64_t m_count;
+		uint64_t m_bytes;
+	};
 	//连接管理容器
 	deps::EpollContainer* m_container;
-	PaxosNode m_paxosNode;
+	//按照subCmd索引的消息分发表
+	MessageDispatcher<Server> m_dispatcher;
+	//分组编号 -> 分组，不在这个事件循环上的分组为nullptr
+	std::vector<PaxosGroup*> m_groups;
+	//事件循环编号
+	int m_loopIndex;
+	//其他线程提交的命令：分组编号和命令，m_postedProposals由m_proposalMutex保护
+	std::mutex m_proposalMutex;
+	std::vector<std::pair<uint16_t, std::string>> m_postedProposals;
+	//提交队列不为空，事件循环线程不加锁就能检查
+	std::atomic<bool> m_hasPostedProposals;
+	//连到自己监听端口的唤醒连接和它的fd，其他线程只读fd直接send，连接断开以后fd为-1
+	deps::SocketBase* m_wakeupSocket;
+	std::atomic<int> m_wakeupFd;
+	//编码好的唤醒消息，事件循环启动之前生成，之后只读
+	PacketBuffer m_wakeupPacket;
 	EzTimerManager m_timerManager;
+	//接收端拼装议题value的分片
+	ValueStreamAssembler m_valueStreams;
+	//下一个分片流编号
+	uint64_t m_nextStreamID;
+	//节点编号 -> 还没有发出去的分片和引用分片的消息
+	std::map<NodeID, std::deque<PacketBuffer>> m_bulkQueues;
+	//对端地址 -> 还没有发出去的包，发送队列为空的对端不在表里
+	std::map<PeerAddr, PeerOutbox> m_outboxes;
+	//发送队列超过上限丢弃的包数
+	uint64_t m_outboxDropped;
+	//按照subCmd统计的收发消息个数和字节数，以及上次统计时的值
+	MessageCounter m_recvCounters[MAX_STATS_CMD];
+	MessageCounter m_sendCounters[MAX_STATS_CMD];
+	MessageCounter m_lastRecvCounters[MAX_STATS_CMD];
+	MessageCounter m_lastSendCounters[MAX_STATS_CMD];
+	//节点编号 -> 上次统计以来的往返时间分布
+	std::map<NodeID, LatencyHistogram> m_peerRtts;
+	//统计输出目录
+	std::string m_statsDir;
+	//上次统计的时间戳，单位毫秒
+	uint64_t m_lastStatsTimestamp;
 	//自己的节点信息
 	std::string m_myUID;
+	NodeID m_myNodeID;
 	uint32_t m_localIP;
 	uint16_t m_localPort;
 	deps::SocketType m_socketType;
@@ -113,13 +275,21 @@ private:
 	std::vector<PeerInfo> m_stablePeers;
 	//集群所有节点
 	std::map<std::string, PeerInfo> m_peers;
+	//节点编号 -> m_peers里的节点，编号是稠密的，直接按下标查找
+	std::vector<PeerInfo*> m_nodes;
+	//成员表版本号 -> 节点id，节点加入或者删除时分配一个递增的版本号，删除的节点留下墓碑条目随增量发出去
+	std::map<uint64_t, std::string> m_membershipLog;
+	uint64_t m_membershipVersion;
+	//删除的节点id，别的节点转发来的旧条目不会把它加回来，只有它自己发来Ping时重新加入
+	std::set<std::string> m_removedPeers;
+	//节点编号 -> 对端确认已经应用的自己成员表的版本
+	std::map<NodeID, uint64_t> m_gossipAcked;
+	//节点编号 -> 自己已经应用的对端成员表的版本
+	std::map<NodeID, uint64_t> m_gossipApplied;
 	//集群所有节点
 	std::map<PeerAddr, deps::SocketBase*> m_addr2socket;
 	std::map<deps::SocketBase*, PeerAddr> m_socket2addr;
-	//已经选择过的最大的节点id
-	std::string m_maxChoosenAcceptorUID;
-
-	//Acceptors集合
-	std::set<std::string> m_majorityAcceptors;
-	size_t m_quorumSize;
-};
+	//节点编号 -> 作为Acceptor的往返时间和等待状态
+	std::map<NodeID, AcceptorHealth> m_acceptorHealth;
+	QuorumMode m_quorumMode;
+};
\ No newline at end of file
@@ -0,0 +1,873 @@
+#include "sim_cluster.h"
+
+#include <algorithm>
+
+#include "paxos/clock.h"
+#include "paxos/batcher.h"
+
+//和心跳超时一致，这么久没有收到消息的节点不选来转发payload
+static const uint64_t RELAY_SILENCE_US = 100000;
+
+SimConfig::SimConfig():
+	m_nodeCount(3), m_latencyUs(200), m_jitterUs(50), m_lossRate(0), m_fsyncUs(100), m_thrifty(false),
+	m_prepareQuorum(0), m_acceptQuorum(0), m_acceptors(0), m_leaseUs(80000),
+	m_acceptWindow(64), m_batchCount(64), m_batchBytes(16384), m_batchDelayUs(1000), 
+	m_payloadThreshold(0), m_bandwidth(0), m_snapshotInterval(0), m_seed(1)
+{
+}
+
+/**
+ * @brief 参数和PaxosGroup创建PaxosNode时一致：心跳周期10ms，心跳超时100ms，prepare窗口50ms，租约80ms
+ */
+SimNode::SimNode(SimCluster& cluster, NodeID nodeID, const Membership& membership, const SimConfig& config):
+	m_cluster(cluster), m_nodeID(nodeID), m_thrifty(config.m_thrifty),
+	m_paxosNode(*this, nodeID, membership, 10000, 100000, 50000, config.m_leaseUs, config.m_acceptWindow, 
+		config.m_batchCount, config.m_batchBytes, config.m_batchDelayUs, INVALID_NODE_ID),
+	m_persistScheduled(false), m_fsyncUs(config.m_fsyncUs), m_pollScheduled(false), m_nextRelayUID(nodeID),
+	m_nextResendTimer(0), m_snapshotInterval(config.m_snapshotInterval), m_appliedInstanceID(0), m_appliedHash(0), 
+	m_snapshotInstanceID(0), m_snapshotHash(0)
+{
+	m_paxosNode.setPayloadThreshold(config.m_payloadThreshold);
+}
+
+SimNode::~SimNode(){}
+
+NodeID SimNode::getNodeID() const
+{
+	return m_nodeID;
+}
+
+PaxosNode& SimNode::getPaxosNode()
+{
+	return m_paxosNode;
+}
+
+void SimNode::persist()
+{
+	m_persistScheduled = false;
+	if (!m_paxosNode.persistenceRequired())
+	{
+		return;
+	}
+	ProposalID promisedID;
+	std::vector<PaxosInstance> acceptedInstances;
+	m_paxosNode.getPendingPersistence(promisedID, acceptedInstances);
+	m_paxosNode.persisted();
+}
+
+void SimNode::pollEventLoop()
+{
+	m_pollScheduled = false;
+	m_paxosNode.pollCommit();
+	m_paxosNode.pollReads();
+}
+
+void SimNode::selectAcceptors(std::set<NodeID>& acceptors, const Membership& membership, size_t quorumSize)
+{
+	acceptors.clear();
+	//从自己开始轮流选，自己是Acceptor时总在里面，和Server::SelectMajorityAcceptors一致：
+	//PaxosGroup把发给本机的prepare/accept在本地投递，本机的承诺和批准计入quorum
+	for (size_t i = 0; i < m_cluster.size(); ++i)
+	{
+		NodeID nodeID = (m_nodeID - 1 + i) % m_cluster.size() + 1;
+		if (!membership.contains(nodeID))
+		{
+			continue;
+		}
+		if (m_thrifty && acceptors.size() >= quorumSize)
+		{
+			break;
+		}
+		acceptors.insert(nodeID);
+	}
+}
+
+void SimNode::sendPrepare(const ProposalID& proposalID, uint64_t instanceID)
+{
+	//起始实例之后还没生效的配置里也要拿到Q1个承诺
+	std::vector<const Membership*> memberships;
+	m_paxosNode.getMemberships().getMemberships(instanceID, memberships);
+	std::set<NodeID> acceptors;
+	for (auto membership : memberships)
+	{
+		std::set<NodeID> selected;
+		selectAcceptors(selected, *membership, membership->getPrepareQuorumSize());
+		acceptors.insert(selected.begin(), selected.end());
+	}
+	NodeID from = m_nodeID;
+	for (auto to : acceptors)
+	{
+		m_cluster.send(from, to, SimCluster::MSG_PREPARE, [=](SimNode& node){
+			node.getPaxosNode().receivePrepare(from, proposalID, instanceID);
+		});
+	}
+}
+
+void SimNode::sendPromise(NodeID toUID, const ProposalID& proposalID,
+	uint64_t instanceID, const std::vector<PaxosInstance>& acceptedInstances)
+{
+	NodeID from = m_nodeID;
+	size_t bytes = 0;
+	for (auto& instance : acceptedInstances)
+	{
+		bytes += instance.m_acceptedValue.size();
+	}
+	m_cluster.send(from, toUID, SimCluster::MSG_PROMISE, [=](SimNode& node){
+		node.getPaxosNode().receivePromise(from, proposalID, instanceID, acceptedInstances);
+	}, bytes);
+}
+
+void SimNode::sendAccept(const ProposalID& proposalID, uint64_t instanceID,
+	const std::string& proposalValue, uint64_t commitInstanceID)
+{
+	const Membership& membership = m_paxosNode.getMemberships().at(instanceID);
+	std::set<NodeID> acceptors;
+	selectAcceptors(acceptors, membership, membership.getAcceptQuorumSize());
+	NodeID from = m_nodeID;
+	//所有接收者共用一份value，和Server的一次编码多次发送一致
+	std::shared_ptr<const std::string> value = std::make_shared<const std::string>(proposalValue);
+	for (auto to : acceptors)
+	{
+		m_cluster.send(from, to, SimCluster::MSG_ACCEPT, [=](SimNode& node){
+			node.getPaxosNode().receiveAcceptRequest(from, proposalID, instanceID, *value);
+			node.getPaxosNode().receiveCommit(from, proposalID, commitInstanceID);
+		}, value->size());
+	}
+}
+
+void SimNode::sendPermit(NodeID proposerUID, const ProposalID& proposalID,
+	uint64_t instanceID, const std::string& acceptedValue)
+{
+	NodeID from = m_nodeID;
+	m_cluster.send(from, proposerUID, SimCluster::MSG_PERMIT, [=](SimNode& node){
+		node.getPaxosNode().receivePermit(from, proposalID, instanceID, acceptedValue);
+	}, acceptedValue.size());
+}
+
+/**
+ * @brief 和PaxosGroup::onResolution一致，批次里的成员变更命令在这个实例上应用
+ */
+void SimNode::onResolution(uint64_t instanceID, const ProposalID& proposalID,
+	const std::string& value)
+{
+	std::vector<std::string> commands;
+	Membership membership;
+	if (ProposalBatcher::decode(value, commands))
+	{
+		for (auto& command : commands)
+		{
+			if (Membership::decodeCommand(command, membership))
+			{
+				m_paxosNode.changeMembership(instanceID, membership);
+			}
+		}
+	}
+	//FNV风格的链式哈希，执行过的值和顺序都一样时才相同
+	m_appliedHash = (m_appliedHash ^ std::hash<std::string>()(value)) * 1099511628211ULL;
+	m_appliedInstanceID = instanceID + 1;
+	m_cluster.onResolution(m_nodeID, instanceID, value, m_appliedHash);
+}
+
+void SimNode::checkSnapshot()
+{
+	if (m_appliedInstanceID < m_snapshotInstanceID + m_snapshotInterval)
+	{
+		return;
+	}
+	m_snapshotInstanceID = m_appliedInstanceID;
+	m_snapshotHash = m_appliedHash;
+	m_paxosNode.getSnapshotMemberships(m_snapshotInstanceID, m_snapshotStarts, m_snapshotMemberships);
+	m_paxosNode.truncate(m_snapshotInstanceID);
+	m_cluster.onSnapshot(m_nodeID, m_snapshotInstanceID, m_snapshotHash, false);
+}
+
+void SimNode::installSnapshot(NodeID fromUID, uint64_t instanceID, uint64_t appliedHash, 
+	const std::vector<uint64_t>& starts, const std::vector<Membership>& memberships)
+{
+	if (instanceID <= m_appliedInstanceID || memberships.empty() || starts.size() != memberships.size())
+	{
+		return;
+	}
+	m_appliedInstanceID = instanceID;
+	m_appliedHash = appliedHash;
+	m_snapshotInstanceID = instanceID;
+	m_snapshotHash = appliedHash;
+	m_snapshotStarts = starts;
+	m_snapshotMemberships = memberships;
+	m_cluster.onSnapshot(m_nodeID, instanceID, appliedHash, true);
+	m_paxosNode.installSnapshot(instanceID, starts, memberships);
+}
+
+uint64_t SimNode::getAppliedInstanceID() const
+{
+	return m_appliedInstanceID;
+}
+
+void SimNode::sendPrepareNACK(NodeID proposerUID, const ProposalID& proposalID,
+	const ProposalID& promisedID, uint64_t truncatedInstanceID)
+{
+	NodeID from = m_nodeID;
+	m_cluster.send(from, proposerUID, SimCluster::MSG_PREPARE_NACK, [=](SimNode& node){
+		node.getPaxosNode().receivePrepareNACK(from, proposalID, promisedID, truncatedInstanceID);
+	});
+}
+
+void SimNode::sendAcceptNACK(NodeID proposerUID, const ProposalID& proposalID,
+	uint64_t instanceID, const ProposalID& promisedID, uint64_t truncatedInstanceID)
+{
+	NodeID from = m_nodeID;
+	m_cluster.send(from, proposerUID, SimCluster::MSG_ACCEPT_NACK, [=](SimNode& node){
+		node.getPaxosNode().receiveAcceptNACK(from, proposalID, instanceID, promisedID, truncatedInstanceID);
+	});
+}
+
+void SimNode::onLeadershipAcquired(){}
+
+void SimNode::onLeadershipLost(){}
+
+void SimNode::onLeadershipChange(NodeID previousLeaderUID, NodeID newLeaderUID){}
+
+/**
+ * @brief 和Server::HandleHeatBeatMessage一致：只有leader自己发的心跳才带租约申请
+ */
+void SimNode::sendHeartbeat(NodeID leaderUID, const ProposalID& leaderProposalID,
+	uint64_t timestamp, uint64_t leaseDuration, uint64_t commitInstanceID)
+{
+	NodeID from = m_nodeID;
+	for (size_t i = 1; i <= m_cluster.size(); ++i)
+	{
+		m_cluster.send(from, i, SimCluster::MSG_HEARTBEAT, [=](SimNode& node){
+			node.getPaxosNode().receiveHeartbeat(leaderUID, leaderProposalID);
+			if (from == leaderUID)
+			{
+				node.getPaxosNode().receiveLeaseRequest(leaderUID, leaderProposalID, timestamp, leaseDuration);
+				node.getPaxosNode().receiveCommit(leaderUID, leaderProposalID, commitInstanceID);
+			}
+		});
+	}
+}
+
+/**
+ * @brief 和PaxosGroup::sendCommit一致，发给所有其他节点
+ */
+void SimNode::sendCommit(const ProposalID& proposalID, uint64_t commitInstanceID)
+{
+	NodeID from = m_nodeID;
+	for (size_t i = 1; i <= m_cluster.size(); ++i)
+	{
+		if (i == from)
+		{
+			continue;
+		}
+		m_cluster.send(from, i, SimCluster::MSG_COMMIT, [=](SimNode& node){
+			node.getPaxosNode().receiveCommit(from, proposalID, commitInstanceID);
+		});
+	}
+}
+
+void SimNode::sendLeaseGrant(NodeID leaderUID, const ProposalID& leaderProposalID,
+	uint64_t timestamp)
+{
+	NodeID from = m_nodeID;
+	m_cluster.send(from, leaderUID, SimCluster::MSG_LEASE_GRANT, [=](SimNode& node){
+		node.getPaxosNode().receiveLeaseGrant(from, leaderProposalID, timestamp);
+	});
+}
+
+/**
+ * @brief 和PaxosGroup::sendChosen一致，发给不在最新配置里的其他节点
+ */
+void SimNode::sendChosen(NodeID toUID, const ProposalID& proposalID,
+	const std::vector<PaxosInstance>& chosenInstances, uint64_t commitInstanceID)
+{
+	NodeID from = m_nodeID;
+	std::shared_ptr<const std::vector<PaxosInstance> > instances = 
+		std::make_shared<const std::vector<PaxosInstance> >(chosenInstances);
+	const Membership& membership = m_paxosNode.getMemberships().latest();
+	size_t bytes = 0;
+	for (auto& instance : chosenInstances)
+	{
+		bytes += instance.m_acceptedValue.size();
+	}
+	for (size_t i = 1; i <= m_cluster.size(); ++i)
+	{
+		if (i == from || (toUID != INVALID_NODE_ID && i != toUID) || 
+			(toUID == INVALID_NODE_ID && membership.contains(i)))
+		{
+			continue;
+		}
+		m_cluster.send(from, i, SimCluster::MSG_CHOSEN, [=](SimNode& node){
+			node.getPaxosNode().receiveChosen(from, proposalID, *instances, commitInstanceID);
+		}, bytes);
+	}
+}
+
+void SimNode::sendLearnRequest(NodeID leaderUID, uint64_t fromInstanceID)
+{
+	NodeID from = m_nodeID;
+	m_cluster.send(from, leaderUID, SimCluster::MSG_LEARN_REQUEST, [=](SimNode& node){
+		node.getPaxosNode().receiveLearnRequest(from, fromInstanceID);
+	});
+}
+
+/**
+ * @brief 和PaxosGroup::sendPayload一致：分发时只发给一个转发节点，转发节点轮流选，由它发给其余节点
+ */
+void SimNode::sendPayload(NodeID toUID, const std::string& digest, const std::string& payload)
+{
+	NodeID from = m_nodeID;
+	bool relay = toUID == INVALID_NODE_ID;
+	if (relay)
+	{
+		if (m_cluster.size() < 2)
+		{
+			return;
+		}
+		//跳过自己和一个心跳超时没有消息的节点，都没有消息时照样轮流选
+		uint64_t now = SimCluster::now();
+		for (size_t i = 0; i < m_cluster.size(); ++i)
+		{
+			m_nextRelayUID = m_nextRelayUID % m_cluster.size() + 1;
+			auto itr = m_lastHeardUs.find(m_nextRelayUID);
+			if (m_nextRelayUID != from && itr != m_lastHeardUs.end() && now - itr->second <= RELAY_SILENCE_US)
+			{
+				break;
+			}
+		}
+		if (m_nextRelayUID == from)
+		{
+			m_nextRelayUID = m_nextRelayUID % m_cluster.size() + 1;
+		}
+		toUID = m_nextRelayUID;
+	}
+	std::shared_ptr<const std::string> value = std::make_shared<const std::string>(payload);
+	m_cluster.send(from, toUID, SimCluster::MSG_PAYLOAD, [=](SimNode& node){
+		node.getPaxosNode().receivePayload(from, digest, *value, relay);
+	}, value->size());
+}
+
+void SimNode::relayPayload(NodeID sourceUID, const std::string& digest, const std::string& payload)
+{
+	NodeID from = m_nodeID;
+	std::shared_ptr<const std::string> value = std::make_shared<const std::string>(payload);
+	for (size_t i = 1; i <= m_cluster.size(); ++i)
+	{
+		if (i == from || i == sourceUID)
+		{
+			continue;
+		}
+		m_cluster.send(from, i, SimCluster::MSG_PAYLOAD, [=](SimNode& node){
+			node.getPaxosNode().receivePayload(from, digest, *value, false);
+		}, value->size());
+	}
+}
+
+void SimNode::sendPayloadRequest(NodeID toUID, const std::string& digest)
+{
+	NodeID from = m_nodeID;
+	for (size_t i = 1; i <= m_cluster.size(); ++i)
+	{
+		if (i == from || (toUID != INVALID_NODE_ID && i != toUID))
+		{
+			continue;
+		}
+		m_cluster.send(from, i, SimCluster::MSG_PAYLOAD_REQUEST, [=](SimNode& node){
+			node.getPaxosNode().receivePayloadRequest(from, digest);
+		});
+	}
+}
+
+void SimNode::sendSnapshotRequest(NodeID toUID, uint64_t instanceID)
+{
+	NodeID from = m_nodeID;
+	m_cluster.send(from, toUID, SimCluster::MSG_SNAPSHOT_REQUEST, [=](SimNode& node){
+		node.getPaxosNode().receiveSnapshotRequest(from, instanceID);
+	});
+}
+
+/**
+ * @brief 和PaxosGroup::scheduleResend一致，每个实例一个单次定时器，按毫秒向上取整
+ */
+void SimNode::scheduleResend(uint64_t instanceID, uint64_t delayUs)
+{
+	uint64_t timerID = ++m_nextResendTimer;
+	m_resendTimers[instanceID] = timerID;
+	m_cluster.schedule((delayUs + 999) / 1000 * 1000, [this, instanceID, timerID](){
+		auto itr = m_resendTimers.find(instanceID);
+		if (itr == m_resendTimers.end() || itr->second != timerID)
+		{
+			return;
+		}
+		m_resendTimers.erase(itr);
+		m_paxosNode.resendAccept(instanceID);
+	});
+}
+
+void SimNode::cancelResend(uint64_t instanceID)
+{
+	m_resendTimers.erase(instanceID);
+}
+
+/**
+ * @brief 和PaxosGroup::sendSnapshot一致，本地快照比请求方新时才发送；快照只有哈希，不计入带宽
+ */
+void SimNode::sendSnapshot(NodeID toUID, uint64_t instanceID)
+{
+	if (m_snapshotInstanceID <= instanceID)
+	{
+		return;
+	}
+	NodeID from = m_nodeID;
+	uint64_t snapshotInstanceID = m_snapshotInstanceID;
+	uint64_t snapshotHash = m_snapshotHash;
+	std::vector<uint64_t> starts = m_snapshotStarts;
+	std::vector<Membership> memberships = m_snapshotMemberships;
+	m_cluster.send(from, toUID, SimCluster::MSG_SNAPSHOT, [=](SimNode& node){
+		node.installSnapshot(from, snapshotInstanceID, snapshotHash, starts, memberships);
+	});
+}
+
+uint64_t SimCluster::s_nowUs = 0;
+
+SimCluster::SimCluster(const SimConfig& config):
+	m_config(config), m_seq(0), m_randomState(config.m_seed), m_droppedMessages(0), 
+	m_commands(0), m_membershipChanges(0), m_safetyViolations(0), m_snapshots(0), 
+	m_installedSnapshots(0), m_divergences(0), m_nextCommand(0), m_reads(0), m_staleReads(0)
+{
+	//虚拟时钟从一个不为0的时间开始，协议里有用0表示没有时间戳的地方
+	s_nowUs = 1000000;
+	PaxosClock::setSource(&SimCluster::now);
+
+	for (int i = 0; i < MSG_TYPE_COUNT; ++i)
+	{
+		m_messages[i] = 0;
+	}
+	//不限制成员时quorum按照节点总数计算，否则按照初始的Acceptor个数计算
+	Membership membership;
+	size_t voters = config.m_nodeCount;
+	if (config.m_acceptors > 0)
+	{
+		voters = config.m_acceptors;
+		for (size_t i = 0; i < voters; ++i)
+		{
+			membership.m_acceptors.insert(i + 1);
+		}
+	}
+	membership.m_prepareQuorum = config.m_prepareQuorum > 0 ? config.m_prepareQuorum : voters / 2 + 1;
+	membership.m_acceptQuorum = config.m_acceptQuorum > 0 ? config.m_acceptQuorum : voters / 2 + 1;
+	for (size_t i = 0; i < config.m_nodeCount; ++i)
+	{
+		m_nodes.push_back(std::unique_ptr<SimNode>(new SimNode(*this, i + 1, membership, config)));
+	}
+	m_partitions.assign(config.m_nodeCount, 0);
+	m_sentBytes.assign(config.m_nodeCount, 0);
+	m_linkFreeUs.assign(config.m_nodeCount, 0);
+	//每个节点的定时器错开，所有节点同时发起prepare会互相抢占
+	for (auto& node : m_nodes)
+	{
+		startTimers(*node, random() % 10000);
+	}
+}
+
+SimCluster::~SimCluster(){}
+
+uint64_t SimCluster::now()
+{
+	return s_nowUs;
+}
+
+void SimCluster::schedule(uint64_t delayUs, std::function<void()> callback)
+{
+	Event event;
+	event.m_time = s_nowUs + delayUs;
+	event.m_seq = m_seq++;
+	event.m_callback.swap(callback);
+	m_events.push(event);
+}
+
+void SimCluster::runUntil(uint64_t untilUs)
+{
+	while (!m_events.empty() && m_events.top().m_time <= untilUs)
+	{
+		Event event = m_events.top();
+		m_events.pop();
+		s_nowUs = event.m_time;
+		event.m_callback();
+	}
+	if (s_nowUs < untilUs)
+	{
+		s_nowUs = untilUs;
+	}
+}
+
+void SimCluster::send(NodeID from, NodeID to, MessageType type, std::function<void(SimNode&)> deliver, size_t bytes)
+{
+	++m_messages[type];
+	//发给自己的不经过网卡
+	uint64_t queueUs = 0;
+	if (from != to && bytes > 0)
+	{
+		m_sentBytes[from - 1] += bytes;
+		if (m_config.m_bandwidth > 0)
+		{
+			uint64_t& linkFreeUs = m_linkFreeUs[from - 1];
+			linkFreeUs = std::max(linkFreeUs, s_nowUs) + bytes * 1000000 / m_config.m_bandwidth;
+			queueUs = linkFreeUs - s_nowUs;
+		}
+	}
+	if (!reachable(from, to) || (m_config.m_lossRate > 0 && random() % 1000000 < m_config.m_lossRate * 1000000))
+	{
+		++m_droppedMessages;
+		return;
+	}
+
+	uint64_t delay = queueUs + m_config.m_latencyUs + 
+		(m_config.m_jitterUs > 0 ? random() % (m_config.m_jitterUs + 1) : 0);
+	schedule(delay, [this, from, to, deliver](){
+		//在路上的时候发生了分区
+		if (!reachable(from, to))
+		{
+			++m_droppedMessages;
+			return;
+		}
+		SimNode& node = getNode(to);
+		node.m_lastHeardUs[from] = s_nowUs;
+		deliver(node);
+		if (!node.m_persistScheduled && node.getPaxosNode().persistenceRequired())
+		{
+			node.m_persistScheduled = true;
+			schedule(node.m_fsyncUs, std::bind(&SimNode::persist, &node));
+		}
+		//同一时刻到达的消息都处理完以后再检查提交通知和读请求，和Server每轮事件循环结束时检查一致
+		if (!node.m_pollScheduled && node.getPaxosNode().isLeader())
+		{
+			node.m_pollScheduled = true;
+			schedule(0, std::bind(&SimNode::pollEventLoop, &node));
+		}
+	});
+}
+
+void SimCluster::partition(const std::vector<int>& partitions)
+{
+	m_partitions = partitions;
+	m_partitions.resize(m_nodes.size(), 0);
+}
+
+void SimCluster::cut(NodeID a, NodeID b)
+{
+	m_cuts.insert(std::make_pair(std::min(a, b), std::max(a, b)));
+}
+
+void SimCluster::heal()
+{
+	m_partitions.assign(m_nodes.size(), 0);
+	m_cuts.clear();
+}
+
+bool SimCluster::reachable(NodeID from, NodeID to) const
+{
+	return m_partitions[from - 1] == m_partitions[to - 1] && 
+		(m_cuts.empty() || m_cuts.count(std::make_pair(std::min(from, to), std::max(from, to))) == 0);
+}
+
+size_t SimCluster::size() const
+{
+	return m_nodes.size();
+}
+
+SimNode& SimCluster::getNode(NodeID nodeID)
+{
+	return *m_nodes[nodeID - 1];
+}
+
+SimNode* SimCluster::getLeader()
+{
+	SimNode* leader = nullptr;
+	for (auto& node : m_nodes)
+	{
+		PaxosNode& paxosNode = node->getPaxosNode();
+		if (paxosNode.isLeader() && (leader == nullptr || 
+			leader->getPaxosNode().getMyProposalID() < paxosNode.getMyProposalID()))
+		{
+			leader = node.get();
+		}
+	}
+	return leader;
+}
+
+void SimCluster::generateLoad(size_t load, size_t valueSize)
+{
+	SimNode* leader = getLeader();
+	if (leader == nullptr)
+	{
+		return;
+	}
+	PaxosNode& paxosNode = leader->getPaxosNode();
+	for (size_t i = paxosNode.numPendingProposals(); i < load; ++i)
+	{
+		//命令内容各不相同，决议值的哈希才能区分不同的批次
+		std::string value = std::to_string(m_nextCommand++);
+		value.resize(valueSize, 'x');
+		paxosNode.propose(value);
+	}
+}
+
+void SimCluster::generateReads(size_t reads)
+{
+	SimNode* leader = getLeader();
+	if (leader == nullptr)
+	{
+		return;
+	}
+	PaxosNode& paxosNode = leader->getPaxosNode();
+	//读请求发起之前已经在任何节点上决议的实例，读位置必须包含它们
+	uint64_t requiredInstanceID = m_chosen.empty() ? 0 : m_chosen.rbegin()->first + 1;
+	for (size_t i = paxosNode.numPendingReads(); i < reads; ++i)
+	{
+		if (!paxosNode.readIndex(std::bind(&SimCluster::onRead, this, leader->getNodeID(), s_nowUs, 
+			requiredInstanceID, std::placeholders::_1)))
+		{
+			break;
+		}
+	}
+	if (!leader->m_pollScheduled && paxosNode.numPendingReads() > 0)
+	{
+		leader->m_pollScheduled = true;
+		schedule(0, std::bind(&SimNode::pollEventLoop, leader));
+	}
+}
+
+void SimCluster::onRead(NodeID nodeID, uint64_t startUs, uint64_t requiredInstanceID, bool confirmed)
+{
+	if (!confirmed)
+	{
+		return;
+	}
+	++m_reads;
+	m_readLatency.record(s_nowUs - startUs);
+	if (getNode(nodeID).getPaxosNode().getCommitInstanceID() < requiredInstanceID)
+	{
+		++m_staleReads;
+	}
+}
+
+bool SimCluster::proposeMembership(const Membership& membership)
+{
+	SimNode* leader = getLeader();
+	if (leader == nullptr)
+	{
+		return false;
+	}
+	PaxosNode& paxosNode = leader->getPaxosNode();
+	if (!paxosNode.getMemberships().latest().canChangeTo(membership))
+	{
+		return false;
+	}
+	std::string command;
+	Membership::encodeCommand(membership, command);
+	paxosNode.propose(command);
+	return true;
+}
+
+void SimCluster::onResolution(NodeID nodeID, uint64_t instanceID, const std::string& value, uint64_t appliedHash)
+{
+	auto applied = m_appliedHashes.insert(std::make_pair(instanceID, appliedHash));
+	if (!applied.second && applied.first->second != appliedHash)
+	{
+		++m_divergences;
+	}
+
+	size_t hash = std::hash<std::string>()(value);
+	auto itr = m_chosen.find(instanceID);
+	if (itr != m_chosen.end())
+	{
+		if (itr->second != hash)
+		{
+			++m_safetyViolations;
+		}
+		return;
+	}
+	m_chosen[instanceID] = hash;
+	m_decisionTimes[instanceID] = s_nowUs;
+
+	std::vector<std::string> commands;
+	if (ProposalBatcher::decode(value, commands))
+	{
+		m_commands += commands.size();
+		Membership membership;
+		for (auto& command : commands)
+		{
+			if (Membership::decodeCommand(command, membership))
+			{
+				++m_membershipChanges;
+			}
+		}
+	}
+}
+
+/**
+ * @brief 快照覆盖instanceID之前的实例，快照里的状态必须和执行到instanceID - 1的节点一致
+ */
+void SimCluster::onSnapshot(NodeID nodeID, uint64_t instanceID, uint64_t appliedHash, bool installed)
+{
+	if (installed)
+	{
+		++m_installedSnapshots;
+	}
+	else
+	{
+		++m_snapshots;
+	}
+	auto itr = m_appliedHashes.find(instanceID - 1);
+	if (instanceID > 0 && itr != m_appliedHashes.end() && itr->second != appliedHash)
+	{
+		++m_divergences;
+	}
+}
+
+uint64_t SimCluster::getMessageCount(MessageType type) const
+{
+	return m_messages[type];
+}
+
+uint64_t SimCluster::getTotalMessages() const
+{
+	uint64_t total = 0;
+	for (int i = 0; i < MSG_TYPE_COUNT; ++i)
+	{
+		total += m_messages[i];
+	}
+	return total;
+}
+
+uint64_t SimCluster::getDroppedMessages() const
+{
+	return m_droppedMessages;
+}
+
+uint64_t SimCluster::getSentBytes(NodeID nodeID) const
+{
+	return m_sentBytes[nodeID - 1];
+}
+
+uint64_t SimCluster::getDecisions() const
+{
+	return m_chosen.size();
+}
+
+uint64_t SimCluster::getCommands() const
+{
+	return m_commands;
+}
+
+uint64_t SimCluster::getMembershipChanges() const
+{
+	return m_membershipChanges;
+}
+
+uint64_t SimCluster::getSafetyViolations() const
+{
+	return m_safetyViolations;
+}
+
+uint64_t SimCluster::getSnapshots() const
+{
+	return m_snapshots;
+}
+
+uint64_t SimCluster::getInstalledSnapshots() const
+{
+	return m_installedSnapshots;
+}
+
+uint64_t SimCluster::getDivergences() const
+{
+	return m_divergences;
+}
+
+uint64_t SimCluster::getReads() const
+{
+	return m_reads;
+}
+
+const LatencyHistogram& SimCluster::getReadLatency() const
+{
+	return m_readLatency;
+}
+
+uint64_t SimCluster::getStaleReads() const
+{
+	return m_staleReads;
+}
+
+uint64_t SimCluster::getFirstDecisionAfter(uint64_t markUs) const
+{
+	uint64_t first = 0;
+	for (auto& decision : m_decisionTimes)
+	{
+		if (decision.second > markUs && (first == 0 || decision.second < first))
+		{
+			first = decision.second;
+		}
+	}
+	return first;
+}
+
+void SimCluster::takeLatencies(LatencyHistogram& prepareLatency, LatencyHistogram& acceptLatency, 
+	LatencyHistogram& commitLatency)
+{
+	for (auto& node : m_nodes)
+	{
+		LatencyHistogram prepare, accept, commit;
+		node->getPaxosNode().takeLatencies(prepare, accept, commit);
+		prepareLatency.merge(prepare);
+		acceptLatency.merge(accept);
+		commitLatency.merge(commit);
+	}
+}
+
+const char* SimCluster::getMessageName(MessageType type)
+{
+	static const char* names[MSG_TYPE_COUNT] = {
+		"prepare", "promise", "accept", "permit", "prepare_nack", "accept_nack", "heartbeat", "lease_grant", "commit",
+		"chosen", "learn_request", "payload", "payload_request", "snapshot_request", "snapshot",
+	};
+	return names[type];
+}
+
+uint64_t SimCluster::random()
+{
+	//xorshift64*，同样的种子在任何平台上序列都一样
+	m_randomState ^= m_randomState >> 12;
+	m_randomState ^= m_randomState << 25;
+	m_randomState ^= m_randomState >> 27;
+	return m_randomState * 2685821657736338717ULL;
+}
+
+/**
+ * @brief 和PaxosGroup::Init注册的定时器一致：心跳10ms，活性检查100ms，攒批检查1ms，
+ * 	开启快照时快照检查100ms
+ */
+void SimCluster::startTimers(SimNode& node, uint64_t offsetUs)
+{
+	struct Timer
+	{
+		static void periodic(SimCluster* cluster, uint64_t periodUs, std::function<void()> callback)
+		{
+			callback();
+			cluster->schedule(periodUs, std::bind(&Timer::periodic, cluster, periodUs, callback));
+		}
+	};
+	PaxosNode* paxosNode = &node.getPaxosNode();
+	schedule(offsetUs, std::bind(&Timer::periodic, this, 10000, 
+		std::function<void()>(std::bind(&PaxosNode::pulse, paxosNode))));
+	schedule(offsetUs, std::bind(&Timer::periodic, this, 100000, 
+		std::function<void()>(std::bind(&PaxosNode::pollLiveness, paxosNode))));
+	schedule(offsetUs, std::bind(&Timer::periodic, this, 1000, 
+		std::function<void()>(std::bind(&PaxosNode::pollBatch, paxosNode))));
+	if (m_config.m_snapshotInterval > 0)
+	{
+		schedule(offsetUs, std::bind(&Timer::periodic, this, 100000, 
+			std::function<void()>(std::bind(&SimNode::checkSnapshot, &node))));
+	}
+}
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <queue>
+#include <memory>
+#include <functional>
+
+#include "paxos/paxos_node.h"
+
+/**
+ * @brief 模拟集群的参数，时间单位都是微秒
+ * 
+ */
+struct SimConfig
+{
+	SimConfig();
+
+	size_t m_nodeCount;
+	//单向网络延迟
+	uint64_t m_latencyUs;
+	//延迟在[0, m_jitterUs]之间随机增加，后发的消息可能先到(乱序)
+	uint64_t m_jitterUs;
+	//丢包率，0到1
+	double m_lossRate;
+	//Acceptor状态落盘的耗时
+	uint64_t m_fsyncUs;
+	//只把prepare/accept发给quorum个Acceptor，和Server::SelectMajorityAcceptors一致；否则发给所有节点
+	bool m_thrifty;
+	//prepare和accept阶段的quorum(Flexible Paxos)，0表示多数派
+	size_t m_prepareQuorum;
+	size_t m_acceptQuorum;
+	//初始配置里的Acceptor个数，前m_acceptors个节点有投票权，其余节点等待成员变更加入；0表示不限制成员
+	size_t m_acceptors;
+	//leader租约时长，0表示不使用租约，读请求全部走ReadIndex
+	uint64_t m_leaseUs;
+	size_t m_acceptWindow;
+	size_t m_batchCount;
+	size_t m_batchBytes;
+	uint64_t m_batchDelayUs;
+	//议题value不小于这个字节数时先分发payload，共识消息只带摘要，0表示不分开
+	size_t m_payloadThreshold;
+	//每个节点出口带宽，字节每秒，同一个节点发出的消息按顺序排队发送；0表示不限制
+	uint64_t m_bandwidth;
+	//每执行多少个实例做一次快照并且截断之前的实例，0表示不做快照
+	uint64_t m_snapshotInterval;
+	//随机数种子，同样的参数和种子每次运行的结果完全一样
+	uint64_t m_seed;
+};
+
+class SimCluster;
+
+/**
+ * @brief 模拟节点：一个PaxosNode，通过内存里的消息队列和其他节点通信
+ * 
+ */
+class SimNode : public Messenger
+{
+public:
+	SimNode(SimCluster& cluster, NodeID nodeID, const Membership& membership, const SimConfig& config);
+	~SimNode();
+
+	NodeID getNodeID() const;
+	PaxosNode& getPaxosNode();
+	//Acceptor状态落盘，和PaxosGroup::persistAcceptor一致，落盘以后才会发出Promise/Permit
+	void persist();
+	//事件循环结束时的检查：空闲leader的提交通知和这一轮到达的读请求，和Server::Run一致
+	void pollEventLoop();
+	//和PaxosGroup::checkSnapshot一致，只是快照立即完成：记下执行到的位置和执行过的值的哈希，截断之前的实例
+	void checkSnapshot();
+	//装载别的节点的快照，和PaxosGroup::installSnapshot一致
+	void installSnapshot(NodeID fromUID, uint64_t instanceID, uint64_t appliedHash, 
+		const std::vector<uint64_t>& starts, const std::vector<Membership>& memberships);
+	uint64_t getAppliedInstanceID() const;
+
+	virtual void sendPrepare(const ProposalID& proposalID, uint64_t instanceID);
+	virtual void sendPromise(NodeID toUID, const ProposalID& proposalID,
+		uint64_t instanceID, const std::vector<PaxosInstance>& acceptedInstances);
+	virtual void sendAccept(const ProposalID& proposalID, uint64_t instanceID,
+		const std::string& proposalValue, uint64_t commitInstanceID);
+	virtual void sendPermit(NodeID proposerUID, const ProposalID& proposalID,
+		uint64_t instanceID, const std::string& acceptedValue);
+	virtual void onResolution(uint64_t instanceID, const ProposalID& proposalID,
+		const std::string& value);
+	virtual void sendPrepareNACK(NodeID proposerUID, const ProposalID& proposalID,
+		const ProposalID& promisedID, uint64_t truncatedInstanceID);
+	virtual void sendAcceptNACK(NodeID proposerUID, const ProposalID& proposalID,
+		uint64_t instanceID, const ProposalID& promisedID, uint64_t truncatedInstanceID);
+	virtual void onLeadershipAcquired();
+	virtual void onLeadershipLost();
+	virtual void onLeadershipChange(NodeID previousLeaderUID, NodeID newLeaderUID);
+	virtual void sendHeartbeat(NodeID leaderUID, const ProposalID& leaderProposalID,
+		uint64_t timestamp, uint64_t leaseDuration, uint64_t commitInstanceID);
+	virtual void sendCommit(const ProposalID& proposalID, uint64_t commitInstanceID);
+	virtual void sendLeaseGrant(NodeID leaderUID, const ProposalID& leaderProposalID,
+		uint64_t timestamp);
+	virtual void sendChosen(NodeID toUID, const ProposalID& proposalID,
+		const std::vector<PaxosInstance>& chosenInstances, uint64_t commitInstanceID);
+	virtual void sendLearnRequest(NodeID leaderUID, uint64_t fromInstanceID);
+	virtual void sendPayload(NodeID toUID, const std::string& digest, const std::string& payload);
+	virtual void relayPayload(NodeID sourceUID, const std::string& digest, const std::string& payload);
+	virtual void sendPayloadRequest(NodeID toUID, const std::string& digest);
+	virtual void sendSnapshotRequest(NodeID toUID, uint64_t instanceID);
+	virtual void sendSnapshot(NodeID toUID, uint64_t instanceID);
+	virtual void scheduleResend(uint64_t instanceID, uint64_t delayUs);
+	virtual void cancelResend(uint64_t instanceID);
+private:
+	//prepare/accept的接收者，只从配置里的Acceptor中选
+	void selectAcceptors(std::set<NodeID>& acceptors, const Membership& membership, size_t quorumSize);
+private:
+	SimCluster& m_cluster;
+	NodeID m_nodeID;
+	bool m_thrifty;
+	PaxosNode m_paxosNode;
+	//已经挂了落盘事件，一次落盘覆盖这段时间里所有的承诺和批准(group commit)
+	bool m_persistScheduled;
+	uint64_t m_fsyncUs;
+	//已经挂了事件循环结束时的检查事件
+	bool m_pollScheduled;
+	//下一个payload的转发节点，轮流选
+	NodeID m_nextRelayUID;
+	//最近一次收到每个节点消息的虚拟时间，和Server判断节点停顿一致，分发payload时不选停顿的节点转发
+	std::map<NodeID, uint64_t> m_lastHeardUs;
+	//实例编号到它当前的重发定时器编号，事件队列不能撤销事件，到期时编号对不上就是已经取消或者替换了
+	std::map<uint64_t, uint64_t> m_resendTimers;
+	uint64_t m_nextResendTimer;
+	uint64_t m_snapshotInterval;
+	//已经执行到的实例编号，和按顺序执行过的所有值的哈希，相当于状态机的内容
+	uint64_t m_appliedInstanceID;
+	uint64_t m_appliedHash;
+	//最近一次快照覆盖的实例编号、状态机内容和配置
+	uint64_t m_snapshotInstanceID;
+	uint64_t m_snapshotHash;
+	std::vector<uint64_t> m_snapshotStarts;
+	std::vector<Membership> m_snapshotMemberships;
+
+	friend class SimCluster;
+};
+
+/**
+ * @brief 单进程的确定性集群模拟器：N个PaxosNode，内存消息队列，虚拟时钟。
+ * 	事件按照虚拟时间顺序执行，网络延迟、乱序、丢包、分区都由参数和随机数种子决定，
+ * 	不需要socket和真实等待，协议改动可以在同样的条件下反复比较吞吐、每次决议的消息数和故障切换时间。
+ * 
+ */
+class SimCluster
+{
+public:
+	enum MessageType
+	{
+		MSG_PREPARE,
+		MSG_PROMISE,
+		MSG_ACCEPT,
+		MSG_PERMIT,
+		MSG_PREPARE_NACK,
+		MSG_ACCEPT_NACK,
+		MSG_HEARTBEAT,
+		MSG_LEASE_GRANT,
+		MSG_COMMIT,
+		MSG_CHOSEN,
+		MSG_LEARN_REQUEST,
+		MSG_PAYLOAD,
+		MSG_PAYLOAD_REQUEST,
+		MSG_SNAPSHOT_REQUEST,
+		MSG_SNAPSHOT,
+		MSG_TYPE_COUNT,
+	};
+
+	SimCluster(const SimConfig& config);
+	~SimCluster();
+
+	//虚拟时钟，PaxosClock的时间源
+	static uint64_t now();
+
+	//delayUs微秒以后执行
+	void schedule(uint64_t delayUs, std::function<void()> callback);
+	//执行所有时间不晚于untilUs的事件，虚拟时钟停在untilUs
+	void runUntil(uint64_t untilUs);
+
+	//从from发给to的消息，经过延迟、丢包和分区以后在to上执行deliver。bytes是消息里value的字节数，
+	//计入from的出口流量，限制带宽时在from的出口排队
+	void send(NodeID from, NodeID to, MessageType type, std::function<void(SimNode&)> deliver, size_t bytes = 0);
+	//partitions[i]是第i个节点所在的分区，不同分区之间的消息全部丢掉
+	void partition(const std::vector<int>& partitions);
+	//切断两个节点之间的链路，两边都还能和其他节点通信，这种分区不满足传递性
+	void cut(NodeID a, NodeID b);
+	void heal();
+	bool reachable(NodeID from, NodeID to) const;
+
+	size_t size() const;
+	SimNode& getNode(NodeID nodeID);
+	//多个节点认为自己是leader时(旧leader被隔离)，取议题编号最大的那个，客户端会切换到它上面
+	SimNode* getLeader();
+	//闭环压测：leader上保持load个还没有达成一致的命令
+	void generateLoad(size_t load, size_t valueSize);
+	//闭环压测：leader上保持reads个还没有完成的ReadIndex读请求
+	void generateReads(size_t reads);
+	//通过leader提交成员变更，新旧配置的quorum不相交或者没有leader时返回false
+	bool proposeMembership(const Membership& membership);
+
+	//appliedHash是节点执行完这个实例以后所有执行过的值的哈希
+	void onResolution(NodeID nodeID, uint64_t instanceID, const std::string& value, uint64_t appliedHash);
+	//节点做了快照(installed为false)或者装载了别的节点的快照
+	void onSnapshot(NodeID nodeID, uint64_t instanceID, uint64_t appliedHash, bool installed);
+
+	//统计
+	uint64_t getMessageCount(MessageType type) const;
+	uint64_t getTotalMessages() const;
+	uint64_t getDroppedMessages() const;
+	//节点发给其他节点的value字节数
+	uint64_t getSentBytes(NodeID nodeID) const;
+	uint64_t getDecisions() const;
+	uint64_t getCommands() const;
+	//达成一致的成员变更命令个数
+	uint64_t getMembershipChanges() const;
+	//同一个实例在不同节点上决议出不同的值，正确的实现应该永远为0
+	uint64_t getSafetyViolations() const;
+	//做快照和装载快照的次数
+	uint64_t getSnapshots() const;
+	uint64_t getInstalledSnapshots() const;
+	//节点执行到同一个实例时状态不同(执行了不同的值、跳过了实例或者装载了不一致的快照)，正确的实现应该永远为0
+	uint64_t getDivergences() const;
+	//完成的读请求个数和读延迟分布
+	uint64_t getReads() const;
+	const LatencyHistogram& getReadLatency() const;
+	//读位置没有包含读请求发起之前已经决议的实例，正确的实现应该永远为0
+	uint64_t getStaleReads() const;
+	//从markUs开始第一次有新实例达成一致的虚拟时间，没有时返回0
+	uint64_t getFirstDecisionAfter(uint64_t markUs) const;
+	//取走所有节点上的各阶段延迟分布
+	void takeLatencies(LatencyHistogram& prepareLatency, LatencyHistogram& acceptLatency, 
+		LatencyHistogram& commitLatency);
+	static const char* getMessageName(MessageType type);
+private:
+	struct Event
+	{
+		uint64_t m_time;
+		//同一时间的事件按加入顺序执行
+		uint64_t m_seq;
+		std::function<void()> m_callback;
+		bool operator<(const Event& other) const
+		{
+			return m_time != other.m_time ? m_time > other.m_time : m_seq > other.m_seq;
+		}
+	};
+	uint64_t random();
+	void startTimers(SimNode& node, uint64_t offsetUs);
+	void onRead(NodeID nodeID, uint64_t startUs, uint64_t requiredInstanceID, bool confirmed);
+private:
+	static uint64_t s_nowUs;
+
+	SimConfig m_config;
+	std::vector<std::unique_ptr<SimNode> > m_nodes;
+	std::priority_queue<Event> m_events;
+	uint64_t m_seq;
+	uint64_t m_randomState;
+	//每个节点所在的分区
+	std::vector<int> m_partitions;
+	//切断的链路，编号小的节点在前
+	std::set<std::pair<NodeID, NodeID> > m_cuts;
+
+	uint64_t m_messages[MSG_TYPE_COUNT];
+	uint64_t m_droppedMessages;
+	//每个节点发出的value字节数和出口空闲的虚拟时间，按节点编号减1索引
+	std::vector<uint64_t> m_sentBytes;
+	std::vector<uint64_t> m_linkFreeUs;
+	//实例编号 -> 第一次决议出的值的哈希
+	std::map<uint64_t, size_t> m_chosen;
+	//实例编号 -> 第一个执行到这个实例的节点上执行过的所有值的哈希
+	std::map<uint64_t, uint64_t> m_appliedHashes;
+	//每个实例第一次达成一致的虚拟时间
+	std::map<uint64_t, uint64_t> m_decisionTimes;
+	uint64_t m_commands;
+	uint64_t m_membershipChanges;
+	uint64_t m_safetyViolations;
+	uint64_t m_snapshots;
+	uint64_t m_installedSnapshots;
+	uint64_t m_divergences;
+	uint64_t m_nextCommand;
+	uint64_t m_reads;
+	uint64_t m_staleReads;
+	LatencyHistogram m_readLatency;
+};
@@ -0,0 +1,95 @@
+#include "stats.h"
+
+JsonWriter::JsonWriter():m_needComma(false){}
+
+void JsonWriter::beginObject(const char* name){
+	key(name);
+	m_buffer += '{';
+	m_needComma = false;
+}
+
+void JsonWriter::endObject(){
+	m_buffer += '}';
+	m_needComma = true;
+}
+
+void JsonWriter::beginArray(const char* name){
+	key(name);
+	m_buffer += '[';
+	m_needComma = false;
+}
+
+void JsonWriter::endArray(){
+	m_buffer += ']';
+	m_needComma = true;
+}
+
+void JsonWriter::field(const char* name, uint64_t value){
+	key(name);
+	m_buffer += std::to_string(value);
+	m_needComma = true;
+}
+
+void JsonWriter::field(const char* name, const std::string& value){
+	key(name);
+	m_buffer += '"';
+	escape(value);
+	m_buffer += '"';
+	m_needComma = true;
+}
+
+void JsonWriter::histogram(const char* name, const LatencyHistogram& histogram){
+	beginObject(name);
+	field("count", histogram.count());
+	field("mean", histogram.mean());
+	field("p50", histogram.percentile(50));
+	field("p90", histogram.percentile(90));
+	field("p99", histogram.percentile(99));
+	field("p999", histogram.percentile(99.9));
+	field("max", histogram.max());
+	endObject();
+}
+
+const std::string& JsonWriter::str() const{
+	return m_buffer;
+}
+
+/**
+ * @brief 字符串里的引号、反斜杠和控制字符转义，节点名是命令行传进来的，不能让它破坏一行JSON
+ */
+void JsonWriter::escape(const std::string& value){
+	static const char* HEX = "0123456789abcdef";
+	for(size_t i = 0; i < value.size(); ++i){
+		unsigned char c = value[i];
+		switch(c){
+			case '"': m_buffer += "\\\""; break;
+			case '\\': m_buffer += "\\\\"; break;
+			case '\n': m_buffer += "\\n"; break;
+			case '\r': m_buffer += "\\r"; break;
+			case '\t': m_buffer += "\\t"; break;
+			case '\b': m_buffer += "\\b"; break;
+			case '\f': m_buffer += "\\f"; break;
+			default:
+				if(c < 0x20){
+					m_buffer += "\\u00";
+					m_buffer += HEX[c >> 4];
+					m_buffer += HEX[c & 0xf];
+				}
+				else{
+					m_buffer += (char)c;
+				}
+				break;
+		}
+	}
+}
+
+void JsonWriter::key(const char* name){
+	if(m_needComma){
+		m_buffer += ',';
+	}
+	if(name != nullptr){
+		m_buffer += '"';
+		m_buffer += name;
+		m_buffer += "\":";
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "paxos/histogram.h"
+
+/**
+ * @brief 拼一行机器可读的统计输出(JSON)，字段按调用顺序输出，没有转义，key和字符串值只能是普通标识符
+ */
+class JsonWriter
+{
+public:
+	JsonWriter();
+
+	void beginObject(const char* key = nullptr);
+	void endObject();
+	void beginArray(const char* key);
+	void endArray();
+	void field(const char* key, uint64_t value);
+	void field(const char* key, const std::string& value);
+	//次数、均值、常用百分位数和最大值
+	void histogram(const char* key, const LatencyHistogram& histogram);
+
+	const std::string& str() const;
+private:
+	void key(const char* key);
+	void escape(const std::string& value);
+private:
+	std::string m_buffer;
+	//下一个元素前面需要逗号
+	bool m_needComma;
+};
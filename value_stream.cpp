@@ -0,0 +1,112 @@
+#include "value_stream.h"
+
+#include "sys/util.h"
+#include "sys/log.h"
+#include "paxos/wide_codec.h"
+
+//所有流缓存的字节数上限，超过时丢掉新的流和继续增长的流，等Proposer重发
+static const uint64_t MAX_BUFFERED_BYTES = 512 * 1024 * 1024;
+//每个对端缓存的字节数上限，一个对端同时开很多流或者扔下不管的流不能占满整个上限
+static const uint64_t MAX_PEER_BUFFERED_BYTES = MAX_VALUE_SIZE;
+
+ValueStreamAssembler::ValueStreamAssembler(uint64_t timeoutMs):m_timeoutMs(timeoutMs), m_bufferedBytes(0){}
+
+ValueStreamAssembler::~ValueStreamAssembler(){}
+
+void ValueStreamAssembler::receive(const ValueChunkMessage& chunk){
+	std::pair<NodeID, uint64_t> key(chunk.m_from, chunk.m_streamID);
+	auto itr = m_streams.find(key);
+	//偏移为0的分片开始一个新流，发送方重启以后流编号重复也没有关系
+	if(chunk.m_offset == 0){
+		if(itr != m_streams.end()){
+			erase(itr);
+		}
+		if(chunk.m_totalSize > MAX_VALUE_SIZE){
+			LOG_ERROR("peer node:%u stream:%llu size:%u exceed limit:%u", chunk.m_from, 
+				chunk.m_streamID, chunk.m_totalSize, MAX_VALUE_SIZE);
+			return;
+		}
+		uint64_t& peerBytes = m_peerBytes[chunk.m_from];
+		if(m_bufferedBytes >= MAX_BUFFERED_BYTES || peerBytes >= MAX_PEER_BUFFERED_BYTES){
+			LOG_ERROR("peer node:%u stream:%llu size:%u dropped, buffered:%llu peer buffered:%llu", chunk.m_from, 
+				chunk.m_streamID, chunk.m_totalSize, m_bufferedBytes, peerBytes);
+			return;
+		}
+		//声明的长度不可信，不预先分配，随着分片到达增长
+		itr = m_streams.insert(std::make_pair(key, Stream())).first;
+		itr->second.m_totalSize = chunk.m_totalSize;
+	}
+	if(itr == m_streams.end()){
+		return;
+	}
+
+	Stream& stream = itr->second;
+	if(chunk.m_totalSize != stream.m_totalSize || chunk.m_offset != stream.m_value.size() ||
+		chunk.m_data.size() > stream.m_totalSize - stream.m_value.size()){
+		LOG_ERROR("peer node:%u stream:%llu offset:%u received:%zd out of order, drop", chunk.m_from, 
+			chunk.m_streamID, chunk.m_offset, stream.m_value.size());
+		erase(itr);
+		return;
+	}
+	uint64_t& peerBytes = m_peerBytes[chunk.m_from];
+	if(m_bufferedBytes + chunk.m_data.size() > MAX_BUFFERED_BYTES || 
+		peerBytes + chunk.m_data.size() > MAX_PEER_BUFFERED_BYTES){
+		LOG_ERROR("peer node:%u stream:%llu received:%zd/%u exceed buffer limit, drop", chunk.m_from, 
+			chunk.m_streamID, stream.m_value.size(), stream.m_totalSize);
+		erase(itr);
+		return;
+	}
+	stream.m_value.append(chunk.m_data);
+	stream.m_lastUpdate = deps::GetMonoTimeMs();
+	m_bufferedBytes += chunk.m_data.size();
+	peerBytes += chunk.m_data.size();
+}
+
+bool ValueStreamAssembler::take(NodeID from, uint64_t streamID, std::string& value){
+	auto itr = m_streams.find(std::make_pair(from, streamID));
+	if(itr == m_streams.end() || itr->second.m_value.size() != itr->second.m_totalSize){
+		return false;
+	}
+	release(from, itr->second.m_value.size());
+	value.swap(itr->second.m_value);
+	m_streams.erase(itr);
+	return true;
+}
+
+void ValueStreamAssembler::expire(){
+	uint64_t now = deps::GetMonoTimeMs();
+	for(auto itr = m_streams.begin(); itr != m_streams.end();){
+		if(now - itr->second.m_lastUpdate >= m_timeoutMs){
+			LOG_INFO("peer node:%u stream:%llu expired received:%zd/%u", itr->first.first, 
+				itr->first.second, itr->second.m_value.size(), itr->second.m_totalSize);
+			erase(itr++);
+		}
+		else{
+			++itr;
+		}
+	}
+}
+
+size_t ValueStreamAssembler::size() const{
+	return m_streams.size();
+}
+
+uint64_t ValueStreamAssembler::getBufferedBytes() const{
+	return m_bufferedBytes;
+}
+
+void ValueStreamAssembler::erase(std::map<std::pair<NodeID, uint64_t>, Stream>::iterator itr){
+	release(itr->first.first, itr->second.m_value.size());
+	m_streams.erase(itr);
+}
+
+void ValueStreamAssembler::release(NodeID from, uint64_t bytes){
+	m_bufferedBytes -= bytes;
+	auto itr = m_peerBytes.find(from);
+	if(itr != m_peerBytes.end()){
+		itr->second -= bytes;
+		if(itr->second == 0){
+			m_peerBytes.erase(itr);
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <map>
+
+#include "paxos/proto.h"
+
+/**
+ * @brief 接收端把议题value的分片拼回去。分片按顺序到达(tcp)，中间丢了分片(udp)、超过长度上限或者
+ * 	缓存的字节数超过总上限、单个对端的上限时丢掉整个流，引用它的消息找不到value会被丢掉，等Proposer重发。
+ * 	长时间没有被取走的流定时清理。
+ */
+class ValueStreamAssembler
+{
+public:
+	ValueStreamAssembler(uint64_t timeoutMs);
+	~ValueStreamAssembler();
+
+	//收到一个分片
+	void receive(const ValueChunkMessage& chunk);
+	//取走已经拼好的value，流还没有收完或者不存在时返回false
+	bool take(NodeID from, uint64_t streamID, std::string& value);
+	//清理超过m_timeoutMs没有收到分片的流
+	void expire();
+
+	size_t size() const;
+	uint64_t getBufferedBytes() const;
+private:
+	struct Stream{
+		Stream():m_totalSize(0), m_lastUpdate(0){}
+		uint32_t m_totalSize;
+		std::string m_value;
+		//最后一次收到分片的时间戳，单位毫秒
+		uint64_t m_lastUpdate;
+	};
+	void erase(std::map<std::pair<NodeID, uint64_t>, Stream>::iterator itr);
+	void release(NodeID from, uint64_t bytes);
+private:
+	//(发送方节点编号, 流编号) -> 流
+	std::map<std::pair<NodeID, uint64_t>, Stream> m_streams;
+	uint64_t m_timeoutMs;
+	//所有流已经收到的字节数
+	uint64_t m_bufferedBytes;
+	//每个对端的流已经收到的字节数
+	std::map<NodeID, uint64_t> m_peerBytes;
+};